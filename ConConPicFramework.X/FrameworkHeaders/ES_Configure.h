@@ -261,11 +261,15 @@ typedef enum
   /* User-defined events start here */
   ES_NEW_KEY,               /* signals a new key received from terminal */
   PAIR_BUTTON_PRESSED,
+  DISCOVER_TUGS,
   ACK_RECEIVED,
   VALID_STATUS_RECEIVED,
   MODE3_BUTTON_PRESSED,
   XBEE_TRANSMIT_MESSAGE,
+  XBEE_TRANSMIT_SYNC,
   TRANSMIT_BYTE,
+  XBEE_TX_FRAME_SENT,
+  XBEE_TX_RETRY,
   UART_BYTE_RECEIVED,
   SPI_RESPONSE_RECEIVED
 }ES_EventType_t;
@@ -314,7 +318,7 @@ typedef enum
 #define TIMER0_RESP_FUNC TIMER_UNUSED
 #define TIMER1_RESP_FUNC TIMER_UNUSED
 #define TIMER2_RESP_FUNC PostPilotFSM
-#define TIMER3_RESP_FUNC TIMER_UNUSED
+#define TIMER3_RESP_FUNC PostPilotFSM
 #define TIMER4_RESP_FUNC TIMER_UNUSED
 #define TIMER5_RESP_FUNC PostPilotFSM
 #define TIMER6_RESP_FUNC TIMER_UNUSED
@@ -336,6 +340,7 @@ typedef enum
 // These symbolic names should be changed to be relevant to your application
 
 #define COMMSTIMER 2
+#define DISCOVERYTIMER 3
 #define INACTIVITYTIMER 5
 #define PAIRBUTTONDEBOUNCETIMER 15
 #define MODE3BUTTONDEBOUNCETIMER 14
@@ -0,0 +1,100 @@
+/****************************************************************************
+ * File:   LinkRate.h
+ * Picks the control frame rate, 5 to 50 Hz, from status loss and RSSI
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef LINKRATE_H
+#define	LINKRATE_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      LinkRate_Reset
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Drops back to the 5 Hz protocol rate and starts a new measurement
+ *      window. Call on pairing and on losing the pair
+****************************************************************************/
+void LinkRate_Reset(void);
+
+/****************************************************************************
+ * Function
+ *      LinkRate_ControlSent
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each control frame sent while paired. Once a window has
+ *      passed this picks the rate for the next one
+****************************************************************************/
+void LinkRate_ControlSent(void);
+
+/****************************************************************************
+ * Function
+ *      LinkRate_StatusReceived
+ *
+ * Parameters
+ *      uint8_t RSSI - RSSI byte of the status frame, -dBm
+ * Return
+ *      void
+ * Description
+ *      Call for each valid status frame from the paired Tug
+****************************************************************************/
+void LinkRate_StatusReceived(uint8_t RSSI);
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetPeriod
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, ms between control frames
+****************************************************************************/
+uint16_t LinkRate_GetPeriod(void);
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetRateHz
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, control frames per second
+****************************************************************************/
+uint8_t LinkRate_GetRateHz(void);
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetLossPct
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, percent of status frames missed in the last window
+****************************************************************************/
+uint8_t LinkRate_GetLossPct(void);
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetRSSI
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, filtered status frame RSSI in -dBm. 0 before any arrive
+****************************************************************************/
+uint8_t LinkRate_GetRSSI(void);
+
+#endif	/* LINKRATE_H */
@@ -16,7 +16,7 @@
 // State definitions for use with the query function
 typedef enum
 {
-    AttemptingToPair, Paired
+    AttemptingToPair, DiscoveringTugs, Paired
 }PilotState_t;
 
 // Public Function Prototypes
@@ -0,0 +1,182 @@
+/****************************************************************************
+ * File:   TugDiscovery.h
+ * Finds free Tugs with a broadcast probe and picks one to pair with
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef TUGDISCOVERY_H
+#define	TUGDISCOVERY_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+#include "XBeeProtocol.h"
+
+#define TUGDISCOVERY_MAX_TUGS 8
+
+typedef struct
+{
+    uint16_t Address;
+    uint8_t ProbeRSSI;      // -dBm the Tug heard our probe at
+    uint8_t ReplyRSSI;      // -dBm we heard its reply at
+}TugDiscovery_Tug_t;
+
+typedef struct
+{
+    uint16_t Probes;        // Rounds broadcast
+    uint16_t Replies;       // From this round's Tugs, repeats included
+    uint16_t Target;        // Picked Tug, 0 if the selector picks
+    uint16_t LastPairingMs; // Pair button, probe or timeout to acknowledged
+    bool LastPairingDiscovered;
+}TugDiscovery_Stats_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_Start
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Starts a new round. Replies to earlier rounds are ignored from here
+****************************************************************************/
+void TugDiscovery_Start(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetProbe
+ *
+ * Parameters
+ *      XBeeProbe_t *Probe - Filled with the round and reply window to send
+ * Return
+ *      void
+****************************************************************************/
+void TugDiscovery_GetProbe(XBeeProbe_t *Probe);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetWaitTime
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, ms from sending a probe until every reply is in
+****************************************************************************/
+uint16_t TugDiscovery_GetWaitTime(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_ReplyReceived
+ *
+ * Parameters
+ *      const XBeeProbeReply_t *Reply - The Tug's reply
+ *      uint16_t Source - Address it came from
+ *      uint8_t RSSI - -dBm we heard it at
+ * Return
+ *      bool, true if it answered this round
+****************************************************************************/
+bool TugDiscovery_ReplyReceived(const XBeeProbeReply_t *Reply, uint16_t Source,
+        uint8_t RSSI);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_Choose
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, false if no Tug replied this round
+ * Description
+ *      Makes the Tug with the best weaker direction of the link the
+ *      target, so QueryTargetTUGAddress returns it until cleared
+****************************************************************************/
+bool TugDiscovery_Choose(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetTarget
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, address of the picked Tug, 0 if none
+****************************************************************************/
+uint16_t TugDiscovery_GetTarget(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_ClearTarget
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Hands the choice of Tug back to the pairing selector
+****************************************************************************/
+void TugDiscovery_ClearTarget(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetTugs
+ *
+ * Parameters
+ *      TugDiscovery_Tug_t *ThisTugs - Room for TUGDISCOVERY_MAX_TUGS
+ * Return
+ *      uint8_t, Tugs that replied in the last round
+****************************************************************************/
+uint8_t TugDiscovery_GetTugs(TugDiscovery_Tug_t *ThisTugs);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_IsOurTug
+ *
+ * Parameters
+ *      uint16_t Address - Tug to check
+ * Return
+ *      bool, true if it answered the last probe round
+ * Description
+ *      Only our Tugs answer probes, so only they understand our extra bytes
+****************************************************************************/
+bool TugDiscovery_IsOurTug(uint16_t Address);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_PairingStarted
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when the ConCon starts looking for a Tug, to time the pairing
+****************************************************************************/
+void TugDiscovery_PairingStarted(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_PairingDone
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when the Tug acknowledges
+****************************************************************************/
+void TugDiscovery_PairingDone(void);
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetStats
+ *
+ * Parameters
+ *      TugDiscovery_Stats_t *ThisStats - Filled with the counts and timing
+ * Return
+ *      void
+****************************************************************************/
+void TugDiscovery_GetStats(TugDiscovery_Stats_t *ThisStats);
+
+#endif	/* TUGDISCOVERY_H */
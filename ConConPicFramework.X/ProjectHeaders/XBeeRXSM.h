@@ -27,9 +27,12 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent);
 XBeeRXState_t QueryXBeeRXSM(void);
 
 uint8_t QueryFuelLevel(void);
+uint16_t QueryTimeToEmpty(void);
 
 //Event checker for RX buffer nonempty in UART2
 bool IsRXBufferNonempty(void);
+//Called from the UART2 ISR when a byte is received
+void DrainRXFIFO(void);
 
 #endif /* XBeeRXSM_H */
 
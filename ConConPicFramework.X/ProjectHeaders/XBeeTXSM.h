@@ -11,6 +11,8 @@
 // Event Definitions
 #include "ES_Configure.h" /* gets us event definitions */
 #include "ES_Types.h"     /* gets bool type for returns */
+// Frame layout and message structs
+#include "XBeeProtocol.h"
 
 // typedefs for the states
 // State definitions for use with the query function
@@ -19,16 +21,13 @@ typedef enum
     XBeeTXIdleState, XBeeTXActiveState
 }XBeeTXState_t;
 
-typedef enum
-{
-    XBee_Control=1, XBee_Status=2, XBee_RequestToPair=3, XBee_PairingAcknowledged=4
-}XBeeTXMessage_t;
 // Public Function Prototypes
 
 bool InitXBeeTXSM(uint8_t Priority);
 bool PostXBeeTXSM(ES_Event_t ThisEvent);
 ES_Event_t RunXBeeTXSM(ES_Event_t ThisEvent);
 XBeeTXState_t QueryXBeeTXSM(void);
+uint16_t QueryTargetTUGAddress(void);
 
 #endif /* XBeeTXSM_H */
 
@@ -25,6 +25,13 @@
 #include "KeyboardResponses.h"
 #include "PilotFSM.h"
 #include "XBeeTXSM.h"
+#include "XBeeBaud.h"
+#include "LinkRate.h"
+#include "LinkStats.h"
+#include "TXStatus.h"
+#include "StatusTelemetry.h"
+#include "TugDiscovery.h"
+#include "SlotSchedule.h"
 #include "terminal.h"
 #include "dbprintf.h"
 #include <string.h>
@@ -161,6 +168,17 @@ ES_Event_t RunKeyboardResponses(ES_Event_t ThisEvent)
                   puts("Query Address of Target TUG:                       \'T\'\r");
                   puts("Query Left Thrust Value:                           \'L\'\r");
                   puts("Query Right Thrust Value:                          \'R\'\r");
+                  puts("Step XBee link baud rate, print round trips:  \'U\'\r");
+                  puts("Query Control Rate, Status Loss and RSSI:          \'H\'\r");
+                  puts("Query XBee Link Stats:                             \'S\'\r");
+                  puts("Clear XBee Link Stats:                             \'X\'\r");
+                  puts("Query XBee Delivery Stats since last query:        \'D\'\r");
+                  puts("Toggle early resend of failed pairing frames:      \'P\'\r");
+                  puts("Query TUG telemetry from its status frames:        \'E\'\r");
+                  puts("Discover free TUGs and pair with the best:         \'F\'\r");
+                  puts("Query discovered TUGs and time to pair:            \'G\'\r");
+                  puts("Toggle slotted airtime for many pairs:             \'W\'\r");
+                  puts("Query airtime slot and sync:                       \'Y\'\r");
                   puts("------------------------------------------------------\r\n");
               }
               break;
@@ -229,6 +247,12 @@ ES_Event_t RunKeyboardResponses(ES_Event_t ThisEvent)
                     }
                     break;
                     
+                    case DiscoveringTugs:
+                    {
+                        strcpy(StateChar,"DiscoveringTugs");
+                    }
+                    break;
+                    
                     case Paired:
                     {
                         strcpy(StateChar,"Paired");
@@ -299,6 +323,155 @@ ES_Event_t RunKeyboardResponses(ES_Event_t ThisEvent)
               }
               break;
               
+              case 'U':
+              {
+                //Each change measures the UART round trip to the radio
+                if (QueryXBeeTXSM() != XBeeTXIdleState) {
+                    puts("XBee busy, try again\r\n");
+                    break;
+                }
+                XBeeBaud_SetRate((XBeeBaud_GetRate() + 1) % NUM_XBEE_BAUDS);
+                //Link trips are control to status while paired at each rate
+                for (uint8_t i = 0; i < NUM_XBEE_BAUDS; i++) {
+                    XBeeBaud_LinkTrip_t Trip;
+                    XBeeBaud_GetLinkRoundTrip(i, &Trip);
+                    DB_printf("%u baud: AT round trip %u us, link %u/%u/%u us min/avg/max over %u\r\n",
+                            XBeeBaud_GetBitsPerSecond(i), XBeeBaud_GetRoundTripUs(i),
+                            Trip.MinUs, (Trip.Count > 0) ? (Trip.SumUs / Trip.Count) : 0,
+                            Trip.MaxUs, Trip.Count);
+                }
+                DB_printf("In use: %u baud\r\n\n", XBeeBaud_GetBitsPerSecond(XBeeBaud_GetRate()));
+              }
+              break;
+              
+              case 'H':
+              {
+                DB_printf("Control rate %u Hz, status loss %u%%, RSSI -%u dBm\r\n\n",
+                        LinkRate_GetRateHz(), LinkRate_GetLossPct(), LinkRate_GetRSSI());
+              }
+              break;
+              
+              case 'S':
+              {
+                LinkStats_t Stats;
+                LinkStats_Get(&Stats);
+                DB_printf("XBee RX: %u frames, %u bad checksum, %u too long, %u bytes dropped, %u overruns\r\n",
+                        Stats.FramesReceived, Stats.ChecksumFailures, Stats.LengthErrors,
+                        Stats.BytesDropped, Stats.UARTOverruns);
+                DB_printf("From TUG: %u valid, %u unknown source, %u pairing timeouts\r\n",
+                        Stats.ValidFrames, Stats.UnknownSource, Stats.PairingTimeouts);
+                DB_printf("RSSI -%u/-%u/-%u dBm min/avg/max, longest gap %u ms\r\n",
+                        Stats.RSSIMin, Stats.RSSIAvg, Stats.RSSIMax, Stats.MaxGapMs);
+                for (uint8_t i = 0; i < (LINKSTATS_GAP_BINS - 1); i++) {
+                    DB_printf("  gap < %u ms: %u\r\n", LinkStats_GetGapBinLimit(i),
+                            Stats.GapCounts[i]);
+                }
+                DB_printf("  gap >= %u ms: %u\r\n\n",
+                        LinkStats_GetGapBinLimit(LINKSTATS_GAP_BINS - 2),
+                        Stats.GapCounts[LINKSTATS_GAP_BINS - 1]);
+              }
+              break;
+              
+              case 'X':
+              {
+                LinkStats_Clear();
+                puts("XBee link stats cleared\r\n");
+              }
+              break;
+              
+              case 'D':
+              {
+                TXStatus_Stats_t Stats;
+                TXStatus_GetStats(&Stats);
+                DB_printf("XBee TX: %u sent, %u delivered, %u no ACK, %u CCA fail, %u purged, %u no status\r\n",
+                        Stats.Sent, Stats.Delivered, Stats.NoAck, Stats.CCAFailures,
+                        Stats.Purged, Stats.NoResponse);
+                DB_printf("Delivery avg %u us, max %u us queued to TX Status, %u pairing retries\r\n",
+                        Stats.AvgLatencyUs, Stats.MaxLatencyUs, Stats.PairingRetries);
+                DB_printf("Queue full: %u requests coalesced, %u dropped\r\n\n",
+                        Stats.Coalesced, Stats.Dropped);
+              }
+              break;
+              
+              case 'P':
+              {
+                TXStatus_SetPairingRetry(!TXStatus_IsPairingRetry());
+                DB_printf("Early resend of failed pairing frames %s\r\n\n",
+                        TXStatus_IsPairingRetry() ? "on" : "off");
+              }
+              break;
+              
+              case 'E':
+              {
+                StatusTelemetry_t Telemetry;
+                StatusTelemetry_Stats_t Stats;
+                bool Current = StatusTelemetry_GetLatest(&Telemetry);
+                StatusTelemetry_GetStats(&Stats);
+                DB_printf("TUG wheels %d/%d RPM, duty %d/%d tenths of a percent left/right%s\r\n",
+                        Telemetry.LeftRPM, Telemetry.RightRPM, Telemetry.LeftDuty,
+                        Telemetry.RightDuty, Current ? "" : " (stale)");
+                DB_printf("Fuel trend %d levels in 5 s, control law load %u%%\r\n",
+                        Telemetry.FuelTrend, Telemetry.LoadPercent);
+                DB_printf("TUG heard %u of our frames, %u RX errors, RSSI -%u dBm\r\n",
+                        Telemetry.ValidFrames, Telemetry.RXErrors, Telemetry.RSSI);
+                DB_printf("%u blocks, %u keyframes, %u gaps, %u malformed, %u bytes\r\n\n",
+                        Stats.Blocks, Stats.Keyframes, Stats.Gaps, Stats.Malformed,
+                        Stats.Bytes);
+              }
+              break;
+              
+              case 'F':
+              {
+                puts("Posting DISCOVER_TUGS Event to PilotFSM\r\n");
+                NewEvent.EventType = DISCOVER_TUGS;
+                PostPilotFSM(NewEvent);
+              }
+              break;
+              
+              case 'G':
+              {
+                TugDiscovery_Tug_t Tugs[TUGDISCOVERY_MAX_TUGS];
+                TugDiscovery_Stats_t Stats;
+                uint8_t NumTugs = TugDiscovery_GetTugs(Tugs);
+                TugDiscovery_GetStats(&Stats);
+                DB_printf("%u probes, %u replies, %u TUGs in the last round\r\n",
+                        Stats.Probes, Stats.Replies, NumTugs);
+                for (uint8_t i = 0; i < NumTugs; i++) {
+                    DB_printf("  TUG 0x%x heard us at -%u dBm, we heard it at -%u dBm%s\r\n",
+                            Tugs[i].Address, Tugs[i].ProbeRSSI, Tugs[i].ReplyRSSI,
+                            (Tugs[i].Address == Stats.Target) ? " (picked)" : "");
+                }
+                DB_printf("Last pairing took %u ms, %s\r\n\n", Stats.LastPairingMs,
+                        Stats.LastPairingDiscovered ? "discovered" : "pairing selector");
+              }
+              break;
+              
+              case 'W':
+              {
+                if (!SlotSchedule_SetEnabled(!SlotSchedule_IsEnabled())) {
+                    puts("Link baud too slow for a slot, slotted airtime stays off\r\n");
+                }
+                else {
+                    DB_printf("Slotted airtime %s\r\n\n",
+                            SlotSchedule_IsEnabled() ? "on, control at 5 Hz" : "off");
+                }
+              }
+              break;
+              
+              case 'Y':
+              {
+                SlotSchedule_Stats_t Stats;
+                SlotSchedule_GetStats(&Stats);
+                DB_printf("Slotted airtime %s, slot %u of %u%s\r\n",
+                        Stats.Enabled ? "on" : "off", Stats.Slot, SLOTSCHEDULE_NUM_SLOTS,
+                        Stats.Moved ? " (moved off our TUG's slot)" : "");
+                DB_printf("Other pairs in slots 0x%x, %u syncs sent, %u heard, %u conflicts\r\n",
+                        Stats.HeardSlots, Stats.SyncsSent, Stats.SyncsHeard, Stats.Conflicts);
+                DB_printf("Superframe %d ms from the last pair heard, worst %u ms\r\n\n",
+                        Stats.LastError, Stats.MaxError);
+              }
+              break;
+              
               default:
                   break;
           }
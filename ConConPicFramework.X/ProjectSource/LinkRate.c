@@ -0,0 +1,235 @@
+/****************************************************************************
+ * File:   LinkRate.c
+ * Picks the control frame rate, 5 to 50 Hz, from status loss and RSSI
+ *
+ * Our Tug answers each control frame period with one status frame, timing
+ * its status to the control frames it receives. So over a window, status
+ * frames missing against control frames sent is the round trip loss. Each
+ * window the rate steps up 5 Hz on a clean, strong link, steps down 5 Hz on
+ * some loss or a weak signal, and halves on heavy loss. The window after a
+ * change is skipped while the Tug catches up.
+ *
+ * A Tug that stays at 5 Hz looks like heavy loss at any higher rate, so
+ * this settles back to the class protocol's 5 Hz with it.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "LinkRate.h"
+#include "XBeeBaud.h"
+#include "ES_Timers.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define MIN_RATE_HZ 5           // Class protocol rate
+#define MAX_RATE_HZ 50
+#define MAX_RATE_HZ_AT_9600 20  // A frame each way is then 30% of the wire
+#define RATE_STEP_HZ 5
+#define WINDOW_MS 1000
+
+#define HIGH_LOSS_PCT 20        // More than this halves the rate
+#define LOW_LOSS_PCT 5          // More than this steps the rate down
+#define RSSI_STRONG 75          // -dBm. Stronger is needed to step up
+#define RSSI_WEAK 85            // -dBm. Weaker steps down
+#define RSSI_FILTER_SHIFT 2     // Each status moves the filter 1/4 of the way
+#define RSSI_FRACTION_BITS 4
+
+/*---------------------------- Module Functions ---------------------------*/
+static void PickRate(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint8_t RateHz = MIN_RATE_HZ;
+static uint16_t WindowStart;
+static uint8_t ControlsSent;
+static uint8_t StatusesReceived;
+static bool Settling;
+static uint8_t LossPct;
+static uint16_t FilteredRSSI; // -dBm with RSSI_FRACTION_BITS, 0 if unknown
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      LinkRate_Reset
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Drops back to the 5 Hz protocol rate and starts a new measurement
+ *      window. Call on pairing and on losing the pair
+****************************************************************************/
+void LinkRate_Reset(void)
+{
+    RateHz = MIN_RATE_HZ;
+    WindowStart = ES_Timer_GetTime();
+    ControlsSent = 0;
+    StatusesReceived = 0;
+    Settling = true;
+    LossPct = 0;
+    FilteredRSSI = 0;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkRate_ControlSent
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each control frame sent while paired. Once a window has
+ *      passed this picks the rate for the next one
+****************************************************************************/
+void LinkRate_ControlSent(void)
+{
+    ControlsSent++;
+    if ((uint16_t) (ES_Timer_GetTime() - WindowStart) >= WINDOW_MS)
+    {
+        PickRate();
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      LinkRate_StatusReceived
+ *
+ * Parameters
+ *      uint8_t RSSI - RSSI byte of the status frame, -dBm
+ * Return
+ *      void
+ * Description
+ *      Call for each valid status frame from the paired Tug
+****************************************************************************/
+void LinkRate_StatusReceived(uint8_t RSSI)
+{
+    StatusesReceived++;
+
+    int16_t NewRSSI = (int16_t) RSSI << RSSI_FRACTION_BITS;
+    if (0 == FilteredRSSI)
+    {
+        FilteredRSSI = NewRSSI;
+    }
+    else
+    {
+        FilteredRSSI += (NewRSSI - (int16_t) FilteredRSSI) >> RSSI_FILTER_SHIFT;
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetPeriod
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, ms between control frames
+****************************************************************************/
+uint16_t LinkRate_GetPeriod(void)
+{
+    return 1000 / RateHz;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetRateHz
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, control frames per second
+****************************************************************************/
+uint8_t LinkRate_GetRateHz(void)
+{
+    return RateHz;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetLossPct
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, percent of status frames missed in the last window
+****************************************************************************/
+uint8_t LinkRate_GetLossPct(void)
+{
+    return LossPct;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkRate_GetRSSI
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, filtered status frame RSSI in -dBm. 0 before any arrive
+****************************************************************************/
+uint8_t LinkRate_GetRSSI(void)
+{
+    return (FilteredRSSI + (1 << (RSSI_FRACTION_BITS - 1))) >> RSSI_FRACTION_BITS;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * PickRate
+ * Helper for LinkRate_ControlSent
+ * Measures the window's loss, sets the rate for the next window and
+ * starts it
+ */
+static void PickRate(void)
+{
+    LossPct = 0;
+    if (StatusesReceived < ControlsSent)
+    {
+        LossPct = (100 * (ControlsSent - StatusesReceived)) / ControlsSent;
+    }
+
+    if (Settling)
+    {
+        Settling = false;
+    }
+    else
+    {
+        uint8_t RSSI = LinkRate_GetRSSI();
+        int16_t NewRateHz = RateHz;
+        if (LossPct > HIGH_LOSS_PCT)
+        {
+            NewRateHz = RateHz / 2;
+        }
+        else if ((LossPct > LOW_LOSS_PCT) || (RSSI > RSSI_WEAK))
+        {
+            NewRateHz = RateHz - RATE_STEP_HZ;
+        }
+        else if (RSSI < RSSI_STRONG)
+        {
+            NewRateHz = RateHz + RATE_STEP_HZ;
+        }
+
+        // Slow link rates leave little room for the faster frames
+        int16_t MaxRateHz = (_Baud_9600 == XBeeBaud_GetRate()) ?
+            MAX_RATE_HZ_AT_9600 : MAX_RATE_HZ;
+        if (NewRateHz > MaxRateHz)
+        {
+            NewRateHz = MaxRateHz;
+        }
+        if (NewRateHz < MIN_RATE_HZ)
+        {
+            NewRateHz = MIN_RATE_HZ;
+        }
+
+        if (NewRateHz != RateHz)
+        {
+            RateHz = NewRateHz;
+            Settling = true;
+        }
+    }
+
+    WindowStart = ES_Timer_GetTime();
+    ControlsSent = 0;
+    StatusesReceived = 0;
+}
@@ -28,6 +28,11 @@
 #include "ES_Framework.h"
 #include "PilotFSM.h"
 #include "XBeeTXSM.h"
+#include "XBeeBaud.h"
+#include "LinkRate.h"
+#include "LinkStats.h"
+#include "TugDiscovery.h"
+#include "SlotSchedule.h"
 #include "../HALs/PIC32PortHAL.h"
 #include "../HALs/PIC32_AD_Lib.h"
 #include <stdbool.h>
@@ -39,7 +44,6 @@
 #define ONE_SEC 1000
 #define MODE3DEBOUNCETIMERDURATION 2000
 #define ONE_TENTH_SEC 100
-#define ONE_FIFTH_SEC 200// For 5Hz communications
 #define PAIRBUTTONBIT PORTAbits.RA4
 #define MODE3BUTTONBIT PORTBbits.RB9
 
@@ -56,6 +60,9 @@ static void ConfigureIOPins(void);
 static void LatchAddress(void);
 static void RequestToPair(void);
 static void SendControl(void);
+static void SendSync(void);
+static void StartDiscovery(void);
+static void RestartPairing(void);
 static void StartCommsTimer(void);
 static void StartInactivityTimer(void);
 static void StopInactivityTimer(void);
@@ -134,6 +141,12 @@ bool InitPilotFSM(uint8_t Priority)
   //Configure UART for XBee Communications
   ConfigureUARTforXBee();
   
+  //Pairing is always at 5 Hz
+  LinkRate_Reset();
+  
+  //Move the link off 9600 baud. Falls back to 9600 if the XBee won't
+  XBeeBaud_Init();
+  
   //Start Comms Timer
   StartCommsTimer();
   
@@ -223,7 +236,14 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
           case PAIR_BUTTON_PRESSED:
           {
               //puts("PilotFSM received PAIR_BUTTON_PRESSED Event in AttemptingToPair State\r\n");
-              LatchAddress();
+              RestartPairing();
+          }
+          break;
+          
+          case DISCOVER_TUGS:
+          {
+              TugDiscovery_PairingStarted();
+              StartDiscovery();
           }
           break;
           
@@ -232,10 +252,16 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
               //puts("PilotFSM received ES_TIMEOUT Event in AttemptingToPair State\r\n");
               if (ThisEvent.EventParam == COMMSTIMER) {
                   //puts("ES_TIMEOUT Event is of type CommsTimer\r\n");
-                  UpdateThrustVals();
-                  StartCommsTimer();
-                  RequestToPair();
-                  ToggleCommsLED();
+                  //No Tug on this selector position, so go find one
+                  if (0 == QueryTargetTUGAddress()) {
+                      StartDiscovery();
+                  }
+                  else {
+                      UpdateThrustVals();
+                      StartCommsTimer();
+                      RequestToPair();
+                      ToggleCommsLED();
+                  }
               }
               if (ThisEvent.EventParam == PAIRBUTTONDEBOUNCETIMER) {
                   //puts("ES_TIMEOUT Event is of type PairButtonDebounceTimer\r\n");
@@ -251,9 +277,62 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
           {
               //puts("PilotFSM received ACK_RECEIVED Event in AttemptingToPair State\r\n");
               StartInactivityTimer();
+              LinkRate_Reset();
+              TugDiscovery_PairingDone();
               CurrentState = Paired;
               TurnOffTryingToPairLED();
               TurnOnPairedLED();
+              //First control frame now, so the Tug finishes pairing too
+              UpdateThrustVals();
+              StartCommsTimer();
+              SendControl();
+              LinkRate_ControlSent();
+          }
+          break;
+          
+          default:
+              ;
+      }
+    }
+    break;
+
+    case DiscoveringTugs:
+    {
+      switch (ThisEvent.EventType)
+      {
+          case PAIR_BUTTON_PRESSED:
+          {
+              ES_Timer_StopTimer(DISCOVERYTIMER);
+              RestartPairing();
+          }
+          break;
+          
+          case DISCOVER_TUGS:
+          {
+              TugDiscovery_PairingStarted();
+              StartDiscovery();
+          }
+          break;
+          
+          case ES_TIMEOUT:
+          {
+              if (ThisEvent.EventParam == DISCOVERYTIMER) {
+                  //Every reply is in. Ask the best Tug straight away. With
+                  //none, the next CommsTimer probes again or falls back to
+                  //the selector's Tug
+                  CurrentState = AttemptingToPair;
+                  if (TugDiscovery_Choose()) {
+                      UpdateThrustVals();
+                      RequestToPair();
+                  }
+                  StartCommsTimer();
+              }
+              if (ThisEvent.EventParam == PAIRBUTTONDEBOUNCETIMER) {
+                  PairButtonEventCheckerActive = true;
+              }
+              if (ThisEvent.EventParam == MODE3BUTTONDEBOUNCETIMER) {
+                  Mode3ButtonEventCheckerActive = true;
+              }
           }
           break;
           
@@ -271,6 +350,8 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
         { 
             //puts("PilotFSM received VALID_STATUS_RECEIVED Event in Paired State\r\n");
             ResetInactivityTimer();
+            //EventParam is the frame's RSSI
+            LinkRate_StatusReceived(ThisEvent.EventParam);
         }
         break;
         
@@ -282,6 +363,11 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
                 UpdateThrustVals();
                 StartCommsTimer();
                 SendControl();
+                LinkRate_ControlSent();
+                //Other pairs line their slots up on our sync
+                if (SlotSchedule_IsEnabled() && SlotSchedule_IsSyncDue()) {
+                    SendSync();
+                }
                 ToggleCommsLED();
             }
             if (ThisEvent.EventParam == INACTIVITYTIMER){
@@ -289,6 +375,10 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
                 LatchAddress();
                 CurrentState = AttemptingToPair;
                 StopInactivityTimer();
+                LinkRate_Reset();
+                LinkStats_PairingEnded(true);
+                //Same Tug again, discovered or not
+                TugDiscovery_PairingStarted();
                 TurnOffPairedLED();
                 TurnOnTryingToPairLED();
             }
@@ -311,11 +401,25 @@ ES_Event_t RunPilotFSM(ES_Event_t ThisEvent)
         case PAIR_BUTTON_PRESSED:  
         { 
             //puts("PilotFSM received PAIR_BUTTON_PRESSED Event in Paired State\r\n");
-            LatchAddress();
             CurrentState = AttemptingToPair;
             StopInactivityTimer();
+            LinkRate_Reset();
+            LinkStats_PairingEnded(false);
+            TurnOffPairedLED();
+            TurnOnTryingToPairLED();
+            RestartPairing();
+        }
+        break;
+        
+        case DISCOVER_TUGS:
+        {
+            StopInactivityTimer();
+            LinkRate_Reset();
+            LinkStats_PairingEnded(false);
             TurnOffPairedLED();
             TurnOnTryingToPairLED();
+            TugDiscovery_PairingStarted();
+            StartDiscovery();
         }
         break;
         
@@ -459,10 +563,15 @@ static void ConfigureUARTforXBee(void)
     U2STAbits.URXEN = 1;
     
     U2STAbits.UTXISEL = 0b10; //Generate interrupt when transmit buffer is empty
+    U2STAbits.URXISEL = 0b00; //Generate interrupt when a byte is received
     
     //Make interrupt priority high for UART
     IPC9bits.U2IP = 0b111;
     
+    //Receive by interrupt into XBeeRXSM's buffer
+    IFS1CLR = _IFS1_U2RXIF_MASK;
+    IEC1SET = _IEC1_U2RXIE_MASK;
+    
     //Enable interrupts in general
     __builtin_enable_interrupts();
     
@@ -541,9 +650,68 @@ static void SendControl(void)
     return;
 }
 
+/*
+ * SendSync
+ * Broadcasts our slot right behind the control frame, still inside the slot
+ */
+static void SendSync(void)
+{
+    ES_Event_t NewEvent;
+    NewEvent.EventType = XBEE_TRANSMIT_SYNC;
+    PostXBeeTXSM(NewEvent);
+    return;
+}
+
+/*
+ * StartDiscovery
+ * Broadcasts a probe for free Tugs and waits out their replies in
+ * DiscoveringTugs. Any Tug picked before is dropped
+ */
+static void StartDiscovery(void)
+{
+    TugDiscovery_ClearTarget();
+    TugDiscovery_Start();
+    ES_Timer_StopTimer(COMMSTIMER);
+    //State first, so XBeeTXSM builds a probe
+    CurrentState = DiscoveringTugs;
+    ES_Event_t NewEvent;
+    NewEvent.EventType = XBEE_TRANSMIT_MESSAGE;
+    PostXBeeTXSM(NewEvent);
+    ES_Timer_InitTimer(DISCOVERYTIMER, TugDiscovery_GetWaitTime());
+    ToggleCommsLED();
+    return;
+}
+
+/*
+ * RestartPairing
+ * Pair button. Reads the selector, and if that position has no Tug,
+ * discovers one right away
+ */
+static void RestartPairing(void)
+{
+    LatchAddress();
+    TugDiscovery_ClearTarget();
+    TugDiscovery_PairingStarted();
+    if (0 == QueryTargetTUGAddress()) {
+        StartDiscovery();
+    }
+    else if (CurrentState == DiscoveringTugs) {
+        CurrentState = AttemptingToPair;
+        StartCommsTimer();
+    }
+    return;
+}
+
 static void StartCommsTimer(void)
 {
-    ES_Timer_InitTimer(COMMSTIMER, ONE_FIFTH_SEC);
+    //Slotted, control goes out at the start of our slot each superframe
+    if ((CurrentState == Paired) && SlotSchedule_IsEnabled()) {
+        SlotSchedule_SetTug(QueryTargetTUGAddress());
+        ES_Timer_InitTimer(COMMSTIMER, SlotSchedule_GetWait());
+        return;
+    }
+    //5 Hz while pairing, LinkRate's pick once paired
+    ES_Timer_InitTimer(COMMSTIMER, LinkRate_GetPeriod());
     return;
 }
 
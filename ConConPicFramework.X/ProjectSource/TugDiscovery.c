@@ -0,0 +1,309 @@
+/****************************************************************************
+ * File:   TugDiscovery.c
+ * Finds free Tugs with a broadcast probe and picks one to pair with
+ *
+ * PilotFSM broadcasts a Probe with a round number and a reply window. Every
+ * one of our Tugs that isn't paired answers with a ProbeReply after a
+ * random delay inside the window, so replies rarely collide, and reports
+ * the RSSI it heard the probe at. Once the window and the last reply's trip
+ * through both UARTs are over, the Tug whose weaker direction is strongest
+ * becomes the target. PilotFSM then sends it a request to pair right away.
+ *
+ * Tugs from other teams don't know the probe and stay quiet. The pairing
+ * selector still picks those.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "TugDiscovery.h"
+#include "XBeeBaud.h"
+#include "ES_Timers.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define PROBE_WINDOW_MS 40      // Replies spread over this
+#define AIR_MARGIN_MS 5         // Radio backoff and MAC retries on a reply
+#define BITS_PER_UART_BYTE 10
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint8_t WeakerRSSI(const TugDiscovery_Tug_t *ThisTug);
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint8_t Round;
+static TugDiscovery_Tug_t Tugs[TUGDISCOVERY_MAX_TUGS];
+static uint8_t NumTugs;
+static uint16_t Target;
+
+static uint16_t Probes;
+static uint16_t Replies;
+static uint16_t PairingStartTime;
+static bool PairingTimed;
+static bool PairingDiscovered;
+static uint16_t LastPairingMs;
+static bool LastPairingDiscovered;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      TugDiscovery_Start
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Starts a new round. Replies to earlier rounds are ignored from here
+****************************************************************************/
+void TugDiscovery_Start(void)
+{
+    Round++;
+    NumTugs = 0;
+    Probes++;
+    PairingDiscovered = true;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetProbe
+ *
+ * Parameters
+ *      XBeeProbe_t *Probe - Filled with the round and reply window to send
+ * Return
+ *      void
+****************************************************************************/
+void TugDiscovery_GetProbe(XBeeProbe_t *Probe)
+{
+    Probe->Round = Round;
+    Probe->Window = PROBE_WINDOW_MS;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetWaitTime
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, ms from sending a probe until every reply is in
+****************************************************************************/
+uint16_t TugDiscovery_GetWaitTime(void)
+{
+    // Probe out of our UART, and a late reply back in, at the link's baud
+    uint32_t FrameMs = ((uint32_t) XBEE_FRAME_SIZE * BITS_PER_UART_BYTE * 1000) /
+            XBeeBaud_GetBitsPerSecond(XBeeBaud_GetRate()) + 1;
+    return PROBE_WINDOW_MS + (2 * FrameMs) + AIR_MARGIN_MS;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_ReplyReceived
+ *
+ * Parameters
+ *      const XBeeProbeReply_t *Reply - The Tug's reply
+ *      uint16_t Source - Address it came from
+ *      uint8_t RSSI - -dBm we heard it at
+ * Return
+ *      bool, true if it answered this round
+****************************************************************************/
+bool TugDiscovery_ReplyReceived(const XBeeProbeReply_t *Reply, uint16_t Source,
+        uint8_t RSSI)
+{
+    if (Reply->Round != Round)
+    {
+        return false;
+    }
+    Replies++;
+
+    // A resent reply updates the Tug's entry
+    uint8_t i;
+    for (i = 0; i < NumTugs; i++)
+    {
+        if (Tugs[i].Address == Source)
+        {
+            break;
+        }
+    }
+    if (i == NumTugs)
+    {
+        if (NumTugs >= TUGDISCOVERY_MAX_TUGS)
+        {
+            return true;
+        }
+        NumTugs++;
+    }
+    Tugs[i].Address = Source;
+    Tugs[i].ProbeRSSI = Reply->RSSI;
+    Tugs[i].ReplyRSSI = RSSI;
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_Choose
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, false if no Tug replied this round
+ * Description
+ *      Makes the Tug with the best weaker direction of the link the
+ *      target, so QueryTargetTUGAddress returns it until cleared
+****************************************************************************/
+bool TugDiscovery_Choose(void)
+{
+    if (0 == NumTugs)
+    {
+        return false;
+    }
+    uint8_t Best = 0;
+    for (uint8_t i = 1; i < NumTugs; i++)
+    {
+        // RSSI is -dBm, so smaller is stronger
+        if (WeakerRSSI(&Tugs[i]) < WeakerRSSI(&Tugs[Best]))
+        {
+            Best = i;
+        }
+    }
+    Target = Tugs[Best].Address;
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetTarget
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, address of the picked Tug, 0 if none
+****************************************************************************/
+uint16_t TugDiscovery_GetTarget(void)
+{
+    return Target;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_ClearTarget
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Hands the choice of Tug back to the pairing selector
+****************************************************************************/
+void TugDiscovery_ClearTarget(void)
+{
+    Target = 0;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetTugs
+ *
+ * Parameters
+ *      TugDiscovery_Tug_t *ThisTugs - Room for TUGDISCOVERY_MAX_TUGS
+ * Return
+ *      uint8_t, Tugs that replied in the last round
+****************************************************************************/
+uint8_t TugDiscovery_GetTugs(TugDiscovery_Tug_t *ThisTugs)
+{
+    for (uint8_t i = 0; i < NumTugs; i++)
+    {
+        ThisTugs[i] = Tugs[i];
+    }
+    return NumTugs;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_IsOurTug
+ *
+ * Parameters
+ *      uint16_t Address - Tug to check
+ * Return
+ *      bool, true if it answered the last probe round
+ * Description
+ *      Only our Tugs answer probes, so only they understand our extra bytes
+****************************************************************************/
+bool TugDiscovery_IsOurTug(uint16_t Address)
+{
+    for (uint8_t i = 0; i < NumTugs; i++)
+    {
+        if (Tugs[i].Address == Address)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_PairingStarted
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when the ConCon starts looking for a Tug, to time the pairing
+****************************************************************************/
+void TugDiscovery_PairingStarted(void)
+{
+    PairingStartTime = ES_Timer_GetTime();
+    PairingTimed = true;
+    PairingDiscovered = false;
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_PairingDone
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when the Tug acknowledges
+****************************************************************************/
+void TugDiscovery_PairingDone(void)
+{
+    if (PairingTimed)
+    {
+        LastPairingMs = ES_Timer_GetTime() - PairingStartTime;
+        LastPairingDiscovered = PairingDiscovered;
+        PairingTimed = false;
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      TugDiscovery_GetStats
+ *
+ * Parameters
+ *      TugDiscovery_Stats_t *ThisStats - Filled with the counts and timing
+ * Return
+ *      void
+****************************************************************************/
+void TugDiscovery_GetStats(TugDiscovery_Stats_t *ThisStats)
+{
+    ThisStats->Probes = Probes;
+    ThisStats->Replies = Replies;
+    ThisStats->Target = Target;
+    ThisStats->LastPairingMs = LastPairingMs;
+    ThisStats->LastPairingDiscovered = LastPairingDiscovered;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * WeakerRSSI
+ * Helper for TugDiscovery_Choose
+ * -dBm of the worse direction. Control and status both have to get through
+ */
+static uint8_t WeakerRSSI(const TugDiscovery_Tug_t *ThisTug)
+{
+    return (ThisTug->ProbeRSSI > ThisTug->ReplyRSSI) ? ThisTug->ProbeRSSI : ThisTug->ReplyRSSI;
+}
@@ -27,6 +27,12 @@
 #include "XBeeRXSM.h"
 #include "XBeeTXSM.h"
 #include "PilotFSM.h"
+#include "LinkStats.h"
+#include "XBeeBaud.h"
+#include "TXStatus.h"
+#include "StatusTelemetry.h"
+#include "TugDiscovery.h"
+#include "SlotSchedule.h"
 #include "../HALs/PIC32PortHAL.h"
 #include "terminal.h"
 #include "dbprintf.h"
@@ -34,27 +40,8 @@
 
 /*----------------------------- Module Defines ----------------------------*/
 
-#define RXMSGFRAME_STARTDELIMITER 1
-#define RXMSGFRAME_LENGTHMSB 2
-#define RXMSGFRAME_LENGTHLSB 3
-#define RXMSGFRAME_APIIDENTIFIER 4
-#define RXMSGFRAME_SOURCEADDRESSMSB 5
-#define RXMSGFRAME_SOURCEADDRESSLSB 6
-#define RXMSGFRAME_RSSI 7
-#define RXMSGFRAME_OPTIONS 8
-#define RXMSGFRAME_MESSAGEID 9
-#define RXMSGFRAME_TUGADDRMSB 10
-#define RXMSGFRAME_X 10
-#define RXMSGFRAME_FUELLEVEL 10
-#define RXMSGFRAME_TUGADDRLSB 11
-#define RXMSGFRAME_Y 11
-#define RXMSGFRAME_PILOTADDRMSB 12
-#define RXMSGFRAME_YAW 12
-#define RXMSGFRAME_PILOTADDRLSB 13
-#define RXMSGFRAME_REFUEL 13
-#define RXMSGFRAME_ACK 14
-#define RXMSGFRAME_MODE3 14
-#define RXMSGFRAME_CHECKSUM 15
+
+#define RX_BUFFER_SIZE 128 // Power of 2. Room for 4 status frames with telemetry
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this machine.They should be functions
@@ -72,14 +59,20 @@ static XBeeRXState_t CurrentState;
 // with the introduction of Gen2, we need a module level Priority var as well
 static uint8_t MyPriority;
 
-static uint8_t RXMessageArray[15];
+static uint8_t RXMessageArray[XBEE_MAX_FRAME_SIZE];
 static uint8_t ByteIndex;
 
 static bool LastRXBufferState;
 
+// Filled by the UART2 ISR, emptied one byte per event by IsRXBufferNonempty
+static volatile uint8_t RXBuffer[RX_BUFFER_SIZE];
+static volatile uint8_t RXHead;
+static volatile uint8_t RXTail;
+
 static uint16_t messageLength;
 
 static uint8_t FuelLevel;
+static uint16_t TimeToEmpty; // tenths of a second
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -111,11 +104,14 @@ bool InitXBeeRXSM(uint8_t Priority)
   //Start pointing to index 0
   ByteIndex = 0;
   
+  LinkStats_Clear();
+  
   //Update last RX Buffer State
   LastRXBufferState = 0;
   
   //Initialize with max fuel to avoid refuel upon powerup
   FuelLevel = 0xFF;
+  TimeToEmpty = 0xFFFF;
   
   //puts("Yooooooooo\r\n");
   
@@ -179,8 +175,8 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
             
             uint8_t tempVal;
             
-            //Get the byte from the UART2 RX Buffer
-            tempVal = U2RXREG;
+            //Get the byte the ISR received
+            tempVal = (uint8_t) ThisEvent.EventParam;
             
             //If the byte is valid as a Start Delimiter (0x7E) then proceed.  Otherwise ignore it.
             if (tempVal == 0x7E) {
@@ -207,7 +203,7 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
         case UART_BYTE_RECEIVED: 
         {  
             uint8_t tempVal2;
-            tempVal2 = U2RXREG;
+            tempVal2 = (uint8_t) ThisEvent.EventParam;
             //Save in the array
             RXMessageArray[ByteIndex]=tempVal2;
             //Increment the index
@@ -219,8 +215,15 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
                 //printf("Message Length is %x",messageLength);
                 //We need to start counting through the message length now
                 ByteIndex = 0;
-                //Go to the next state
-                CurrentState = XBeeRXFrameDataState;
+                //Drop frames too long for the array and wait for the next start
+                if (messageLength > (sizeof(RXMessageArray) - 4)) {
+                    LinkStats_LengthError();
+                    CurrentState = XBeeRXIdleState;
+                }
+                else {
+                    //Go to the next state
+                    CurrentState = XBeeRXFrameDataState;
+                }
             }
                 
         }
@@ -240,7 +243,7 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
         case UART_BYTE_RECEIVED: 
         {  
             //Save in the array
-            RXMessageArray[ByteIndex+3]=U2RXREG;
+            RXMessageArray[ByteIndex+3]=(uint8_t) ThisEvent.EventParam;
             //Increment the index
             ByteIndex++;
             
@@ -249,8 +252,14 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
                 //Go back to being idle
                 CurrentState = XBeeRXIdleState;
                 
-                //Call function to handle new message
-                ParseNewRXMessage();
+                //Call function to handle new message, if it arrived intact
+                if (XBeeProtocol_IsChecksumValid(RXMessageArray)) {
+                    LinkStats_FrameReceived();
+                    ParseNewRXMessage();
+                }
+                else {
+                    LinkStats_ChecksumFailed();
+                }
             }
         }
         break;
@@ -294,92 +303,149 @@ bool IsRXBufferNonempty(void)
 {
     bool returnVal;
     returnVal = false;
-    bool NewRXBufferState;
-    NewRXBufferState = U2STAbits.URXDA;
     //puts("Event Checker\r\n");
-    if (NewRXBufferState == 1) {
-        //In this case new data is available; post an event
+    if (RXTail != RXHead) {
+        //In this case new data is available; post it with the event
         ES_Event_t NewEvent;
         NewEvent.EventType = UART_BYTE_RECEIVED;
+        NewEvent.EventParam = RXBuffer[RXTail];
+        RXTail = (RXTail + 1) & (RX_BUFFER_SIZE - 1);
         PostXBeeRXSM(NewEvent);
         returnVal = true;
         //puts("New Byte Present\r\n");
     }
-    LastRXBufferState = NewRXBufferState;
+    LastRXBufferState = returnVal;
     
     return returnVal;
 }
 
+/****************************************************************************
+ Function
+     DrainRXFIFO
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Moves received bytes from the UART2 FIFO to the RX buffer. Call from
+     the UART2 ISR, so bytes aren't lost to an overrun at the higher link
+     rates while the framework is busy
+ Notes
+     Bytes are dropped if the buffer is full. The frame they were in fails
+     to parse and the next start delimiter resyncs
+ Author
+     agent
+****************************************************************************/
+void DrainRXFIFO(void)
+{
+    while (U2STAbits.URXDA) {
+        uint8_t NewByte = U2RXREG;
+        uint8_t NextHead = (RXHead + 1) & (RX_BUFFER_SIZE - 1);
+        if (NextHead != RXTail) {
+            RXBuffer[RXHead] = NewByte;
+            RXHead = NextHead;
+        }
+        else {
+            LinkStats_ByteDropped();
+        }
+    }
+    //An overrun stops reception until it is cleared
+    if (U2STAbits.OERR) {
+        U2STACLR = _U2STA_OERR_MASK;
+        LinkStats_UARTOverrun();
+    }
+    IFS1CLR = _IFS1_U2RXIF_MASK;
+}
+
 uint8_t QueryFuelLevel(void)
 {
     return FuelLevel;
 }
 
+//Tenths of a second until the Tug runs out of fuel, 0xFFFF if not burning
+uint16_t QueryTimeToEmpty(void)
+{
+    return TimeToEmpty;
+}
+
 /***************************************************************************
  private functions
  ***************************************************************************/
 
 static void ParseNewRXMessage(void)
 {
+    XBeeRX16Header_t Header;
+    uint8_t FrameID;
+    uint8_t Status;
+    
     //for (uint8_t i=0; i<15; i++) {
     //    DB_printf("Byte = %x\r\n",RXMessageArray[i]);
     //}
     //puts("Message Complete\r\n");
     
-    //We only care about this message if it's of the type RX Packet:  16-bit Address,
-    //indicated by the API Identifier 0x81
-    if (RXMessageArray[RXMSGFRAME_APIIDENTIFIER-1] == 0x81) {
-        uint8_t ChecksumTest;
-        ChecksumTest = 0;
-
+    //TX Status (0x89) frames report how the frames we sent were delivered
+    if (XBeeProtocol_ParseTXStatus(RXMessageArray, &FrameID, &Status)) {
+        TXStatus_Received(FrameID, Status);
+        return;
+    }
+    
+    //Otherwise we only care about this message if it's of the type RX Packet:  16-bit Address,
+    //indicated by the API Identifier 0x81. The checksum is already checked
+    if (XBeeProtocol_ParseRX16(RXMessageArray, &Header)) {
+        //While discovering, any free Tug may answer our probe
+        XBeeProbeReply_t Reply;
+        if ((QueryPilotFSM() == DiscoveringTugs) &&
+                XBeeProtocol_UnpackProbeReply(RXMessageArray, &Reply)) {
+            TugDiscovery_ReplyReceived(&Reply, Header.Source, Header.RSSI);
+            return;
+        }
+        //Other slotted ConCons announce their slots to everyone
+        XBeeSync_t Sync;
+        if (XBeeProtocol_UnpackSync(RXMessageArray, &Sync)) {
+            if (SlotSchedule_IsEnabled()) {
+                SlotSchedule_SyncReceived(&Sync);
+            }
+            return;
+        }
+        //Only listen to the TUG we're trying to pair with
+        if (Header.Source != QueryTargetTUGAddress()) {
+            LinkStats_UnknownSource();
+            return;
+        }
         //We're only expecting two types of messages - ignore all others
         //First type:  Pairing Acknowledgement
-        if (RXMessageArray[RXMSGFRAME_MESSAGEID-1] == XBee_PairingAcknowledged) {
-            //Only proceed if checksum is correct
-            ChecksumTest += RXMessageArray[RXMSGFRAME_APIIDENTIFIER-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_SOURCEADDRESSMSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_SOURCEADDRESSLSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_RSSI-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_OPTIONS-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_MESSAGEID-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_TUGADDRMSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_TUGADDRLSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_PILOTADDRMSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_PILOTADDRLSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_ACK-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_CHECKSUM-1];
-            if (ChecksumTest == 0xFF) {
-                //In this case, we're good -- post that a pairing acknowledgement occurred
-                ES_Event_t NewEvent;
-                NewEvent.EventType = ACK_RECEIVED;
-                PostPilotFSM(NewEvent);
-            }
+        XBeePairingAcknowledged_t Ack;
+        XBeeStatus_t TugStatus;
+        if (XBeeProtocol_UnpackPairingAcknowledged(RXMessageArray, &Ack)) {
+            //Post that a pairing acknowledgement occurred
+            LinkStats_ValidFrame(Header.RSSI);
+            StatusTelemetry_Reset();
+            ES_Event_t NewEvent;
+            NewEvent.EventType = ACK_RECEIVED;
+            PostPilotFSM(NewEvent);
         }
         //Second type:  Status while paired
-        else if (RXMessageArray[RXMSGFRAME_MESSAGEID-1] == XBee_Status) {
-            //Only proceed if checksum is correct
-            ChecksumTest += RXMessageArray[RXMSGFRAME_APIIDENTIFIER-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_SOURCEADDRESSMSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_SOURCEADDRESSLSB-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_RSSI-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_OPTIONS-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_MESSAGEID-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_FUELLEVEL-1];
-            ChecksumTest += RXMessageArray[11-1];
-            ChecksumTest += RXMessageArray[12-1];
-            ChecksumTest += RXMessageArray[13-1];
-            ChecksumTest += RXMessageArray[14-1];
-            ChecksumTest += RXMessageArray[RXMSGFRAME_CHECKSUM-1];
-            if (ChecksumTest == 0xFF) {
-                //In this case, we're good -- update fuel level
-                FuelLevel = RXMessageArray[RXMSGFRAME_FUELLEVEL-1];
-                ES_Event_t NewEvent;
-                NewEvent.EventType = VALID_STATUS_RECEIVED;
-                PostPilotFSM(NewEvent);
-                //DB_printf("Fuel Level = %d\r\n",FuelLevel);
+        else if (XBeeProtocol_UnpackStatus(RXMessageArray, &TugStatus)) {
+            //Update fuel level
+            LinkStats_ValidFrame(Header.RSSI);
+            XBeeBaud_StatusReceived();
+            FuelLevel = TugStatus.FuelLevel;
+            TimeToEmpty = TugStatus.TimeToEmpty;
+            //Our own Tug follows it with telemetry
+            if (Header.ExtraLength > 0) {
+                StatusTelemetry_Decode(&RXMessageArray[XBEE_FRAME_EXTRA],
+                        Header.ExtraLength);
             }
+            ES_Event_t NewEvent;
+            NewEvent.EventType = VALID_STATUS_RECEIVED;
+            NewEvent.EventParam = Header.RSSI;
+            PostPilotFSM(NewEvent);
+            //DB_printf("Fuel Level = %d\r\n",FuelLevel);
         }
     }
     
     return;
-}
\ No newline at end of file
+}
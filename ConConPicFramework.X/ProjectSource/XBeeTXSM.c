@@ -25,10 +25,16 @@
 #include "ES_Configure.h"
 #include "ES_Framework.h"
 #include "XBeeTXSM.h"
+#include "XBeeRXSM.h"
 #include "PilotFSM.h"
 #include "ConconSPI.h"
 #include "dbprintf.h"
 #include "terminal.h"
+#include "ES_DeferRecall.h"
+#include "TXStatus.h"
+#include "TugDiscovery.h"
+#include "SlotSchedule.h"
+#include "XBeeBaud.h"
 #include <string.h>
 #include <xc.h>
 #include <sys/attribs.h>
@@ -37,36 +43,28 @@
 
 #define THISXBEE 3
 
-#define MSGFRAME_STARTDELIMITER 1
-#define MSGFRAME_LENGTHMSB 2
-#define MSGFRAME_LENGTHLSB 3
-#define MSGFRAME_APIIDENTIFIER 4
-#define MSGFRAME_FRAMEID 5
-#define MSGFRAME_DESTINATIONADDRESSMSB 6
-#define MSGFRAME_DESTINATIONADDRESSLSB 7
-#define MSGFRAME_OPTIONS 8
-#define MSGFRAME_MESSAGEID 9
-#define MSGFRAME_TUGADDRMSB 10
-#define MSGFRAME_X 10
-#define MSGFRAME_FUELLEVEL 10
-#define MSGFRAME_TUGADDRLSB 11
-#define MSGFRAME_Y 11
-#define MSGFRAME_PILOTADDRMSB 12
-#define MSGFRAME_YAW 12
-#define MSGFRAME_PILOTADDRLSB 13
-#define MSGFRAME_REFUEL 13
-#define MSGFRAME_ACK 14
-#define MSGFRAME_MODE3 14
-#define MSGFRAME_CHECKSUM 15
+#define TX_QUEUE_DEPTH 4 // Power of 2
+#define TX_FRAME_SIZE (XBEE_FRAME_SIZE + SLOTSCHEDULE_EXTRA_SIZE) // Slot byte on control
+#define WAITED_FLAG 0x8000 // EventParam of a request put in the deferral queue
+#define DEFERRAL_QUEUE_SIZE 3 // One per request type, see WaitingTypes
+
+typedef struct
+{
+    uint8_t Length;
+    uint8_t Bytes[TX_FRAME_SIZE];
+}TXFrame_t;
+
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this machine.They should be functions
    relevant to the behavior of this state machine
 */
-static void ConstructNewTXMessage(uint8_t * TXMessage);
+static void QueueNewTXMessage(ES_Event_t ThisEvent);
+static uint8_t ConstructNewTXMessage(uint8_t * TXMessage, uint8_t FrameID);
 static int8_t CalculateX(int32_t, int32_t);
 static int8_t CalculateY(int32_t, int32_t);
 static int8_t CalculateYaw(int32_t, int32_t);
+static uint8_t DeferralBit(ES_EventType_t EventType);
 
 static void TurnOnTXInterrupts(void);
 
@@ -78,7 +76,6 @@ static volatile XBeeTXState_t CurrentState;
 // with the introduction of Gen2, we need a module level Priority var as well
 static uint8_t MyPriority;
 
-static uint8_t TUGAddress;
 static int32_t LeftThrustVal;
 static int32_t RightThrustVal;
 static bool Mode3ToBeActiveOnNextTransmission;
@@ -89,13 +86,23 @@ static const uint16_t PILOTAddresses[8] = {0x218A, 0x2084, 0x2186, 0x2183, 0x208
 
 static uint16_t ThisPILOTAddress;
 
-static uint8_t NewTXMessage[15];
+// Frames waiting to go out. The framework fills slots at TXQueueHead, the
+// ISR sends from TXQueueTail. Both only count up
+static TXFrame_t TXQueue[TX_QUEUE_DEPTH];
+static volatile uint8_t TXQueueHead;
+static volatile uint8_t TXQueueTail;
+
+// Transmit requests made while the queue was full, sent as frames finish
+static ES_Event_t DeferralQueue[DEFERRAL_QUEUE_SIZE + 1];
+static volatile bool TXDeferred;
+static uint8_t WaitingTypes; // DeferralBit of each request in DeferralQueue
+static uint8_t OwedTypes;    // DeferralBit of each type owed a frame
 
 static PilotState_t PilotState;
 
 static XBeeTXMessage_t NewMessageID;
 
-static volatile uint8_t ByteCount;
+static volatile uint8_t ByteCount; // Next byte of the frame at TXQueueTail
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -127,6 +134,12 @@ bool InitXBeeTXSM(uint8_t Priority)
   ThisPILOTAddress = PILOTAddresses[THISXBEE];
   
   ByteCount = 0;
+  TXQueueHead = 0;
+  TXQueueTail = 0;
+  TXDeferred = false;
+  WaitingTypes = 0;
+  OwedTypes = 0;
+  ES_InitDeferralQueueWith(DeferralQueue, DEFERRAL_QUEUE_SIZE + 1);
   
   return true;
 }
@@ -175,79 +188,25 @@ ES_Event_t RunXBeeTXSM(ES_Event_t ThisEvent)
   ES_Event_t ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
   
-  switch (CurrentState)
+  switch (ThisEvent.EventType)
   {
-    case XBeeTXIdleState:        
+    case XBEE_TRANSMIT_MESSAGE:
+    case XBEE_TRANSMIT_SYNC:
+    case XBEE_TX_RETRY:
     {
-      switch (ThisEvent.EventType)
-      {
-        case XBEE_TRANSMIT_MESSAGE:
-        { 
-            //Move into the active state
-            CurrentState = XBeeTXActiveState;
-            
-            //Grab all the relevant parameters for the message
-            //TUG Address
-            TUGAddress = QueryPairingSelectorAddress();
-            //Left Thrust Value
-            LeftThrustVal = QueryLeftThrustVal();
-            //Right Thrust Value
-            RightThrustVal = QueryRightThrustVal();
-            //Mode 3 Setting
-            Mode3ToBeActiveOnNextTransmission = QueryMode3State();
-            //Refuel bit
-            RefuelBitForComms = QueryRefuelBitForComms();
-            //RefuelBitForComms = 0;
-            
-            //MessageID
-            PilotState = QueryPilotFSM();
-            if (PilotState == AttemptingToPair) {
-                NewMessageID = XBee_RequestToPair;
-            }
-            else if (Paired) {
-                NewMessageID = XBee_Control;
-            }
-            
-            ConstructNewTXMessage(NewTXMessage);
-            //Now we have a new message to send
-            
-            //for (uint8_t i=0; i<15; i++) {
-            //    DB_printf("Byte = %x\r\n",NewTXMessage[i]);
-            //}
-            
-            ES_Event_t NewEvent;
-            NewEvent.EventType = TRANSMIT_BYTE;
-            PostXBeeTXSM(NewEvent);
-            
-            ByteCount = 0;
-            TurnOnTXInterrupts();
-            //WriteByteToTX(NewTXMessage[ByteCount]);
-            
-        }
-        break;
-
-        default:
-          ;
-      }
+        //Queue a frame whether or not one is going out now
+        QueueNewTXMessage(ThisEvent);
     }
     break;
 
-    case XBeeTXActiveState:     
+    case XBEE_TX_FRAME_SENT:
     {
-      switch (ThisEvent.EventType)
-      {
-        case TRANSMIT_BYTE:
-        { 
-            //puts("A new transmission is in progress\r\n");
-        }
-        break;
-
-        default:
-          ;
-      }
+        //A slot opened up. ES_RecallEvents puts every request that found
+        //the queue full back at the front of ours, newest first
+        ES_RecallEvents(MyPriority, DeferralQueue);
     }
     break;
-    
+
     default:
       ;
   } 
@@ -276,50 +235,196 @@ XBeeTXState_t QueryXBeeTXSM(void)
   return CurrentState;
 }
 
+/****************************************************************************
+ Function
+     QueryTargetTUGAddress
+
+ Parameters
+     None
+
+ Returns
+     uint16_t, XBee address of the TUG picked by discovery, or if none
+     on the pairing selector
+
+ Description
+     Frames are sent to this address, and only accepted from it
+ Notes
+
+ Author
+     agent
+****************************************************************************/
+uint16_t QueryTargetTUGAddress(void)
+{
+  uint16_t Discovered = TugDiscovery_GetTarget();
+  if (0 != Discovered) {
+      return Discovered;
+  }
+  return TUGAddresses[QueryPairingSelectorAddress()];
+}
+
 /***************************************************************************
  private functions
  ***************************************************************************/
 
-static void ConstructNewTXMessage(uint8_t * TXMessage)
+static void QueueNewTXMessage(ES_Event_t ThisEvent)
 {
-    TXMessage[MSGFRAME_STARTDELIMITER-1]=0x7E;
-    TXMessage[MSGFRAME_LENGTHMSB-1]=0x00;
-    TXMessage[MSGFRAME_LENGTHLSB-1]=0x0B;
-    uint8_t CheckSum = 0;
-    CheckSum += (TXMessage[MSGFRAME_APIIDENTIFIER-1]=0x01);
-    CheckSum += (TXMessage[MSGFRAME_FRAMEID-1]=0x01);
-    //CheckSum += (TXMessage[MSGFRAME_FRAMEID-1]=0x00);
-    CheckSum += (TXMessage[MSGFRAME_DESTINATIONADDRESSMSB-1]=(TUGAddresses[TUGAddress] & 0xFF00) >> 8);
-    //CheckSum += (TXMessage[MSGFRAME_DESTINATIONADDRESSMSB-1]=(0x2119 & 0xFF00) >> 8);
-    CheckSum += (TXMessage[MSGFRAME_DESTINATIONADDRESSLSB-1]=(TUGAddresses[TUGAddress] & 0x00FF));
-    //CheckSum += (TXMessage[MSGFRAME_DESTINATIONADDRESSLSB-1]=(0x2119 & 0x00FF));
-    CheckSum += (TXMessage[MSGFRAME_OPTIONS-1]=0x00);
-    //CheckSum += (TXMessage[MSGFRAME_OPTIONS-1]=0x01);
-    CheckSum += (TXMessage[MSGFRAME_MESSAGEID-1]=NewMessageID);
-    if (NewMessageID == XBee_RequestToPair) {
-        CheckSum += (TXMessage[MSGFRAME_TUGADDRMSB-1]=(TUGAddresses[TUGAddress] & 0xFF00) >> 8);
-        //CheckSum += (TXMessage[MSGFRAME_TUGADDRMSB-1]=(0x2119 & 0xFF00) >> 8);
-        CheckSum += (TXMessage[MSGFRAME_TUGADDRLSB-1]=(TUGAddresses[TUGAddress] & 0x00FF));
-        //CheckSum += (TXMessage[MSGFRAME_TUGADDRLSB-1]=(0x2119 & 0x00FF));
-        CheckSum += (TXMessage[MSGFRAME_PILOTADDRMSB-1]=(ThisPILOTAddress & 0xFF00) >> 8);
-        CheckSum += (TXMessage[MSGFRAME_PILOTADDRLSB-1]=(ThisPILOTAddress & 0x00FF));
-        CheckSum += (TXMessage[MSGFRAME_ACK-1]=0xAA);
-    }
-    else if (NewMessageID == XBee_Control) {
-        CheckSum += (TXMessage[MSGFRAME_X-1]=CalculateX(LeftThrustVal,RightThrustVal));
-        CheckSum += (TXMessage[MSGFRAME_Y-1]=CalculateY(LeftThrustVal,RightThrustVal));
-        CheckSum += (TXMessage[MSGFRAME_YAW-1]=CalculateYaw(LeftThrustVal,RightThrustVal));
-        CheckSum += (TXMessage[MSGFRAME_REFUEL-1]=RefuelBitForComms);
-        CheckSum += (TXMessage[MSGFRAME_MODE3-1]=Mode3ToBeActiveOnNextTransmission);
+    //With the queue full, wait for a frame to finish. Frames are built from
+    //the latest state as they're queued, so one waiting request per type
+    //covers every request of that type made while it waits
+    uint8_t TypeBit = DeferralBit(ThisEvent.EventType);
+    if (ThisEvent.EventParam & WAITED_FLAG) {
+        //Back from the deferral queue
+        ThisEvent.EventParam &= ~WAITED_FLAG;
+        WaitingTypes &= ~TypeBit;
+        if (!(OwedTypes & TypeBit)) {
+            //A newer request of this type was queued while this one waited
+            TXStatus_RequestCoalesced();
+            return;
+        }
     }
     else {
-        puts("Invalid TX Message is Trying to be Sent\r\n");
+        OwedTypes |= TypeBit;
+    }
+    if ((uint8_t) (TXQueueHead - TXQueueTail) >= TX_QUEUE_DEPTH) {
+        if (WaitingTypes & TypeBit) {
+            TXStatus_RequestCoalesced();
+        }
+        else {
+            ES_Event_t WaitingEvent = ThisEvent;
+            WaitingEvent.EventParam |= WAITED_FLAG;
+            if (ES_DeferEvent(DeferralQueue, WaitingEvent)) {
+                WaitingTypes |= TypeBit;
+            }
+            else {
+                OwedTypes &= ~TypeBit;
+                TXStatus_RequestDropped();
+            }
+        }
+        TXDeferred = true;
+        return;
+    }
+    OwedTypes &= ~TypeBit;
+    
+    //Grab all the relevant parameters for the message
+    //Left Thrust Value
+    LeftThrustVal = QueryLeftThrustVal();
+    //Right Thrust Value
+    RightThrustVal = QueryRightThrustVal();
+    //Mode 3 Setting
+    Mode3ToBeActiveOnNextTransmission = QueryMode3State();
+    //Refuel bit
+    RefuelBitForComms = QueryRefuelBitForComms();
+    //RefuelBitForComms = 0;
+    
+    //MessageID
+    PilotState = QueryPilotFSM();
+    if (ThisEvent.EventType == XBEE_TRANSMIT_SYNC) {
+        NewMessageID = XBee_Sync;
+    }
+    else if (PilotState == AttemptingToPair) {
+        NewMessageID = XBee_RequestToPair;
+    }
+    else if (PilotState == DiscoveringTugs) {
+        NewMessageID = XBee_Probe;
+    }
+    else if (PilotState == Paired) {
+        NewMessageID = XBee_Control;
+    }
+    
+    //A retry is only for a request to pair that failed. Drop it if we've
+    //paired since
+    bool IsPairing = (NewMessageID == XBee_RequestToPair);
+    uint8_t Retries = 0;
+    if (ThisEvent.EventType == XBEE_TX_RETRY) {
+        if (!IsPairing) {
+            return;
+        }
+        Retries = ThisEvent.EventParam;
     }
-    TXMessage[MSGFRAME_CHECKSUM-1]=0xFF-CheckSum;
     
+    //Build straight into the free slot, then hand it to the ISR
+    TXFrame_t *ThisFrame = &TXQueue[TXQueueHead & (TX_QUEUE_DEPTH - 1)];
+    ThisFrame->Length = ConstructNewTXMessage(ThisFrame->Bytes,
+            TXStatus_NewFrame(IsPairing, Retries));
+    if (0 == ThisFrame->Length) {
+        return;
+    }
+    
+    //for (uint8_t i=0; i<15; i++) {
+    //    DB_printf("Byte = %x\r\n",ThisFrame->Bytes[i]);
+    //}
+    
+    //Publish the frame before going active, in case the ISR is just
+    //finishing the last one
+    TXQueueHead++;
+    CurrentState = XBeeTXActiveState;
+    TurnOnTXInterrupts();
     return;
 }
 
+static uint8_t ConstructNewTXMessage(uint8_t * TXMessage, uint8_t FrameID)
+{
+    if (NewMessageID == XBee_RequestToPair) {
+        XBeeRequestToPair_t Msg;
+        Msg.TugAddress = QueryTargetTUGAddress();
+        Msg.PilotAddress = ThisPILOTAddress;
+        return XBeeProtocol_PackRequestToPair(TXMessage, FrameID,
+                Msg.TugAddress, &Msg);
+    }
+    else if (NewMessageID == XBee_Probe) {
+        XBeeProbe_t Msg;
+        Msg.PilotAddress = ThisPILOTAddress;
+        TugDiscovery_GetProbe(&Msg);
+        return XBeeProtocol_PackProbe(TXMessage, FrameID,
+                XBEE_BROADCAST_ADDRESS, &Msg);
+    }
+    else if (NewMessageID == XBee_Control) {
+        XBeeControl_t Msg;
+        Msg.X = CalculateX(LeftThrustVal,RightThrustVal);
+        Msg.Y = CalculateY(LeftThrustVal,RightThrustVal);
+        Msg.Yaw = CalculateYaw(LeftThrustVal,RightThrustVal);
+        Msg.Refuel = RefuelBitForComms;
+        Msg.Mode3 = Mode3ToBeActiveOnNextTransmission;
+        uint8_t Length = XBeeProtocol_PackControl(TXMessage, FrameID,
+                QueryTargetTUGAddress(), &Msg);
+        //Times the link round trip at this baud rate
+        XBeeBaud_ControlQueued();
+        //In slotted mode the slot byte tells our Tug to answer right away.
+        //Other teams' Tugs reject the longer frame, so only a Tug that
+        //answered our probe gets it
+        uint8_t Extra[SLOTSCHEDULE_EXTRA_SIZE];
+        uint8_t ExtraLength = SlotSchedule_GetControlExtra(Extra);
+        if ((ExtraLength > 0) && TugDiscovery_IsOurTug(QueryTargetTUGAddress())) {
+            Length = XBeeProtocol_AppendExtra(TXMessage, Extra, ExtraLength);
+        }
+        return Length;
+    }
+    else if (NewMessageID == XBee_Sync) {
+        XBeeSync_t Msg;
+        SlotSchedule_GetSync(&Msg);
+        return XBeeProtocol_PackSync(TXMessage, FrameID,
+                XBEE_BROADCAST_ADDRESS, &Msg);
+    }
+    puts("Invalid TX Message is Trying to be Sent\r\n");
+    return 0;
+}
+
+/*
+ * DeferralBit
+ * Helper for QueueNewTXMessage
+ * One bit per transmit request type, so each type waits at most once
+ */
+static uint8_t DeferralBit(ES_EventType_t EventType)
+{
+    if (EventType == XBEE_TRANSMIT_SYNC) {
+        return 0x02;
+    }
+    else if (EventType == XBEE_TX_RETRY) {
+        return 0x04;
+    }
+    return 0x01; // XBEE_TRANSMIT_MESSAGE
+}
+
 static int8_t CalculateX(int32_t LTV, int32_t RTV)
 {
     return (LTV+RTV)/6;
@@ -337,23 +442,41 @@ static int8_t CalculateYaw(int32_t LTV, int32_t RTV)
 
 static void TurnOnTXInterrupts(void)
 {
-    IEC1bits.U2TXIE = 1; //Enable
+    IEC1SET = _IEC1_U2TXIE_MASK; //Enable, atomic against the ISR
     return;
 }
 
-void __ISR(_UART_2_VECTOR, IPL7SOFT) TXBufferEmptyInterruptHandler(void)
+void __ISR(_UART_2_VECTOR, IPL7SOFT) XBeeUARTInterruptHandler(void)
 {
-    //Put something in the buffer
-    U2TXREG = NewTXMessage[ByteCount];
-    ByteCount++;
-    if (ByteCount < 15) {
-        //Do nothing
+    //RX and TX share the UART2 vector
+    if (IFS1bits.U2RXIF) {
+        DrainRXFIFO();
     }
-    else {
+    if (!(IEC1bits.U2TXIE && IFS1bits.U2TXIF)) {
+        return;
+    }
+    
+    //Fill the FIFO. The next queued frame follows on with no gap
+    while (!U2STAbits.UTXBF && (TXQueueTail != TXQueueHead)) {
+        TXFrame_t *ThisFrame = &TXQueue[TXQueueTail & (TX_QUEUE_DEPTH - 1)];
+        U2TXREG = ThisFrame->Bytes[ByteCount];
+        ByteCount++;
+        if (ByteCount >= ThisFrame->Length) {
+            ByteCount = 0;
+            TXQueueTail++;
+            if (TXDeferred) {
+                TXDeferred = false;
+                ES_Event_t NewEvent;
+                NewEvent.EventType = XBEE_TX_FRAME_SENT;
+                PostXBeeTXSM(NewEvent);
+            }
+        }
+    }
+    
+    if (TXQueueTail == TXQueueHead) {
         //Disable interrupt and move back to the inactive state
-        IEC1bits.U2TXIE = 0; //Disable
+        IEC1CLR = _IEC1_U2TXIE_MASK;
         CurrentState = XBeeTXIdleState;
-        ByteCount = 0;
     }
     //Clear interrupt flag
     IFS1CLR = _IFS1_U2TXIF_MASK;
@@ -0,0 +1,253 @@
+/****************************************************************************
+ * File:   LinkStats.c
+ * Rolling counts of what the XBee link delivers, for the keyboard harness
+ *
+ * Splits lost frames by where they went. Bytes dropped and overruns point
+ * at the ISR or RX buffer, checksum and length errors at the parser or a
+ * resync, unknown sources at another team's radio. Gaps between valid
+ * frames that the radio did deliver, with RSSI, point at the air or at
+ * the sender's scheduling.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "LinkStats.h"
+#include "ES_Timers.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define FIRST_GAP_LIMIT_SHIFT 4 // Bin 0 is under 16 ms
+
+/*---------------------------- Module Variables ---------------------------*/
+static LinkStats_t Stats;
+// Written from the UART2 ISR
+static volatile uint32_t BytesDropped;
+static volatile uint32_t UARTOverruns;
+
+static uint32_t RSSISum;
+static uint16_t LastValidTime;
+static bool GapTiming;  // false until a valid frame starts a gap
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      LinkStats_Clear
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Zeroes every count and starts gap timing over
+****************************************************************************/
+void LinkStats_Clear(void)
+{
+    memset(&Stats, 0, sizeof(Stats));
+    BytesDropped = 0;
+    UARTOverruns = 0;
+    RSSISum = 0;
+    GapTiming = false;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_FrameReceived
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each complete API frame whose checksum checks out
+****************************************************************************/
+void LinkStats_FrameReceived(void)
+{
+    Stats.FramesReceived++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_ChecksumFailed
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each complete API frame whose checksum is wrong
+****************************************************************************/
+void LinkStats_ChecksumFailed(void)
+{
+    Stats.ChecksumFailures++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_LengthError
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when a frame header gives a length the parser can't hold
+****************************************************************************/
+void LinkStats_LengthError(void)
+{
+    Stats.LengthErrors++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_UnknownSource
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each good frame ignored because of who sent it
+****************************************************************************/
+void LinkStats_UnknownSource(void)
+{
+    Stats.UnknownSource++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_ValidFrame
+ *
+ * Parameters
+ *      uint8_t RSSI - RSSI byte of the frame, -dBm
+ * Return
+ *      void
+ * Description
+ *      Call for each frame accepted from our peer. Times the gap since the
+ *      last one and tracks RSSI
+****************************************************************************/
+void LinkStats_ValidFrame(uint8_t RSSI)
+{
+    uint16_t Now = ES_Timer_GetTime();
+    if (GapTiming)
+    {
+        uint16_t Gap = Now - LastValidTime;
+        uint8_t Bin = 0;
+        while ((Bin < (LINKSTATS_GAP_BINS - 1)) &&
+                (Gap >= LinkStats_GetGapBinLimit(Bin)))
+        {
+            Bin++;
+        }
+        Stats.GapCounts[Bin]++;
+        if (Gap > Stats.MaxGapMs)
+        {
+            Stats.MaxGapMs = Gap;
+        }
+    }
+    LastValidTime = Now;
+    GapTiming = true;
+
+    if ((0 == Stats.ValidFrames) || (RSSI < Stats.RSSIMin))
+    {
+        Stats.RSSIMin = RSSI;
+    }
+    if (RSSI > Stats.RSSIMax)
+    {
+        Stats.RSSIMax = RSSI;
+    }
+    RSSISum += RSSI;
+    Stats.ValidFrames++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_ByteDropped
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call from the UART2 ISR for each byte the RX buffer had no room for
+****************************************************************************/
+void LinkStats_ByteDropped(void)
+{
+    BytesDropped++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_UARTOverrun
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call from the UART2 ISR when it clears OERR
+****************************************************************************/
+void LinkStats_UARTOverrun(void)
+{
+    UARTOverruns++;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_PairingEnded
+ *
+ * Parameters
+ *      bool TimedOut - true if the peer went quiet, false if unpaired by hand
+ * Return
+ *      void
+ * Description
+ *      Call when the pairing ends. The next valid frame starts gap timing
+ *      over, so time spent unpaired isn't counted as a gap
+****************************************************************************/
+void LinkStats_PairingEnded(bool TimedOut)
+{
+    if (TimedOut)
+    {
+        Stats.PairingTimeouts++;
+    }
+    GapTiming = false;
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_Get
+ *
+ * Parameters
+ *      LinkStats_t *ThisStats - Filled with the counts since the last clear
+ * Return
+ *      void
+****************************************************************************/
+void LinkStats_Get(LinkStats_t *ThisStats)
+{
+    *ThisStats = Stats;
+    ThisStats->BytesDropped = BytesDropped;
+    ThisStats->UARTOverruns = UARTOverruns;
+    if (Stats.ValidFrames > 0)
+    {
+        ThisStats->RSSIAvg = (RSSISum + (Stats.ValidFrames / 2)) / Stats.ValidFrames;
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      LinkStats_GetGapBinLimit
+ *
+ * Parameters
+ *      uint8_t Bin - Gap histogram bin
+ * Return
+ *      uint16_t, ms the bin's gaps are shorter than. 0 for the last bin,
+ *      which has no limit
+****************************************************************************/
+uint16_t LinkStats_GetGapBinLimit(uint8_t Bin)
+{
+    if (Bin >= (LINKSTATS_GAP_BINS - 1))
+    {
+        return 0;
+    }
+    return 1 << (FIRST_GAP_LIMIT_SHIFT + Bin);
+}
@@ -0,0 +1,179 @@
+/****************************************************************************
+ * File:   LinkStats.h
+ * Rolling counts of what the XBee link delivers, for the keyboard harness
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef LINKSTATS_H
+#define	LINKSTATS_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+// Bin n counts gaps under (16 << n) ms. The last bin takes everything longer
+#define LINKSTATS_GAP_BINS 8
+
+typedef struct
+{
+    uint32_t FramesReceived;    // Any API frame with a good checksum
+    uint32_t ChecksumFailures;
+    uint32_t LengthErrors;      // Too long for the parser, dropped
+    uint32_t UnknownSource;     // From a radio we aren't paired with
+    uint32_t ValidFrames;       // Accepted from our peer
+    uint32_t BytesDropped;      // RX buffer was full
+    uint32_t UARTOverruns;      // UART2 FIFO overflowed before the ISR ran
+    uint32_t PairingTimeouts;
+    uint32_t GapCounts[LINKSTATS_GAP_BINS]; // Between consecutive valid frames
+    uint16_t MaxGapMs;
+    uint8_t RSSIMin;            // -dBm, so this is the strongest seen
+    uint8_t RSSIAvg;
+    uint8_t RSSIMax;            // -dBm, the weakest seen
+}LinkStats_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      LinkStats_Clear
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Zeroes every count and starts gap timing over
+****************************************************************************/
+void LinkStats_Clear(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_FrameReceived
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each complete API frame whose checksum checks out
+****************************************************************************/
+void LinkStats_FrameReceived(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_ChecksumFailed
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each complete API frame whose checksum is wrong
+****************************************************************************/
+void LinkStats_ChecksumFailed(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_LengthError
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when a frame header gives a length the parser can't hold
+****************************************************************************/
+void LinkStats_LengthError(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_UnknownSource
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call for each good frame ignored because of who sent it
+****************************************************************************/
+void LinkStats_UnknownSource(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_ValidFrame
+ *
+ * Parameters
+ *      uint8_t RSSI - RSSI byte of the frame, -dBm
+ * Return
+ *      void
+ * Description
+ *      Call for each frame accepted from our peer. Times the gap since the
+ *      last one and tracks RSSI
+****************************************************************************/
+void LinkStats_ValidFrame(uint8_t RSSI);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_ByteDropped
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call from the UART2 ISR for each byte the RX buffer had no room for
+****************************************************************************/
+void LinkStats_ByteDropped(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_UARTOverrun
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call from the UART2 ISR when it clears OERR
+****************************************************************************/
+void LinkStats_UARTOverrun(void);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_PairingEnded
+ *
+ * Parameters
+ *      bool TimedOut - true if the peer went quiet, false if unpaired by hand
+ * Return
+ *      void
+ * Description
+ *      Call when the pairing ends. The next valid frame starts gap timing
+ *      over, so time spent unpaired isn't counted as a gap
+****************************************************************************/
+void LinkStats_PairingEnded(bool TimedOut);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_Get
+ *
+ * Parameters
+ *      LinkStats_t *ThisStats - Filled with the counts since the last clear
+ * Return
+ *      void
+****************************************************************************/
+void LinkStats_Get(LinkStats_t *ThisStats);
+
+/****************************************************************************
+ * Function
+ *      LinkStats_GetGapBinLimit
+ *
+ * Parameters
+ *      uint8_t Bin - Gap histogram bin
+ * Return
+ *      uint16_t, ms the bin's gaps are shorter than. 0 for the last bin,
+ *      which has no limit
+****************************************************************************/
+uint16_t LinkStats_GetGapBinLimit(uint8_t Bin);
+
+#endif	/* LINKSTATS_H */
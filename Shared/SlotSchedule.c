@@ -0,0 +1,426 @@
+/****************************************************************************
+ * File:   SlotSchedule.c
+ * Optional airtime slots, so many ConCon/Tug pairs share one channel
+ * without their frames colliding
+ *
+ * Time is cut into 200 ms superframes of eight 25 ms slots. A slotted
+ * ConCon sends its control frame once per superframe, at the start of its
+ * own slot, with a slot byte after the message if its Tug answered our
+ * discovery probe. Our Tug sees the byte and answers with status straight
+ * away, so the whole exchange stays inside the slot.
+ *
+ * The slot comes from the Tug's address, so pairs don't have to agree on
+ * anything ahead of time. About once a second each ConCon also broadcasts
+ * a sync in its slot. Other ConCons in slotted mode move their superframe
+ * half way toward it, so every pair's slots line up within a few seconds.
+ * If two pairs end up in one slot, the pair whose Tug address is higher
+ * moves to a slot nobody has announced and the lower one stays.
+ *
+ * Teams without this code keep their own timers. Their frames can still
+ * collide with ours, but ours no longer collide with each other.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "SlotSchedule.h"
+#include "XBeeBaud.h"
+#include "ES_Timers.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define GUARD_MS 2              // Into the slot before sending, for sync error
+#define SYNC_EVERY 5            // Superframes between syncs, about 1 s
+#define HEARD_TIMEOUT_MS 2000   // A slot is free once its sync stops
+#define AIR_MS 3                // Radio time for an exchange, MAC ACKs included
+#define LOOP_MS 1               // Framework event handling at each end
+#define BITS_PER_UART_BYTE 10
+#define SLOT_FLAG 0x80
+#define SLOT_MASK 0x07
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint8_t SlotFromAddress(uint16_t Address);
+static void AdvanceFrame(uint16_t Now);
+static void ExpireHeard(uint16_t Now);
+static void MoveSlot(uint16_t Now);
+static uint16_t UARTMs(uint16_t Bytes);
+static bool FitsSlot(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static bool Enabled;
+static uint8_t Slot;
+static uint16_t SlotTug;
+static bool Moved;
+static uint16_t FrameStart;     // Start of the current superframe, ES time
+static uint8_t SyncCountdown;
+
+static uint16_t HeardTime[SLOTSCHEDULE_NUM_SLOTS];
+static uint8_t HeardSlots;
+
+static bool Following;
+
+static SlotSchedule_Stats_t Stats;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      SlotSchedule_SetEnabled
+ *
+ * Parameters
+ *      bool Enable - true for slotted mode
+ * Return
+ *      bool, false if a slot is too short for a control frame and its
+ *      status at the link's baud. Slotted mode stays off then
+ * Description
+ *      ConCon only. Slotted mode sends control at a fixed 5 Hz, once per
+ *      superframe, and starts a new superframe now
+****************************************************************************/
+bool SlotSchedule_SetEnabled(bool Enable)
+{
+    if (Enable && !FitsSlot())
+    {
+        return false;
+    }
+    if (Enable && !Enabled)
+    {
+        FrameStart = ES_Timer_GetTime();
+        SyncCountdown = 0;
+        HeardSlots = 0;
+        Stats.LastError = 0;
+        Stats.MaxError = 0;
+    }
+    Enabled = Enable;
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_IsEnabled
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true in slotted mode
+****************************************************************************/
+bool SlotSchedule_IsEnabled(void)
+{
+    return Enabled;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_SetTug
+ *
+ * Parameters
+ *      uint16_t TugAddress - Tug we're paired with
+ * Return
+ *      void
+ * Description
+ *      Takes the slot the address gives, unless it's the Tug we already
+ *      have a slot for. Cheap to call before every control frame
+****************************************************************************/
+void SlotSchedule_SetTug(uint16_t TugAddress)
+{
+    if (TugAddress == SlotTug)
+    {
+        return;
+    }
+    SlotTug = TugAddress;
+    Slot = SlotFromAddress(TugAddress);
+    Moved = false;
+    SyncCountdown = 0;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetWait
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, ms until our next slot starts, past the guard time
+ * Description
+ *      Never less than half a slot, so a timer that fires a tick early
+ *      doesn't send twice in one slot
+****************************************************************************/
+uint16_t SlotSchedule_GetWait(void)
+{
+    uint16_t Now = ES_Timer_GetTime();
+    AdvanceFrame(Now);
+    uint16_t Phase = Now - FrameStart;
+    uint16_t Start = (Slot * SLOTSCHEDULE_SLOT_MS) + GUARD_MS;
+    uint16_t Wait = (Start + SLOTSCHEDULE_SUPERFRAME_MS - Phase) % SLOTSCHEDULE_SUPERFRAME_MS;
+    if (Wait < (SLOTSCHEDULE_SLOT_MS / 2))
+    {
+        Wait += SLOTSCHEDULE_SUPERFRAME_MS;
+    }
+    return Wait;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetControlExtra
+ *
+ * Parameters
+ *      uint8_t *Extra - Room for SLOTSCHEDULE_EXTRA_SIZE bytes
+ * Return
+ *      uint8_t, bytes to append to a control frame, 0 unless slotted
+ * Description
+ *      Tells our Tug to answer straight away, inside the slot
+****************************************************************************/
+uint8_t SlotSchedule_GetControlExtra(uint8_t *Extra)
+{
+    if (!Enabled)
+    {
+        return 0;
+    }
+    Extra[0] = SLOT_FLAG | Slot;
+    return SLOTSCHEDULE_EXTRA_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_IsSyncDue
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if this slot should also carry a sync broadcast
+ * Description
+ *      Call once per slot. Due about once a second, and in the next slot
+ *      after enabling or moving
+****************************************************************************/
+bool SlotSchedule_IsSyncDue(void)
+{
+    if (0 == SyncCountdown)
+    {
+        SyncCountdown = SYNC_EVERY - 1;
+        return true;
+    }
+    SyncCountdown--;
+    return false;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetSync
+ *
+ * Parameters
+ *      XBeeSync_t *Sync - Filled with our slot and where we are in it
+ * Return
+ *      void
+****************************************************************************/
+void SlotSchedule_GetSync(XBeeSync_t *Sync)
+{
+    uint16_t Now = ES_Timer_GetTime();
+    AdvanceFrame(Now);
+    uint16_t Phase = Now - FrameStart;
+    uint16_t SlotStart = Slot * SLOTSCHEDULE_SLOT_MS;
+
+    Sync->TugAddress = SlotTug;
+    Sync->Slot = Slot;
+    Sync->Offset = (Phase > SlotStart) ? (uint8_t) (Phase - SlotStart) : 0;
+    Stats.SyncsSent++;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_SyncReceived
+ *
+ * Parameters
+ *      const XBeeSync_t *Sync - Another pair's sync broadcast
+ * Return
+ *      void
+ * Description
+ *      Moves our superframe half way to the other pair's. If the other
+ *      pair is in our slot, we move to a free one when our Tug address is
+ *      the higher of the two
+****************************************************************************/
+void SlotSchedule_SyncReceived(const XBeeSync_t *Sync)
+{
+    uint16_t Now = ES_Timer_GetTime();
+    AdvanceFrame(Now);
+    uint8_t TheirSlot = Sync->Slot & SLOT_MASK;
+    Stats.SyncsHeard++;
+    HeardTime[TheirSlot] = Now;
+    HeardSlots |= (1 << TheirSlot);
+
+    // Their superframe start on our clock. The sync sat behind their
+    // control frame, then crossed both UARTs and the radio
+    uint16_t Latency = UARTMs((2 * XBEE_FRAME_SIZE) + XBEE_FRAME_SIZE + SLOTSCHEDULE_EXTRA_SIZE) +
+            AIR_MS + LOOP_MS;
+    uint16_t TheirStart = Now - Latency - Sync->Offset - (TheirSlot * SLOTSCHEDULE_SLOT_MS);
+    int16_t Error = ((int16_t) (TheirStart - FrameStart)) % SLOTSCHEDULE_SUPERFRAME_MS;
+    if (Error >= (SLOTSCHEDULE_SUPERFRAME_MS / 2))
+    {
+        Error -= SLOTSCHEDULE_SUPERFRAME_MS;
+    }
+    else if (Error < -(SLOTSCHEDULE_SUPERFRAME_MS / 2))
+    {
+        Error += SLOTSCHEDULE_SUPERFRAME_MS;
+    }
+    // Half way, so pairs that hear each other meet in the middle
+    FrameStart += Error / 2;
+    Stats.LastError = Error;
+    uint16_t Size = (Error < 0) ? -Error : Error;
+    if (Size > Stats.MaxError)
+    {
+        Stats.MaxError = Size;
+    }
+
+    // Higher Tug address gives way, the lower one keeps the slot
+    if ((TheirSlot == Slot) && (Sync->TugAddress < SlotTug))
+    {
+        MoveSlot(Now);
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_ControlReceived
+ *
+ * Parameters
+ *      const uint8_t *Extra - Bytes after the control message
+ *      uint8_t Length - How many
+ * Return
+ *      void
+ * Description
+ *      Tug only. Call for each control frame from the paired ConCon
+****************************************************************************/
+void SlotSchedule_ControlReceived(const uint8_t *Extra, uint8_t Length)
+{
+    Following = (Length >= SLOTSCHEDULE_EXTRA_SIZE) && (Extra[0] & SLOT_FLAG);
+    if (Following)
+    {
+        Slot = Extra[0] & SLOT_MASK;
+        Stats.SlottedControls++;
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_IsFollowing
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, Tug only. true if the last control frame was slotted, so
+ *      status should go out now, in the ConCon's slot
+****************************************************************************/
+bool SlotSchedule_IsFollowing(void)
+{
+    return Following;
+}
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetStats
+ *
+ * Parameters
+ *      SlotSchedule_Stats_t *ThisStats - Filled with the slot and counts
+ * Return
+ *      void
+****************************************************************************/
+void SlotSchedule_GetStats(SlotSchedule_Stats_t *ThisStats)
+{
+    ExpireHeard(ES_Timer_GetTime());
+    *ThisStats = Stats;
+    ThisStats->Enabled = Enabled;
+    ThisStats->Slot = Slot;
+    ThisStats->Moved = Moved;
+    ThisStats->HeardSlots = HeardSlots;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * SlotFromAddress
+ * Helper for SlotSchedule_SetTug
+ * The class Tug addresses differ in bits 0-2 and 6-8. Folding those
+ * together gives each of them its own slot
+ */
+static uint8_t SlotFromAddress(uint16_t Address)
+{
+    return (Address ^ (Address >> 6)) & SLOT_MASK;
+}
+
+/*
+ * AdvanceFrame
+ * Helper for the slot timing functions
+ * Keeps FrameStart within a superframe of Now. ES time wraps at 65536 ms,
+ * which isn't a whole number of superframes, so the phase can't just be
+ * taken modulo
+ */
+static void AdvanceFrame(uint16_t Now)
+{
+    while ((int16_t) (Now - FrameStart) < 0)
+    {
+        FrameStart -= SLOTSCHEDULE_SUPERFRAME_MS;
+    }
+    while ((int16_t) (Now - FrameStart) >= SLOTSCHEDULE_SUPERFRAME_MS)
+    {
+        FrameStart += SLOTSCHEDULE_SUPERFRAME_MS;
+    }
+}
+
+/*
+ * ExpireHeard
+ * Helper for MoveSlot and SlotSchedule_GetStats
+ * Forgets slots whose pair hasn't sent a sync lately
+ */
+static void ExpireHeard(uint16_t Now)
+{
+    for (uint8_t i = 0; i < SLOTSCHEDULE_NUM_SLOTS; i++)
+    {
+        if ((uint16_t) (Now - HeardTime[i]) >= HEARD_TIMEOUT_MS)
+        {
+            HeardSlots &= ~(1 << i);
+        }
+    }
+}
+
+/*
+ * MoveSlot
+ * Helper for SlotSchedule_SyncReceived
+ * Takes the lowest slot nobody announced, and announces it next slot.
+ * With all eight taken we stay and share
+ */
+static void MoveSlot(uint16_t Now)
+{
+    ExpireHeard(Now);
+    for (uint8_t i = 0; i < SLOTSCHEDULE_NUM_SLOTS; i++)
+    {
+        if ((i != Slot) && !(HeardSlots & (1 << i)))
+        {
+            Slot = i;
+            Moved = true;
+            Stats.Conflicts++;
+            SyncCountdown = 0;
+            return;
+        }
+    }
+}
+
+/*
+ * UARTMs
+ * Helper for latency and slot length
+ * ms for Bytes through one UART at the link's baud, rounded up
+ */
+static uint16_t UARTMs(uint16_t Bytes)
+{
+    return ((uint32_t) Bytes * BITS_PER_UART_BYTE * 1000) /
+            XBeeBaud_GetBitsPerSecond(XBeeBaud_GetRate()) + 1;
+}
+
+/*
+ * FitsSlot
+ * Helper for SlotSchedule_SetEnabled
+ * Control with its slot byte, then status with the most telemetry, each
+ * through both UARTs, must finish before the slot does
+ */
+static bool FitsSlot(void)
+{
+    uint16_t Bytes = 2 * ((XBEE_FRAME_SIZE + SLOTSCHEDULE_EXTRA_SIZE) + XBEE_MAX_FRAME_SIZE);
+    return (GUARD_MS + UARTMs(Bytes) + AIR_MS + LOOP_MS) <= SLOTSCHEDULE_SLOT_MS;
+}
@@ -0,0 +1,182 @@
+/****************************************************************************
+ * File:   SlotSchedule.h
+ * Optional airtime slots, so many ConCon/Tug pairs share one channel
+ * without their frames colliding
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef SLOTSCHEDULE_H
+#define	SLOTSCHEDULE_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+#include "XBeeProtocol.h"
+
+#define SLOTSCHEDULE_NUM_SLOTS 8
+#define SLOTSCHEDULE_SLOT_MS 25
+#define SLOTSCHEDULE_SUPERFRAME_MS (SLOTSCHEDULE_NUM_SLOTS * SLOTSCHEDULE_SLOT_MS)
+#define SLOTSCHEDULE_EXTRA_SIZE 1   // Slot byte after a slotted control frame
+
+typedef struct
+{
+    bool Enabled;
+    uint8_t Slot;               // Ours, or on the Tug the ConCon's last one
+    bool Moved;                 // Off the slot our Tug's address gives
+    uint8_t HeardSlots;         // Bit per slot another pair announced lately
+    uint16_t SyncsSent;
+    uint16_t SyncsHeard;
+    uint16_t Conflicts;         // Times we gave up our slot to another pair
+    int16_t LastError;          // ms another pair's superframe was from ours
+    uint16_t MaxError;          // Largest since enabled, either sign
+    uint16_t SlottedControls;   // Tug only. Control frames carrying a slot
+}SlotSchedule_Stats_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_SetEnabled
+ *
+ * Parameters
+ *      bool Enable - true for slotted mode
+ * Return
+ *      bool, false if a slot is too short for a control frame and its
+ *      status at the link's baud. Slotted mode stays off then
+ * Description
+ *      ConCon only. Slotted mode sends control at a fixed 5 Hz, once per
+ *      superframe, and starts a new superframe now
+****************************************************************************/
+bool SlotSchedule_SetEnabled(bool Enable);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_IsEnabled
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true in slotted mode
+****************************************************************************/
+bool SlotSchedule_IsEnabled(void);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_SetTug
+ *
+ * Parameters
+ *      uint16_t TugAddress - Tug we're paired with
+ * Return
+ *      void
+ * Description
+ *      Takes the slot the address gives, unless it's the Tug we already
+ *      have a slot for. Cheap to call before every control frame
+****************************************************************************/
+void SlotSchedule_SetTug(uint16_t TugAddress);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetWait
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, ms until our next slot starts, past the guard time
+ * Description
+ *      Never less than half a slot, so a timer that fires a tick early
+ *      doesn't send twice in one slot
+****************************************************************************/
+uint16_t SlotSchedule_GetWait(void);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetControlExtra
+ *
+ * Parameters
+ *      uint8_t *Extra - Room for SLOTSCHEDULE_EXTRA_SIZE bytes
+ * Return
+ *      uint8_t, bytes to append to a control frame, 0 unless slotted
+ * Description
+ *      Tells our Tug to answer straight away, inside the slot
+****************************************************************************/
+uint8_t SlotSchedule_GetControlExtra(uint8_t *Extra);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_IsSyncDue
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if this slot should also carry a sync broadcast
+ * Description
+ *      Call once per slot. Due about once a second, and in the next slot
+ *      after enabling or moving
+****************************************************************************/
+bool SlotSchedule_IsSyncDue(void);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetSync
+ *
+ * Parameters
+ *      XBeeSync_t *Sync - Filled with our slot and where we are in it
+ * Return
+ *      void
+****************************************************************************/
+void SlotSchedule_GetSync(XBeeSync_t *Sync);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_SyncReceived
+ *
+ * Parameters
+ *      const XBeeSync_t *Sync - Another pair's sync broadcast
+ * Return
+ *      void
+ * Description
+ *      Moves our superframe half way to the other pair's. If the other
+ *      pair is in our slot, we move to a free one when our Tug address is
+ *      the higher of the two
+****************************************************************************/
+void SlotSchedule_SyncReceived(const XBeeSync_t *Sync);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_ControlReceived
+ *
+ * Parameters
+ *      const uint8_t *Extra - Bytes after the control message
+ *      uint8_t Length - How many
+ * Return
+ *      void
+ * Description
+ *      Tug only. Call for each control frame from the paired ConCon
+****************************************************************************/
+void SlotSchedule_ControlReceived(const uint8_t *Extra, uint8_t Length);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_IsFollowing
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, Tug only. true if the last control frame was slotted, so
+ *      status should go out now, in the ConCon's slot
+****************************************************************************/
+bool SlotSchedule_IsFollowing(void);
+
+/****************************************************************************
+ * Function
+ *      SlotSchedule_GetStats
+ *
+ * Parameters
+ *      SlotSchedule_Stats_t *ThisStats - Filled with the slot and counts
+ * Return
+ *      void
+****************************************************************************/
+void SlotSchedule_GetStats(SlotSchedule_Stats_t *ThisStats);
+
+#endif	/* SLOTSCHEDULE_H */
@@ -0,0 +1,407 @@
+/****************************************************************************
+ * File:   StatusTelemetry.c
+ * Compact drive and link telemetry carried after the Tug's status message
+ *
+ * The class status message only has room for fuel. When this is on, the
+ * Tug adds a block after it in the same frame, so the extra telemetry
+ * costs a few bytes of airtime and no extra frames. Blocks are made to stay
+ * small:
+ *  - Wheel speeds and duties go every frame as the change since the last
+ *    block, zigzag varint coded, so a steady drive costs a byte each.
+ *  - The slower fields take turns, one slot per frame, sent whole.
+ *  - Every KEYFRAME_INTERVAL blocks, and after a lost status frame, the
+ *    drive fields go whole too. A decoder that missed a block skips the
+ *    drive fields until then, but still takes the slot fields.
+ *
+ *  Block layout
+ *      Header      bits 0-3 sequence, bit 4 keyframe, bits 5-6 slot
+ *      Drive       left RPM, right RPM, left duty, right duty
+ *      Slot 0      fuel trend
+ *      Slot 1      control law load
+ *      Slot 2      valid frames, RX errors
+ *      Slot 3      RSSI
+ *  Signed values are zigzag coded, then every value is a varint of 7 bit
+ *  groups, least significant first, with the top bit set on all but the
+ *  last.
+ *
+ * Off by default. Other teams' ConCons expect the 15 byte class status
+ * frame and reject a longer one, so the Tug only turns this on when it
+ * pairs with a ConCon that probed it first, which only ours do.
+ *
+ * The Tug only encodes and the ConCon only decodes.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "StatusTelemetry.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define KEYFRAME_INTERVAL 8     // Power of 2
+#define NUM_SLOTS 4
+#define NUM_DRIVE_FIELDS 4
+#define SEQUENCE_MASK 0x0F
+#define KEYFRAME_BIT 0x10
+#define SLOT_SHIFT 5
+#define COUNTER_MASK 0x3FFF     // Link counters fit two varint bytes
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint8_t PutVarint(uint8_t *Block, uint8_t Index, uint32_t Value);
+static bool GetVarint(const uint8_t *Block, uint8_t Length, uint8_t *Index,
+        uint32_t *Value);
+static uint32_t ZigZag(int32_t Value);
+static int32_t UnZigZag(uint32_t Value);
+static void GetDriveFields(const StatusTelemetry_t *ThisTelemetry, int16_t *Fields);
+static void SetDriveFields(StatusTelemetry_t *ThisTelemetry, const int16_t *Fields);
+
+/*---------------------------- Module Variables ---------------------------*/
+static bool Enabled; // Only for a ConCon that knows the block is there
+
+// Encoder
+static uint8_t TXSequence;
+static bool KeyframeDue = true;
+static int16_t LastSent[NUM_DRIVE_FIELDS];
+
+// Decoder
+static StatusTelemetry_t Latest;
+static bool HaveReference;  // Drive fields in Latest are up to date
+static uint8_t RXSequence;
+static StatusTelemetry_Stats_t Stats;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_Encode
+ *
+ * Parameters
+ *      const StatusTelemetry_t *Now - Latest values
+ *      uint8_t *Block - Room for STATUSTELEMETRY_MAX_SIZE bytes
+ * Return
+ *      uint8_t, bytes in the block
+ * Description
+ *      Tug side. Call once per status frame sent
+****************************************************************************/
+uint8_t StatusTelemetry_Encode(const StatusTelemetry_t *Now, uint8_t *Block)
+{
+    uint8_t Slot = TXSequence % NUM_SLOTS;
+    bool Keyframe = KeyframeDue || (0 == (TXSequence % KEYFRAME_INTERVAL));
+    KeyframeDue = false;
+
+    Block[0] = (TXSequence & SEQUENCE_MASK) | (Slot << SLOT_SHIFT) |
+            (Keyframe ? KEYFRAME_BIT : 0);
+    uint8_t Index = 1;
+
+    int16_t Fields[NUM_DRIVE_FIELDS];
+    GetDriveFields(Now, Fields);
+    for (uint8_t i = 0; i < NUM_DRIVE_FIELDS; i++)
+    {
+        int32_t Value = Keyframe ? Fields[i] : ((int32_t) Fields[i] - LastSent[i]);
+        Index = PutVarint(Block, Index, ZigZag(Value));
+        LastSent[i] = Fields[i];
+    }
+
+    switch (Slot)
+    {
+        case 0:
+            Index = PutVarint(Block, Index, ZigZag(Now->FuelTrend));
+            break;
+        case 1:
+            Index = PutVarint(Block, Index, Now->LoadPercent);
+            break;
+        case 2:
+            Index = PutVarint(Block, Index, Now->ValidFrames & COUNTER_MASK);
+            Index = PutVarint(Block, Index, Now->RXErrors & COUNTER_MASK);
+            break;
+        default:
+            Index = PutVarint(Block, Index, Now->RSSI);
+            break;
+    }
+
+    TXSequence++;
+    return Index;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_ForceKeyframe
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Makes the next block a keyframe, for when a status frame was lost
+****************************************************************************/
+void StatusTelemetry_ForceKeyframe(void)
+{
+    KeyframeDue = true;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_Decode
+ *
+ * Parameters
+ *      const uint8_t *Block - Bytes after the status message
+ *      uint8_t Length - How many
+ * Return
+ *      bool, true if the drive fields are up to date
+ * Description
+ *      ConCon side. Call for each status frame carrying a block
+****************************************************************************/
+bool StatusTelemetry_Decode(const uint8_t *Block, uint8_t Length)
+{
+    if (0 == Length)
+    {
+        return HaveReference;
+    }
+    uint8_t Sequence = Block[0] & SEQUENCE_MASK;
+    bool Keyframe = (0 != (Block[0] & KEYFRAME_BIT));
+    uint8_t Slot = (Block[0] >> SLOT_SHIFT) % NUM_SLOTS;
+    uint8_t Index = 1;
+
+    // Read everything before changing anything, so a bad block is ignored
+    uint32_t Drive[NUM_DRIVE_FIELDS];
+    uint32_t SlotValues[2] = {0, 0};
+    uint8_t NumSlotValues = (2 == Slot) ? 2 : 1;
+    for (uint8_t i = 0; i < NUM_DRIVE_FIELDS; i++)
+    {
+        if (!GetVarint(Block, Length, &Index, &Drive[i]))
+        {
+            Stats.Malformed++;
+            return HaveReference;
+        }
+    }
+    for (uint8_t i = 0; i < NumSlotValues; i++)
+    {
+        if (!GetVarint(Block, Length, &Index, &SlotValues[i]))
+        {
+            Stats.Malformed++;
+            return HaveReference;
+        }
+    }
+
+    Stats.Blocks++;
+    Stats.Bytes += Length;
+
+    // Drive fields need the block before this one unless they're whole
+    int16_t Fields[NUM_DRIVE_FIELDS];
+    GetDriveFields(&Latest, Fields);
+    if (Keyframe)
+    {
+        Stats.Keyframes++;
+        for (uint8_t i = 0; i < NUM_DRIVE_FIELDS; i++)
+        {
+            Fields[i] = (int16_t) UnZigZag(Drive[i]);
+        }
+        HaveReference = true;
+    }
+    else if (HaveReference && (Sequence == ((RXSequence + 1) & SEQUENCE_MASK)))
+    {
+        for (uint8_t i = 0; i < NUM_DRIVE_FIELDS; i++)
+        {
+            Fields[i] = (int16_t) (Fields[i] + UnZigZag(Drive[i]));
+        }
+    }
+    else
+    {
+        Stats.Gaps++;
+        HaveReference = false;
+    }
+    SetDriveFields(&Latest, Fields);
+    RXSequence = Sequence;
+
+    switch (Slot)
+    {
+        case 0:
+            Latest.FuelTrend = (int8_t) UnZigZag(SlotValues[0]);
+            break;
+        case 1:
+            Latest.LoadPercent = (uint8_t) SlotValues[0];
+            break;
+        case 2:
+            Latest.ValidFrames = (uint16_t) SlotValues[0];
+            Latest.RXErrors = (uint16_t) SlotValues[1];
+            break;
+        default:
+            Latest.RSSI = (uint8_t) SlotValues[0];
+            break;
+    }
+    return HaveReference;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_Reset
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Starts both sides over. The decoder waits for the next keyframe
+****************************************************************************/
+void StatusTelemetry_Reset(void)
+{
+    TXSequence = 0;
+    KeyframeDue = true;
+    memset(LastSent, 0, sizeof(LastSent));
+    memset(&Latest, 0, sizeof(Latest));
+    HaveReference = false;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_GetLatest
+ *
+ * Parameters
+ *      StatusTelemetry_t *ThisTelemetry - Filled with the last values decoded
+ * Return
+ *      bool, true if the drive fields are up to date
+****************************************************************************/
+bool StatusTelemetry_GetLatest(StatusTelemetry_t *ThisTelemetry)
+{
+    *ThisTelemetry = Latest;
+    return HaveReference;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_GetStats
+ *
+ * Parameters
+ *      StatusTelemetry_Stats_t *ThisStats - Filled with the decode counts
+ * Return
+ *      void
+****************************************************************************/
+void StatusTelemetry_GetStats(StatusTelemetry_Stats_t *ThisStats)
+{
+    *ThisStats = Stats;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_SetEnabled
+ *
+ * Parameters
+ *      bool Enable - true for the Tug to add a block to each status frame
+ * Return
+ *      void
+ * Description
+ *      Off at startup. The Tug sets it on pairing, on only if the ConCon
+ *      probed it first, so other teams' ConCons get plain status frames
+****************************************************************************/
+void StatusTelemetry_SetEnabled(bool Enable)
+{
+    if (Enable && !Enabled)
+    {
+        KeyframeDue = true;
+    }
+    Enabled = Enable;
+}
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_IsEnabled
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the Tug adds a block to each status frame
+****************************************************************************/
+bool StatusTelemetry_IsEnabled(void)
+{
+    return Enabled;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * PutVarint
+ * Helper for StatusTelemetry_Encode
+ * Writes Value at Block[Index] and returns the index after it
+ */
+static uint8_t PutVarint(uint8_t *Block, uint8_t Index, uint32_t Value)
+{
+    while (Value >= 0x80)
+    {
+        Block[Index++] = (uint8_t) (Value | 0x80);
+        Value >>= 7;
+    }
+    Block[Index++] = (uint8_t) Value;
+    return Index;
+}
+
+/*
+ * GetVarint
+ * Helper for StatusTelemetry_Decode
+ * Reads a value at Block[*Index] and moves *Index past it. false if it
+ * runs off the end of the block or is longer than any value we send
+ */
+static bool GetVarint(const uint8_t *Block, uint8_t Length, uint8_t *Index,
+        uint32_t *Value)
+{
+    *Value = 0;
+    for (uint8_t Shift = 0; Shift < 21; Shift += 7)
+    {
+        if (*Index >= Length)
+        {
+            return false;
+        }
+        uint8_t Byte = Block[(*Index)++];
+        *Value |= (uint32_t) (Byte & 0x7F) << Shift;
+        if (0 == (Byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * ZigZag
+ * Helper for StatusTelemetry_Encode
+ * Maps 0, -1, 1, -2... to 0, 1, 2, 3... so small changes either way fit
+ * one varint byte
+ */
+static uint32_t ZigZag(int32_t Value)
+{
+    return ((uint32_t) Value << 1) ^ (uint32_t) (Value >> 31);
+}
+
+/*
+ * UnZigZag
+ * Helper for StatusTelemetry_Decode
+ */
+static int32_t UnZigZag(uint32_t Value)
+{
+    return (int32_t) (Value >> 1) ^ -(int32_t) (Value & 1);
+}
+
+/*
+ * GetDriveFields
+ * Helper for StatusTelemetry_Encode and StatusTelemetry_Decode
+ * Drive fields in block order
+ */
+static void GetDriveFields(const StatusTelemetry_t *ThisTelemetry, int16_t *Fields)
+{
+    Fields[0] = ThisTelemetry->LeftRPM;
+    Fields[1] = ThisTelemetry->RightRPM;
+    Fields[2] = ThisTelemetry->LeftDuty;
+    Fields[3] = ThisTelemetry->RightDuty;
+}
+
+/*
+ * SetDriveFields
+ * Helper for StatusTelemetry_Decode
+ */
+static void SetDriveFields(StatusTelemetry_t *ThisTelemetry, const int16_t *Fields)
+{
+    ThisTelemetry->LeftRPM = Fields[0];
+    ThisTelemetry->RightRPM = Fields[1];
+    ThisTelemetry->LeftDuty = Fields[2];
+    ThisTelemetry->RightDuty = Fields[3];
+}
@@ -0,0 +1,144 @@
+/****************************************************************************
+ * File:   StatusTelemetry.h
+ * Compact drive and link telemetry carried after the Tug's status message
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef STATUSTELEMETRY_H
+#define	STATUSTELEMETRY_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+#define STATUSTELEMETRY_MAX_SIZE 20 // Worst case block, a keyframe
+
+typedef struct
+{
+    // Sent every frame
+    int16_t LeftRPM;        // + forward
+    int16_t RightRPM;
+    int16_t LeftDuty;       // Tenths of a percent, + forward
+    int16_t RightDuty;
+    // One of these each frame, in turn
+    int8_t FuelTrend;       // Fuel levels gained over the last 5 s, - burning
+    uint8_t LoadPercent;    // Control law ISR share of the CPU
+    uint16_t ValidFrames;   // Tug's count of our frames, mod 16384
+    uint16_t RXErrors;      // Tug's bad, dropped and overrun counts, mod 16384
+    uint8_t RSSI;           // Tug's average RSSI of our frames, -dBm
+}StatusTelemetry_t;
+
+typedef struct
+{
+    uint32_t Blocks;        // Decoded
+    uint32_t Keyframes;
+    uint32_t Gaps;          // Blocks whose drive fields were skipped after a loss
+    uint32_t Malformed;
+    uint32_t Bytes;         // Total block bytes, for the airtime cost
+}StatusTelemetry_Stats_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_Encode
+ *
+ * Parameters
+ *      const StatusTelemetry_t *Now - Latest values
+ *      uint8_t *Block - Room for STATUSTELEMETRY_MAX_SIZE bytes
+ * Return
+ *      uint8_t, bytes in the block
+ * Description
+ *      Tug side. Call once per status frame sent
+****************************************************************************/
+uint8_t StatusTelemetry_Encode(const StatusTelemetry_t *Now, uint8_t *Block);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_ForceKeyframe
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Makes the next block a keyframe, for when a status frame was lost
+****************************************************************************/
+void StatusTelemetry_ForceKeyframe(void);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_Decode
+ *
+ * Parameters
+ *      const uint8_t *Block - Bytes after the status message
+ *      uint8_t Length - How many
+ * Return
+ *      bool, true if the drive fields are up to date
+ * Description
+ *      ConCon side. Call for each status frame carrying a block
+****************************************************************************/
+bool StatusTelemetry_Decode(const uint8_t *Block, uint8_t Length);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_Reset
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Starts both sides over. The decoder waits for the next keyframe
+****************************************************************************/
+void StatusTelemetry_Reset(void);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_GetLatest
+ *
+ * Parameters
+ *      StatusTelemetry_t *ThisTelemetry - Filled with the last values decoded
+ * Return
+ *      bool, true if the drive fields are up to date
+****************************************************************************/
+bool StatusTelemetry_GetLatest(StatusTelemetry_t *ThisTelemetry);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_GetStats
+ *
+ * Parameters
+ *      StatusTelemetry_Stats_t *ThisStats - Filled with the decode counts
+ * Return
+ *      void
+****************************************************************************/
+void StatusTelemetry_GetStats(StatusTelemetry_Stats_t *ThisStats);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_SetEnabled
+ *
+ * Parameters
+ *      bool Enable - true for the Tug to add a block to each status frame
+ * Return
+ *      void
+ * Description
+ *      Off at startup. The Tug sets it on pairing, on only if the ConCon
+ *      probed it first, so other teams' ConCons get plain status frames
+****************************************************************************/
+void StatusTelemetry_SetEnabled(bool Enable);
+
+/****************************************************************************
+ * Function
+ *      StatusTelemetry_IsEnabled
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the Tug adds a block to each status frame
+****************************************************************************/
+bool StatusTelemetry_IsEnabled(void);
+
+#endif	/* STATUSTELEMETRY_H */
@@ -0,0 +1,288 @@
+/****************************************************************************
+ * File:   TXStatus.c
+ * Gives each XBee frame an ID and matches it to the radio's TX Status
+ *
+ * With a nonzero frame ID the radio answers every TX Request with a TX
+ * Status (0x89) frame once the peer radio has ACKed it, or once its own
+ * MAC retries are used up. Each frame gets the next ID from 1 to 255 and
+ * a slot in a small pending table, so the status can be matched back to
+ * when the frame was queued. The latency measured runs from queueing,
+ * through the UART and the air, to the status arriving.
+ *
+ * The radio doesn't report how many MAC retries a frame took, only whether
+ * they ran out. Our own early resends of pairing frames are counted here.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "TXStatus.h"
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "XBeeTXSM.h"
+#include "StatusTelemetry.h"
+#include <string.h>
+#include <xc.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define CORE_TICKS_PER_US 20
+#define PENDING_FRAMES 8
+#define STATUS_TIMEOUT_US 100000    // Statuses come back in a few ms
+#define MAX_PAIRING_RETRIES 2       // Early resends per pairing frame
+
+// TX Status delivery status byte
+#define TX_STATUS_SUCCESS 0
+#define TX_STATUS_NO_ACK 1
+#define TX_STATUS_CCA_FAILURE 2
+#define TX_STATUS_PURGED 3
+
+typedef struct
+{
+    bool InUse;
+    bool IsPairing;
+    uint8_t FrameID;
+    uint8_t Retries;
+    uint32_t QueuedCount;   // Core timer
+}PendingFrame_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static void ExpirePending(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static PendingFrame_t Pending[PENDING_FRAMES];
+static uint8_t LastFrameID;
+static bool PairingRetry = true;
+
+static TXStatus_Stats_t Stats;
+static uint32_t LatencySumUs;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      TXStatus_NewFrame
+ *
+ * Parameters
+ *      bool IsPairing - true for a pairing frame, which may be retried
+ *      uint8_t Retries - How many times this pairing frame has been resent
+ * Return
+ *      uint8_t, frame ID to send it with. Never 0, which turns off the
+ *      TX Status
+ * Description
+ *      Call as each frame is queued. Starts timing its delivery
+****************************************************************************/
+uint8_t TXStatus_NewFrame(bool IsPairing, uint8_t Retries)
+{
+    ExpirePending();
+
+    // Take a free slot, or give up on the oldest frame
+    uint8_t Slot = 0;
+    for (uint8_t i = 0; i < PENDING_FRAMES; i++)
+    {
+        if (!Pending[i].InUse)
+        {
+            Slot = i;
+            break;
+        }
+        if ((int32_t) (Pending[i].QueuedCount - Pending[Slot].QueuedCount) < 0)
+        {
+            Slot = i;
+        }
+    }
+    if (Pending[Slot].InUse)
+    {
+        Stats.NoResponse++;
+    }
+
+    LastFrameID = (LastFrameID == 0xFF) ? 1 : (LastFrameID + 1);
+
+    Pending[Slot].InUse = true;
+    Pending[Slot].IsPairing = IsPairing;
+    Pending[Slot].FrameID = LastFrameID;
+    Pending[Slot].Retries = Retries;
+    Pending[Slot].QueuedCount = _CP0_GET_COUNT();
+
+    Stats.Sent++;
+    if (Retries > 0)
+    {
+        Stats.PairingRetries++;
+    }
+    return LastFrameID;
+}
+
+/****************************************************************************
+ * Function
+ *      TXStatus_Received
+ *
+ * Parameters
+ *      uint8_t FrameID - Frame ID of the TX Status (0x89) frame
+ *      uint8_t Status - Its delivery status byte
+ * Return
+ *      void
+ * Description
+ *      Call for each TX Status frame. A failed pairing frame with retries
+ *      left posts XBEE_TX_RETRY to XBeeTXSM so it goes again right away
+****************************************************************************/
+void TXStatus_Received(uint8_t FrameID, uint8_t Status)
+{
+    uint8_t Slot;
+    for (Slot = 0; Slot < PENDING_FRAMES; Slot++)
+    {
+        if (Pending[Slot].InUse && (Pending[Slot].FrameID == FrameID))
+        {
+            break;
+        }
+    }
+    if (Slot >= PENDING_FRAMES)
+    {
+        return; // Already given up on
+    }
+    PendingFrame_t *ThisFrame = &Pending[Slot];
+    ThisFrame->InUse = false;
+
+    switch (Status)
+    {
+        case TX_STATUS_SUCCESS:
+        {
+            uint32_t LatencyUs = (_CP0_GET_COUNT() - ThisFrame->QueuedCount) /
+                    CORE_TICKS_PER_US;
+            Stats.Delivered++;
+            LatencySumUs += LatencyUs;
+            if (LatencyUs > Stats.MaxLatencyUs)
+            {
+                Stats.MaxLatencyUs = LatencyUs;
+            }
+            return;
+        }
+        case TX_STATUS_NO_ACK:
+            Stats.NoAck++;
+            break;
+        case TX_STATUS_CCA_FAILURE:
+            Stats.CCAFailures++;
+            break;
+        default:
+            Stats.Purged++;
+            break;
+    }
+
+    // The peer may have missed a status telemetry block, so don't send the
+    // next one as changes from it
+    StatusTelemetry_ForceKeyframe();
+
+    // A pairing frame that didn't get through goes again now, rather than
+    // waiting out the pairing period
+    if (PairingRetry && ThisFrame->IsPairing &&
+            (ThisFrame->Retries < MAX_PAIRING_RETRIES))
+    {
+        ES_Event_t NewEvent;
+        NewEvent.EventType = XBEE_TX_RETRY;
+        NewEvent.EventParam = ThisFrame->Retries + 1;
+        PostXBeeTXSM(NewEvent);
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      TXStatus_SetPairingRetry
+ *
+ * Parameters
+ *      bool Enable - true to resend failed pairing frames early
+ * Return
+ *      void
+****************************************************************************/
+void TXStatus_SetPairingRetry(bool Enable)
+{
+    PairingRetry = Enable;
+}
+
+/****************************************************************************
+ * Function
+ *      TXStatus_IsPairingRetry
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if failed pairing frames are resent early
+****************************************************************************/
+bool TXStatus_IsPairingRetry(void)
+{
+    return PairingRetry;
+}
+
+/****************************************************************************
+ * Function
+ *      TXStatus_RequestCoalesced
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Counts a transmit request folded into one of its type already waiting
+****************************************************************************/
+void TXStatus_RequestCoalesced(void)
+{
+    Stats.Coalesced++;
+}
+
+/****************************************************************************
+ * Function
+ *      TXStatus_RequestDropped
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Counts a transmit request lost to a full deferral queue. XBeeTXSM
+ *      sizes that queue so this stays at 0
+****************************************************************************/
+void TXStatus_RequestDropped(void)
+{
+    Stats.Dropped++;
+}
+
+/****************************************************************************
+ * Function
+ *      TXStatus_GetStats
+ *
+ * Parameters
+ *      TXStatus_Stats_t *ThisStats - Filled with the counts since the last call
+ * Return
+ *      void
+ * Description
+ *      Reads and resets the delivery stats
+****************************************************************************/
+void TXStatus_GetStats(TXStatus_Stats_t *ThisStats)
+{
+    ExpirePending();
+
+    *ThisStats = Stats;
+    ThisStats->AvgLatencyUs = (Stats.Delivered > 0) ?
+        (LatencySumUs / Stats.Delivered) : 0;
+
+    memset(&Stats, 0, sizeof(Stats));
+    LatencySumUs = 0;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * ExpirePending
+ * Helper for TXStatus_NewFrame and TXStatus_GetStats
+ * Frees the slots of frames whose TX Status is overdue
+ */
+static void ExpirePending(void)
+{
+    uint32_t Now = _CP0_GET_COUNT();
+    for (uint8_t i = 0; i < PENDING_FRAMES; i++)
+    {
+        if (Pending[i].InUse &&
+                ((Now - Pending[i].QueuedCount) > (STATUS_TIMEOUT_US * CORE_TICKS_PER_US)))
+        {
+            Pending[i].InUse = false;
+            Stats.NoResponse++;
+        }
+    }
+}
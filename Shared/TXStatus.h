@@ -0,0 +1,123 @@
+/****************************************************************************
+ * File:   TXStatus.h
+ * Gives each XBee frame an ID and matches it to the radio's TX Status
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef TXSTATUS_H
+#define	TXSTATUS_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+typedef struct
+{
+    uint32_t Sent;
+    uint32_t Delivered;     // Peer radio ACKed
+    uint32_t NoAck;         // Radio gave up after its own retries
+    uint32_t CCAFailures;   // Channel never clear
+    uint32_t Purged;
+    uint32_t NoResponse;    // No TX Status came back
+    uint32_t PairingRetries; // Pairing frames resent early on a failure
+    uint32_t AvgLatencyUs;  // Queued to TX Status, delivered frames only
+    uint32_t MaxLatencyUs;
+    uint32_t Coalesced;     // Requests folded into one already waiting
+    uint32_t Dropped;       // Requests that found the deferral queue full
+}TXStatus_Stats_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      TXStatus_NewFrame
+ *
+ * Parameters
+ *      bool IsPairing - true for a pairing frame, which may be retried
+ *      uint8_t Retries - How many times this pairing frame has been resent
+ * Return
+ *      uint8_t, frame ID to send it with. Never 0, which turns off the
+ *      TX Status
+ * Description
+ *      Call as each frame is queued. Starts timing its delivery
+****************************************************************************/
+uint8_t TXStatus_NewFrame(bool IsPairing, uint8_t Retries);
+
+/****************************************************************************
+ * Function
+ *      TXStatus_Received
+ *
+ * Parameters
+ *      uint8_t FrameID - Frame ID of the TX Status (0x89) frame
+ *      uint8_t Status - Its delivery status byte
+ * Return
+ *      void
+ * Description
+ *      Call for each TX Status frame. A failed pairing frame with retries
+ *      left posts XBEE_TX_RETRY to XBeeTXSM so it goes again right away
+****************************************************************************/
+void TXStatus_Received(uint8_t FrameID, uint8_t Status);
+
+/****************************************************************************
+ * Function
+ *      TXStatus_SetPairingRetry
+ *
+ * Parameters
+ *      bool Enable - true to resend failed pairing frames early
+ * Return
+ *      void
+****************************************************************************/
+void TXStatus_SetPairingRetry(bool Enable);
+
+/****************************************************************************
+ * Function
+ *      TXStatus_IsPairingRetry
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if failed pairing frames are resent early
+****************************************************************************/
+bool TXStatus_IsPairingRetry(void);
+
+/****************************************************************************
+ * Function
+ *      TXStatus_RequestCoalesced
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Counts a transmit request folded into one of its type already waiting
+****************************************************************************/
+void TXStatus_RequestCoalesced(void);
+
+/****************************************************************************
+ * Function
+ *      TXStatus_RequestDropped
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Counts a transmit request lost to a full deferral queue
+****************************************************************************/
+void TXStatus_RequestDropped(void);
+
+/****************************************************************************
+ * Function
+ *      TXStatus_GetStats
+ *
+ * Parameters
+ *      TXStatus_Stats_t *ThisStats - Filled with the counts since the last call
+ * Return
+ *      void
+ * Description
+ *      Reads and resets the delivery stats
+****************************************************************************/
+void TXStatus_GetStats(TXStatus_Stats_t *ThisStats);
+
+#endif	/* TXSTATUS_H */
@@ -0,0 +1,553 @@
+/****************************************************************************
+ * File:   XBeeBaud.c
+ * Moves the UART2 link to the XBee off 9600 baud with API AT commands
+ *
+ * A 15 byte frame takes about 16 ms on the wire at 9600, and a control and
+ * status exchange crosses a UART four times. At startup this finds the rate
+ * the radio answers at, sends it ATBD for XBEE_TARGET_BAUD, switches UART2
+ * to match and checks the radio still answers. If it doesn't, the link is
+ * put back to 9600.
+ *
+ * Without XBEE_SAVE_BAUD the new rate is not written to the radio's flash,
+ * so a power cycle brings it back at 9600. A PIC only reset finds it at the
+ * target rate instead, which is why that rate is probed second.
+ *
+ * While this runs it reads UART2 directly with the RX interrupt held off.
+ * Any frame from the other end that arrives meanwhile is dropped.
+ *
+ * It also times the real link, from queueing a control frame to the next
+ * status frame back, at whatever rate the link is at.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "XBeeBaud.h"
+#include "dbprintf.h"
+#include <stdio.h>
+#include <xc.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define XBEE_TARGET_BAUD _Baud_115200
+//#define XBEE_SAVE_BAUD // define to ATWR the new rate into the radio
+
+#define CORE_TICKS_PER_US 20
+#define RESPONSE_TIMEOUT_US 50000 // AT responses come back in a few ms
+#define SETTLE_US 10000 // Radio switching rates after its ATBD response
+
+#define API_START_DELIMITER 0x7E
+#define API_ID_AT_COMMAND 0x08
+#define API_ID_AT_RESPONSE 0x88
+#define AT_STATUS_OK 0
+#define MAX_FRAME_DATA 16 // Longer frames can't be AT responses we sent for
+#define MAX_LINK_TRIP_US 1000000 // Longer means the status was lost
+
+typedef struct
+{
+    uint32_t BitsPerSecond; // The radio's actual rate
+    uint8_t BRGH;
+    uint16_t BRG;       // For the 20 MHz PBCLK
+    uint8_t BDParam;    // ATBD value for the rate
+}BaudSetting_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool FindRadio(void);
+static bool QueryRadio(XBeeBaud_t Rate);
+static void FallBackTo9600(XBeeBaud_t TriedRate);
+static void SetUARTRate(XBeeBaud_t Rate);
+static uint8_t SendATCommand(const char *Command, const uint8_t *Param,
+        uint8_t ParamLength);
+static bool WaitATResponse(uint8_t FrameID, const char *Command,
+        uint32_t StartCount);
+static bool ReadByte(uint8_t *Byte, uint32_t StartCount);
+static void WriteByte(uint8_t Byte);
+static void WaitUs(uint32_t Us);
+static bool PauseRXInterrupt(void);
+static void ResumeRXInterrupt(bool WasEnabled);
+
+/*---------------------------- Module Variables ---------------------------*/
+// Indexed by XBeeBaud_t. BRG matches the radio's rate within 0.3%. At
+// BD=7 the XBee runs at 111111, not 115200, so that entry matches it
+// exactly rather than the nominal rate
+static const BaudSetting_t BaudSettings[NUM_XBEE_BAUDS] = {
+    {9600, 0, 129, 3},      // 9615
+    {57600, 1, 86, 6},      // 57471
+    {111111, 1, 44, 7},     // 111111
+};
+
+// Factory rate first, then where an earlier boot may have left the radio
+static const XBeeBaud_t ProbeOrder[] = {_Baud_9600, XBEE_TARGET_BAUD,
+        _Baud_57600, _Baud_115200};
+
+static XBeeBaud_t CurrentRate = _Baud_9600;
+static uint8_t LastFrameID;
+static uint32_t RoundTripUs[NUM_XBEE_BAUDS];
+static XBeeBaud_LinkTrip_t LinkTrips[NUM_XBEE_BAUDS];
+static uint32_t ControlQueuedCount;
+static bool ControlPending;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      XBeeBaud_Init
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the link ended up at XBEE_TARGET_BAUD
+ * Description
+ *      Finds the rate the radio is at, then moves it and UART2 to
+ *      XBEE_TARGET_BAUD. Call once at startup, after UART2 is configured.
+ *      Blocks for up to a few hundred ms if the radio doesn't answer
+****************************************************************************/
+bool XBeeBaud_Init(void)
+{
+    bool WasEnabled = PauseRXInterrupt();
+    bool Found = FindRadio();
+    ResumeRXInterrupt(WasEnabled);
+
+    if (!Found)
+    {
+        puts("XBeeBaud: No answer from the XBee, staying at 9600\r");
+        return false;
+    }
+    return XBeeBaud_SetRate(XBEE_TARGET_BAUD);
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_SetRate
+ *
+ * Parameters
+ *      XBeeBaud_t NewRate - Rate to move the link to
+ * Return
+ *      bool, true if the radio answered at NewRate
+ * Description
+ *      Sends ATBD, switches UART2 and checks the radio answers at the new
+ *      rate. Falls back to 9600 if it doesn't. Blocks, and reads UART2
+ *      directly, so only call while no frame is being sent
+****************************************************************************/
+bool XBeeBaud_SetRate(XBeeBaud_t NewRate)
+{
+    if (NewRate >= NUM_XBEE_BAUDS)
+    {
+        return false;
+    }
+
+    bool WasEnabled = PauseRXInterrupt();
+    bool Moved = false;
+
+    // The radio answers at the old rate, then switches
+    uint32_t StartCount = _CP0_GET_COUNT();
+    uint8_t FrameID = SendATCommand("BD", &BaudSettings[NewRate].BDParam, 1);
+    if (WaitATResponse(FrameID, "BD", StartCount))
+    {
+        SetUARTRate(NewRate);
+        WaitUs(SETTLE_US);
+        Moved = QueryRadio(NewRate);
+    }
+
+    // A control frame queued before the change says nothing about NewRate
+    ControlPending = false;
+    if (Moved)
+    {
+        CurrentRate = NewRate;
+#ifdef XBEE_SAVE_BAUD
+        StartCount = _CP0_GET_COUNT();
+        FrameID = SendATCommand("WR", 0, 0);
+        WaitATResponse(FrameID, "WR", StartCount);
+#endif
+        DB_printf("XBeeBaud: Link at %u baud\r\n", BaudSettings[NewRate].BitsPerSecond);
+    }
+    else
+    {
+        FallBackTo9600(NewRate);
+        DB_printf("XBeeBaud: No answer at %u baud, back to 9600\r\n",
+                BaudSettings[NewRate].BitsPerSecond);
+    }
+
+    ResumeRXInterrupt(WasEnabled);
+    return Moved;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetRate
+ *
+ * Parameters
+ *      void
+ * Return
+ *      XBeeBaud_t, rate the link is at now
+****************************************************************************/
+XBeeBaud_t XBeeBaud_GetRate(void)
+{
+    return CurrentRate;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetBitsPerSecond
+ *
+ * Parameters
+ *      XBeeBaud_t Rate - Rate to look up
+ * Return
+ *      uint32_t, nominal baud rate
+****************************************************************************/
+uint32_t XBeeBaud_GetBitsPerSecond(XBeeBaud_t Rate)
+{
+    return (Rate < NUM_XBEE_BAUDS) ? BaudSettings[Rate].BitsPerSecond : 0;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetRoundTripUs
+ *
+ * Parameters
+ *      XBeeBaud_t Rate - Rate to look up
+ * Return
+ *      uint32_t, us from the first byte of the last ATBD query sent at Rate
+ *      to the end of its response. 0 if the radio never answered at Rate
+ * Description
+ *      The UART share of a control/status round trip at that rate
+****************************************************************************/
+uint32_t XBeeBaud_GetRoundTripUs(XBeeBaud_t Rate)
+{
+    return (Rate < NUM_XBEE_BAUDS) ? RoundTripUs[Rate] : 0;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_ControlQueued
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Marks a control frame queued to the paired Tug. Starts a link round
+ *      trip, replacing any that hasn't been answered yet
+****************************************************************************/
+void XBeeBaud_ControlQueued(void)
+{
+    ControlQueuedCount = _CP0_GET_COUNT();
+    ControlPending = true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_StatusReceived
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Marks a status frame from the paired Tug. Ends the round trip from
+ *      the last control frame and adds it to the current rate's record
+****************************************************************************/
+void XBeeBaud_StatusReceived(void)
+{
+    if (!ControlPending)
+    {
+        return;
+    }
+    ControlPending = false;
+
+    uint32_t Us = (_CP0_GET_COUNT() - ControlQueuedCount) / CORE_TICKS_PER_US;
+    XBeeBaud_LinkTrip_t *ThisTrip = &LinkTrips[CurrentRate];
+    if ((Us > MAX_LINK_TRIP_US) || (UINT16_MAX == ThisTrip->Count))
+    {
+        return;
+    }
+    if ((0 == ThisTrip->Count) || (Us < ThisTrip->MinUs))
+    {
+        ThisTrip->MinUs = Us;
+    }
+    if (Us > ThisTrip->MaxUs)
+    {
+        ThisTrip->MaxUs = Us;
+    }
+    ThisTrip->SumUs += Us;
+    ThisTrip->Count++;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetLinkRoundTrip
+ *
+ * Parameters
+ *      XBeeBaud_t Rate - Rate to look up
+ *      XBeeBaud_LinkTrip_t *Trip - Filled with that rate's round trips
+ * Return
+ *      void
+ * Description
+ *      Control frame queued to status received, over the whole time the
+ *      link was at Rate. All zero if none were timed at Rate
+****************************************************************************/
+void XBeeBaud_GetLinkRoundTrip(XBeeBaud_t Rate, XBeeBaud_LinkTrip_t *Trip)
+{
+    XBeeBaud_LinkTrip_t None = {0};
+    *Trip = (Rate < NUM_XBEE_BAUDS) ? LinkTrips[Rate] : None;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * FindRadio
+ * Helper for XBeeBaud_Init
+ * Queries the radio at each rate until it answers. Leaves UART2 and
+ * CurrentRate at the rate that worked, or at 9600 if none did
+ */
+static bool FindRadio(void)
+{
+    for (uint8_t i = 0; i < sizeof(ProbeOrder) / sizeof(ProbeOrder[0]); i++)
+    {
+        // The target is already in second place
+        if ((i > 1) && (XBEE_TARGET_BAUD == ProbeOrder[i]))
+        {
+            continue;
+        }
+        if (QueryRadio(ProbeOrder[i]))
+        {
+            CurrentRate = ProbeOrder[i];
+            return true;
+        }
+    }
+    SetUARTRate(_Baud_9600);
+    CurrentRate = _Baud_9600;
+    return false;
+}
+
+/*
+ * QueryRadio
+ * Helper for FindRadio and XBeeBaud_SetRate
+ * Switches UART2 to Rate and sends an ATBD query. Records the round trip
+ * if the radio answers
+ */
+static bool QueryRadio(XBeeBaud_t Rate)
+{
+    SetUARTRate(Rate);
+    uint32_t StartCount = _CP0_GET_COUNT();
+    uint8_t FrameID = SendATCommand("BD", 0, 0);
+    if (!WaitATResponse(FrameID, "BD", StartCount))
+    {
+        return false;
+    }
+    RoundTripUs[Rate] = (_CP0_GET_COUNT() - StartCount) / CORE_TICKS_PER_US;
+    return true;
+}
+
+/*
+ * FallBackTo9600
+ * Helper for XBeeBaud_SetRate
+ * The radio may have switched to TriedRate and gone quiet, or never left
+ * CurrentRate. Asks it back to 9600 at both before settling UART2 there
+ */
+static void FallBackTo9600(XBeeBaud_t TriedRate)
+{
+    if (!QueryRadio(_Baud_9600))
+    {
+        XBeeBaud_t MaybeAt[2] = {TriedRate, CurrentRate};
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            SetUARTRate(MaybeAt[i]);
+            uint32_t StartCount = _CP0_GET_COUNT();
+            uint8_t FrameID = SendATCommand("BD", &BaudSettings[_Baud_9600].BDParam, 1);
+            WaitATResponse(FrameID, "BD", StartCount);
+        }
+        SetUARTRate(_Baud_9600);
+        WaitUs(SETTLE_US);
+        QueryRadio(_Baud_9600);
+    }
+    CurrentRate = _Baud_9600;
+}
+
+/*
+ * SetUARTRate
+ * Helper for the rate changes
+ * Lets the last byte out, then reprograms the baud generator and throws
+ * away anything received at the old rate
+ */
+static void SetUARTRate(XBeeBaud_t Rate)
+{
+    while (!U2STAbits.TRMT)
+    {
+    }
+    U2MODEbits.ON = 0;
+    U2MODEbits.BRGH = BaudSettings[Rate].BRGH;
+    U2BRG = BaudSettings[Rate].BRG;
+    U2MODEbits.ON = 1;
+
+    while (U2STAbits.URXDA)
+    {
+        (void) U2RXREG;
+    }
+    U2STAbits.OERR = 0;
+}
+
+/*
+ * SendATCommand
+ * Helper for the rate changes
+ * Sends a local AT Command API frame. Returns its frame ID, never 0 so the
+ * radio always responds
+ */
+static uint8_t SendATCommand(const char *Command, const uint8_t *Param,
+        uint8_t ParamLength)
+{
+    LastFrameID++;
+    if (0 == LastFrameID)
+    {
+        LastFrameID = 1;
+    }
+
+    uint8_t CheckSum = API_ID_AT_COMMAND + LastFrameID + Command[0] + Command[1];
+    WriteByte(API_START_DELIMITER);
+    WriteByte(0x00);
+    WriteByte(4 + ParamLength);
+    WriteByte(API_ID_AT_COMMAND);
+    WriteByte(LastFrameID);
+    WriteByte(Command[0]);
+    WriteByte(Command[1]);
+    for (uint8_t i = 0; i < ParamLength; i++)
+    {
+        CheckSum += Param[i];
+        WriteByte(Param[i]);
+    }
+    WriteByte(0xFF - CheckSum);
+    return LastFrameID;
+}
+
+/*
+ * WaitATResponse
+ * Helper for the rate changes
+ * Reads frames until the AT Command Response to FrameID arrives, skipping
+ * any others. Returns true if it did within the timeout and reports OK
+ */
+static bool WaitATResponse(uint8_t FrameID, const char *Command,
+        uint32_t StartCount)
+{
+    uint8_t Byte;
+    uint8_t Data[MAX_FRAME_DATA];
+
+    while (ReadByte(&Byte, StartCount))
+    {
+        if (API_START_DELIMITER != Byte)
+        {
+            continue;
+        }
+
+        uint8_t LengthMSB;
+        uint8_t LengthLSB;
+        if (!ReadByte(&LengthMSB, StartCount) || !ReadByte(&LengthLSB, StartCount))
+        {
+            return false;
+        }
+        if ((0 != LengthMSB) || (LengthLSB < 5) || (LengthLSB > MAX_FRAME_DATA))
+        {
+            continue; // Not a response we sent for. Find the next frame
+        }
+
+        uint8_t CheckSum = 0;
+        for (uint8_t i = 0; i < LengthLSB; i++)
+        {
+            if (!ReadByte(&Data[i], StartCount))
+            {
+                return false;
+            }
+            CheckSum += Data[i];
+        }
+        if (!ReadByte(&Byte, StartCount))
+        {
+            return false;
+        }
+        if (0xFF != (uint8_t) (CheckSum + Byte))
+        {
+            continue;
+        }
+
+        if ((API_ID_AT_RESPONSE == Data[0]) && (FrameID == Data[1]) &&
+                (Command[0] == Data[2]) && (Command[1] == Data[3]))
+        {
+            return (AT_STATUS_OK == Data[4]);
+        }
+    }
+    return false;
+}
+
+/*
+ * ReadByte
+ * Helper for WaitATResponse
+ * Waits for the next received byte. False once RESPONSE_TIMEOUT_US has
+ * passed since StartCount
+ */
+static bool ReadByte(uint8_t *Byte, uint32_t StartCount)
+{
+    while (!U2STAbits.URXDA)
+    {
+        if (U2STAbits.OERR)
+        {
+            U2STAbits.OERR = 0;
+        }
+        if ((_CP0_GET_COUNT() - StartCount) > (RESPONSE_TIMEOUT_US * CORE_TICKS_PER_US))
+        {
+            return false;
+        }
+    }
+    *Byte = U2RXREG;
+    return true;
+}
+
+/*
+ * WriteByte
+ * Helper for SendATCommand
+ * Waits for room in the TX FIFO, then queues Byte
+ */
+static void WriteByte(uint8_t Byte)
+{
+    while (U2STAbits.UTXBF)
+    {
+    }
+    U2TXREG = Byte;
+}
+
+/*
+ * WaitUs
+ * Helper for the rate changes
+ * Busy waits on the core timer
+ */
+static void WaitUs(uint32_t Us)
+{
+    uint32_t StartCount = _CP0_GET_COUNT();
+    while ((_CP0_GET_COUNT() - StartCount) < (Us * CORE_TICKS_PER_US))
+    {
+    }
+}
+
+/*
+ * PauseRXInterrupt
+ * Helper for XBeeBaud_Init and XBeeBaud_SetRate
+ * Stops the UART2 RX interrupt taking the radio's responses. Returns
+ * whether it was on
+ */
+static bool PauseRXInterrupt(void)
+{
+    bool WasEnabled = IEC1bits.U2RXIE;
+    IEC1CLR = _IEC1_U2RXIE_MASK;
+    return WasEnabled;
+}
+
+/*
+ * ResumeRXInterrupt
+ * Helper for XBeeBaud_Init and XBeeBaud_SetRate
+ * Turns the UART2 RX interrupt back on if it was before
+ */
+static void ResumeRXInterrupt(bool WasEnabled)
+{
+    IFS1CLR = _IFS1_U2RXIF_MASK;
+    if (WasEnabled)
+    {
+        IEC1SET = _IEC1_U2RXIE_MASK;
+    }
+}
@@ -0,0 +1,141 @@
+/****************************************************************************
+ * File:   XBeeBaud.h
+ * Moves the UART2 link to the XBee off 9600 baud with API AT commands
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef XBEEBAUD_H
+#define	XBEEBAUD_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+// Link rates, in the order they are tried
+typedef enum
+{
+    _Baud_9600, _Baud_57600, _Baud_115200, NUM_XBEE_BAUDS
+}XBeeBaud_t;
+
+// Control frame to status frame round trips at one rate
+typedef struct
+{
+    uint16_t Count;
+    uint32_t MinUs;
+    uint32_t MaxUs;
+    uint32_t SumUs;     // Average is SumUs / Count
+}XBeeBaud_LinkTrip_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_Init
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the link ended up at XBEE_TARGET_BAUD
+ * Description
+ *      Finds the rate the radio is at, then moves it and UART2 to
+ *      XBEE_TARGET_BAUD. Call once at startup, after UART2 is configured.
+ *      Blocks for up to a few hundred ms if the radio doesn't answer
+****************************************************************************/
+bool XBeeBaud_Init(void);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_SetRate
+ *
+ * Parameters
+ *      XBeeBaud_t NewRate - Rate to move the link to
+ * Return
+ *      bool, true if the radio answered at NewRate
+ * Description
+ *      Sends ATBD, switches UART2 and checks the radio answers at the new
+ *      rate. Falls back to 9600 if it doesn't. Blocks, and reads UART2
+ *      directly, so only call while no frame is being sent
+****************************************************************************/
+bool XBeeBaud_SetRate(XBeeBaud_t NewRate);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetRate
+ *
+ * Parameters
+ *      void
+ * Return
+ *      XBeeBaud_t, rate the link is at now
+****************************************************************************/
+XBeeBaud_t XBeeBaud_GetRate(void);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetBitsPerSecond
+ *
+ * Parameters
+ *      XBeeBaud_t Rate - Rate to look up
+ * Return
+ *      uint32_t, the radio's actual baud rate. 111111 for _Baud_115200
+****************************************************************************/
+uint32_t XBeeBaud_GetBitsPerSecond(XBeeBaud_t Rate);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetRoundTripUs
+ *
+ * Parameters
+ *      XBeeBaud_t Rate - Rate to look up
+ * Return
+ *      uint32_t, us from the first byte of the last ATBD query sent at Rate
+ *      to the end of its response. 0 if the radio never answered at Rate
+ * Description
+ *      The UART share of a control/status round trip at that rate
+****************************************************************************/
+uint32_t XBeeBaud_GetRoundTripUs(XBeeBaud_t Rate);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_ControlQueued
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Marks a control frame queued to the paired Tug. Starts a link round
+ *      trip, replacing any that hasn't been answered yet
+****************************************************************************/
+void XBeeBaud_ControlQueued(void);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_StatusReceived
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Marks a status frame from the paired Tug. Ends the round trip from
+ *      the last control frame and adds it to the current rate's record
+****************************************************************************/
+void XBeeBaud_StatusReceived(void);
+
+/****************************************************************************
+ * Function
+ *      XBeeBaud_GetLinkRoundTrip
+ *
+ * Parameters
+ *      XBeeBaud_t Rate - Rate to look up
+ *      XBeeBaud_LinkTrip_t *Trip - Filled with that rate's round trips
+ * Return
+ *      void
+ * Description
+ *      Control frame queued to status received, over the whole time the
+ *      link was at Rate. All zero if none were timed at Rate
+****************************************************************************/
+void XBeeBaud_GetLinkRoundTrip(XBeeBaud_t Rate, XBeeBaud_LinkTrip_t *Trip);
+
+#endif	/* XBEEBAUD_H */
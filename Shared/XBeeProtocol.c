@@ -0,0 +1,550 @@
+/****************************************************************************
+ * File:   XBeeProtocol.c
+ * Class protocol messages over the XBee link
+ *
+ * GENERATED by Tools/gen_xbee_protocol.py from Tools/xbee_protocol.py.
+ * Do not edit by hand.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "XBeeProtocol.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_IsChecksumValid
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole API frame
+ * Return
+ *      bool, true if the API ID through checksum sums to 0xFF
+ * Description
+ *      Uses the frame's own length field, so call only once
+ *      that many bytes are in
+****************************************************************************/
+bool XBeeProtocol_IsChecksumValid(const uint8_t *Frame)
+{
+    uint16_t Length = ((uint16_t) Frame[XBEE_FRAME_LENGTH_MSB] << 8) |
+            Frame[XBEE_FRAME_LENGTH_LSB];
+    uint8_t Sum = 0;
+    for (uint16_t i = 0; i <= Length; i++)
+    {
+        Sum += Frame[XBEE_FRAME_API_ID + i];
+    }
+    return (0xFF == Sum);
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_ParseRX16
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole API frame
+ *      XBeeRX16Header_t *Header - Filled with its addressing
+ * Return
+ *      bool, false if it isn't an RX Packet 16 carrying a message
+ * Description
+ *      Frames may carry up to XBEE_MAX_EXTRA_SIZE bytes after
+ *      the message. Header->ExtraLength says how many
+****************************************************************************/
+bool XBeeProtocol_ParseRX16(const uint8_t *Frame, XBeeRX16Header_t *Header)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_LENGTH_MSB] != 0) ||
+            (Frame[XBEE_FRAME_LENGTH_LSB] < (XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD)) ||
+            (Frame[XBEE_FRAME_LENGTH_LSB] > (XBEE_MAX_FRAME_SIZE - XBEE_FRAME_OVERHEAD)))
+    {
+        return false;
+    }
+    Header->Source = ((uint16_t) Frame[4] << 8) | Frame[5];
+    Header->RSSI = Frame[6];
+    Header->Options = Frame[7];
+    Header->MessageID = Frame[XBEE_FRAME_MESSAGE_ID];
+    Header->ExtraLength = Frame[XBEE_FRAME_LENGTH_LSB] -
+            (XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD);
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_ParseTXStatus
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole API frame
+ *      uint8_t *FrameID, *Status - Filled from the frame
+ * Return
+ *      bool, false if it isn't a TX Status frame
+****************************************************************************/
+bool XBeeProtocol_ParseTXStatus(const uint8_t *Frame, uint8_t *FrameID,
+        uint8_t *Status)
+{
+    if (Frame[XBEE_FRAME_API_ID] != XBEE_API_TX_STATUS)
+    {
+        return false;
+    }
+    *FrameID = Frame[4];
+    *Status = Frame[5];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_AppendExtra
+ *
+ * Parameters
+ *      uint8_t *Frame - Frame just built by a Pack function, with room
+ *                     for XBEE_MAX_FRAME_SIZE bytes
+ *      const uint8_t *Extra - Bytes to send after the message
+ *      uint8_t Length - How many, up to XBEE_MAX_EXTRA_SIZE
+ * Return
+ *      uint8_t, bytes in the frame now
+ * Description
+ *      Fixes up the length and checksum. Only our own boards
+ *      expect extra bytes, so only send them to one
+****************************************************************************/
+uint8_t XBeeProtocol_AppendExtra(uint8_t *Frame, const uint8_t *Extra,
+        uint8_t Length)
+{
+    if (Length > XBEE_MAX_EXTRA_SIZE)
+    {
+        Length = XBEE_MAX_EXTRA_SIZE;
+    }
+    // Carry on from the sum the Pack function left in the checksum
+    uint8_t Sum = 0xFF - Frame[XBEE_FRAME_EXTRA];
+    for (uint8_t i = 0; i < Length; i++)
+    {
+        Sum += (Frame[XBEE_FRAME_EXTRA + i] = Extra[i]);
+    }
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD + Length;
+    Frame[XBEE_FRAME_EXTRA + Length] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE + Length;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackControl
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeControl_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackControl(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeControl_t *Msg)
+{
+    uint8_t Sum = 0x02; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_Control;
+    Sum += (Frame[9] = (uint8_t) Msg->X);
+    Sum += (Frame[10] = (uint8_t) Msg->Y);
+    Sum += (Frame[11] = (uint8_t) Msg->Yaw);
+    Sum += (Frame[12] = (uint8_t) Msg->Refuel);
+    Sum += (Frame[13] = (uint8_t) Msg->Mode3);
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackControl
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeControl_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackControl(const uint8_t *Frame, XBeeControl_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_Control))
+    {
+        return false;
+    }
+    Msg->X = (int8_t) Frame[9];
+    Msg->Y = (int8_t) Frame[10];
+    Msg->Yaw = (int8_t) Frame[11];
+    Msg->Refuel = (uint8_t) Frame[12];
+    Msg->Mode3 = (uint8_t) Frame[13];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackStatus
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeStatus_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackStatus(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeStatus_t *Msg)
+{
+    uint8_t Sum = 0x03; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_Status;
+    Sum += (Frame[9] = (uint8_t) Msg->FuelLevel);
+    Sum += (Frame[10] = Msg->TimeToEmpty >> 8);
+    Sum += (Frame[11] = Msg->TimeToEmpty & 0xFF);
+    Frame[12] = 0;
+    Frame[13] = 0;
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackStatus
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeStatus_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackStatus(const uint8_t *Frame, XBeeStatus_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_Status))
+    {
+        return false;
+    }
+    Msg->FuelLevel = (uint8_t) Frame[9];
+    Msg->TimeToEmpty = ((uint16_t) Frame[10] << 8) | Frame[11];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackRequestToPair
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeRequestToPair_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackRequestToPair(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeRequestToPair_t *Msg)
+{
+    uint8_t Sum = 0xAE; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_RequestToPair;
+    Sum += (Frame[9] = Msg->TugAddress >> 8);
+    Sum += (Frame[10] = Msg->TugAddress & 0xFF);
+    Sum += (Frame[11] = Msg->PilotAddress >> 8);
+    Sum += (Frame[12] = Msg->PilotAddress & 0xFF);
+    Frame[13] = 0xAA; // Ack
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackRequestToPair
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeRequestToPair_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackRequestToPair(const uint8_t *Frame, XBeeRequestToPair_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_RequestToPair))
+    {
+        return false;
+    }
+    Msg->TugAddress = ((uint16_t) Frame[9] << 8) | Frame[10];
+    Msg->PilotAddress = ((uint16_t) Frame[11] << 8) | Frame[12];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackPairingAcknowledged
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeePairingAcknowledged_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackPairingAcknowledged(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeePairingAcknowledged_t *Msg)
+{
+    uint8_t Sum = 0x5A; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_PairingAcknowledged;
+    Sum += (Frame[9] = Msg->TugAddress >> 8);
+    Sum += (Frame[10] = Msg->TugAddress & 0xFF);
+    Sum += (Frame[11] = Msg->PilotAddress >> 8);
+    Sum += (Frame[12] = Msg->PilotAddress & 0xFF);
+    Frame[13] = 0x55; // Ack
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackPairingAcknowledged
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeePairingAcknowledged_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackPairingAcknowledged(const uint8_t *Frame, XBeePairingAcknowledged_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_PairingAcknowledged))
+    {
+        return false;
+    }
+    Msg->TugAddress = ((uint16_t) Frame[9] << 8) | Frame[10];
+    Msg->PilotAddress = ((uint16_t) Frame[11] << 8) | Frame[12];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackProbe
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeProbe_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackProbe(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeProbe_t *Msg)
+{
+    uint8_t Sum = 0x06; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_Probe;
+    Sum += (Frame[9] = Msg->PilotAddress >> 8);
+    Sum += (Frame[10] = Msg->PilotAddress & 0xFF);
+    Sum += (Frame[11] = (uint8_t) Msg->Round);
+    Sum += (Frame[12] = (uint8_t) Msg->Window);
+    Frame[13] = 0;
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackProbe
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeProbe_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackProbe(const uint8_t *Frame, XBeeProbe_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_Probe))
+    {
+        return false;
+    }
+    Msg->PilotAddress = ((uint16_t) Frame[9] << 8) | Frame[10];
+    Msg->Round = (uint8_t) Frame[11];
+    Msg->Window = (uint8_t) Frame[12];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackProbeReply
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeProbeReply_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackProbeReply(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeProbeReply_t *Msg)
+{
+    uint8_t Sum = 0x07; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_ProbeReply;
+    Sum += (Frame[9] = Msg->TugAddress >> 8);
+    Sum += (Frame[10] = Msg->TugAddress & 0xFF);
+    Sum += (Frame[11] = (uint8_t) Msg->Round);
+    Sum += (Frame[12] = (uint8_t) Msg->RSSI);
+    Frame[13] = 0;
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackProbeReply
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeProbeReply_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackProbeReply(const uint8_t *Frame, XBeeProbeReply_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_ProbeReply))
+    {
+        return false;
+    }
+    Msg->TugAddress = ((uint16_t) Frame[9] << 8) | Frame[10];
+    Msg->Round = (uint8_t) Frame[11];
+    Msg->RSSI = (uint8_t) Frame[12];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackSync
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeSync_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackSync(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeSync_t *Msg)
+{
+    uint8_t Sum = 0x08; // API ID, message ID and constants
+    Frame[0] = XBEE_START_DELIMITER;
+    Frame[XBEE_FRAME_LENGTH_MSB] = 0;
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;
+    Sum += (Frame[4] = FrameID);
+    Sum += (Frame[5] = Destination >> 8);
+    Sum += (Frame[6] = Destination & 0xFF);
+    Frame[7] = 0; // Options
+    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_Sync;
+    Sum += (Frame[9] = Msg->TugAddress >> 8);
+    Sum += (Frame[10] = Msg->TugAddress & 0xFF);
+    Sum += (Frame[11] = (uint8_t) Msg->Slot);
+    Sum += (Frame[12] = (uint8_t) Msg->Offset);
+    Frame[13] = 0;
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackSync
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeSync_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackSync(const uint8_t *Frame, XBeeSync_t *Msg)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_Sync))
+    {
+        return false;
+    }
+    Msg->TugAddress = ((uint16_t) Frame[9] << 8) | Frame[10];
+    Msg->Slot = (uint8_t) Frame[11];
+    Msg->Offset = (uint8_t) Frame[12];
+    return true;
+}
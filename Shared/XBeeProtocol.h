@@ -0,0 +1,387 @@
+/****************************************************************************
+ * File:   XBeeProtocol.h
+ * Class protocol messages over the XBee link
+ *
+ * GENERATED by Tools/gen_xbee_protocol.py from Tools/xbee_protocol.py.
+ * Do not edit by hand.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef XBEEPROTOCOL_H
+#define	XBEEPROTOCOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define XBEE_START_DELIMITER 0x7E
+#define XBEE_API_TX16 0x01        // TX Request, 16 bit address
+#define XBEE_API_RX16 0x81        // RX Packet, 16 bit address
+#define XBEE_API_TX_STATUS 0x89
+#define XBEE_BROADCAST_ADDRESS 0xFFFF // Every radio on the channel, no MAC ACK
+
+#define XBEE_PAYLOAD_SIZE 6         // Message ID plus data, in every message
+#define XBEE_FRAME_SIZE 15          // TX16 and RX16 frames carrying a message
+#define XBEE_FRAME_OVERHEAD 4       // Start delimiter, length and checksum
+#define XBEE_MAX_EXTRA_SIZE 20      // Bytes our boards may add after a message
+#define XBEE_MAX_FRAME_SIZE (XBEE_FRAME_SIZE + XBEE_MAX_EXTRA_SIZE)
+
+// 0 based offsets into a whole API frame
+#define XBEE_FRAME_LENGTH_MSB 1
+#define XBEE_FRAME_LENGTH_LSB 2
+#define XBEE_FRAME_API_ID 3
+#define XBEE_FRAME_MESSAGE_ID 8
+#define XBEE_FRAME_EXTRA 14          // Extra bytes, where there are any
+
+typedef enum
+{
+    XBee_Control=1, XBee_Status=2, XBee_RequestToPair=3, XBee_PairingAcknowledged=4, XBee_Probe=5, XBee_ProbeReply=6, XBee_Sync=7
+}XBeeTXMessage_t;
+
+// Control, ConCon to Tug. Thrust request, each pilot period
+typedef struct __attribute__((packed))
+{
+    int8_t X;               // Surge, + forward
+    int8_t Y;               // Sway, unused by our Tug
+    int8_t Yaw;             // + clockwise
+    uint8_t Refuel;         // Nonzero to refuel
+    uint8_t Mode3;          // Nonzero while the mode 3 button is held
+}XBeeControl_t;
+
+// Status, Tug to ConCon. Answer to each control frame
+typedef struct __attribute__((packed))
+{
+    uint8_t FuelLevel;
+    uint16_t TimeToEmpty;   // Tenths of a second, 0xFFFF if not burning
+}XBeeStatus_t;
+
+// RequestToPair, ConCon to Tug. Sent until the Tug acknowledges
+typedef struct __attribute__((packed))
+{
+    uint16_t TugAddress;
+    uint16_t PilotAddress;
+}XBeeRequestToPair_t;
+
+// PairingAcknowledged, Tug to ConCon. Sent until the first control frame
+typedef struct __attribute__((packed))
+{
+    uint16_t TugAddress;
+    uint16_t PilotAddress;
+}XBeePairingAcknowledged_t;
+
+// Probe, ConCon to Tug. Our boards only. Broadcast to find free Tugs
+typedef struct __attribute__((packed))
+{
+    uint16_t PilotAddress;
+    uint8_t Round;          // Discovery round, echoed in replies
+    uint8_t Window;         // ms the Tugs spread their replies over
+}XBeeProbe_t;
+
+// ProbeReply, Tug to ConCon. Our boards only. A free Tug answering a probe
+typedef struct __attribute__((packed))
+{
+    uint16_t TugAddress;
+    uint8_t Round;
+    uint8_t RSSI;           // -dBm the Tug heard the probe at
+}XBeeProbeReply_t;
+
+// Sync, ConCon to ConCon. Our boards only. Broadcast in our airtime slot
+typedef struct __attribute__((packed))
+{
+    uint16_t TugAddress;    // Our Tug, breaks ties when two pairs want one slot
+    uint8_t Slot;
+    uint8_t Offset;         // ms into the slot the frame was built
+}XBeeSync_t;
+
+// Addressing of a received RX Packet 16 frame
+typedef struct
+{
+    uint16_t Source;
+    uint8_t RSSI;               // -dBm
+    uint8_t Options;
+    uint8_t MessageID;
+    uint8_t ExtraLength;        // Bytes after the message, at XBEE_FRAME_EXTRA
+}XBeeRX16Header_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_IsChecksumValid
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole API frame
+ * Return
+ *      bool, true if the API ID through checksum sums to 0xFF
+ * Description
+ *      Uses the frame's own length field, so call only once
+ *      that many bytes are in
+****************************************************************************/
+bool XBeeProtocol_IsChecksumValid(const uint8_t *Frame);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_ParseRX16
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole API frame
+ *      XBeeRX16Header_t *Header - Filled with its addressing
+ * Return
+ *      bool, false if it isn't an RX Packet 16 carrying a message
+ * Description
+ *      Frames may carry up to XBEE_MAX_EXTRA_SIZE bytes after
+ *      the message. Header->ExtraLength says how many
+****************************************************************************/
+bool XBeeProtocol_ParseRX16(const uint8_t *Frame, XBeeRX16Header_t *Header);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_ParseTXStatus
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole API frame
+ *      uint8_t *FrameID, *Status - Filled from the frame
+ * Return
+ *      bool, false if it isn't a TX Status frame
+****************************************************************************/
+bool XBeeProtocol_ParseTXStatus(const uint8_t *Frame, uint8_t *FrameID,
+        uint8_t *Status);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_AppendExtra
+ *
+ * Parameters
+ *      uint8_t *Frame - Frame just built by a Pack function, with room
+ *                     for XBEE_MAX_FRAME_SIZE bytes
+ *      const uint8_t *Extra - Bytes to send after the message
+ *      uint8_t Length - How many, up to XBEE_MAX_EXTRA_SIZE
+ * Return
+ *      uint8_t, bytes in the frame now
+ * Description
+ *      Fixes up the length and checksum. Only our own boards
+ *      expect extra bytes, so only send them to one
+****************************************************************************/
+uint8_t XBeeProtocol_AppendExtra(uint8_t *Frame, const uint8_t *Extra,
+        uint8_t Length);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackControl
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeControl_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackControl(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeControl_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackControl
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeControl_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackControl(const uint8_t *Frame, XBeeControl_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackStatus
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeStatus_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackStatus(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeStatus_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackStatus
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeStatus_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackStatus(const uint8_t *Frame, XBeeStatus_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackRequestToPair
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeRequestToPair_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackRequestToPair(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeRequestToPair_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackRequestToPair
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeRequestToPair_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackRequestToPair(const uint8_t *Frame, XBeeRequestToPair_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackPairingAcknowledged
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeePairingAcknowledged_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackPairingAcknowledged(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeePairingAcknowledged_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackPairingAcknowledged
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeePairingAcknowledged_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackPairingAcknowledged(const uint8_t *Frame, XBeePairingAcknowledged_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackProbe
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeProbe_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackProbe(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeProbe_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackProbe
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeProbe_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackProbe(const uint8_t *Frame, XBeeProbe_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackProbeReply
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeProbeReply_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackProbeReply(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeProbeReply_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackProbeReply
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeProbeReply_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackProbeReply(const uint8_t *Frame, XBeeProbeReply_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_PackSync
+ *
+ * Parameters
+ *      uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes
+ *      uint8_t FrameID - 0 for no TX Status
+ *      uint16_t Destination - Radio to send to
+ *      const XBeeSync_t *Msg - Fields to send
+ * Return
+ *      uint8_t, bytes in the frame
+ * Description
+ *      Builds the whole TX Request frame, checksum included
+****************************************************************************/
+uint8_t XBeeProtocol_PackSync(uint8_t *Frame, uint8_t FrameID, uint16_t Destination,
+        const XBeeSync_t *Msg);
+
+/****************************************************************************
+ * Function
+ *      XBeeProtocol_UnpackSync
+ *
+ * Parameters
+ *      const uint8_t *Frame - Whole RX Packet 16 frame
+ *      XBeeSync_t *Msg - Filled from the frame
+ * Return
+ *      bool, false if the frame holds some other message
+ * Description
+ *      Doesn't check the checksum
+****************************************************************************/
+bool XBeeProtocol_UnpackSync(const uint8_t *Frame, XBeeSync_t *Msg);
+
+#endif	/* XBEEPROTOCOL_H */
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Check the Tug's fixed point thrust mix over every (X, Yaw) input.
+
+Builds Propulsion/ThrustMix.c with the host compiler, runs all 256x256
+int8 inputs through it and compares against:
+  - the mix model in gen_thrust_mix_table.py (what the firmware computed in
+    float before the table). Must agree within 1 Q15 LSB everywhere.
+  - a literal port of XYYawConversionMapping.m. Differences are only
+    allowed on the X = 0 / Yaw = 0 axes, where the .m file's strict > 0
+    tests send points to its 3rd quadrant branch.
+
+Also checks ThrustMixTable.h is what the generator produces now.
+
+    python3 check_thrust_mix.py [--cc gcc]
+
+Exits non zero on any failure.
+
+Author: agent
+"""
+import argparse
+import ctypes
+import os
+import subprocess
+import sys
+import tempfile
+
+import gen_thrust_mix_table as gen
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TUG = os.path.join(HERE, "..", "TugPicFramework.X")
+SOURCE = os.path.join(TUG, "Propulsion", "ThrustMix.c")
+TABLE = os.path.join(TUG, "Propulsion", "ThrustMixTable.h")
+MAX_INPUT = 127
+Q15_FULL = 32767
+
+
+def build(cc, workdir):
+    lib = os.path.join(workdir, "thrustmix.so")
+    subprocess.check_call([cc, "-O2", "-shared", "-fPIC", "-DCOMPILER_IS_C99",
+                           "-I", os.path.join(TUG, "FrameworkHeaders"),
+                           "-I", os.path.join(TUG, "Propulsion"),
+                           SOURCE, "-o", lib])
+    mixlib = ctypes.CDLL(lib)
+    mixlib.ThrustMix_Mix.argtypes = [ctypes.c_int8, ctypes.c_int8,
+                                     ctypes.POINTER(ctypes.c_int16),
+                                     ctypes.POINTER(ctypes.c_int16)]
+    mixlib.ThrustMix_Mix.restype = None
+    return mixlib
+
+
+def to_q15(counts):
+    return counts * Q15_FULL / MAX_INPUT
+
+
+def check_table_fresh():
+    with tempfile.TemporaryFile("w+") as f:
+        stdout, sys.stdout = sys.stdout, f
+        try:
+            gen.main()
+        finally:
+            sys.stdout = stdout
+        f.seek(0)
+        expected = f.read()
+    with open(TABLE) as f:
+        return f.read() == expected
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cc", default="gcc")
+    args = parser.parse_args()
+
+    ok = True
+    if not check_table_fresh():
+        print("FAIL: ThrustMixTable.h is stale. Re-run gen_thrust_mix_table.py")
+        ok = False
+
+    with tempfile.TemporaryDirectory() as workdir:
+        mixlib = build(args.cc, workdir)
+        left = ctypes.c_int16()
+        right = ctypes.c_int16()
+
+        worst = 0.0
+        model_fail = 0
+        m_axis = 0
+        m_off_axis = 0
+        for x_in in range(-128, 128):
+            for yaw_in in range(-128, 128):
+                mixlib.ThrustMix_Mix(x_in, yaw_in, ctypes.byref(left), ctypes.byref(right))
+                fw = (left.value, right.value)
+                x = max(x_in, -MAX_INPUT)
+                y = max(yaw_in, -MAX_INPUT)
+
+                model = [to_q15(v) for v in gen.mix(x, y)]
+                err = max(abs(fw[0] - model[0]), abs(fw[1] - model[1]))
+                worst = max(worst, err)
+                if err > 1.0:
+                    model_fail += 1
+                    if model_fail <= 10:
+                        print("FAIL model X=%d Yaw=%d fw=%s model=%.1f,%.1f"
+                              % (x_in, yaw_in, fw, model[0], model[1]))
+
+                ref = [to_q15(v) for v in gen.mix_reference_m(x, y)]
+                if max(abs(fw[0] - ref[0]), abs(fw[1] - ref[1])) > 1.0:
+                    if x == 0 or y == 0:
+                        m_axis += 1
+                    else:
+                        m_off_axis += 1
+                        if m_off_axis <= 10:
+                            print("FAIL .m X=%d Yaw=%d fw=%s ref=%.1f,%.1f"
+                                  % (x_in, yaw_in, fw, ref[0], ref[1]))
+
+    print("65536 inputs. Worst error vs model: %.3f LSB, %d over 1 LSB" % (worst, model_fail))
+    print("vs XYYawConversionMapping.m: %d differ on the axes (expected), %d off axis"
+          % (m_axis, m_off_axis))
+    ok = ok and model_fail == 0 and m_off_axis == 0
+    print("PASS" if ok else "FAIL")
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
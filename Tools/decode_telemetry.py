@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Decode Tug control law telemetry into CSV.
+
+Reads the raw terminal UART byte stream (from a file, or straight from the
+serial port with --port) and writes one CSV row per control tick. Frame
+layout matches Propulsion/ControlTelemetry.h. Printf text mixed into the
+stream is skipped, and frames with a bad checksum are dropped.
+
+    python3 decode_telemetry.py capture.bin > run.csv
+    python3 decode_telemetry.py --port /dev/ttyUSB0 > run.csv
+
+Author: agent
+"""
+import argparse
+import struct
+import sys
+
+SYNC = b"\xA5\x5A"
+FRAME_LEN = 25
+BODY = struct.Struct("<H hhhhH hhhhH")  # sequence, left wheel, right wheel
+RPM_SCALE = 10.0
+
+HEADER = ["seq", "time_s",
+          "l_target_rpm", "l_rpm", "l_error_rpm", "l_integral", "l_duty",
+          "r_target_rpm", "r_rpm", "r_error_rpm", "r_integral", "r_duty"]
+
+
+def frames(chunks):
+    """Yield decoded frame tuples from an iterable of byte chunks."""
+    buf = bytearray()
+    for chunk in chunks:
+        buf += chunk
+        while True:
+            start = buf.find(SYNC)
+            if start < 0:
+                # keep a trailing 0xA5 in case the sync is split across reads
+                del buf[:max(0, len(buf) - 1)]
+                break
+            if len(buf) - start < FRAME_LEN:
+                del buf[:start]
+                break
+            frame = bytes(buf[start:start + FRAME_LEN])
+            if (sum(frame[2:]) & 0xFF) == 0xFF:
+                yield BODY.unpack(frame[2:-1])
+                del buf[:start + FRAME_LEN]
+            else:
+                # not a frame, just bytes that look like sync. Resync after them
+                del buf[:start + 1]
+
+
+def read_file(path):
+    with open(path, "rb") as f:
+        while True:
+            chunk = f.read(4096)
+            if not chunk:
+                return
+            yield chunk
+
+
+def read_port(port, baud):
+    import serial  # pyserial, only needed for live capture
+    with serial.Serial(port, baud, timeout=0.1) as ser:
+        while True:
+            yield ser.read(4096)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="raw capture file")
+    parser.add_argument("--port", help="serial port to read live")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--tick-ms", type=float, default=5.0,
+                        help="control law period the capture was taken at")
+    args = parser.parse_args()
+    if not args.capture and not args.port:
+        parser.error("give a capture file or --port")
+    tick_s = args.tick_ms / 1000.0
+
+    source = read_port(args.port, args.baud) if args.port else read_file(args.capture)
+    out = sys.stdout
+    out.write(",".join(HEADER) + "\n")
+
+    last_seq = None
+    decoded = 0
+    dropped = 0
+    try:
+        for f in frames(source):
+            seq = f[0]
+            if last_seq is not None:
+                dropped += (seq - last_seq - 1) & 0xFFFF
+            last_seq = seq
+            decoded += 1
+            row = [seq, "%.3f" % (seq * tick_s)]
+            for wheel in (f[1:6], f[6:11]):
+                target, rpm, error, integral, duty = wheel
+                row += ["%.1f" % (target / RPM_SCALE), "%.1f" % (rpm / RPM_SCALE),
+                        "%.1f" % (error / RPM_SCALE), integral, duty]
+            out.write(",".join(str(v) for v in row) + "\n")
+    except KeyboardInterrupt:
+        pass
+    sys.stderr.write("%d frames decoded, %d missing from sequence\n" % (decoded, dropped))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""Decode XBee API frames into class protocol messages.
+
+Reads a raw capture of either side of the radio UART (from a file, or
+straight from a serial port with --port) and prints one line per API
+frame. TX Request 16 and RX Packet 16 frames are decoded with the message
+definitions in xbee_protocol.py, TX Status frames with their delivery
+status. The Tug's telemetry after a status message is decoded the way
+StatusTelemetry.c does it. Bytes outside a frame are skipped, and frames
+with a bad checksum are reported but not decoded.
+
+    python3 decode_xbee.py capture.bin
+    python3 decode_xbee.py --port /dev/ttyUSB0 --baud 111111
+
+Author: agent
+"""
+import argparse
+import struct
+import sys
+
+import xbee_protocol as xp
+
+MAX_FRAME_DATA = 100    # Longer than any 802.15.4 API frame, so a bad length
+
+# StatusTelemetry.c block layout
+TELEMETRY_DRIVE = ["l_rpm", "r_rpm", "l_duty", "r_duty"]
+TELEMETRY_SLOTS = [[("fuel_trend", True)], [("load", False)],
+                   [("valid_frames", False), ("rx_errors", False)],
+                   [("rssi", False)]]
+STATUS_ID = next(m.id for m in xp.MESSAGES if m.name == "Status")
+
+
+class TelemetryDecoder:
+    """Mirror of StatusTelemetry_Decode. Drive fields are changes from the
+    last block unless it's a keyframe, so follow one direction of one link."""
+
+    def __init__(self):
+        self.drive = None
+        self.sequence = None
+
+    @staticmethod
+    def varints(block):
+        values, value, shift = [], 0, 0
+        for byte in block:
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                values.append(value)
+                value, shift = 0, 0
+        return values
+
+    @staticmethod
+    def unzigzag(value):
+        return (value >> 1) ^ -(value & 1)
+
+    def decode(self, block):
+        sequence = block[0] & 0x0F
+        keyframe = bool(block[0] & 0x10)
+        slot = (block[0] >> 5) & 0x03
+        values = self.varints(block[1:])
+        if len(values) != 4 + len(TELEMETRY_SLOTS[slot]):
+            return "telemetry malformed " + block.hex()
+        drive = [self.unzigzag(v) for v in values[:4]]
+        if keyframe:
+            self.drive = drive
+        elif self.drive is not None and sequence == ((self.sequence + 1) & 0x0F):
+            self.drive = [a + b for a, b in zip(self.drive, drive)]
+        else:
+            self.drive = None
+        self.sequence = sequence
+
+        text = ["telemetry%s" % (" key" if keyframe else "")]
+        if self.drive is None:
+            text.append("(waiting for keyframe)")
+        else:
+            text += ["%s=%d" % f for f in zip(TELEMETRY_DRIVE, self.drive)]
+        for (name, signed), v in zip(TELEMETRY_SLOTS[slot], values[4:]):
+            text.append("%s=%d" % (name, self.unzigzag(v) if signed else v))
+        return " ".join(text)
+
+
+def frames(chunks):
+    """Yield (frame data, checksum ok) from an iterable of byte chunks."""
+    buf = bytearray()
+    for chunk in chunks:
+        buf += chunk
+        while True:
+            start = buf.find(xp.START_DELIMITER)
+            if start < 0:
+                del buf[:]
+                break
+            del buf[:start]
+            if len(buf) < 3:
+                break
+            length = (buf[1] << 8) | buf[2]
+            if length == 0 or length > MAX_FRAME_DATA:
+                # not a frame, just a byte that looks like a start delimiter
+                del buf[:1]
+                continue
+            if len(buf) < length + 4:
+                break
+            data = bytes(buf[3:3 + length])
+            ok = xp.checksum(data) == buf[3 + length]
+            yield data, ok
+            del buf[:length + 4]
+
+
+def describe_message(payload):
+    message = xp.BY_ID.get(payload[0]) if payload else None
+    if message is None or len(payload) < xp.PAYLOAD_SIZE:
+        return "unknown message " + payload.hex()
+    values = message.unpack(payload)
+    text = []
+    for f in message.fields:
+        v = values[f.name]
+        if f.type == "const":
+            text.append("%s=0x%02X" % (f.name, v))
+        elif "Address" in f.name:
+            text.append("%s=0x%04X" % (f.name, v))
+        else:
+            text.append("%s=%d" % (f.name, v))
+    return message.name + " " + " ".join(text)
+
+
+def describe_payload(payload, telemetry):
+    text = describe_message(payload)
+    extra = payload[xp.PAYLOAD_SIZE:]
+    if extra and payload[0] == STATUS_ID:
+        text += "  " + telemetry.decode(extra)
+    elif extra:
+        text += "  extra " + extra.hex()
+    return text
+
+
+def describe(data, telemetry):
+    api = data[0]
+    if api == xp.API_TX16 and len(data) >= xp.TX16_HEADER_SIZE:
+        _, frame_id, dest, _ = struct.unpack(">BBHB", data[:xp.TX16_HEADER_SIZE])
+        return "TX  id=%-3d to   0x%04X  %s" % (
+            frame_id, dest, describe_payload(data[xp.TX16_HEADER_SIZE:], telemetry))
+    if api == xp.API_RX16 and len(data) >= xp.RX16_HEADER_SIZE:
+        _, source, rssi, _ = struct.unpack(">BHBB", data[:xp.RX16_HEADER_SIZE])
+        return "RX  from 0x%04X -%-3d dBm  %s" % (
+            source, rssi, describe_payload(data[xp.RX16_HEADER_SIZE:], telemetry))
+    if api == xp.API_TX_STATUS and len(data) >= xp.TX_STATUS_SIZE:
+        return "TXS id=%-3d %s" % (data[1], xp.TX_STATUS_NAMES.get(
+            data[2], "status 0x%02X" % data[2]))
+    return "API 0x%02X %s" % (api, data[1:].hex())
+
+
+def read_file(path):
+    with open(path, "rb") as f:
+        while True:
+            chunk = f.read(4096)
+            if not chunk:
+                return
+            yield chunk
+
+
+def read_port(port, baud):
+    import serial  # pyserial, only needed for live capture
+    with serial.Serial(port, baud, timeout=0.1) as ser:
+        while True:
+            yield ser.read(4096)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="raw capture file")
+    parser.add_argument("--port", help="serial port to read live")
+    parser.add_argument("--baud", type=int, default=111111,
+                        help="XBee link rate. The radio runs BD=7 at 111111")
+    args = parser.parse_args()
+    if not args.capture and not args.port:
+        parser.error("give a capture file or --port")
+
+    source = read_port(args.port, args.baud) if args.port else read_file(args.capture)
+    telemetry = TelemetryDecoder()
+    decoded = 0
+    bad = 0
+    try:
+        for data, ok in frames(source):
+            if ok:
+                decoded += 1
+                print(describe(data, telemetry))
+            else:
+                bad += 1
+                print("bad checksum " + data.hex())
+    except KeyboardInterrupt:
+        pass
+    sys.stderr.write("%d frames decoded, %d bad checksums\n" % (decoded, bad))
+
+
+if __name__ == "__main__":
+    main()
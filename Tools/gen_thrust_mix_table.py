@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Generate the Tug's (X, Yaw) -> (Left, Right) thrust mixing table.
+
+The mix is the quadrant max/sum/difference block of XYYawConversionMapping.m
+at the repo root. It is piecewise linear in X and Yaw, with kinks only on the
+axes and on the |X| = |Yaw| diagonals. Sampling it every 16 counts therefore
+puts every kink on a grid line or a cell diagonal, and splitting each cell
+into two triangles along that diagonal makes interpolation exact. 17x17 nodes
+(578 bytes) replace the full 256x256 map.
+
+Node values are stored in input counts (X + Yaw etc), so they are exact
+integers. ThrustMix.c interpolates them and scales to Q15.
+
+One difference from the .m file: it tests X > 0 and Y > 0 strictly and sends
+points on the axes to its last (3rd quadrant) branch, which makes the map
+jump there. The firmware has always used >= 0, which keeps the map
+continuous, and that is what is generated here. check_thrust_mix.py reports
+the axis points where the two differ.
+
+    python3 gen_thrust_mix_table.py > ../TugPicFramework.X/Propulsion/ThrustMixTable.h
+
+Author: agent
+"""
+import sys
+
+STEP = 16               # input counts between nodes
+MIN_NODE = -128
+NUM_NODES = 17          # -128 .. 128
+
+
+def mix(x, y):
+    """Quadrant mix from XYYawConversionMapping.m, with >= 0 on the axes.
+
+    Inputs and outputs are in the same units, so with x, y in -127..127
+    the outputs are in -127..127 too.
+    """
+    maximum = max(abs(x), abs(y))
+    if x >= 0:
+        if y >= 0:
+            return maximum, x - y       # 1st quadrant
+        return x + y, maximum           # 2nd quadrant
+    if y >= 0:
+        return x + y, -maximum          # 4th quadrant
+    return -maximum, x - y              # 3rd quadrant
+
+
+def mix_reference_m(x, y):
+    """Literal port of the .m branch tests, including strict > 0."""
+    maximum = max(abs(x), abs(y))
+    if x > 0 and y > 0:
+        return maximum, x - y
+    if x > 0 and y < 0:
+        return x + y, maximum
+    if x < 0 and y > 0:
+        return x + y, -maximum
+    return -maximum, x - y
+
+
+def nodes():
+    return [MIN_NODE + STEP * i for i in range(NUM_NODES)]
+
+
+def main():
+    out = sys.stdout
+    out.write("""/****************************************************************************
+ * File:   ThrustMixTable.h
+ * Thrust mixing nodes for ThrustMix.c
+ *
+ * GENERATED by Tools/gen_thrust_mix_table.py. Do not edit by hand.
+ * Indexed [Yaw node][X node][Left/Right]. Nodes every %d counts from %d,
+ * values in input counts.
+ ***************************************************************************/
+
+#ifndef THRUSTMIXTABLE_H
+#define	THRUSTMIXTABLE_H
+
+#define THRUST_MIX_STEP_SHIFT %d // %d counts per cell
+#define THRUST_MIX_MIN_NODE (%d)
+#define THRUST_MIX_NUM_NODES %d
+
+static const int16_t ThrustMixNodes[THRUST_MIX_NUM_NODES][THRUST_MIX_NUM_NODES][2] = {
+""" % (STEP, MIN_NODE, STEP.bit_length() - 1, STEP, MIN_NODE, NUM_NODES))
+    for y in nodes():
+        row = ", ".join("{%d, %d}" % mix(x, y) for x in nodes())
+        out.write("    {%s},\n" % row)
+    out.write("""};
+
+#endif	/* THRUSTMIXTABLE_H */
+""")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,371 @@
+#!/usr/bin/env python3
+"""Generate Shared/XBeeProtocol.h/.c from xbee_protocol.py.
+
+For each message in xbee_protocol.MESSAGES this writes a packed struct of
+its fields, a pack function that builds the whole TX Request 16 frame and
+an unpack function that reads one out of an RX Packet 16 frame. The frame
+layout is worked out here once, so the generated code is straight line
+byte moves. The checksum share of the API ID, message ID and constant
+bytes is folded in at generation time, and only the variable bytes are
+summed at run time. XBeeProtocol_AppendExtra adds bytes after a packed
+message, and XBeeProtocol_ParseRX16 reports how many a frame carries.
+
+Both boards build the one pair in Shared/. Run with no arguments to
+rewrite them, or with --check to exit non zero if either is out of date.
+
+    python3 gen_xbee_protocol.py
+    python3 gen_xbee_protocol.py --check
+
+Author: agent
+"""
+import argparse
+import os
+import sys
+
+import xbee_protocol as xp
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SHARED = os.path.join(HERE, "..", "Shared")
+OUTPUTS = [
+    (os.path.join(SHARED, "XBeeProtocol.h"), "header"),
+    (os.path.join(SHARED, "XBeeProtocol.c"), "source"),
+]
+
+# 0 based offsets into a whole API frame
+API_ID = 3
+PAYLOAD = 3 + xp.TX16_HEADER_SIZE       # same for RX16
+FRAME_SIZE = PAYLOAD + xp.PAYLOAD_SIZE + 1
+assert xp.TX16_HEADER_SIZE == xp.RX16_HEADER_SIZE
+
+BANNER = """/****************************************************************************
+ * File:   {name}
+ * Class protocol messages over the XBee link
+ *
+ * GENERATED by Tools/gen_xbee_protocol.py from Tools/xbee_protocol.py.
+ * Do not edit by hand.
+ *
+ * Shared by the Tug and ConCon projects.
+ *
+ * Author: agent
+ ***************************************************************************/
+"""
+
+
+def doc_block(name, params, ret, desc=None):
+    lines = ["/****************************************************************************",
+             " * Function", " *      " + name, " *", " * Parameters"]
+    lines += [" *      " + p for p in params]
+    lines += [" * Return", " *      " + ret]
+    if desc:
+        lines += [" * Description"] + [" *      " + d for d in desc]
+    lines.append("****************************************************************************/")
+    return "\n".join(lines)
+
+
+def pack_signature(m):
+    return ("uint8_t XBeeProtocol_Pack%s(uint8_t *Frame, uint8_t FrameID, "
+            "uint16_t Destination,\n        const XBee%s_t *Msg)" % (m.name, m.name))
+
+
+def unpack_signature(m):
+    return ("bool XBeeProtocol_Unpack%s(const uint8_t *Frame, XBee%s_t *Msg)"
+            % (m.name, m.name))
+
+
+PROTOTYPES = {
+    "XBeeProtocol_IsChecksumValid":
+        "bool XBeeProtocol_IsChecksumValid(const uint8_t *Frame);\n",
+    "XBeeProtocol_ParseRX16":
+        "bool XBeeProtocol_ParseRX16(const uint8_t *Frame, XBeeRX16Header_t *Header);\n",
+    "XBeeProtocol_ParseTXStatus":
+        "bool XBeeProtocol_ParseTXStatus(const uint8_t *Frame, uint8_t *FrameID,\n"
+        "        uint8_t *Status);\n",
+    "XBeeProtocol_AppendExtra":
+        "uint8_t XBeeProtocol_AppendExtra(uint8_t *Frame, const uint8_t *Extra,\n"
+        "        uint8_t Length);\n",
+}
+
+
+def prototype(name):
+    m = next(m for m in xp.MESSAGES if name.endswith(m.name))
+    return pack_signature(m) if "_Pack" in name else unpack_signature(m)
+
+
+def function_docs():
+    """(name, doc block) for every public function, in file order."""
+    docs = [
+        ("XBeeProtocol_IsChecksumValid", doc_block(
+            "XBeeProtocol_IsChecksumValid",
+            ["const uint8_t *Frame - Whole API frame"],
+            "bool, true if the API ID through checksum sums to 0xFF",
+            ["Uses the frame's own length field, so call only once",
+             "that many bytes are in"])),
+        ("XBeeProtocol_ParseRX16", doc_block(
+            "XBeeProtocol_ParseRX16",
+            ["const uint8_t *Frame - Whole API frame",
+             "XBeeRX16Header_t *Header - Filled with its addressing"],
+            "bool, false if it isn't an RX Packet 16 carrying a message",
+            ["Frames may carry up to XBEE_MAX_EXTRA_SIZE bytes after",
+             "the message. Header->ExtraLength says how many"])),
+        ("XBeeProtocol_ParseTXStatus", doc_block(
+            "XBeeProtocol_ParseTXStatus",
+            ["const uint8_t *Frame - Whole API frame",
+             "uint8_t *FrameID, *Status - Filled from the frame"],
+            "bool, false if it isn't a TX Status frame")),
+        ("XBeeProtocol_AppendExtra", doc_block(
+            "XBeeProtocol_AppendExtra",
+            ["uint8_t *Frame - Frame just built by a Pack function, with room",
+             "               for XBEE_MAX_FRAME_SIZE bytes",
+             "const uint8_t *Extra - Bytes to send after the message",
+             "uint8_t Length - How many, up to XBEE_MAX_EXTRA_SIZE"],
+            "uint8_t, bytes in the frame now",
+            ["Fixes up the length and checksum. Only our own boards",
+             "expect extra bytes, so only send them to one"])),
+    ]
+    for m in xp.MESSAGES:
+        docs.append(("XBeeProtocol_Pack" + m.name, doc_block(
+            "XBeeProtocol_Pack" + m.name,
+            ["uint8_t *Frame - Room for XBEE_FRAME_SIZE bytes",
+             "uint8_t FrameID - 0 for no TX Status",
+             "uint16_t Destination - Radio to send to",
+             "const XBee%s_t *Msg - Fields to send" % m.name],
+            "uint8_t, bytes in the frame",
+            ["Builds the whole TX Request frame, checksum included"])))
+        docs.append(("XBeeProtocol_Unpack" + m.name, doc_block(
+            "XBeeProtocol_Unpack" + m.name,
+            ["const uint8_t *Frame - Whole RX Packet 16 frame",
+             "XBee%s_t *Msg - Filled from the frame" % m.name],
+            "bool, false if the frame holds some other message",
+            ["Doesn't check the checksum"])))
+    return docs
+
+
+def header():
+    out = [BANNER.format(name="XBeeProtocol.h") + """
+#ifndef XBEEPROTOCOL_H
+#define	XBEEPROTOCOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define XBEE_START_DELIMITER 0x%02X
+#define XBEE_API_TX16 0x%02X        // TX Request, 16 bit address
+#define XBEE_API_RX16 0x%02X        // RX Packet, 16 bit address
+#define XBEE_API_TX_STATUS 0x%02X
+#define XBEE_BROADCAST_ADDRESS 0x%04X // Every radio on the channel, no MAC ACK
+
+#define XBEE_PAYLOAD_SIZE %d         // Message ID plus data, in every message
+#define XBEE_FRAME_SIZE %d          // TX16 and RX16 frames carrying a message
+#define XBEE_FRAME_OVERHEAD 4       // Start delimiter, length and checksum
+#define XBEE_MAX_EXTRA_SIZE %d      // Bytes our boards may add after a message
+#define XBEE_MAX_FRAME_SIZE (XBEE_FRAME_SIZE + XBEE_MAX_EXTRA_SIZE)
+
+// 0 based offsets into a whole API frame
+#define XBEE_FRAME_LENGTH_MSB 1
+#define XBEE_FRAME_LENGTH_LSB 2
+#define XBEE_FRAME_API_ID %d
+#define XBEE_FRAME_MESSAGE_ID %d
+#define XBEE_FRAME_EXTRA %d          // Extra bytes, where there are any
+""" % (xp.START_DELIMITER, xp.API_TX16, xp.API_RX16, xp.API_TX_STATUS,
+       xp.BROADCAST_ADDRESS, xp.PAYLOAD_SIZE, FRAME_SIZE, xp.MAX_EXTRA_SIZE, API_ID, PAYLOAD,
+       FRAME_SIZE - 1)]
+
+    out.append("typedef enum\n{\n    " + ", ".join(
+        "XBee_%s=%d" % (m.name, m.id) for m in xp.MESSAGES) + "\n}XBeeTXMessage_t;\n")
+
+    for m in xp.MESSAGES:
+        out.append("// %s, %s to %s. %s" % (
+            m.name, m.sender, m.receiver, m.doc))
+        out.append("typedef struct __attribute__((packed))\n{")
+        for f in m.struct_fields:
+            line = "    %s %s;" % (xp.FIELD_C_TYPES[f.type], f.name)
+            if f.doc:
+                line = line.ljust(28) + "// " + f.doc
+            out.append(line)
+        out.append("}XBee%s_t;\n" % m.name)
+
+    out.append("""// Addressing of a received RX Packet 16 frame
+typedef struct
+{
+    uint16_t Source;
+    uint8_t RSSI;               // -dBm
+    uint8_t Options;
+    uint8_t MessageID;
+    uint8_t ExtraLength;        // Bytes after the message, at XBEE_FRAME_EXTRA
+}XBeeRX16Header_t;
+
+// Public Function Prototypes
+""")
+    for name, block in function_docs():
+        out.append(block)
+        out.append(PROTOTYPES.get(name, "") or prototype(name) + ";\n")
+    out.append("#endif	/* XBEEPROTOCOL_H */\n")
+    return "\n".join(out)
+
+
+def pack_body(m):
+    pos = PAYLOAD + 1
+    const_sum = xp.API_TX16 + m.id
+    lines = []
+    for f in m.fields:
+        if f.type == "const":
+            const_sum += f.value
+            lines.append("    Frame[%d] = 0x%02X; // %s" % (pos, f.value, f.name))
+        elif f.type == "uint16":
+            lines.append("    Sum += (Frame[%d] = Msg->%s >> 8);" % (pos, f.name))
+            lines.append("    Sum += (Frame[%d] = Msg->%s & 0xFF);" % (pos + 1, f.name))
+        else:
+            lines.append("    Sum += (Frame[%d] = (uint8_t) Msg->%s);" % (pos, f.name))
+        pos += f.size
+    while pos < FRAME_SIZE - 1:
+        lines.append("    Frame[%d] = 0;" % pos)
+        pos += 1
+
+    return "\n".join([
+        pack_signature(m), "{",
+        "    uint8_t Sum = 0x%02X; // API ID, message ID and constants" % (const_sum & 0xFF),
+        "    Frame[0] = XBEE_START_DELIMITER;",
+        "    Frame[XBEE_FRAME_LENGTH_MSB] = 0;",
+        "    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD;",
+        "    Frame[XBEE_FRAME_API_ID] = XBEE_API_TX16;",
+        "    Sum += (Frame[%d] = FrameID);" % (API_ID + 1),
+        "    Sum += (Frame[%d] = Destination >> 8);" % (API_ID + 2),
+        "    Sum += (Frame[%d] = Destination & 0xFF);" % (API_ID + 3),
+        "    Frame[%d] = 0; // Options" % (API_ID + 4),
+        "    Frame[XBEE_FRAME_MESSAGE_ID] = XBee_%s;" % m.name,
+    ] + lines + [
+        "    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;",
+        "    return XBEE_FRAME_SIZE;",
+        "}\n"])
+
+
+def unpack_body(m):
+    pos = PAYLOAD + 1
+    lines = []
+    for f in m.fields:
+        if f.type == "uint16":
+            lines.append("    Msg->%s = ((uint16_t) Frame[%d] << 8) | Frame[%d];"
+                         % (f.name, pos, pos + 1))
+        elif f.type != "const":
+            lines.append("    Msg->%s = (%s) Frame[%d];"
+                         % (f.name, xp.FIELD_C_TYPES[f.type], pos))
+        pos += f.size
+    return "\n".join([
+        unpack_signature(m), "{",
+        "    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||",
+        "            (Frame[XBEE_FRAME_MESSAGE_ID] != XBee_%s))" % m.name,
+        "    {",
+        "        return false;",
+        "    }",
+    ] + lines + [
+        "    return true;",
+        "}\n"])
+
+
+def generic_bodies():
+    return {
+        "XBeeProtocol_IsChecksumValid": """bool XBeeProtocol_IsChecksumValid(const uint8_t *Frame)
+{
+    uint16_t Length = ((uint16_t) Frame[XBEE_FRAME_LENGTH_MSB] << 8) |
+            Frame[XBEE_FRAME_LENGTH_LSB];
+    uint8_t Sum = 0;
+    for (uint16_t i = 0; i <= Length; i++)
+    {
+        Sum += Frame[XBEE_FRAME_API_ID + i];
+    }
+    return (0xFF == Sum);
+}
+""",
+        "XBeeProtocol_ParseRX16": """bool XBeeProtocol_ParseRX16(const uint8_t *Frame, XBeeRX16Header_t *Header)
+{
+    if ((Frame[XBEE_FRAME_API_ID] != XBEE_API_RX16) ||
+            (Frame[XBEE_FRAME_LENGTH_MSB] != 0) ||
+            (Frame[XBEE_FRAME_LENGTH_LSB] < (XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD)) ||
+            (Frame[XBEE_FRAME_LENGTH_LSB] > (XBEE_MAX_FRAME_SIZE - XBEE_FRAME_OVERHEAD)))
+    {
+        return false;
+    }
+    Header->Source = ((uint16_t) Frame[%d] << 8) | Frame[%d];
+    Header->RSSI = Frame[%d];
+    Header->Options = Frame[%d];
+    Header->MessageID = Frame[XBEE_FRAME_MESSAGE_ID];
+    Header->ExtraLength = Frame[XBEE_FRAME_LENGTH_LSB] -
+            (XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD);
+    return true;
+}
+""" % (API_ID + 1, API_ID + 2, API_ID + 3, API_ID + 4),
+        "XBeeProtocol_ParseTXStatus": """bool XBeeProtocol_ParseTXStatus(const uint8_t *Frame, uint8_t *FrameID,
+        uint8_t *Status)
+{
+    if (Frame[XBEE_FRAME_API_ID] != XBEE_API_TX_STATUS)
+    {
+        return false;
+    }
+    *FrameID = Frame[%d];
+    *Status = Frame[%d];
+    return true;
+}
+""" % (API_ID + 1, API_ID + 2),
+        "XBeeProtocol_AppendExtra": """uint8_t XBeeProtocol_AppendExtra(uint8_t *Frame, const uint8_t *Extra,
+        uint8_t Length)
+{
+    if (Length > XBEE_MAX_EXTRA_SIZE)
+    {
+        Length = XBEE_MAX_EXTRA_SIZE;
+    }
+    // Carry on from the sum the Pack function left in the checksum
+    uint8_t Sum = 0xFF - Frame[XBEE_FRAME_EXTRA];
+    for (uint8_t i = 0; i < Length; i++)
+    {
+        Sum += (Frame[XBEE_FRAME_EXTRA + i] = Extra[i]);
+    }
+    Frame[XBEE_FRAME_LENGTH_LSB] = XBEE_FRAME_SIZE - XBEE_FRAME_OVERHEAD + Length;
+    Frame[XBEE_FRAME_EXTRA + Length] = 0xFF - Sum;
+    return XBEE_FRAME_SIZE + Length;
+}
+""",
+    }
+
+
+def source():
+    bodies = generic_bodies()
+    for m in xp.MESSAGES:
+        bodies["XBeeProtocol_Pack" + m.name] = pack_body(m)
+        bodies["XBeeProtocol_Unpack" + m.name] = unpack_body(m)
+    out = [BANNER.format(name="XBeeProtocol.c") +
+           "/*----------------------------- Include Files -----------------------------*/\n"
+           '#include "XBeeProtocol.h"\n',
+           "/*------------------------------ Module Code ------------------------------*/"]
+    for name, block in function_docs():
+        out.append(block)
+        out.append(bodies[name])
+    return "\n".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--check", action="store_true",
+                        help="don't write, exit 1 if a file is out of date")
+    args = parser.parse_args()
+
+    text = {"header": header(), "source": source()}
+    stale = []
+    for path, kind in OUTPUTS:
+        try:
+            with open(path) as f:
+                current = f.read()
+        except FileNotFoundError:
+            current = None
+        if current == text[kind]:
+            continue
+        stale.append(os.path.relpath(path))
+        if not args.check:
+            with open(path, "w") as f:
+                f.write(text[kind])
+    for path in stale:
+        print(("out of date: " if args.check else "wrote ") + path)
+    return 1 if (args.check and stale) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
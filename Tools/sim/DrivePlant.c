@@ -0,0 +1,204 @@
+/****************************************************************************
+ * File:   DrivePlant.c
+ * Host model of one drive motor, its gearbox and quadrature encoder
+ *
+ * Encoder position is kept in channel A edges. A changes at every whole
+ * edge count and B half way between, so B leads A going forward
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "DrivePlant.h"
+#include <math.h>
+#include <stddef.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define DEFAULT_TAU_S 0.08
+#define DEFAULT_MAX_RPM 170
+#define DEFAULT_DEADBAND 0.3 // Same as the linearization's default min duty
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool LevelA(double Edges);
+static bool LevelB(double Edges);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      DrivePlant_DefaultParams
+ *
+ * Parameters
+ *      void
+ * Return
+ *      DrivePlant_Params_t, parameters matching the default linearization
+****************************************************************************/
+DrivePlant_Params_t DrivePlant_DefaultParams(void)
+{
+    DrivePlant_Params_t Params;
+    Params.TauS = DEFAULT_TAU_S;
+    Params.MaxRPM = DEFAULT_MAX_RPM;
+    Params.Deadband = DEFAULT_DEADBAND;
+    Params.Load = 0;
+    Params.Gain = 1;
+    Params.Vbat = 1;
+    return Params;
+}
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_Init
+ *
+ * Parameters
+ *      DrivePlant_Motor_t *ThisMotor - Motor to reset
+ *      DrivePlant_Params_t Params - Its parameters
+ * Return
+ *      void
+ * Description
+ *      Stops the motor a quarter edge past encoder position 0
+****************************************************************************/
+void DrivePlant_Init(DrivePlant_Motor_t *ThisMotor, DrivePlant_Params_t Params)
+{
+    ThisMotor->Params = Params;
+    ThisMotor->RPM = 0;
+    // Between edges, so the first small move either way doesn't trip one
+    ThisMotor->Edges = 0.25;
+}
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_Step
+ *
+ * Parameters
+ *      DrivePlant_Motor_t *ThisMotor - Motor to advance
+ *      double Duty - Applied duty, -1 to 1. Negative drives backward
+ *      double StartTime - Simulated time at the start of the step, seconds
+ *      double Dt - Step length in seconds
+ *      DrivePlant_EdgeFn_t OnEdge - Called in order for each encoder edge
+ *      void *Context - Passed to OnEdge
+ * Return
+ *      void
+ * Description
+ *      Integrates the motor over one step and reports the encoder edges
+ *      crossed, with their times interpolated within the step
+****************************************************************************/
+void DrivePlant_Step(DrivePlant_Motor_t *ThisMotor, double Duty,
+        double StartTime, double Dt, DrivePlant_EdgeFn_t OnEdge, void *Context)
+{
+    const DrivePlant_Params_t *P = &ThisMotor->Params;
+    // RPM per unit duty above the deadband
+    double Kv = P->Gain * P->MaxRPM / (1.0 - P->Deadband);
+    double Drive = Kv * Duty * P->Vbat;
+    double Friction = Kv * (P->Deadband + P->Load);
+    double OldRPM = ThisMotor->RPM;
+    double NewRPM;
+
+    if ((0 == OldRPM) && (fabs(Drive) <= Friction))
+    {
+        // Stiction. Not enough drive to break away
+        NewRPM = 0;
+    }
+    else
+    {
+        // Friction opposes motion, or the drive when just breaking away
+        double Direction = (0 != OldRPM) ? OldRPM : Drive;
+        double Net = Drive - OldRPM - copysign(Friction, Direction);
+        NewRPM = OldRPM + (Net * Dt / P->TauS);
+        // Stop at zero rather than step through it. Stiction decides on
+        // the next step whether it breaks away the other way
+        if ((0 != OldRPM) && ((NewRPM > 0) != (OldRPM > 0)))
+        {
+            NewRPM = 0;
+        }
+    }
+    ThisMotor->RPM = NewRPM;
+
+    // Trapezoidal position update, in edges
+    double OldEdges = ThisMotor->Edges;
+    double NewEdges = OldEdges + ((OldRPM + NewRPM) / 2.0 / 60.0 *
+            PLANT_EDGES_PER_REV * Dt);
+    ThisMotor->Edges = NewEdges;
+
+    if (NULL == OnEdge || NewEdges == OldEdges)
+    {
+        return;
+    }
+    // Report every whole edge count crossed, in the order crossed
+    double Span = NewEdges - OldEdges;
+    if (Span > 0)
+    {
+        for (double k = floor(OldEdges) + 1; k <= NewEdges; k++)
+        {
+            double EdgeTime = StartTime + (Dt * (k - OldEdges) / Span);
+            OnEdge(Context, EdgeTime, LevelA(k), LevelB(k));
+        }
+    }
+    else
+    {
+        for (double k = floor(OldEdges); k > NewEdges; k--)
+        {
+            double EdgeTime = StartTime + (Dt * (k - OldEdges) / Span);
+            // Level just below the crossing, where the wheel now is
+            OnEdge(Context, EdgeTime, LevelA(k - 0.5), LevelB(k));
+        }
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_Channels
+ *
+ * Parameters
+ *      const DrivePlant_Motor_t *ThisMotor - Motor to read
+ *      bool *ChA, *ChB - Current encoder channel levels
+ * Return
+ *      void
+ * Description
+ *      Forward motion gives B low on a rising A edge and high on a falling
+ *      one, which the encoder ISRs read as _Forward_Dir
+****************************************************************************/
+void DrivePlant_Channels(const DrivePlant_Motor_t *ThisMotor, bool *ChA, bool *ChB)
+{
+    *ChA = LevelA(ThisMotor->Edges);
+    *ChB = LevelB(ThisMotor->Edges);
+}
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_SteadyRPM
+ *
+ * Parameters
+ *      const DrivePlant_Params_t *Params - Motor parameters
+ *      double Duty - Applied duty, 0 to 1
+ * Return
+ *      double, speed the motor settles at, what a characterization sweep
+ *      of this motor would measure
+****************************************************************************/
+double DrivePlant_SteadyRPM(const DrivePlant_Params_t *Params, double Duty)
+{
+    // Drive minus friction, as in DrivePlant_Step with dRPM/dt = 0
+    double Kv = Params->Gain * Params->MaxRPM / (1.0 - Params->Deadband);
+    double RPM = Kv * ((Duty * Params->Vbat) - Params->Deadband - Params->Load);
+    return (RPM > 0) ? RPM : 0;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * LevelA
+ * Helper for DrivePlant_Step
+ * A changes at every whole edge count, high after an odd one
+ */
+static bool LevelA(double Edges)
+{
+    return ((int64_t) floor(Edges)) & 1;
+}
+
+/*
+ * LevelB
+ * Helper for DrivePlant_Step
+ * B changes half way between A edges, a quarter cycle ahead of A
+ */
+static bool LevelB(double Edges)
+{
+    return ((int64_t) floor(Edges - 0.5)) & 1;
+}
@@ -0,0 +1,118 @@
+/****************************************************************************
+ * File:   DrivePlant.h
+ * Host model of one drive motor, its gearbox and quadrature encoder
+ *
+ * Speed is first order with Coulomb friction:
+ *      Tau * dRPM/dt = Gain*MaxRPM/(1-Deadband) * Duty * Vbat - RPM - Friction
+ * where Friction = Gain*MaxRPM/(1-Deadband) * (Deadband + Load) opposes
+ * motion, and holds the wheel still while the drive is below it. With the
+ * defaults the motor starts at 30% duty and reaches 170 RPM at full duty,
+ * the same curve MotorLinearization uses until the motors are characterized
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef DRIVEPLANT_H
+#define	DRIVEPLANT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PLANT_EDGES_PER_REV 300 // Encoder edges per output shaft rev
+
+typedef struct {
+    double TauS;        // Mechanical time constant in seconds
+    double MaxRPM;      // Output speed at full duty, no extra load
+    double Deadband;    // Duty (0-1) needed to overcome friction
+    double Load;        // Extra friction as a fraction of full duty
+    double Gain;        // Motor constant multiplier. Models L/R mismatch
+    double Vbat;        // Supply as a fraction of nominal
+}DrivePlant_Params_t;
+
+typedef struct {
+    DrivePlant_Params_t Params;
+    double RPM;         // Output speed. Positive is the motor's forward
+    double Edges;       // Encoder position in edges. Positive is forward
+}DrivePlant_Motor_t;
+
+// Callback for each channel A edge, the edges input capture sees. EdgeTime
+// is the simulated time of the edge, A and B the channel levels after it
+typedef void (*DrivePlant_EdgeFn_t)(void *Context, double EdgeTime,
+        bool ChA, bool ChB);
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_DefaultParams
+ *
+ * Parameters
+ *      void
+ * Return
+ *      DrivePlant_Params_t, parameters matching the default linearization
+****************************************************************************/
+DrivePlant_Params_t DrivePlant_DefaultParams(void);
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_Init
+ *
+ * Parameters
+ *      DrivePlant_Motor_t *ThisMotor - Motor to reset
+ *      DrivePlant_Params_t Params - Its parameters
+ * Return
+ *      void
+ * Description
+ *      Stops the motor a quarter edge past encoder position 0
+****************************************************************************/
+void DrivePlant_Init(DrivePlant_Motor_t *ThisMotor, DrivePlant_Params_t Params);
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_Step
+ *
+ * Parameters
+ *      DrivePlant_Motor_t *ThisMotor - Motor to advance
+ *      double Duty - Applied duty, -1 to 1. Negative drives backward
+ *      double StartTime - Simulated time at the start of the step, seconds
+ *      double Dt - Step length in seconds
+ *      DrivePlant_EdgeFn_t OnEdge - Called in order for each encoder edge
+ *      void *Context - Passed to OnEdge
+ * Return
+ *      void
+ * Description
+ *      Integrates the motor over one step and reports the encoder edges
+ *      crossed, with their times interpolated within the step
+****************************************************************************/
+void DrivePlant_Step(DrivePlant_Motor_t *ThisMotor, double Duty,
+        double StartTime, double Dt, DrivePlant_EdgeFn_t OnEdge, void *Context);
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_Channels
+ *
+ * Parameters
+ *      const DrivePlant_Motor_t *ThisMotor - Motor to read
+ *      bool *ChA, *ChB - Current encoder channel levels
+ * Return
+ *      void
+ * Description
+ *      Forward motion gives B low on a rising A edge and high on a falling
+ *      one, which the encoder ISRs read as _Forward_Dir
+****************************************************************************/
+void DrivePlant_Channels(const DrivePlant_Motor_t *ThisMotor, bool *ChA, bool *ChB);
+
+/****************************************************************************
+ * Function
+ *      DrivePlant_SteadyRPM
+ *
+ * Parameters
+ *      const DrivePlant_Params_t *Params - Motor parameters
+ *      double Duty - Applied duty, 0 to 1
+ * Return
+ *      double, speed the motor settles at, what a characterization sweep
+ *      of this motor would measure
+****************************************************************************/
+double DrivePlant_SteadyRPM(const DrivePlant_Params_t *Params, double Duty);
+
+#endif	/* DRIVEPLANT_H */
@@ -0,0 +1,268 @@
+/****************************************************************************
+ * File:   ProtocolBench.c
+ * Host benchmark of the generated XBee pack and unpack code
+ *
+ * Times XBeeProtocol.c, built unmodified with the host compiler, packing
+ * and unpacking each message, and validating a frame's checksum. The old
+ * hand written Control frame builder, with its checksum summed field by
+ * field, is timed alongside as a baseline.
+ *
+ * Results go to stdout for Tools/bench_xbee_protocol.py:
+ *      "METRIC <name> <value>"  ns (and cycles on x86) per call
+ *      "FRAME <message> <hex>"  the frame packed from fixed test values,
+ *                               checked against xbee_protocol.py
+ *
+ * Host timings only compare builds of the generated code against each
+ * other, they aren't PIC32 cycle counts.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "XBeeProtocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER
+#endif
+
+/*----------------------------- Module Defines ----------------------------*/
+#define DEFAULT_ITERATIONS 2000000
+#define TEST_DESTINATION 0x2183
+#define TEST_SOURCE 0x2103
+#define TEST_RSSI 40
+
+/*---------------------------- Module Functions ---------------------------*/
+static void StartTiming(void);
+static void StopTiming(const char *Name, long Iterations);
+static void PrintFrame(const char *Name, const uint8_t *Frame, uint8_t Length);
+static void MakeRX16(uint8_t *Frame);
+static uint8_t LegacyPackControl(uint8_t *TXMessage, uint8_t FrameID,
+        uint16_t Destination, const XBeeControl_t *Msg);
+static void Metric(const char *Name, double Value);
+
+/*---------------------------- Module Variables ---------------------------*/
+static struct timespec StartTime;
+#ifdef HAVE_CYCLE_COUNTER
+static uint64_t StartCycles;
+#endif
+// Written each iteration so the calls can't be optimized out
+static volatile uint32_t Sink;
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char **argv)
+{
+    long Iterations = (argc > 1) ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    uint8_t Frame[XBEE_FRAME_SIZE];
+
+    XBeeControl_t Control = { -20, 0, 35, 1, 0 };
+    XBeeStatus_t Status = { 80, 1234 };
+    XBeeRequestToPair_t Request = { TEST_DESTINATION, TEST_SOURCE };
+    XBeePairingAcknowledged_t Ack = { TEST_DESTINATION, TEST_SOURCE };
+
+    // Fixed frames for the cross check
+    PrintFrame("Control", Frame,
+            XBeeProtocol_PackControl(Frame, 1, TEST_DESTINATION, &Control));
+    PrintFrame("Legacy", Frame,
+            LegacyPackControl(Frame, 1, TEST_DESTINATION, &Control));
+    PrintFrame("Status", Frame,
+            XBeeProtocol_PackStatus(Frame, 1, TEST_DESTINATION, &Status));
+    PrintFrame("RequestToPair", Frame,
+            XBeeProtocol_PackRequestToPair(Frame, 1, TEST_DESTINATION, &Request));
+    PrintFrame("PairingAcknowledged", Frame,
+            XBeeProtocol_PackPairingAcknowledged(Frame, 1, TEST_DESTINATION, &Ack));
+
+    // Pack. Frame ID and one field change every call
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Control.X = (int8_t) i;
+        Sink += XBeeProtocol_PackControl(Frame, (uint8_t) i, TEST_DESTINATION, &Control);
+        Sink += Frame[XBEE_FRAME_SIZE - 1];
+    }
+    StopTiming("pack_control", Iterations);
+
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Control.X = (int8_t) i;
+        Sink += LegacyPackControl(Frame, (uint8_t) i, TEST_DESTINATION, &Control);
+        Sink += Frame[XBEE_FRAME_SIZE - 1];
+    }
+    StopTiming("pack_control_legacy", Iterations);
+
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Status.TimeToEmpty = (uint16_t) i;
+        Sink += XBeeProtocol_PackStatus(Frame, (uint8_t) i, TEST_DESTINATION, &Status);
+        Sink += Frame[XBEE_FRAME_SIZE - 1];
+    }
+    StopTiming("pack_status", Iterations);
+
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Request.PilotAddress = (uint16_t) i;
+        Sink += XBeeProtocol_PackRequestToPair(Frame, (uint8_t) i, TEST_DESTINATION, &Request);
+        Sink += Frame[XBEE_FRAME_SIZE - 1];
+    }
+    StopTiming("pack_request_to_pair", Iterations);
+
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Ack.PilotAddress = (uint16_t) i;
+        Sink += XBeeProtocol_PackPairingAcknowledged(Frame, (uint8_t) i, TEST_DESTINATION, &Ack);
+        Sink += Frame[XBEE_FRAME_SIZE - 1];
+    }
+    StopTiming("pack_pairing_acknowledged", Iterations);
+
+    // Receive side, on the frame the radio would hand over for a Control
+    XBeeRX16Header_t Header;
+    XBeeControl_t ControlOut;
+    XBeeStatus_t StatusOut;
+    XBeeProtocol_PackControl(Frame, 1, TEST_DESTINATION, &Control);
+    MakeRX16(Frame);
+    if (!XBeeProtocol_IsChecksumValid(Frame) ||
+            !XBeeProtocol_ParseRX16(Frame, &Header) ||
+            !XBeeProtocol_UnpackControl(Frame, &ControlOut) ||
+            (0 != memcmp(&ControlOut, &Control, sizeof(Control))) ||
+            (Header.Source != TEST_SOURCE) || (Header.RSSI != TEST_RSSI)) {
+        printf("ERROR Control did not survive pack and unpack\n");
+        return 1;
+    }
+
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Frame[9] = (uint8_t) i;
+        Sink += XBeeProtocol_IsChecksumValid(Frame);
+    }
+    StopTiming("checksum_valid", Iterations);
+
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Frame[9] = (uint8_t) i;
+        Sink += XBeeProtocol_ParseRX16(Frame, &Header);
+        Sink += XBeeProtocol_UnpackControl(Frame, &ControlOut);
+        Sink += (uint8_t) ControlOut.X;
+    }
+    StopTiming("unpack_control", Iterations);
+
+    XBeeProtocol_PackStatus(Frame, 1, TEST_DESTINATION, &Status);
+    MakeRX16(Frame);
+    StartTiming();
+    for (long i = 0; i < Iterations; i++) {
+        Frame[10] = (uint8_t) i;
+        Sink += XBeeProtocol_ParseRX16(Frame, &Header);
+        Sink += XBeeProtocol_UnpackStatus(Frame, &StatusOut);
+        Sink += StatusOut.TimeToEmpty;
+    }
+    StopTiming("unpack_status", Iterations);
+
+    return 0;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * StartTiming
+ * Helper for main
+ */
+static void StartTiming(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &StartTime);
+#ifdef HAVE_CYCLE_COUNTER
+    StartCycles = __rdtsc();
+#endif
+}
+
+/*
+ * StopTiming
+ * Helper for main
+ * Reports the time per call since StartTiming
+ */
+static void StopTiming(const char *Name, long Iterations)
+{
+    struct timespec End;
+#ifdef HAVE_CYCLE_COUNTER
+    uint64_t Cycles = __rdtsc() - StartCycles;
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &End);
+    uint64_t Ns = (uint64_t) ((End.tv_sec - StartTime.tv_sec) * 1000000000LL +
+            (End.tv_nsec - StartTime.tv_nsec));
+
+    char MetricName[64];
+    snprintf(MetricName, sizeof(MetricName), "%s_ns", Name);
+    Metric(MetricName, (double) Ns / Iterations);
+#ifdef HAVE_CYCLE_COUNTER
+    snprintf(MetricName, sizeof(MetricName), "%s_cycles", Name);
+    Metric(MetricName, (double) Cycles / Iterations);
+#endif
+}
+
+/*
+ * PrintFrame
+ * Helper for main
+ */
+static void PrintFrame(const char *Name, const uint8_t *Frame, uint8_t Length)
+{
+    printf("FRAME %s ", Name);
+    for (uint8_t i = 0; i < Length; i++) {
+        printf("%02x", Frame[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * MakeRX16
+ * Helper for main
+ * Turns a packed TX Request into the RX Packet the other radio would hand
+ * over: same message, source and RSSI in place of frame ID and destination
+ */
+static void MakeRX16(uint8_t *Frame)
+{
+    Frame[XBEE_FRAME_API_ID] = XBEE_API_RX16;
+    Frame[4] = TEST_SOURCE >> 8;
+    Frame[5] = TEST_SOURCE & 0xFF;
+    Frame[6] = TEST_RSSI;
+    Frame[7] = 0;
+    uint8_t Sum = 0;
+    for (uint8_t i = XBEE_FRAME_API_ID; i < (XBEE_FRAME_SIZE - 1); i++) {
+        Sum += Frame[i];
+    }
+    Frame[XBEE_FRAME_SIZE - 1] = 0xFF - Sum;
+}
+
+/*
+ * LegacyPackControl
+ * Helper for main
+ * The Control half of ConCon's ConstructNewTXMessage before the protocol
+ * was generated, for comparison. Not inlined, so it pays for a call like
+ * the generated functions in their own file do
+ */
+__attribute__((noinline))
+static uint8_t LegacyPackControl(uint8_t *TXMessage, uint8_t FrameID,
+        uint16_t Destination, const XBeeControl_t *Msg)
+{
+    TXMessage[0]=0x7E;
+    TXMessage[1]=0x00;
+    TXMessage[2]=0x0B;
+    uint8_t CheckSum = 0;
+    CheckSum += (TXMessage[3]=0x01);
+    CheckSum += (TXMessage[4]=FrameID);
+    CheckSum += (TXMessage[5]=(Destination & 0xFF00) >> 8);
+    CheckSum += (TXMessage[6]=(Destination & 0x00FF));
+    CheckSum += (TXMessage[7]=0x00);
+    CheckSum += (TXMessage[8]=XBee_Control);
+    CheckSum += (TXMessage[9]=Msg->X);
+    CheckSum += (TXMessage[10]=Msg->Y);
+    CheckSum += (TXMessage[11]=Msg->Yaw);
+    CheckSum += (TXMessage[12]=Msg->Refuel);
+    CheckSum += (TXMessage[13]=Msg->Mode3);
+    TXMessage[14]=0xFF-CheckSum;
+    return 15;
+}
+
+static void Metric(const char *Name, double Value)
+{
+    printf("METRIC %s %.4f\n", Name, Value);
+}
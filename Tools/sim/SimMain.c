@@ -0,0 +1,830 @@
+/****************************************************************************
+ * File:   SimMain.c
+ * Host simulation of the Tug drive train under the real control law
+ *
+ * Runs the unmodified MotorControlDriver against two DrivePlant motors.
+ * The firmware writes duty cycles to the simulated OCxRS/LAT registers,
+ * the plant turns them into speed and encoder edges, and each edge is
+ * latched into ICxBUF and handed to the encoder ISR at its simulated time.
+ * ControlLawHandler runs every control period while Timer4 is on.
+ *
+ * Results go to stdout as "METRIC <name> <value>" lines for
+ * Tools/simulate_drive.py. Any other output is the firmware's own.
+ *
+ *  Scenarios
+ *      step    Both wheels from rest to --target RPM with SetMotorSpeed.
+ *              With --open-loop 1, the linearized duty cycle open loop
+ *              teleop would set for that speed instead
+ *      drive   DriveStraight at --target RPM for --distance cm
+ *      turn    DriveTurn clockwise at --target RPM for --angle degrees
+ *      tune    MotorControl_StartAutoTune, then its step tests on the old
+ *              and new gains. Ends early once the tune finishes
+ *      failsafe  Velocity teleop at --target RPM, then at --stop-ms the
+ *              MotorControl_StopMotors the link failsafe ends in. Reports
+ *              the control ticks that still drove a motor after it
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "MotorControlDriver.h"
+#include "MotorLinearization.h"
+#include "Propulsion.h"
+#include "PIC32PortHAL.h"
+#include "PIC32_NVM_HAL.h"
+#include "DrivePlant.h"
+#include "SimRegisters.h"
+#include <xc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER
+#endif
+
+/*----------------------------- Module Defines ----------------------------*/
+#define STEP_NS 20000ULL        // Plant integration step, 20 us
+#define ISR_LATENCY_NS 1000ULL  // Edge to encoder ISR entry
+#define MAX_EDGES_PER_STEP 64
+#define SETTLE_BAND 0.02        // Settled within 2% of target...
+#define MIN_SETTLE_BAND_RPM 1.0 // ...or 1 RPM, whichever is wider
+#define SSE_WINDOW 0.2          // Steady state error over the last 20%
+#define NUM_MOTORS 2
+#define FULL_DUTY_CYCLE 1000.0  // Firmware duty cycle scale
+
+/*----------------------------- Module Types ------------------------------*/
+typedef enum
+{
+    _Step_Scenario, _Drive_Scenario, _Turn_Scenario, _Tune_Scenario,
+    _Failsafe_Scenario
+}Scenario_t;
+
+typedef struct {
+    Scenario_t Scenario;
+    double TargetRPM;       // step, and speed for drive/turn
+    double DistanceCM;
+    double AngleDeg;
+    double DurationS;
+    double StopMs;          // failsafe: when the motors are stopped
+    int PeriodMs;           // 0 to keep the firmware default
+    MotorControl_Gains_t Gains; // At the 5 ms rate. NAN keeps the firmware's
+    int ProfileAccel;       // < 0 to keep the firmware default
+    int ProfileJerk;
+    DrivePlant_Params_t Plant;
+    double Mismatch;        // Right motor gain relative to left
+    int Observer;           // < 0 to keep the firmware default
+    int Characterized;      // Nonzero to start with tables swept from the plant
+    int OpenLoop;           // Nonzero for an open loop step
+    const char *TracePath;
+}Options_t;
+
+typedef struct {
+    uint64_t TimeNs;
+    MotorControl_Motor_t WhichMotor;
+    bool ChA;
+    bool ChB;
+}Edge_t;
+
+// Step response of one wheel
+typedef struct {
+    double Target;
+    double Peak;
+    double RiseStart;       // First time above 10% of target, s
+    double RiseEnd;         // First time above 90% of target, s
+    double LastOutside;     // Last time outside the settle band, s
+    double ErrorSum;        // Over the SSE window
+    double ErrorSquares;
+    double WindowMin;       // Speed range over the SSE window
+    double WindowMax;
+    uint32_t ErrorSamples;
+}StepStats_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+// MotorControlDriver ISRs. Called directly at their simulated times
+void ControlLawHandler(void);
+void LeftEncoderHandler(void);
+void RightEncoderHandler(void);
+
+static bool ParseOptions(int argc, char **argv, Options_t *Opts);
+static void StartScenario(const Options_t *Opts);
+static void LoadSweptTables(const DrivePlant_Params_t *Params, 
+        MotorControl_Motor_t WhichMotor);
+static void StartOpenLoopStep(double TargetRPM);
+static double AppliedDuty(MotorControl_Motor_t WhichMotor);
+static void CollectEdge(void *Context, double EdgeTime, bool ChA, bool ChB);
+static int CompareEdges(const void *A, const void *B);
+static void DeliverEdge(const Edge_t *ThisEdge);
+static void RunControlTick(uint64_t Now);
+static void InitStepStats(StepStats_t *Stats, double Target);
+static void UpdateStepStats(StepStats_t *Stats, double RPM, double Time,
+        double Duration);
+static void ReportStepStats(const char *Name, const StepStats_t *Stats);
+static void ReportTuneStats(const char *Name, MotorControl_Motor_t WhichMotor);
+static double PlantTicks(MotorControl_Motor_t WhichMotor);
+static void Metric(const char *Name, double Value);
+
+/*---------------------------- Module Variables ---------------------------*/
+static DrivePlant_Motor_t Plant[NUM_MOTORS];
+static double StartEdges[NUM_MOTORS]; // Plant position at the start
+static Edge_t Edges[MAX_EDGES_PER_STEP];
+static uint8_t NumEdges;
+static uint64_t StepStartNs;
+static uint32_t DroppedEdges;
+
+static double GoalReachedS = -1; // Time DRIVE_GOAL_REACHED was posted
+
+// Host cost of each ControlLawHandler call
+static uint32_t TickCount;
+static uint64_t TickNsSum;
+static uint64_t TickNsPeak;
+static uint64_t TickCyclesSum;
+static uint64_t TickCyclesPeak;
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char **argv)
+{
+    Options_t Opts;
+    if (!ParseOptions(argc, argv, &Opts))
+    {
+        return 2;
+    }
+
+    DrivePlant_Params_t RightParams = Opts.Plant;
+    RightParams.Gain *= Opts.Mismatch;
+    DrivePlant_Init(&Plant[_Left_Motor], Opts.Plant);
+    DrivePlant_Init(&Plant[_Right_Motor], RightParams);
+    StartEdges[_Left_Motor] = Plant[_Left_Motor].Edges;
+    StartEdges[_Right_Motor] = Plant[_Right_Motor].Edges;
+
+    SimRegisters_SetTime(0);
+    InitMotorControlDriver();
+    if (Opts.Characterized)
+    {
+        // Swept once on the bench, fresh battery and no load, so --vbat and
+        // --load show what the tables miss
+        DrivePlant_Params_t LeftBench = Opts.Plant;
+        DrivePlant_Params_t RightBench = RightParams;
+        LeftBench.Vbat = RightBench.Vbat = 1;
+        LeftBench.Load = RightBench.Load = 0;
+        LoadSweptTables(&LeftBench, _Left_Motor);
+        LoadSweptTables(&RightBench, _Right_Motor);
+        MotorLinearization_SetCharacterized(true);
+    }
+    StartScenario(&Opts);
+
+    FILE *Trace = NULL;
+    if (NULL != Opts.TracePath)
+    {
+        Trace = fopen(Opts.TracePath, "w");
+        if (NULL == Trace)
+        {
+            perror(Opts.TracePath);
+            return 2;
+        }
+        fprintf(Trace, "t_ms,l_target,l_measured,l_estimate,l_true,l_duty,"
+                "r_target,r_measured,r_estimate,r_true,r_duty\n");
+    }
+
+    StepStats_t Stats[NUM_MOTORS];
+    InitStepStats(&Stats[_Left_Motor], Opts.TargetRPM);
+    InitStepStats(&Stats[_Right_Motor], Opts.TargetRPM);
+    double PeakSyncError = 0;
+    // Failsafe stop, and what the control law did after it
+    bool Stopped = false;
+    uint32_t DrivenTicks = 0;
+    double PeakDutyAfterStop = 0;
+    double StopRPM = 0;
+    // Sign of each wheel's commanded direction, so speeds read positive
+    double Sign[NUM_MOTORS] = {1, 1};
+    if (_Turn_Scenario == Opts.Scenario)
+    {
+        Sign[_Right_Motor] = -1;
+    }
+
+    uint64_t EndNs = (uint64_t) (Opts.DurationS * 1e9);
+    uint64_t NextControlNs = 0;
+    bool ControlWasOn = false;
+    for (uint64_t Now = 0; Now < EndNs; Now += STEP_NS)
+    {
+        if ((_Tune_Scenario == Opts.Scenario) && !MotorControl_IsAutoTuning())
+        {
+            break;
+        }
+        // Move both wheels, then replay their edges in time order
+        StepStartNs = Now;
+        NumEdges = 0;
+        for (uint8_t i = 0; i < NUM_MOTORS; i++)
+        {
+            MotorControl_Motor_t WhichMotor = (MotorControl_Motor_t) i;
+            DrivePlant_Step(&Plant[i], AppliedDuty(WhichMotor), Now * 1e-9,
+                    STEP_NS * 1e-9, CollectEdge, &WhichMotor);
+        }
+        qsort(Edges, NumEdges, sizeof(Edges[0]), CompareEdges);
+        for (uint8_t i = 0; i < NumEdges; i++)
+        {
+            DeliverEdge(&Edges[i]);
+        }
+
+        uint64_t StepEnd = Now + STEP_NS;
+        SimRegisters_SetTime(StepEnd);
+        if ((_Failsafe_Scenario == Opts.Scenario) && !Stopped &&
+                (StepEnd >= (uint64_t) (Opts.StopMs * 1e6)))
+        {
+            // Propulsion_FailsafeStop empties the thrust mailbox, then this
+            MotorControl_StopMotors();
+            Stopped = true;
+            StopRPM = Plant[_Left_Motor].RPM;
+        }
+
+        // Timer4 restarts its period whenever it is turned on
+        if (T4CONbits.ON && !ControlWasOn)
+        {
+            NextControlNs = StepEnd +
+                    (uint64_t) MotorControl_GetControlPeriod() * 1000000ULL;
+        }
+        ControlWasOn = T4CONbits.ON;
+        if (ControlWasOn && (StepEnd >= NextControlNs))
+        {
+            RunControlTick(StepEnd);
+            NextControlNs += (uint64_t) MotorControl_GetControlPeriod() * 1000000ULL;
+            if (Stopped)
+            {
+                double Duty = fmax(fabs(AppliedDuty(_Left_Motor)),
+                        fabs(AppliedDuty(_Right_Motor)));
+                if (Duty > 0)
+                {
+                    DrivenTicks++;
+                }
+                PeakDutyAfterStop = fmax(PeakDutyAfterStop, Duty);
+            }
+
+            if (NULL != Trace)
+            {
+                ControlState_t L = MotorControl_GetControlState(_Left_Motor);
+                ControlState_t R = MotorControl_GetControlState(_Right_Motor);
+                fprintf(Trace, "%.3f,%.2f,%.2f,%.2f,%.2f,%.4f,%.2f,%.2f,%.2f,%.2f,%.4f\n",
+                        StepEnd * 1e-6,
+                        L.ActualTargetRPM, MotorControl_GetEncoder(_Left_Motor).CurrentRPM,
+                        L.Observer.RPM, Plant[_Left_Motor].RPM, AppliedDuty(_Left_Motor),
+                        R.ActualTargetRPM, MotorControl_GetEncoder(_Right_Motor).CurrentRPM,
+                        R.Observer.RPM, Plant[_Right_Motor].RPM, AppliedDuty(_Right_Motor));
+            }
+        }
+
+        double Time = StepEnd * 1e-9;
+        for (uint8_t i = 0; i < NUM_MOTORS; i++)
+        {
+            UpdateStepStats(&Stats[i], Sign[i] * Plant[i].RPM, Time, Opts.DurationS);
+        }
+        double SyncError = fabs(PlantTicks(_Left_Motor) -
+                PlantTicks(_Right_Motor));
+        if ((GoalReachedS < 0) && (SyncError > PeakSyncError))
+        {
+            PeakSyncError = SyncError;
+        }
+    }
+
+    if (NULL != Trace)
+    {
+        fclose(Trace);
+    }
+
+    // Results
+    Metric("control_period_ms", MotorControl_GetControlPeriod());
+    MotorControl_Gains_t Gains = MotorControl_GetGains(_Left_Motor);
+    Metric("gain_p", Gains.P);
+    Metric("gain_i", Gains.I);
+    Metric("gain_d", Gains.D);
+    if (_Step_Scenario == Opts.Scenario)
+    {
+        ReportStepStats("left", &Stats[_Left_Motor]);
+        ReportStepStats("right", &Stats[_Right_Motor]);
+    }
+    else if (_Failsafe_Scenario == Opts.Scenario)
+    {
+        Metric("stop_rpm", StopRPM);
+        Metric("driven_ticks_after_stop", DrivenTicks);
+        Metric("peak_duty_after_stop", PeakDutyAfterStop);
+    }
+    else if (_Tune_Scenario == Opts.Scenario)
+    {
+        Metric("tune_finished", !MotorControl_IsAutoTuning());
+        ReportTuneStats("left", _Left_Motor);
+        ReportTuneStats("right", _Right_Motor);
+    }
+    else
+    {
+        double GoalTicks = (_Drive_Scenario == Opts.Scenario) ?
+            (uint16_t) (Opts.DistanceCM * TICKS_PER_CM) :
+            (uint16_t) (Opts.AngleDeg * TICKS_PER_DEGREE);
+        Metric("goal_ticks", GoalTicks);
+        Metric("goal_reached_ms", (GoalReachedS < 0) ? -1 : GoalReachedS * 1e3);
+        Metric("left_ticks", PlantTicks(_Left_Motor));
+        Metric("right_ticks", PlantTicks(_Right_Motor));
+        Metric("left_overrun_ticks", PlantTicks(_Left_Motor) - GoalTicks);
+        Metric("right_overrun_ticks", PlantTicks(_Right_Motor) - GoalTicks);
+        Metric("peak_sync_error_ticks", PeakSyncError);
+        if (_Drive_Scenario == Opts.Scenario)
+        {
+            // A wheel a tick ahead turns the Tug half as far as a tick of
+            // each wheel in a turn
+            Metric("peak_heading_error_deg", PeakSyncError / (2 * TICKS_PER_DEGREE));
+        }
+    }
+    Metric("control_ticks", TickCount);
+    Metric("ns_per_tick_avg", (TickCount > 0) ? (double) TickNsSum / TickCount : 0);
+    Metric("ns_per_tick_max", TickNsPeak);
+#ifdef HAVE_CYCLE_COUNTER
+    Metric("cycles_per_tick_avg", (TickCount > 0) ? (double) TickCyclesSum / TickCount : 0);
+    Metric("cycles_per_tick_max", TickCyclesPeak);
+#endif
+    Metric("dropped_edges", DroppedEdges);
+    return 0;
+}
+
+/****************************************************************************
+ * Function
+ *      PostPropulsion
+ *
+ * Parameters
+ *      ES_Event_t ThisEvent - Event from the drive code
+ * Return
+ *      bool, always true
+ * Description
+ *      Stands in for the Propulsion service. Notes when the drive goal
+ *      is reached
+****************************************************************************/
+bool PostPropulsion(ES_Event_t ThisEvent)
+{
+    if ((DRIVE_GOAL_REACHED == ThisEvent.EventType) && (GoalReachedS < 0))
+    {
+        GoalReachedS = SimRegisters_GetTime() * 1e-9;
+    }
+    return true;
+}
+
+// Nothing feeds the thrust mailbox in the simulator
+void Propulsion_ReadThrustMailbox(void)
+{
+}
+
+// Fuel isn't modelled
+void Propulsion_BurnFuel(uint8_t ElapsedMs)
+{
+    (void) ElapsedMs;
+}
+
+// Telemetry capture is never started, so it never has room to stream
+size_t Terminal_TxSpace(void)
+{
+    return 0;
+}
+
+void Terminal_WriteByte(uint8_t txByte)
+{
+    (void) txByte;
+}
+
+bool PortSetup_ConfigureDigitalInputs(PortSetup_Port_t WhichPort, PortSetup_Pin_t WhichPin)
+{
+    (void) WhichPort;
+    (void) WhichPin;
+    return true;
+}
+
+bool PortSetup_ConfigureDigitalOutputs(PortSetup_Port_t WhichPort, PortSetup_Pin_t WhichPin)
+{
+    (void) WhichPort;
+    (void) WhichPin;
+    return true;
+}
+
+// Gains are never saved from the simulator
+bool NVM_ErasePage(const void *PageAddress)
+{
+    (void) PageAddress;
+    return false;
+}
+
+bool NVM_WriteWords(const void *Address, const uint32_t *Data, uint16_t NumWords)
+{
+    (void) Address;
+    (void) Data;
+    (void) NumWords;
+    return false;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+/*
+ * ParseOptions
+ * Helper for main
+ * Reads "--name value" pairs. Returns false with a message on a bad one
+ */
+static bool ParseOptions(int argc, char **argv, Options_t *Opts)
+{
+    memset(Opts, 0, sizeof(*Opts));
+    Opts->Scenario = _Step_Scenario;
+    Opts->TargetRPM = 100;
+    Opts->DistanceCM = 100;
+    Opts->AngleDeg = 90;
+    Opts->DurationS = 2;
+    Opts->StopMs = 1000;
+    Opts->ProfileAccel = -1;
+    Opts->ProfileJerk = -1;
+    Opts->Plant = DrivePlant_DefaultParams();
+    Opts->Mismatch = 1;
+    Opts->Observer = -1;
+    Opts->Gains.P = NAN;
+    Opts->Gains.I = NAN;
+    Opts->Gains.D = NAN;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *Name = argv[i];
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "missing value for %s\n", Name);
+            return false;
+        }
+        const char *Value = argv[++i];
+        double Number = atof(Value);
+
+        if (0 == strcmp(Name, "--scenario"))
+        {
+            if (0 == strcmp(Value, "step")) Opts->Scenario = _Step_Scenario;
+            else if (0 == strcmp(Value, "drive")) Opts->Scenario = _Drive_Scenario;
+            else if (0 == strcmp(Value, "turn")) Opts->Scenario = _Turn_Scenario;
+            else if (0 == strcmp(Value, "tune")) Opts->Scenario = _Tune_Scenario;
+            else if (0 == strcmp(Value, "failsafe")) Opts->Scenario = _Failsafe_Scenario;
+            else
+            {
+                fprintf(stderr, "unknown scenario %s\n", Value);
+                return false;
+            }
+        }
+        else if (0 == strcmp(Name, "--target")) Opts->TargetRPM = Number;
+        else if (0 == strcmp(Name, "--distance")) Opts->DistanceCM = Number;
+        else if (0 == strcmp(Name, "--angle")) Opts->AngleDeg = Number;
+        else if (0 == strcmp(Name, "--duration")) Opts->DurationS = Number;
+        else if (0 == strcmp(Name, "--stop-ms")) Opts->StopMs = Number;
+        else if (0 == strcmp(Name, "--period")) Opts->PeriodMs = (int) Number;
+        else if (0 == strcmp(Name, "--kp")) Opts->Gains.P = Number;
+        else if (0 == strcmp(Name, "--ki")) Opts->Gains.I = Number;
+        else if (0 == strcmp(Name, "--kd")) Opts->Gains.D = Number;
+        else if (0 == strcmp(Name, "--accel")) Opts->ProfileAccel = (int) Number;
+        else if (0 == strcmp(Name, "--jerk")) Opts->ProfileJerk = (int) Number;
+        else if (0 == strcmp(Name, "--tau")) Opts->Plant.TauS = Number;
+        else if (0 == strcmp(Name, "--max-rpm")) Opts->Plant.MaxRPM = Number;
+        else if (0 == strcmp(Name, "--deadband")) Opts->Plant.Deadband = Number;
+        else if (0 == strcmp(Name, "--load")) Opts->Plant.Load = Number;
+        else if (0 == strcmp(Name, "--vbat")) Opts->Plant.Vbat = Number;
+        else if (0 == strcmp(Name, "--mismatch")) Opts->Mismatch = Number;
+        else if (0 == strcmp(Name, "--observer")) Opts->Observer = (int) Number;
+        else if (0 == strcmp(Name, "--characterized")) Opts->Characterized = (int) Number;
+        else if (0 == strcmp(Name, "--open-loop")) Opts->OpenLoop = (int) Number;
+        else if (0 == strcmp(Name, "--trace")) Opts->TracePath = Value;
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", Name);
+            return false;
+        }
+    }
+
+    if ((Opts->DurationS <= 0) || (Opts->Plant.TauS <= 0) ||
+            (Opts->Plant.Deadband < 0) || (Opts->Plant.Deadband >= 1))
+    {
+        fprintf(stderr, "duration and tau must be positive, deadband 0 to <1\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * StartScenario
+ * Helper for main
+ * Applies gains, rate and profile limits, then issues the drive command.
+ * Gains go in at the 5 ms rate and SetControlPeriod rescales them
+ */
+static void StartScenario(const Options_t *Opts)
+{
+    for (uint8_t i = 0; i < NUM_MOTORS; i++)
+    {
+        MotorControl_Gains_t Gains = MotorControl_GetGains((MotorControl_Motor_t) i);
+        if (!isnan(Opts->Gains.P)) Gains.P = Opts->Gains.P;
+        if (!isnan(Opts->Gains.I)) Gains.I = Opts->Gains.I;
+        if (!isnan(Opts->Gains.D)) Gains.D = Opts->Gains.D;
+        MotorControl_SetGains((MotorControl_Motor_t) i, Gains);
+    }
+    if ((0 != Opts->PeriodMs) && !MotorControl_SetControlPeriod(Opts->PeriodMs))
+    {
+        fprintf(stderr, "control period %d ms rejected\n", Opts->PeriodMs);
+        exit(2);
+    }
+    if (Opts->Observer >= 0)
+    {
+        MotorControl_SetVelocityObserver(0 != Opts->Observer);
+    }
+    if ((Opts->ProfileAccel >= 0) || (Opts->ProfileJerk >= 0))
+    {
+        MotorControl_SetProfileLimits((Opts->ProfileAccel < 0) ? 0 : Opts->ProfileAccel,
+                (Opts->ProfileJerk < 0) ? 0 : Opts->ProfileJerk);
+    }
+
+    uint16_t Speed = (uint16_t) (Opts->TargetRPM * 10);
+    switch (Opts->Scenario)
+    {
+        case _Step_Scenario:
+            if (Opts->OpenLoop)
+            {
+                StartOpenLoopStep(Opts->TargetRPM);
+                break;
+            }
+            MotorControl_SetMotorSpeed(_Left_Motor, _Forward_Dir, Speed);
+            MotorControl_SetMotorSpeed(_Right_Motor, _Forward_Dir, Speed);
+            break;
+        case _Drive_Scenario:
+            MotorControl_DriveStraight(_Forward_Dir, Speed, (uint16_t) Opts->DistanceCM);
+            break;
+        case _Turn_Scenario:
+            MotorControl_DriveTurn(_Clockwise_Turn, Speed, (uint16_t) Opts->AngleDeg);
+            break;
+        case _Tune_Scenario:
+            MotorControl_StartAutoTune();
+            break;
+        case _Failsafe_Scenario:
+            // What Propulsion's thrust mailbox does in velocity mode
+            MotorControl_SetSpeedTargets(_Forward_Dir, Speed, _Forward_Dir, Speed);
+            break;
+    }
+}
+
+/*
+ * LoadSweptTables
+ * Helper for main
+ * Fills one motor's linearization tables with the speeds a sweep of its
+ * plant would measure, so the feedforward can be tried without running
+ * the 35 s sweep first
+ */
+static void LoadSweptTables(const DrivePlant_Params_t *Params, 
+        MotorControl_Motor_t WhichMotor)
+{
+    for (uint8_t i = 0; i < LINEARIZATION_POINTS; i++)
+    {
+        float RPM = (float) DrivePlant_SteadyRPM(Params, 
+                (double) (i * LINEARIZATION_DUTY_STEP) / FULL_DUTY_CYCLE);
+        MotorLinearization_SetPoint(WhichMotor, _Forward_Dir, i, RPM);
+        MotorLinearization_SetPoint(WhichMotor, _Backward_Dir, i, RPM);
+    }
+}
+
+/*
+ * StartOpenLoopStep
+ * Helper for StartScenario
+ * Sets the duty cycles open loop teleop would for TargetRPM. Thrust is the
+ * fraction of the common top speed, as Propulsion maps it
+ */
+static void StartOpenLoopStep(double TargetRPM)
+{
+    float Thrust = (float) (TargetRPM / MotorLinearization_GetCommonMaxRPM());
+    for (uint8_t i = 0; i < NUM_MOTORS; i++)
+    {
+        MotorControl_Motor_t WhichMotor = (MotorControl_Motor_t) i;
+        MotorControl_SetMotorDutyCycle(WhichMotor, _Forward_Dir,
+                MotorLinearization_ThrustToDuty(WhichMotor, _Forward_Dir, Thrust));
+    }
+}
+
+/*
+ * AppliedDuty
+ * Helper for main
+ * Signed duty the H bridge applies. DIRB high inverts the PWM, so the
+ * motor sees OCRS/counts - DIRB
+ */
+static double AppliedDuty(MotorControl_Motor_t WhichMotor)
+{
+    double Counts = (double) PR3 + 1;
+    if (_Left_Motor == WhichMotor)
+    {
+        return (OC1CONbits.ON ? OC1RS / Counts : 0) - LATAbits.LATA3;
+    }
+    return (OC2CONbits.ON ? OC2RS / Counts : 0) - LATBbits.LATB9;
+}
+
+/*
+ * CollectEdge
+ * Helper for main
+ * Queues one plant edge. Context points at the motor it came from
+ */
+static void CollectEdge(void *Context, double EdgeTime, bool ChA, bool ChB)
+{
+    if (NumEdges >= MAX_EDGES_PER_STEP)
+    {
+        DroppedEdges++;
+        return;
+    }
+    Edge_t *ThisEdge = &Edges[NumEdges++];
+    ThisEdge->TimeNs = (uint64_t) llround(EdgeTime * 1e9);
+    if (ThisEdge->TimeNs < StepStartNs)
+    {
+        ThisEdge->TimeNs = StepStartNs;
+    }
+    ThisEdge->WhichMotor = *(MotorControl_Motor_t *) Context;
+    ThisEdge->ChA = ChA;
+    ThisEdge->ChB = ChB;
+}
+
+/*
+ * CompareEdges
+ * Helper for main
+ * qsort order for edges, earliest first
+ */
+static int CompareEdges(const void *A, const void *B)
+{
+    uint64_t TimeA = ((const Edge_t *) A)->TimeNs;
+    uint64_t TimeB = ((const Edge_t *) B)->TimeNs;
+    return (TimeA > TimeB) - (TimeA < TimeB);
+}
+
+/*
+ * DeliverEdge
+ * Helper for main
+ * Latches the edge into the capture buffer, sets the encoder pins and runs
+ * the encoder ISR shortly after, as the interrupt controller would
+ */
+static void DeliverEdge(const Edge_t *ThisEdge)
+{
+    SimRegisters_SetTime(ThisEdge->TimeNs + ISR_LATENCY_NS);
+    if (_Left_Motor == ThisEdge->WhichMotor)
+    {
+        IC1BUF = SimRegisters_Timer2At(ThisEdge->TimeNs);
+        PORTAbits.RA4 = ThisEdge->ChA;
+        PORTBbits.RB12 = ThisEdge->ChB;
+        Sim_EnableInterrupts();
+        LeftEncoderHandler();
+    }
+    else
+    {
+        IC3BUF = SimRegisters_Timer2At(ThisEdge->TimeNs);
+        PORTBbits.RB5 = ThisEdge->ChA;
+        PORTBbits.RB11 = ThisEdge->ChB;
+        Sim_EnableInterrupts();
+        RightEncoderHandler();
+    }
+}
+
+/*
+ * RunControlTick
+ * Helper for main
+ * Runs the control law ISR once and records what it cost on this host
+ */
+static void RunControlTick(uint64_t Now)
+{
+    SimRegisters_SetTime(Now);
+    Sim_EnableInterrupts();
+
+    struct timespec Start, End;
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+#ifdef HAVE_CYCLE_COUNTER
+    uint64_t StartCycles = __rdtsc();
+#endif
+    ControlLawHandler();
+#ifdef HAVE_CYCLE_COUNTER
+    uint64_t Cycles = __rdtsc() - StartCycles;
+    TickCyclesSum += Cycles;
+    if (Cycles > TickCyclesPeak) TickCyclesPeak = Cycles;
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &End);
+
+    uint64_t Ns = (uint64_t) ((End.tv_sec - Start.tv_sec) * 1000000000LL +
+            (End.tv_nsec - Start.tv_nsec));
+    TickNsSum += Ns;
+    if (Ns > TickNsPeak) TickNsPeak = Ns;
+    TickCount++;
+}
+
+/*
+ * InitStepStats
+ * Helper for main
+ */
+static void InitStepStats(StepStats_t *Stats, double Target)
+{
+    memset(Stats, 0, sizeof(*Stats));
+    Stats->Target = Target;
+    Stats->RiseStart = -1;
+    Stats->RiseEnd = -1;
+}
+
+/*
+ * UpdateStepStats
+ * Helper for main
+ * Folds one plant speed sample into the step response measurements
+ */
+static void UpdateStepStats(StepStats_t *Stats, double RPM, double Time,
+        double Duration)
+{
+    double Band = fmax(SETTLE_BAND * Stats->Target, MIN_SETTLE_BAND_RPM);
+
+    if (RPM > Stats->Peak) Stats->Peak = RPM;
+    if ((Stats->RiseStart < 0) && (RPM >= 0.1 * Stats->Target)) Stats->RiseStart = Time;
+    if ((Stats->RiseEnd < 0) && (RPM >= 0.9 * Stats->Target)) Stats->RiseEnd = Time;
+    if (fabs(RPM - Stats->Target) > Band) Stats->LastOutside = Time;
+    if (Time >= (1.0 - SSE_WINDOW) * Duration)
+    {
+        if ((0 == Stats->ErrorSamples) || (RPM < Stats->WindowMin)) Stats->WindowMin = RPM;
+        if ((0 == Stats->ErrorSamples) || (RPM > Stats->WindowMax)) Stats->WindowMax = RPM;
+        Stats->ErrorSum += RPM - Stats->Target;
+        Stats->ErrorSquares += (RPM - Stats->Target) * (RPM - Stats->Target);
+        Stats->ErrorSamples++;
+    }
+}
+
+/*
+ * ReportStepStats
+ * Helper for main
+ * Times are -1 where the wheel never got there
+ */
+static void ReportStepStats(const char *Name, const StepStats_t *Stats)
+{
+    char Key[64];
+    bool Risen = (Stats->RiseStart >= 0) && (Stats->RiseEnd >= 0);
+    snprintf(Key, sizeof(Key), "%s_rise_ms", Name);
+    Metric(Key, Risen ? (Stats->RiseEnd - Stats->RiseStart) * 1e3 : -1);
+    snprintf(Key, sizeof(Key), "%s_settle_ms", Name);
+    Metric(Key, Risen ? Stats->LastOutside * 1e3 : -1);
+    snprintf(Key, sizeof(Key), "%s_overshoot_pct", Name);
+    Metric(Key, (Stats->Target > 0) ?
+            fmax(0, 100.0 * (Stats->Peak - Stats->Target) / Stats->Target) : 0);
+    snprintf(Key, sizeof(Key), "%s_sse_rpm", Name);
+    Metric(Key, (Stats->ErrorSamples > 0) ? Stats->ErrorSum / Stats->ErrorSamples : 0);
+
+    // Ripple about the mean speed in the same window
+    double Mean = 0;
+    double Variance = 0;
+    if (Stats->ErrorSamples > 0)
+    {
+        Mean = Stats->ErrorSum / Stats->ErrorSamples;
+        Variance = fmax(0, Stats->ErrorSquares / Stats->ErrorSamples - Mean * Mean);
+    }
+    snprintf(Key, sizeof(Key), "%s_ripple_rms_rpm", Name);
+    Metric(Key, sqrt(Variance));
+    snprintf(Key, sizeof(Key), "%s_ripple_pp_rpm", Name);
+    Metric(Key, Stats->WindowMax - Stats->WindowMin);
+}
+
+/*
+ * ReportTuneStats
+ * Helper for main
+ * The auto tune's own step tests on the old and new gains, as the firmware
+ * measured them. Times are -1 where the wheel never got there
+ */
+static void ReportTuneStats(const char *Name, MotorControl_Motor_t WhichMotor)
+{
+    MotorControl_StepResult_t Results[2];
+    if (!MotorControl_GetTuneComparison(WhichMotor, &Results[0], &Results[1]))
+    {
+        return;
+    }
+    MotorControl_Gains_t Gains = MotorControl_GetGains(WhichMotor);
+    char Key[64];
+    snprintf(Key, sizeof(Key), "%s_tuned_p", Name);
+    Metric(Key, Gains.P);
+    snprintf(Key, sizeof(Key), "%s_tuned_i", Name);
+    Metric(Key, Gains.I);
+    snprintf(Key, sizeof(Key), "%s_tuned_d", Name);
+    Metric(Key, Gains.D);
+    const char *Which[2] = {"old", "new"};
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        snprintf(Key, sizeof(Key), "%s_%s_rise_ms", Name, Which[i]);
+        Metric(Key, (MOTORCONTROL_STEP_NOT_REACHED == Results[i].RiseMs) ? 
+                -1 : Results[i].RiseMs);
+        snprintf(Key, sizeof(Key), "%s_%s_settle_ms", Name, Which[i]);
+        Metric(Key, (MOTORCONTROL_STEP_NOT_REACHED == Results[i].SettleMs) ? 
+                -1 : Results[i].SettleMs);
+        snprintf(Key, sizeof(Key), "%s_%s_overshoot_pct", Name, Which[i]);
+        Metric(Key, Results[i].OvershootPct);
+    }
+}
+
+/*
+ * PlantTicks
+ * Helper for main
+ * Edges the wheel has actually turned through since the start
+ */
+static double PlantTicks(MotorControl_Motor_t WhichMotor)
+{
+    return fabs(Plant[WhichMotor].Edges - StartEdges[WhichMotor]);
+}
+
+/*
+ * Metric
+ * Helper for main
+ */
+static void Metric(const char *Name, double Value)
+{
+    printf("METRIC %s %.4f\n", Name, Value);
+}
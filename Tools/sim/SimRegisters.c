@@ -0,0 +1,158 @@
+/****************************************************************************
+ * File:   SimRegisters.c
+ * Register storage and the simulated clock behind the host xc.h
+ *
+ * Simulated time is kept in nanoseconds. The core timer, Timer2 and the
+ * interrupt enable state are derived from it the way the PIC32 does, so
+ * timestamps the drive code takes line up with the plant's edge times
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <xc.h>
+#include "SimRegisters.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define CORE_TIMER_HZ 20000000ULL // Half of the 40 MHz SYSCLK
+#define TIMER2_HZ 5000000ULL      // 20 MHz PBCLK with prescale of 4
+#define NS_PER_S 1000000000ULL
+
+/*---------------------------- Module Variables ---------------------------*/
+// Timers
+volatile uint32_t T2CON, T3CON, T4CON;
+volatile SimTxCONbits_t T2CONbits, T3CONbits, T4CONbits;
+volatile uint32_t TMR2, TMR3, TMR4, PR2, PR3, PR4;
+
+// Output compare
+volatile uint32_t OC1CON, OC2CON, OC1R, OC1RS, OC2R, OC2RS;
+volatile SimOCxCONbits_t OC1CONbits, OC2CONbits;
+
+// Input capture
+volatile uint32_t IC1CON, IC3CON, IC1BUF, IC3BUF;
+volatile SimICxCONbits_t IC1CONbits, IC3CONbits;
+
+// Interrupt controller
+volatile uint32_t INTCON, IFS0, IFS0SET, IFS0CLR, IEC0, IEC0SET, IEC0CLR;
+volatile SimINTCONbits_t INTCONbits;
+volatile SimIFS0bits_t IFS0bits;
+volatile SimIPCbits_t IPC1bits, IPC3bits, IPC4bits;
+
+// Ports
+volatile uint32_t LATA, LATB, PORTA, PORTB;
+volatile SimLATAbits_t LATAbits;
+volatile SimLATBbits_t LATBbits;
+volatile SimPORTAbits_t PORTAbits;
+volatile SimPORTBbits_t PORTBbits;
+volatile uint32_t RPB4R, RPB8R, IC1R, IC3R;
+
+static uint64_t SimTimeNs;
+static bool InterruptsEnabled;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      SimRegisters_SetTime
+ *
+ * Parameters
+ *      uint64_t TimeNs - Simulated time since reset in nanoseconds
+ * Return
+ *      void
+ * Description
+ *      Moves the simulated clock. Timer2 follows it. Timer3 is held at 0 so
+ *      the drive code never waits for a PWM period match
+****************************************************************************/
+void SimRegisters_SetTime(uint64_t TimeNs)
+{
+    SimTimeNs = TimeNs;
+    if (T2CONbits.ON)
+    {
+        TMR2 = (uint32_t) ((TimeNs * TIMER2_HZ / NS_PER_S) & 0xFFFF);
+    }
+    TMR3 = 0;
+}
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_GetTime
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint64_t, simulated time since reset in nanoseconds
+****************************************************************************/
+uint64_t SimRegisters_GetTime(void)
+{
+    return SimTimeNs;
+}
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_Timer2At
+ *
+ * Parameters
+ *      uint64_t TimeNs - Simulated time in nanoseconds
+ * Return
+ *      uint16_t, what TMR2 read at that time. Latched into ICxBUF for edges
+****************************************************************************/
+uint16_t SimRegisters_Timer2At(uint64_t TimeNs)
+{
+    return (uint16_t) (TimeNs * TIMER2_HZ / NS_PER_S);
+}
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_InterruptsEnabled
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the drive code left interrupts on
+****************************************************************************/
+bool SimRegisters_InterruptsEnabled(void)
+{
+    return InterruptsEnabled;
+}
+
+/****************************************************************************
+ * Function
+ *      Sim_CoreCount
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint32_t, core timer count at the current simulated time
+****************************************************************************/
+uint32_t Sim_CoreCount(void)
+{
+    return (uint32_t) (SimTimeNs * CORE_TIMER_HZ / NS_PER_S);
+}
+
+/****************************************************************************
+ * Function
+ *      Sim_DisableInterrupts
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint32_t, previous Status register. Bit 0 set if interrupts were on
+****************************************************************************/
+uint32_t Sim_DisableInterrupts(void)
+{
+    uint32_t Status = InterruptsEnabled ? 1 : 0;
+    InterruptsEnabled = false;
+    return Status;
+}
+
+/****************************************************************************
+ * Function
+ *      Sim_EnableInterrupts
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+****************************************************************************/
+void Sim_EnableInterrupts(void)
+{
+    InterruptsEnabled = true;
+}
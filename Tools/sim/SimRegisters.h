@@ -0,0 +1,63 @@
+/****************************************************************************
+ * File:   SimRegisters.h
+ * Register storage and the simulated clock behind the host xc.h
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef SIMREGISTERS_H
+#define	SIMREGISTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_SetTime
+ *
+ * Parameters
+ *      uint64_t TimeNs - Simulated time since reset in nanoseconds
+ * Return
+ *      void
+ * Description
+ *      Moves the simulated clock. Timer2 follows it. Timer3 is held at 0 so
+ *      the drive code never waits for a PWM period match
+****************************************************************************/
+void SimRegisters_SetTime(uint64_t TimeNs);
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_GetTime
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint64_t, simulated time since reset in nanoseconds
+****************************************************************************/
+uint64_t SimRegisters_GetTime(void);
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_Timer2At
+ *
+ * Parameters
+ *      uint64_t TimeNs - Simulated time in nanoseconds
+ * Return
+ *      uint16_t, what TMR2 read at that time. Latched into ICxBUF for edges
+****************************************************************************/
+uint16_t SimRegisters_Timer2At(uint64_t TimeNs);
+
+/****************************************************************************
+ * Function
+ *      SimRegisters_InterruptsEnabled
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the drive code left interrupts on
+****************************************************************************/
+bool SimRegisters_InterruptsEnabled(void);
+
+#endif	/* SIMREGISTERS_H */
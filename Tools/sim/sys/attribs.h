@@ -0,0 +1,13 @@
+/****************************************************************************
+ * File:   attribs.h
+ * Host stand-in for XC32's sys/attribs.h. ISRs become plain functions the
+ * drive simulator calls at the right simulated time
+ *
+ * Author: agent
+ ***************************************************************************/
+#ifndef SIM_ATTRIBS_H
+#define SIM_ATTRIBS_H
+
+#define __ISR(Vector, Priority)
+
+#endif /* SIM_ATTRIBS_H */
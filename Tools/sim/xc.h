@@ -0,0 +1,106 @@
+/****************************************************************************
+ * File:   xc.h
+ * Host stand-in for the XC32 device header, used by the drive simulator
+ *
+ * Only the registers and bits the drive train code touches are here. Each
+ * SFR is a plain variable with a bits view, so firmware writes land where
+ * SimRegisters.c and DrivePlant.c can read them back. SET/CLR/INV registers
+ * are separate variables and do not modify the base register.
+ *
+ * Bit positions are not the real ones. Nothing in the drive code depends
+ * on them except through the _MASK defines below, which are kept real.
+ *
+ * Author: agent
+ ***************************************************************************/
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+#include <stdint.h>
+
+typedef struct {
+    unsigned ON:1, SIDL:1, TCKPS:3, T32:1, TCS:1, TGATE:1;
+} SimTxCONbits_t;
+
+typedef struct {
+    unsigned ON:1, SIDL:1, OC32:1, OCTSEL:1, OCM:3;
+} SimOCxCONbits_t;
+
+typedef struct {
+    unsigned ON:1, SIDL:1, C32:1, ICTMR:1, ICI:2, ICM:3;
+} SimICxCONbits_t;
+
+typedef struct {
+    unsigned MVEC:1;
+} SimINTCONbits_t;
+
+typedef struct {
+    unsigned T2IF:1, T3IF:1, T4IF:1, IC1IF:1, IC3IF:1;
+} SimIFS0bits_t;
+
+typedef struct {
+    unsigned IC1IP:3, IC3IP:3, T2IP:3, T4IP:3;
+} SimIPCbits_t;
+
+typedef struct {
+    unsigned LATA0:1, LATA1:1, LATA2:1, LATA3:1, LATA4:1;
+} SimLATAbits_t;
+
+typedef struct {
+    unsigned LATB9:1, LATB13:1, LATB14:1;
+} SimLATBbits_t;
+
+typedef struct {
+    unsigned RA0:1, RA1:1, RA2:1, RA3:1, RA4:1;
+} SimPORTAbits_t;
+
+typedef struct {
+    unsigned RB5:1, RB11:1, RB12:1;
+} SimPORTBbits_t;
+
+// Timers
+extern volatile uint32_t T2CON, T3CON, T4CON;
+extern volatile SimTxCONbits_t T2CONbits, T3CONbits, T4CONbits;
+extern volatile uint32_t TMR2, TMR3, TMR4, PR2, PR3, PR4;
+
+// Output compare (drive PWM)
+extern volatile uint32_t OC1CON, OC2CON, OC1R, OC1RS, OC2R, OC2RS;
+extern volatile SimOCxCONbits_t OC1CONbits, OC2CONbits;
+
+// Input capture (encoders)
+extern volatile uint32_t IC1CON, IC3CON, IC1BUF, IC3BUF;
+extern volatile SimICxCONbits_t IC1CONbits, IC3CONbits;
+
+// Interrupt controller
+extern volatile uint32_t INTCON, IFS0, IFS0SET, IFS0CLR, IEC0, IEC0SET, IEC0CLR;
+extern volatile SimINTCONbits_t INTCONbits;
+extern volatile SimIFS0bits_t IFS0bits;
+extern volatile SimIPCbits_t IPC1bits, IPC3bits, IPC4bits;
+
+// Ports and peripheral pin select
+extern volatile uint32_t LATA, LATB, PORTA, PORTB;
+extern volatile SimLATAbits_t LATAbits;
+extern volatile SimLATBbits_t LATBbits;
+extern volatile SimPORTAbits_t PORTAbits;
+extern volatile SimPORTBbits_t PORTBbits;
+extern volatile uint32_t RPB4R, RPB8R, IC1R, IC3R;
+
+#define _IFS0_T2IF_MASK (1u << 9)
+#define _IFS0_T4IF_MASK (1u << 19)
+#define _IEC0_T2IE_MASK (1u << 9)
+#define _IEC0_T4IE_MASK (1u << 19)
+#define _IFS0_IC1IF_MASK (1u << 6)
+#define _IFS0_IC1EIF_MASK (1u << 5)
+#define _IEC0_IC1IE_MASK (1u << 6)
+#define _IFS0_IC3IF_MASK (1u << 16)
+#define _IFS0_IC3EIF_MASK (1u << 15)
+#define _IEC0_IC3IE_MASK (1u << 16)
+
+// Core timer and interrupt control come from the simulator clock
+uint32_t Sim_CoreCount(void);
+uint32_t Sim_DisableInterrupts(void);
+void Sim_EnableInterrupts(void);
+#define _CP0_GET_COUNT() Sim_CoreCount()
+#define __builtin_disable_interrupts() Sim_DisableInterrupts()
+#define __builtin_enable_interrupts() Sim_EnableInterrupts()
+
+#endif /* SIM_XC_H */
@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+"""Simulate many ConCon/Tug pairs sharing one radio channel.
+
+Discrete event model of the 802.15.4 MAC the XBees run, with 1 to 8 pairs
+on one channel, in two modes:
+  - free:     every ConCon sends control and every Tug sends status on its
+              own timer, at --free-rate, with a random phase and a little
+              clock drift. This is how every team's boards work today
+  - slotted:  SlotSchedule.c. Each pair's ConCon sends control at the start
+              of its 25 ms slot in a 200 ms superframe, and its Tug answers
+              straight away. Slots come from the Tug addresses, and pair
+              clocks agree to within --sync-error ms. Each ConCon also
+              broadcasts a sync once a second
+
+Every frame crosses the sender's UART at --baud, waits for the radio's
+unslotted CSMA-CA (XBee RN, macMinBE, is 0 by default, so there's no
+random backoff until the channel is found busy), goes out at 250 kbit/s
+and is acknowledged, with up to 3 MAC retries. Frames whose airtime
+overlaps are both lost, as is a frame to a radio that is sending at the
+time. --legacy adds pairs from other teams, which always run free.
+
+Reported for each number of pairs:
+  - delivered: control and status frames per second that got through,
+               over all pairs, and as a share of those sent
+  - collided:  share of transmissions that overlapped another one
+  - retries:   MAC retries per frame
+  - latency:   ms from the frame's timer to the other PIC having it,
+               mean and 95th percentile
+  - run:       longest run of lost control frames on any one link. Three
+               in a row trips the Tug's failsafe
+
+    python3 simulate_channel.py
+    python3 simulate_channel.py --pairs 1 4 8 --free-rate 20 --legacy 2
+
+Author: agent
+"""
+import argparse
+import heapq
+import random
+
+# SlotSchedule.c
+NUM_SLOTS = 8
+SLOT_MS = 25
+SUPERFRAME_MS = NUM_SLOTS * SLOT_MS
+GUARD_MS = 2
+SYNC_EVERY = 5
+TUG_ADDRESSES = [0x2187, 0x2086, 0x2184, 0x2188, 0x2085, 0x2185, 0x2186, 0x2083]
+
+# Frames, UART bytes and radio payload bytes
+XBEE_FRAME_SIZE = 15
+PAYLOAD_SIZE = 6
+TELEMETRY_BYTES = 8     # Typical StatusTelemetry block
+LOOP_US = 1000          # Framework handling before an answer
+SLOT_FALLBACK_MARGIN = 5    # TugComm.c
+
+# 802.15.4 at 2.4 GHz, times in us
+BYTE_US = 32
+PHY_MAC_OVERHEAD = 17   # Preamble, SFD, length, MAC header and FCS
+ACK_BYTES = 11
+BACKOFF_US = 320
+CCA_US = 128
+TURNAROUND_US = 192
+ACK_WAIT_US = 864
+MAX_BE = 5
+MAX_CSMA_BACKOFFS = 4
+MAX_FRAME_RETRIES = 3
+
+
+def slot_from_address(address):
+    return (address ^ (address >> 6)) & (NUM_SLOTS - 1)
+
+
+def assign_slots(n):
+    """Slots the pairs settle on. Later pairs move off a taken slot to the
+    lowest free one, as SlotSchedule's MoveSlot does."""
+    slots = []
+    for address in TUG_ADDRESSES[:n]:
+        slot = slot_from_address(address)
+        if slot in slots:
+            slot = min(s for s in range(NUM_SLOTS) if s not in slots)
+        slots.append(slot)
+    return slots
+
+
+class Frame:
+    def __init__(self, kind, pair, src, dst, extra, posted):
+        self.kind = kind
+        self.pair = pair
+        self.src = src
+        self.dst = dst              # None to broadcast
+        self.uart_bytes = XBEE_FRAME_SIZE + extra
+        self.air_us = (PHY_MAC_OVERHEAD + PAYLOAD_SIZE + extra) * BYTE_US
+        self.posted = posted
+        self.retries = 0
+        self.delivered = False
+
+
+class Sim:
+    def __init__(self, args, pairs, mode, rng):
+        self.args = args
+        self.rng = rng
+        self.events = []
+        self.count = 0
+        self.air = []               # (start, end, radio, frame) on the channel
+        self.uart_us_per_byte = 10 * 1e6 / args.baud
+        self.radios = []
+        self.stats = {"sent": 0, "delivered": 0, "tx": 0, "collided": 0,
+                      "retries": 0, "latency": []}
+        self.links = []
+
+        slots = assign_slots(pairs)
+        for p in range(pairs + args.legacy):
+            concon = self.new_radio()
+            tug = self.new_radio()
+            slotted = mode == "slotted" and p < pairs
+            link = {"concon": concon, "tug": tug, "slotted": slotted,
+                    "run": 0, "worst": 0, "tug_timer": 0}
+            self.links.append(link)
+            drift = 1 + rng.uniform(-args.drift, args.drift) * 1e-6
+            if slotted:
+                # Superframe start as this pair sees it
+                offset = rng.uniform(-args.sync_error, args.sync_error) * 1000
+                start = slots[p] * SLOT_MS * 1000 + GUARD_MS * 1000 + offset
+                self.at(start, self.concon_tick, link, SUPERFRAME_MS * 1000 * drift, 0)
+            else:
+                period = 1e6 / args.free_rate
+                self.at(rng.uniform(0, period), self.concon_tick, link, period * drift, 0)
+                period = period / drift
+                self.at(rng.uniform(0, period), self.tug_tick, link, period, None)
+
+    def new_radio(self):
+        radio = {"id": len(self.radios), "queue": [], "busy": False}
+        self.radios.append(radio)
+        return radio
+
+    def at(self, time, fn, *args):
+        self.count += 1
+        heapq.heappush(self.events, (time, self.count, fn, args))
+
+    def run(self, seconds):
+        end = seconds * 1e6
+        while self.events and self.events[0][0] < end:
+            time, _, fn, args = heapq.heappop(self.events)
+            fn(time, *args)
+
+    # Application: PilotFSM and TugComm timers
+    def tick_jitter(self):
+        return self.rng.uniform(0, 1000)    # ES timers tick each ms
+
+    def concon_tick(self, now, link, period, number):
+        self.at(now + period, self.concon_tick, link, period, number + 1)
+        now += self.tick_jitter()
+        extra = 1 if link["slotted"] else 0
+        frame = Frame("control", link, link["concon"], link["tug"], extra, now)
+        self.post(now, frame)
+        if link["slotted"] and number % SYNC_EVERY == 0:
+            self.post(now, Frame("sync", link, link["concon"], None, 0, now))
+
+    def tug_tick(self, now, link, period, generation):
+        if generation is not None and generation != link["tug_timer"]:
+            return  # Re-armed by a slotted control frame
+        if link["slotted"]:
+            self.at(now + period, self.tug_tick, link, period, generation)
+        else:
+            self.at(now + period, self.tug_tick, link, period, None)
+        now += self.tick_jitter()
+        self.post(now, Frame("status", link, link["tug"], link["concon"],
+                             TELEMETRY_BYTES, now))
+
+    def received(self, now, frame):
+        """The other PIC has the whole frame."""
+        if frame.kind == "sync":
+            return
+        self.stats["delivered"] += 1
+        self.stats["latency"].append((now - frame.posted) / 1000.0)
+        link = frame.pair
+        if frame.kind == "control" and link["slotted"]:
+            # TugComm answers now and re-arms TRANSMISSION_TIMER
+            link["tug_timer"] += 1
+            self.post(now + LOOP_US, Frame("status", link, link["tug"],
+                                            link["concon"], TELEMETRY_BYTES, now))
+            fallback = (SUPERFRAME_MS + SLOT_FALLBACK_MARGIN) * 1000
+            self.at(now + fallback, self.tug_tick, link, SUPERFRAME_MS * 1000,
+                    link["tug_timer"])
+
+    def post(self, now, frame):
+        if frame.kind != "sync":
+            self.stats["sent"] += 1
+        arrive = now + frame.uart_bytes * self.uart_us_per_byte
+        self.at(arrive, self.radio_enqueue, frame)
+
+    # Radio: unslotted CSMA-CA, ACK and retries
+    def radio_enqueue(self, now, frame):
+        radio = frame.src
+        radio["queue"].append(frame)
+        if not radio["busy"]:
+            self.next_frame(now, radio)
+
+    def next_frame(self, now, radio):
+        if not radio["queue"]:
+            radio["busy"] = False
+            return
+        radio["busy"] = True
+        self.csma(now, radio["queue"].pop(0))
+
+    def csma(self, now, frame, nb=0, be=None):
+        if be is None:
+            be = self.args.min_be
+        delay = self.rng.randrange(2 ** be) * BACKOFF_US + CCA_US
+        self.at(now + delay, self.cca, frame, nb, be)
+
+    def cca(self, now, frame, nb, be):
+        self.prune(now)
+        busy = any(start < now and end > now - CCA_US for start, end, _, _ in self.air)
+        if busy:
+            nb += 1
+            if nb > MAX_CSMA_BACKOFFS:
+                self.done(now, frame)
+                return
+            self.csma(now, frame, nb, min(be + 1, MAX_BE))
+            return
+        start = now + TURNAROUND_US
+        self.at(start, self.transmit, frame)
+
+    def transmit(self, now, frame):
+        end = now + frame.air_us
+        self.air.append((now, end, frame.src, frame))
+        self.stats["tx"] += 1
+        self.at(end, self.transmitted, frame, now)
+
+    def clean(self, start, end, radio):
+        """True if no other radio, the one listening included, was on the air."""
+        for s, e, r, _ in self.air:
+            if s < end and e > start and r is not radio:
+                return False
+        return True
+
+    def transmitted(self, now, frame, start):
+        ok = self.clean(start, now, frame.src)
+        if not ok:
+            self.stats["collided"] += 1
+        if frame.dst is None:
+            self.done(now, frame)
+            return
+        if ok and not frame.delivered:
+            frame.delivered = True
+            self.at(now + frame.uart_bytes * self.uart_us_per_byte, self.received, frame)
+        if ok:
+            ack = now + TURNAROUND_US
+            self.air.append((ack, ack + ACK_BYTES * BYTE_US, frame.dst, None))
+            self.at(ack + ACK_BYTES * BYTE_US, self.ack_check, frame, ack)
+        else:
+            self.at(now + ACK_WAIT_US, self.retry, frame)
+
+    def ack_check(self, now, frame, start):
+        if self.clean(start, now, frame.dst):
+            self.done(now, frame)
+        else:
+            self.at(start - TURNAROUND_US + ACK_WAIT_US, self.retry, frame)
+
+    def retry(self, now, frame):
+        if frame.retries >= MAX_FRAME_RETRIES:
+            self.done(now, frame)
+            return
+        frame.retries += 1
+        self.stats["retries"] += 1
+        self.csma(now, frame)
+
+    def done(self, now, frame):
+        if frame.kind == "control":
+            link = frame.pair
+            link["run"] = 0 if frame.delivered else link["run"] + 1
+            link["worst"] = max(link["worst"], link["run"])
+        self.next_frame(now, frame.src)
+
+    def prune(self, now):
+        if len(self.air) > 64:
+            self.air = [a for a in self.air if a[1] > now - 20000]
+
+
+def run_case(args, pairs, mode, rng):
+    totals = {"sent": 0, "delivered": 0, "tx": 0, "collided": 0, "retries": 0,
+              "latency": [], "worst": 0}
+    for _ in range(args.trials):
+        sim = Sim(args, pairs, mode, rng)
+        sim.run(args.seconds)
+        for key in ("sent", "delivered", "tx", "collided", "retries"):
+            totals[key] += sim.stats[key]
+        totals["latency"] += sim.stats["latency"]
+        # Only our pairs' links, not the legacy ones
+        totals["worst"] = max([totals["worst"]] +
+                              [link["worst"] for link in sim.links[:pairs]])
+    latency = sorted(totals["latency"]) or [0]
+    seconds = args.trials * args.seconds
+    return (totals["delivered"] / seconds,
+            100.0 * totals["delivered"] / max(totals["sent"], 1),
+            100.0 * totals["collided"] / max(totals["tx"], 1),
+            totals["retries"] / max(totals["sent"], 1),
+            sum(latency) / len(latency),
+            latency[int(len(latency) * 0.95)],
+            totals["worst"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--pairs", type=int, nargs="+", default=list(range(1, 9)))
+    parser.add_argument("--free-rate", type=float, default=5,
+                        help="control and status Hz in free mode")
+    parser.add_argument("--legacy", type=int, default=0,
+                        help="other teams' pairs, always free")
+    parser.add_argument("--baud", type=int, default=111111,
+                        help="XBee link rate. The radio runs BD=7 at 111111")
+    parser.add_argument("--sync-error", type=float, default=2,
+                        help="ms slotted pairs' superframes may be apart")
+    parser.add_argument("--drift", type=float, default=50, help="clock ppm, free mode")
+    parser.add_argument("--min-be", type=int, default=0, help="XBee RN")
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--trials", type=int, default=10)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    print("%d baud, free mode %g Hz, %d legacy pairs, RN %d, %d x %g s per case" % (
+        args.baud, args.free_rate, args.legacy, args.min_be, args.trials, args.seconds))
+    print("%5s %-8s %14s %9s %8s %8s %8s %4s" % (
+        "pairs", "mode", "delivered/s", "collided", "retries", "lat ms", "p95 ms", "run"))
+    for pairs in args.pairs:
+        for mode in ("free", "slotted"):
+            print("%5d %-8s %7.1f %5.1f%% %8.2f%% %8.3f %8.1f %8.1f %4d" % (
+                (pairs, mode) + run_case(args, pairs, mode, rng)))
+
+
+if __name__ == "__main__":
+    main()
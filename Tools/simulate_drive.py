@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+"""Simulate the Tug drive train under the real control law.
+
+Builds Propulsion/MotorControlDriver.c and its helpers with the host
+compiler against the register layer in sim/, runs them against a DC motor
+and encoder model and reports step response and drive metrics:
+  - step:  rise time, settling time (2% or 1 RPM), overshoot and steady
+           state error per wheel, from the true plant speed
+  - drive: DriveStraight. Time to DRIVE_GOAL_REACHED, ticks past the goal
+           and worst left/right mismatch on the way, in ticks and as a
+           heading error
+  - turn:  the same for a clockwise DriveTurn
+  - tune:  the on board auto tune. Its gains and its own step tests on
+           the old and new gains
+  - consistency: a --target step in open loop and in velocity mode over a
+           range of supply and load, with tables swept at nominal. Reports
+           the steady speed of each case and the spread of each mode
+  - failsafe: velocity teleop at --target, stopped at --stop-ms the way the
+           link failsafe stops it. Control ticks that still drove a motor
+           after the stop, and the highest duty they applied
+plus host ns and cycles per control law tick. Host cycles only compare
+builds and gain sets against each other. Use the keyboard harness's 'u'
+for the real PIC32 load.
+
+Gains are given at the 5 ms nominal rate and rescaled to --period the way
+MotorControl_SetControlPeriod does on the Tug. The gain_* lines report the
+per tick gains after that rescale.
+
+    python3 simulate_drive.py --scenario step --target 100 --period 5
+    python3 simulate_drive.py --kp 1.5 --ki 2 --kd 0.3 --period 2
+    python3 simulate_drive.py --scenario drive --distance 150 --mismatch 0.9
+    python3 simulate_drive.py --scenario drive --distance 200 --mismatch 0.9 --accel 0
+    python3 simulate_drive.py --scenario drive --distance 200 --mismatch 0.9 --sync-gain 0
+    python3 simulate_drive.py --max-settle-ms 600 --max-overshoot 25
+    python3 simulate_drive.py --scenario tune --characterized 1
+    python3 simulate_drive.py --scenario consistency --max-spread 2
+    python3 simulate_drive.py --scenario failsafe --max-driven-ticks 0
+
+The last two lines are the old PositionGain creep and a build without
+cross coupling, to compare with the defaults on the same 2 m drive. The
+results are noted at DEFAULT_PROFILE_ACCEL and SyncGain in
+MotorControlDriver.c. --sync-gain rebuilds the firmware with that gain.
+
+With any --max-* limit the script exits non zero if a wheel misses it, so
+it can gate a change to the control law.
+
+Author: agent
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SIM = os.path.join(HERE, "sim")
+TUG = os.path.join(HERE, "..", "TugPicFramework.X")
+FIRMWARE = ["MotorControlDriver.c", "MotorLinearization.c", "MotionProfile.c",
+            "ControlTelemetry.c", "ThrustLatency.c", "VelocityObserver.c"]
+SIM_SOURCES = ["SimMain.c", "SimRegisters.c", "DrivePlant.c"]
+
+# Options passed straight through to the simulator
+SIM_OPTIONS = ["scenario", "target", "distance", "angle", "duration", "stop_ms", "period",
+               "kp", "ki", "kd", "accel", "jerk", "tau", "max_rpm", "deadband",
+               "load", "vbat", "mismatch", "observer", "characterized",
+               "open_loop", "trace"]
+
+# Supply and load cases for the consistency scenario
+CONSISTENCY_VBAT = [1.0, 0.9, 0.8]
+CONSISTENCY_LOAD = [0.0, 0.1]
+
+
+def build(cc, workdir, sync_gain=None):
+    exe = os.path.join(workdir, "drivesim")
+    # sim/ first so its xc.h and sys/attribs.h replace the XC32 ones
+    cmd = [cc, "-O2", "-I", SIM,
+           "-I", os.path.join(TUG, "FrameworkHeaders"),
+           "-I", os.path.join(TUG, "ProjectHeaders"),
+           "-I", os.path.join(TUG, "Propulsion"),
+           "-I", os.path.join(TUG, "HALs")]
+    cmd += [os.path.join(SIM, f) for f in SIM_SOURCES]
+    cmd += [os.path.join(TUG, "Propulsion", f) for f in FIRMWARE]
+    if sync_gain is not None:
+        cmd += ["-DSyncGain=%g" % sync_gain]
+    cmd += ["-lm", "-o", exe]
+    subprocess.check_call(cmd)
+    return exe
+
+
+def run(exe, args):
+    cmd = [exe]
+    for name in SIM_OPTIONS:
+        value = getattr(args, name)
+        if value is not None:
+            cmd += ["--" + name.replace("_", "-"), str(value)]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, universal_newlines=True,
+                         check=True).stdout
+    metrics = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[0] == "METRIC":
+            metrics[fields[1]] = float(fields[2])
+    return metrics
+
+
+def run_consistency(exe, args):
+    """Steps both drive modes through every supply and load case."""
+    metrics = {}
+    for mode, open_loop in (("open", 1), ("velocity", 0)):
+        speeds = []
+        for vbat in CONSISTENCY_VBAT:
+            for load in CONSISTENCY_LOAD:
+                case = argparse.Namespace(**vars(args))
+                case.scenario = "step"
+                case.vbat = vbat
+                case.load = load
+                case.characterized = 1
+                case.open_loop = open_loop
+                case.trace = None
+                step = run(exe, case)
+                # Mean plant speed over the end of the step
+                speed = step["left_sse_rpm"] + args.target
+                metrics["%s_vbat%.1f_load%.1f_rpm" % (mode, vbat, load)] = speed
+                speeds.append(speed)
+        metrics[mode + "_spread_rpm"] = max(speeds) - min(speeds)
+        metrics[mode + "_worst_error_rpm"] = max(abs(v - args.target) for v in speeds)
+    return metrics
+
+
+def check_limits(args, metrics):
+    """Returns a list of failed limits."""
+    failures = []
+    wheels = ("left", "right")
+
+    def over(name, limit, value):
+        if limit is not None and (value < 0 or value > limit):
+            failures.append("%s = %.2f, limit %.2f" % (name, value, limit))
+
+    if args.scenario == "consistency":
+        over("velocity_spread_rpm", args.max_spread, metrics["velocity_spread_rpm"])
+    elif args.scenario == "failsafe":
+        over("driven_ticks_after_stop", args.max_driven_ticks,
+             metrics["driven_ticks_after_stop"])
+    elif args.scenario == "tune":
+        for wheel in wheels:
+            over(wheel + "_new_settle_ms", args.max_settle_ms,
+                 metrics.get(wheel + "_new_settle_ms", -1))
+            over(wheel + "_new_overshoot_pct", args.max_overshoot,
+                 metrics.get(wheel + "_new_overshoot_pct", -1))
+    elif args.scenario == "step":
+        for wheel in wheels:
+            over(wheel + "_settle_ms", args.max_settle_ms, metrics[wheel + "_settle_ms"])
+            over(wheel + "_overshoot_pct", args.max_overshoot, metrics[wheel + "_overshoot_pct"])
+            over("|%s_sse_rpm|" % wheel, args.max_sse, abs(metrics[wheel + "_sse_rpm"]))
+    else:
+        over("goal_reached_ms", args.max_goal_ms, metrics["goal_reached_ms"])
+        for wheel in wheels:
+            over("|%s_overrun_ticks|" % wheel, args.max_overrun,
+                 abs(metrics[wheel + "_overrun_ticks"]))
+    if metrics.get("dropped_edges", 0) > 0:
+        failures.append("plant dropped encoder edges. Shorten the sim step")
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cc", default="gcc")
+    sim = parser.add_argument_group("scenario")
+    sim.add_argument("--scenario",
+                     choices=["step", "drive", "turn", "tune", "consistency", "failsafe"],
+                     default="step")
+    sim.add_argument("--target", type=float, help="RPM. Default 100")
+    sim.add_argument("--distance", type=float, help="drive cm. Default 100")
+    sim.add_argument("--angle", type=float, help="turn degrees. Default 90")
+    sim.add_argument("--duration", type=float, help="seconds. Default 2")
+    sim.add_argument("--stop-ms", type=float, help="failsafe: when to stop. Default 1000")
+    sim.add_argument("--period", type=int, help="control period, 1-20 ms. Default 5")
+    sim.add_argument("--kp", type=float)
+    sim.add_argument("--ki", type=float)
+    sim.add_argument("--kd", type=float)
+    sim.add_argument("--accel", type=int, help="profile RPM/s, 0 for none")
+    sim.add_argument("--jerk", type=int, help="profile RPM/s^2, 0 for trapezoid")
+    sim.add_argument("--observer", type=int, choices=[0, 1],
+                     help="1 to run the speed loops on the velocity observer, 0 on raw "
+                          "encoder speed (default)")
+    sim.add_argument("--characterized", type=int, choices=[0, 1],
+                     help="1 to start with tables a sweep of the plant would "
+                          "measure, which turns on the feedforward")
+    sim.add_argument("--open-loop", type=int, choices=[0, 1],
+                     help="1 to step with the open loop teleop duty cycle")
+    sim.add_argument("--sync-gain", type=float,
+                     help="cross coupling gain to build with, 0 for none. Default 0.5")
+    sim.add_argument("--trace", help="write a per tick CSV here")
+    plant = parser.add_argument_group("plant")
+    plant.add_argument("--tau", type=float, help="time constant, s. Default 0.08")
+    plant.add_argument("--max-rpm", type=float, help="RPM at full duty. Default 170")
+    plant.add_argument("--deadband", type=float, help="duty to start moving. Default 0.3")
+    plant.add_argument("--load", type=float, help="extra friction, fraction of full duty")
+    plant.add_argument("--vbat", type=float, help="supply, fraction of nominal")
+    plant.add_argument("--mismatch", type=float, help="right motor gain vs left")
+    limits = parser.add_argument_group("limits")
+    limits.add_argument("--max-settle-ms", type=float)
+    limits.add_argument("--max-overshoot", type=float, help="percent")
+    limits.add_argument("--max-sse", type=float, help="RPM")
+    limits.add_argument("--max-goal-ms", type=float)
+    limits.add_argument("--max-overrun", type=float, help="ticks")
+    limits.add_argument("--max-spread", type=float,
+                        help="consistency: velocity mode speed spread, RPM")
+    limits.add_argument("--max-driven-ticks", type=float,
+                        help="failsafe: control ticks driving a motor after the stop")
+    args = parser.parse_args()
+
+    if args.scenario == "consistency" and args.target is None:
+        args.target = 100  # needed to turn the step error into a speed
+    if args.scenario == "tune" and args.duration is None:
+        args.duration = 20  # longest the tune can take
+    elif args.scenario in ("drive", "turn") and args.duration is None:
+        args.duration = 5  # long enough for the default moves to finish
+
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = build(args.cc, workdir, args.sync_gain)
+        if args.scenario == "consistency":
+            metrics = run_consistency(exe, args)
+        else:
+            metrics = run(exe, args)
+
+    for name, value in metrics.items():
+        print("%-24s %12.2f" % (name, value))
+
+    failures = check_limits(args, metrics)
+    for failure in failures:
+        print("FAIL " + failure)
+    if any(getattr(args, name) is not None for name in
+           ("max_settle_ms", "max_overshoot", "max_sse", "max_goal_ms",
+            "max_overrun", "max_spread", "max_driven_ticks")):
+        print("FAIL" if failures else "PASS")
+    elif failures:
+        print("FAIL")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
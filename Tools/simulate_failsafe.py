@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Simulate the Tug's link failsafe reaction to losing control frames.
+
+Models TugComm.c on the 1 ms framework tick: FollowControlRate's filtered
+control period, ArmFailsafe's deadline of N and a half periods of the
+longer of that and the last gap (at least MIN_FAILSAFE_TIME), and the 3 s
+COMM_TIMEOUT_TIMER that unpairs. Control frames arrive at --rates with 0
+to --jitter ms of random delay, then stop. For each rate it reports:
+  - reaction: ms from when the first missing frame was due to thrust
+              stopping (Propulsion_FailsafeStop zeroes the duty cycles on
+              the spot, in both drive modes)
+  - gap:      ms from the last frame received to the stop
+  - false trips while the link was still up, from jitter alone
+  - false trips when the ConCon's LinkRate halves its rate part way
+    through (or steps it down 5 Hz with --change step), with this
+    deadline and with the old one of N filtered periods
+next to the old behaviour, where thrust held until the pairing timeout.
+
+Then, in velocity mode, the stop itself: simulate_drive.py's failsafe
+scenario runs the real control law at --target RPM and stops it the way
+TripFailsafe does. It reports the control ticks that still drove a motor
+after the stop, which should be none.
+The 'F' key on the Tug's keyboard harness reports the same reaction time
+on hardware, with 'L' to fake the link loss.
+
+    python3 simulate_failsafe.py
+    python3 simulate_failsafe.py --rates 5 50 --missed 2 --jitter 8
+    python3 simulate_failsafe.py --missed 2 --change step
+
+Author: agent
+"""
+import argparse
+import random
+import tempfile
+
+import simulate_drive
+
+# TugComm.c
+TIMEOUT_TIME = 3000
+TRANSMIT_TIME = 200
+MIN_TRANSMIT_TIME = 20
+PERIOD_FILTER_SHIFT = 2
+PERIOD_FRACTION_BITS = 4
+MIN_FAILSAFE_TIME = 50
+
+# LinkRate.c
+MIN_RATE_HZ = 5
+RATE_STEP_HZ = 5
+
+
+class TugComm:
+    """The failsafe half of TugComm's PairedState, times in whole ms."""
+
+    def __init__(self, missed, now, old_deadline=False):
+        self.missed = missed
+        self.old_deadline = old_deadline
+        self.status_period = TRANSMIT_TIME
+        self.filtered = TRANSMIT_TIME << PERIOD_FRACTION_BITS
+        self.last_interval = TRANSMIT_TIME
+        self.last_control = now
+        self.failsafe_at = None
+        self.active = False
+        self.arm(now)
+
+    def follow_control_rate(self, now):
+        interval = min(max(now - self.last_control, MIN_TRANSMIT_TIME), TRANSMIT_TIME)
+        self.last_control = now
+        self.last_interval = interval
+        error = (interval << PERIOD_FRACTION_BITS) - self.filtered
+        self.filtered += error >> PERIOD_FILTER_SHIFT
+        self.status_period = ((self.filtered + (1 << (PERIOD_FRACTION_BITS - 1)))
+                              >> PERIOD_FRACTION_BITS)
+
+    def arm(self, now):
+        if self.old_deadline:
+            deadline = self.missed * self.status_period
+        else:
+            period = max(self.last_interval, self.status_period)
+            deadline = self.missed * period + (period >> 1)
+        self.failsafe_at = now + max(deadline, MIN_FAILSAFE_TIME)
+
+    def frame(self, now):
+        if self.active:
+            # Recovery frame keeps the rate, like TugComm
+            self.active = False
+            self.last_control = now
+        else:
+            self.follow_control_rate(now)
+        self.arm(now)
+
+    def tick(self, now):
+        if self.failsafe_at is not None and now >= self.failsafe_at:
+            self.failsafe_at = None
+            self.active = True
+            return True
+        return False
+
+
+def changed_rate(rate_hz, change):
+    """The rate LinkRate's PickRate moves to on loss."""
+    if change == "halve":
+        return max(rate_hz / 2, MIN_RATE_HZ)
+    return max(rate_hz - RATE_STEP_HZ, MIN_RATE_HZ)
+
+
+def send_times(rate_hz, seconds, change, change_at):
+    """Control frame send times, the rate changing at change_at seconds."""
+    sends = []
+    now = 0.0
+    while now < seconds * 1000:
+        sends.append(int(now))
+        if change is not None and now >= change_at * 1000:
+            now += 1000.0 / changed_rate(rate_hz, change)
+        else:
+            now += 1000.0 / rate_hz
+    return sends, int(now)
+
+
+def run(rate_hz, missed, jitter, seconds, rng, change=None, old_deadline=False):
+    """One link that drops after `seconds`. Returns (reaction, gap, false trips)."""
+    sends, loss_due = send_times(rate_hz, seconds, change, seconds / 2)
+    arrivals = sorted(t + rng.randint(0, jitter) for t in sends)
+
+    tug = TugComm(missed, 0, old_deadline)
+    next_frame = 0
+    false_trips = 0
+    stop = None
+    for now in range(0, loss_due + TIMEOUT_TIME + 1):
+        while next_frame < len(arrivals) and arrivals[next_frame] <= now:
+            tug.frame(now)
+            next_frame += 1
+        if tug.tick(now):
+            if next_frame < len(arrivals):
+                false_trips += 1
+            else:
+                stop = now
+                break
+    last_frame = arrivals[-1]
+    return stop - loss_due, stop - last_frame, false_trips
+
+
+def velocity_stop(cc, target):
+    """Velocity teleop stopped on the real control law. Returns its metrics."""
+    case = argparse.Namespace(**dict.fromkeys(simulate_drive.SIM_OPTIONS))
+    case.scenario = "failsafe"
+    case.target = target
+    with tempfile.TemporaryDirectory() as workdir:
+        return simulate_drive.run(simulate_drive.build(cc, workdir), case)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--rates", type=float, nargs="+", default=[5, 10, 20, 25, 50],
+                        help="control frame rates, Hz")
+    parser.add_argument("--missed", type=int, default=3,
+                        help="FAILSAFE_MISSED_PERIODS")
+    parser.add_argument("--jitter", type=int, default=5, help="max frame delay, ms")
+    parser.add_argument("--change", choices=["halve", "step"], default="halve",
+                        help="LinkRate change made half way through the link")
+    parser.add_argument("--trials", type=int, default=200)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--target", type=float, default=100,
+                        help="velocity mode speed before the stop, RPM")
+    parser.add_argument("--cc", default="gcc")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    print("missed periods %d, jitter 0-%d ms, %d trials per rate"
+          % (args.missed, args.jitter, args.trials))
+    print("%6s %12s %12s %10s %12s %12s %12s" % (
+        "Hz", "reaction ms", "gap ms", "false", args.change + " false",
+        "was false", "old ms"))
+    for rate in args.rates:
+        reactions, gaps, false_trips = [], [], 0
+        change_trips, old_change_trips = 0, 0
+        for _ in range(args.trials):
+            seconds = rng.uniform(2.0, 4.0)
+            reaction, gap, bad = run(rate, args.missed, args.jitter, seconds, rng)
+            reactions.append(reaction)
+            gaps.append(gap)
+            false_trips += bad
+            # The same link with the rate change, on this and the old deadline
+            state = rng.getstate()
+            change_trips += run(rate, args.missed, args.jitter, seconds, rng,
+                                args.change)[2]
+            rng.setstate(state)
+            old_change_trips += run(rate, args.missed, args.jitter, seconds, rng,
+                                    args.change, old_deadline=True)[2]
+        old = TIMEOUT_TIME - 1000.0 / rate
+        print("%6g %5d-%-6d %5d-%-6d %10d %12d %12d %12d" % (
+            rate, min(reactions), max(reactions), min(gaps), max(gaps),
+            false_trips, change_trips, old_change_trips, old))
+
+    stop = velocity_stop(args.cc, args.target)
+    print("velocity mode at %.4g RPM: %d control ticks drove a motor after the "
+          "stop, peak duty %.1f%%" % (stop["stop_rpm"], stop["driven_ticks_after_stop"],
+                                     100 * stop["peak_duty_after_stop"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Compare time to pair for the selector handshake and Tug discovery.
+
+Monte Carlo model of PilotFSM, TugComm and TugDiscovery timing, from the
+pair button (or 'F' on the ConCon keyboard) until the Tug has its first
+control frame, which is when both sides are paired. Handshakes:
+  - old:       before discovery. The request waits for the ConCon's 200 ms
+               CommsTimer, the Tug acknowledges on its next 200 ms
+               TRANSMISSION_TIMER, and the first control frame waits for
+               the CommsTimer again
+  - selector:  the same request timing, but the Tug acknowledges as soon as
+               it hears the request and the ConCon answers the ack with a
+               control frame straight away
+  - discover:  a broadcast probe, replies from --tugs free Tugs spread over
+               the probe window, then request, ack and control back to back
+               with the best Tug
+
+Every frame takes both UARTs at --baud plus --air ms on the radio, and is
+lost with probability --loss. Lost frames wait for the next periodic
+resend. Colliding probe replies are resent by the radio after a random
+backoff, up to three times, like an unacknowledged unicast.
+
+    python3 simulate_pairing.py
+    python3 simulate_pairing.py --baud 9600 --loss 0.2 --tugs 1 4 8
+
+Author: agent
+"""
+import argparse
+import random
+
+# PilotFSM, TugComm and TugDiscovery
+PAIRING_PERIOD = 200    # CommsTimer and TRANSMISSION_TIMER while pairing
+PROBE_WINDOW = 40
+AIR_MARGIN = 5
+FRAME_BYTES = 15
+LOOP_MS = 1             # Framework event handling between a frame and its answer
+
+MAC_RETRIES = 3
+MAC_BACKOFF_MS = 2.5    # 802.15.4 backoff, roughly
+CCA_MS = 0.2            # Replies starting closer than this collide
+
+
+class Link:
+    def __init__(self, baud, air, loss, rng):
+        self.uart = FRAME_BYTES * 10 * 1000.0 / baud
+        self.air = air
+        self.loss = loss
+        self.rng = rng
+
+    @property
+    def latency(self):
+        """ms from posting a frame to the other side acting on it."""
+        return 2 * self.uart + self.air + LOOP_MS
+
+    def lost(self):
+        return self.rng.random() < self.loss
+
+    def deliver(self, send, period):
+        """Arrival of the first copy to get through, resent every period."""
+        while self.lost():
+            send += period
+        return send + self.latency
+
+
+def old(link, rng):
+    request = rng.uniform(0, PAIRING_PERIOD)    # CommsTimer phase
+    heard = link.deliver(request, PAIRING_PERIOD)
+    acked = link.deliver(heard + PAIRING_PERIOD, PAIRING_PERIOD)
+    # Control goes on the CommsTimer grid the requests were on
+    ticks = int((acked - request) // PAIRING_PERIOD) + 1
+    return link.deliver(request + ticks * PAIRING_PERIOD, PAIRING_PERIOD)
+
+
+def selector(link, rng):
+    request = rng.uniform(0, PAIRING_PERIOD)
+    heard = link.deliver(request, PAIRING_PERIOD)
+    acked = link.deliver(heard, PAIRING_PERIOD)
+    return link.deliver(acked, PAIRING_PERIOD)
+
+
+def probe_round(link, tugs, rng, start):
+    """Reply arrival times at the ConCon that beat the discovery timer."""
+    sends = []
+    for _ in range(tugs):
+        if link.lost():
+            continue
+        sends.append(start + link.latency + 1 + rng.uniform(0, PROBE_WINDOW))
+    arrivals = []
+    for tries in range(MAC_RETRIES + 1):
+        sends.sort()
+        retry = []
+        channel_free = 0.0
+        for i, s in enumerate(sends):
+            near = [o for j, o in enumerate(sends) if j != i and abs(o - s) < CCA_MS]
+            if near:
+                retry.append(s + rng.uniform(0, MAC_BACKOFF_MS))
+                continue
+            # CSMA waits out a reply already on the air
+            s = max(s, channel_free)
+            channel_free = s + link.air
+            if not link.lost():
+                arrivals.append(channel_free + link.uart + LOOP_MS)
+        sends = retry
+    wait = PROBE_WINDOW + 2 * (int(link.uart) + 1) + AIR_MARGIN
+    return [a for a in arrivals if a <= start + wait], start + wait
+
+
+def discover(link, tugs, rng):
+    start = LOOP_MS
+    while True:
+        replies, end = probe_round(link, tugs, rng, start)
+        if replies:
+            break
+        # Back to AttemptingToPair, the next CommsTimer probes again
+        start = end + PAIRING_PERIOD
+    heard = link.deliver(end, PAIRING_PERIOD)
+    acked = link.deliver(heard, PAIRING_PERIOD)
+    return link.deliver(acked, PAIRING_PERIOD)
+
+
+def stats(times):
+    times = sorted(times)
+    return (sum(times) / len(times), times[len(times) // 2],
+            times[int(len(times) * 0.95)], times[-1])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--baud", type=int, default=111111,
+                        help="XBee link rate. The radio runs BD=7 at 111111")
+    parser.add_argument("--air", type=float, default=1.0, help="ms on the radio per frame")
+    parser.add_argument("--loss", type=float, default=0.05, help="frame loss probability")
+    parser.add_argument("--tugs", type=int, nargs="+", default=[1, 4, 8],
+                        help="free Tugs answering the probe")
+    parser.add_argument("--trials", type=int, default=20000)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    link = Link(args.baud, args.air, args.loss, rng)
+    runs = [("old", lambda: old(link, rng)),
+            ("selector", lambda: selector(link, rng))]
+    for tugs in args.tugs:
+        runs.append(("discover %d" % tugs, lambda tugs=tugs: discover(link, tugs, rng)))
+
+    print("%d baud, %.1f ms air, %.0f%% frame loss, %d trials" % (
+        args.baud, args.air, args.loss * 100, args.trials))
+    print("%-12s %8s %8s %8s %8s   ms to paired" % ("", "mean", "median", "p95", "max"))
+    for name, run in runs:
+        print("%-12s %8.1f %8.1f %8.1f %8.1f" % ((name,) + stats(
+            [run() for _ in range(args.trials)])))
+
+
+if __name__ == "__main__":
+    main()
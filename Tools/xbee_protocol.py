@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Class protocol messages carried over the XBee link, described once.
+
+Every message rides in the data of an XBee 802.15.4 API frame: a TX Request
+16 (0x01) from our PIC to its radio, an RX Packet 16 (0x81) from the radio
+on the other end. The data is always PAYLOAD_SIZE bytes, the message ID
+then the fields below, padded with zeros. Our own boards may follow that
+with up to MAX_EXTRA_SIZE more bytes, like the Tug's status telemetry.
+
+gen_xbee_protocol.py turns MESSAGES into the firmware's XBeeProtocol.h/.c,
+and decode_xbee.py uses it to decode captures, so a change here reaches
+both boards and the host tools. This file also packs and unpacks on the
+host, the same way the generated C does.
+
+Field types:
+    int8, uint8     one byte
+    uint16          two bytes, MSB first
+    const           one byte always sent as `value`, not kept in the struct
+
+Author: agent
+"""
+import struct
+
+START_DELIMITER = 0x7E
+API_TX16 = 0x01         # TX Request, 16 bit address
+API_RX16 = 0x81         # RX Packet, 16 bit address
+API_TX_STATUS = 0x89
+BROADCAST_ADDRESS = 0xFFFF
+
+PAYLOAD_SIZE = 6        # Message ID plus 5 data bytes
+MAX_EXTRA_SIZE = 20     # After the message, on our own boards only
+TX16_HEADER_SIZE = 5    # API ID, frame ID, destination, options
+RX16_HEADER_SIZE = 5    # API ID, source, RSSI, options
+TX_STATUS_SIZE = 3      # API ID, frame ID, status
+
+TX_STATUS_NAMES = {0: "success", 1: "no ACK", 2: "CCA failure", 3: "purged"}
+
+FIELD_SIZES = {"int8": 1, "uint8": 1, "uint16": 2, "const": 1}
+FIELD_STRUCT = {"int8": "b", "uint8": "B", "uint16": "H", "const": "B"}
+FIELD_C_TYPES = {"int8": "int8_t", "uint8": "uint8_t", "uint16": "uint16_t"}
+
+
+class Field:
+    def __init__(self, name, ftype, doc="", value=0):
+        if ftype not in FIELD_SIZES:
+            raise ValueError("unknown field type " + ftype)
+        self.name = name
+        self.type = ftype
+        self.doc = doc
+        self.value = value
+
+    @property
+    def size(self):
+        return FIELD_SIZES[self.type]
+
+
+class Message:
+    def __init__(self, name, message_id, sender, doc, fields, receiver=None):
+        self.name = name
+        self.id = message_id
+        self.sender = sender
+        self.receiver = receiver or ("Tug" if sender == "ConCon" else "ConCon")
+        self.doc = doc
+        self.fields = fields
+        size = sum(f.size for f in fields)
+        if size > PAYLOAD_SIZE - 1:
+            raise ValueError("%s needs %d data bytes, only %d fit"
+                             % (name, size, PAYLOAD_SIZE - 1))
+        self.format = ">" + "".join(FIELD_STRUCT[f.type] for f in fields) \
+            + "x" * (PAYLOAD_SIZE - 1 - size)
+
+    @property
+    def struct_fields(self):
+        """Fields kept in the C struct, i.e. all but the constants."""
+        return [f for f in self.fields if f.type != "const"]
+
+    def pack(self, **values):
+        """Payload bytes: message ID then fields. Missing fields are 0."""
+        args = [f.value if f.type == "const" else values.get(f.name, 0)
+                for f in self.fields]
+        return bytes([self.id]) + struct.pack(self.format, *args)
+
+    def unpack(self, payload):
+        """Dict of field values from payload bytes, constants included."""
+        values = struct.unpack(self.format, payload[1:PAYLOAD_SIZE])
+        return dict(zip((f.name for f in self.fields), values))
+
+
+MESSAGES = [
+    Message("Control", 1, "ConCon", "Thrust request, each pilot period", [
+        Field("X", "int8", "Surge, + forward"),
+        Field("Y", "int8", "Sway, unused by our Tug"),
+        Field("Yaw", "int8", "+ clockwise"),
+        Field("Refuel", "uint8", "Nonzero to refuel"),
+        Field("Mode3", "uint8", "Nonzero while the mode 3 button is held"),
+    ]),
+    Message("Status", 2, "Tug", "Answer to each control frame", [
+        Field("FuelLevel", "uint8"),
+        Field("TimeToEmpty", "uint16", "Tenths of a second, 0xFFFF if not burning"),
+    ]),
+    Message("RequestToPair", 3, "ConCon", "Sent until the Tug acknowledges", [
+        Field("TugAddress", "uint16"),
+        Field("PilotAddress", "uint16"),
+        Field("Ack", "const", value=0xAA),
+    ]),
+    Message("PairingAcknowledged", 4, "Tug", "Sent until the first control frame", [
+        Field("TugAddress", "uint16"),
+        Field("PilotAddress", "uint16"),
+        Field("Ack", "const", value=0x55),
+    ]),
+    Message("Probe", 5, "ConCon", "Our boards only. Broadcast to find free Tugs", [
+        Field("PilotAddress", "uint16"),
+        Field("Round", "uint8", "Discovery round, echoed in replies"),
+        Field("Window", "uint8", "ms the Tugs spread their replies over"),
+    ]),
+    Message("ProbeReply", 6, "Tug", "Our boards only. A free Tug answering a probe", [
+        Field("TugAddress", "uint16"),
+        Field("Round", "uint8"),
+        Field("RSSI", "uint8", "-dBm the Tug heard the probe at"),
+    ]),
+    Message("Sync", 7, "ConCon", "Our boards only. Broadcast in our airtime slot", [
+        Field("TugAddress", "uint16", "Our Tug, breaks ties when two pairs want one slot"),
+        Field("Slot", "uint8"),
+        Field("Offset", "uint8", "ms into the slot the frame was built"),
+    ], receiver="ConCon"),
+]
+
+BY_ID = {m.id: m for m in MESSAGES}
+
+
+def checksum(data):
+    """XBee API checksum of the frame data, API ID onward."""
+    return 0xFF - (sum(data) & 0xFF)
+
+
+def frame(data):
+    """Whole API frame around the frame data."""
+    return bytes([START_DELIMITER, len(data) >> 8, len(data) & 0xFF]) + data \
+        + bytes([checksum(data)])
+
+
+def tx16_frame(frame_id, destination, payload, options=0):
+    return frame(struct.pack(">BBHB", API_TX16, frame_id, destination, options)
+                 + payload)
+
+
+def rx16_frame(source, rssi, payload, options=0):
+    return frame(struct.pack(">BHBB", API_RX16, source, rssi, options) + payload)
@@ -24,6 +24,8 @@
 #include "TugComm.h"
 #include "../Propulsion/Propulsion.h"
 #include "XBeeTXSM.h"
+#include "LinkStats.h"
+#include "SlotSchedule.h"
 #include "../HALs/PIC32PortHAL.h"
 #include <xc.h>
 #include <sys/attribs.h>
@@ -40,6 +42,15 @@
 #define ONE_SEC
 #define TIMEOUT_TIME 3000 // 3 sec
 #define TRANSMIT_TIME 200 // ms (5 Hz)
+#define MIN_TRANSMIT_TIME 20 // ms (50 Hz), fastest status rate while paired
+#define PERIOD_FILTER_SHIFT 2 // Each control frame moves StatusPeriod 1/4 of the way
+#define PERIOD_FRACTION_BITS 4
+#define FAILSAFE_MISSED_PERIODS 3 // Default control periods without a frame before thrust stops
+#define MIN_FAILSAFE_PERIODS 2
+#define MAX_FAILSAFE_PERIODS 8
+#define MIN_FAILSAFE_TIME 50 // ms, so jitter at 50 Hz can't trip it
+#define MAX_PROBE_WINDOW 100 // ms, longest a probe can ask us to wait
+#define SLOT_FALLBACK_MARGIN 5 // ms past a superframe, so a slotted control frame beats the timer
 
 #define BUTTON_PORT PORTAbits.RA0
 
@@ -48,6 +59,11 @@
 /* prototypes for private functions for this machine.They should be functions
    relevant to the behavior of this state machine
 */
+static void StartStatusFollowing(void);
+static void FollowControlRate(void);
+static void ArmFailsafe(void);
+static void TripFailsafe(void);
+static uint16_t ProbeReplyDelay(uint8_t Window);
 
 /*---------------------------- Module Variables ---------------------------*/
 // everybody needs a state variable, you may need others as well.
@@ -59,6 +75,19 @@ static uint8_t MyPriority;
 
 bool LastButtonState;
 
+// Status goes out at the rate control frames arrive, so a ConCon that
+// speeds up its control frames gets status back as often
+static uint16_t StatusPeriod; // ms
+static uint16_t FilteredPeriod; // ms with PERIOD_FRACTION_BITS
+static uint16_t LastControlTime;
+static uint16_t LastInterval; // ms, the last gap FollowControlRate measured
+
+// First stage of losing the link. Thrust stops after FailsafePeriods control
+// periods without a frame, the pairing stays until COMM_TIMEOUT_TIMER
+static uint8_t FailsafePeriods;
+static bool FailsafeActive;
+static TugComm_FailsafeStats_t FailsafeStats;
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -91,6 +120,10 @@ bool InitTugComm(uint8_t Priority)
     PortSetup_ConfigureDigitalInputs(_Port_A, _Pin_0);
     PortSetup_ConfigurePullUps(_Port_A, _Pin_0);
     LastButtonState = BUTTON_PORT;
+    
+    FailsafePeriods = FAILSAFE_MISSED_PERIODS;
+    FailsafeActive = false;
+    TugComm_ClearFailsafeStats();
 
     puts("...Done Initializing TugComm\r\n");
  
@@ -164,11 +197,31 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                     PostEvent.EventType = WAIT_TO_PAIR;
                     PostPropulsion(PostEvent);
                 } break;
+                case (XBEE_PROBE_RECEIVED):
+                {
+                    // Spread replies over the probe's window so every free
+                    // Tug gets heard. EventParam is the window in ms
+                    ES_Timer_InitTimer(PROBE_REPLY_TIMER, ProbeReplyDelay(ThisEvent.EventParam));
+                } break;
+                case (ES_TIMEOUT):
+                {
+                    if (ThisEvent.EventParam == PROBE_REPLY_TIMER)
+                    {
+                        printdebug("TugComm: XBEE_TRANSMIT Probe Reply\r\n");
+                        PostEvent.EventType = XBEE_TRANSMIT_MESSAGE;
+                        PostXBeeTXSM(PostEvent);
+                    }
+                } break;
                 case (XBEE_MESSAGE_RECEIVED):
                 {
                     printdebug("TugComm: XBEE_MESSAGE_RECEIVED in PairRequestState\r\n");
                     CurrentState = WaitingForControlPacketState;
+                    ES_Timer_StopTimer(PROBE_REPLY_TIMER);
                     
+                    // Acknowledge now rather than on the next timeout, so
+                    // the first control frame can follow right away
+                    PostEvent.EventType = XBEE_TRANSMIT_MESSAGE;
+                    PostXBeeTXSM(PostEvent);
                     //Init COMM_TIMEOUT_TIMER (5 s) 
                     ES_Timer_InitTimer(COMM_TIMEOUT_TIMER, TIMEOUT_TIME);
                     //Init TRANSMISSION_TIMER (0.2 s)
@@ -190,6 +243,7 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                     // Stop timers and return to Waiting for Pair Request
                     ES_Timer_StopTimer(COMM_TIMEOUT_TIMER);
                     ES_Timer_StopTimer(TRANSMISSION_TIMER);
+                    LinkStats_PairingEnded(false);
                     // Post WAIT_TO_PAIR TO PROPULSION
                     PostEvent.EventType = WAIT_TO_PAIR;
                     PostPropulsion(PostEvent);
@@ -205,6 +259,7 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                         // Stop timers and return to Waiting for Pair Request
                         ES_Timer_StopTimer(COMM_TIMEOUT_TIMER);
                         ES_Timer_StopTimer(TRANSMISSION_TIMER);
+                        LinkStats_PairingEnded(true);
                         // Post WAIT_TO_PAIR TO PROPULSION
                         PostEvent.EventType = WAIT_TO_PAIR;
                         PostPropulsion(PostEvent);
@@ -229,6 +284,8 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                     //Post  PAIRING_COMPLETE to Propulsion &
                     PostEvent.EventType = PAIRING_COMPLETE;
                     PostPropulsion(PostEvent);
+                    StartStatusFollowing();
+                    ArmFailsafe();
                     //Init COMM_TIMEOUT_TIMER (5 s) 
                     ES_Timer_InitTimer(COMM_TIMEOUT_TIMER, TIMEOUT_TIME);
                     //Init TRANSMISSION_TIMER (0.2 s)
@@ -249,6 +306,8 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                     // Stop timers and return to Waiting for Pair Request
                     ES_Timer_StopTimer(COMM_TIMEOUT_TIMER);
                     ES_Timer_StopTimer(TRANSMISSION_TIMER);
+                    ES_Timer_StopTimer(FAILSAFE_TIMER);
+                    LinkStats_PairingEnded(false);
                     // Post WAIT_TO_PAIR TO PROPULSION
                     PostEvent.EventType = WAIT_TO_PAIR;
                     PostPropulsion(PostEvent);
@@ -264,6 +323,8 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                         // Stop timers and return to Waiting for Pair Request
                         ES_Timer_StopTimer(COMM_TIMEOUT_TIMER);
                         ES_Timer_StopTimer(TRANSMISSION_TIMER);
+                        ES_Timer_StopTimer(FAILSAFE_TIMER);
+                        LinkStats_PairingEnded(true);
                         // Post WAIT_TO_PAIR TO PROPULSION
                         PostEvent.EventType = WAIT_TO_PAIR;
                         PostPropulsion(PostEvent);
@@ -273,18 +334,43 @@ ES_Event_t RunTugComm(ES_Event_t ThisEvent)
                     else if (ThisEvent.EventParam == TRANSMISSION_TIMER)
                     {
                         // Transmit Status
-                        printdebug("TugComm: XBEE_TRANSMIT Status\r\n");
                         PostEvent.EventType = XBEE_TRANSMIT_MESSAGE;
                         PostXBeeTXSM(PostEvent);
-                        // Reinit timer
-                        ES_Timer_InitTimer(TRANSMISSION_TIMER, TRANSMIT_TIME);
+                        // Reinit timer at the rate control is arriving
+                        ES_Timer_InitTimer(TRANSMISSION_TIMER, StatusPeriod);
+                    }
+                    else if (ThisEvent.EventParam == FAILSAFE_TIMER)
+                    {
+                        // Control frames stopped. Stop thrust, stay paired
+                        TripFailsafe();
                     }
                 } break;
                 case (XBEE_MESSAGE_RECEIVED):
                 {
-                    printdebug("TugComm: XBEE_MESSAGE_RECEIVED in PairedState\r\n");
                     // Reinit COMM_Timeout_Timer
                     ES_Timer_InitTimer(COMM_TIMEOUT_TIMER, TIMEOUT_TIME);
+                    if (FailsafeActive)
+                    {
+                        // This frame already set thrust again. The outage
+                        // isn't a control period, so the rate is kept
+                        printdebug("TugComm: Control frames back, failsafe cleared\r\n");
+                        FailsafeActive = false;
+                        FailsafeStats.Recoveries++;
+                        LastControlTime = ES_Timer_GetTime();
+                    }
+                    else
+                    {
+                        FollowControlRate();
+                    }
+                    ArmFailsafe();
+                    if (SlotSchedule_IsFollowing())
+                    {
+                        // Answer inside the ConCon's slot. If its next
+                        // frame is lost, the timer still lands in the slot
+                        PostEvent.EventType = XBEE_TRANSMIT_MESSAGE;
+                        PostXBeeTXSM(PostEvent);
+                        ES_Timer_InitTimer(TRANSMISSION_TIMER, SLOTSCHEDULE_SUPERFRAME_MS + SLOT_FALLBACK_MARGIN);
+                    }
                 } break;
                 default:
                     ;
@@ -355,8 +441,243 @@ bool CheckPairingButton(void)
     return ReturnVal;
 }
 
+/****************************************************************************
+ Function
+    TugComm_SetFailsafePeriods
+
+ Parameters
+    uint8_t MissedPeriods - Control periods without a frame before thrust stops
+
+ Returns
+    bool, false if out of range and unchanged
+
+ Description
+    Sets the first stage of the link failsafe. Used from the next frame on
+ Notes
+
+ Author
+ agent
+****************************************************************************/
+bool TugComm_SetFailsafePeriods(uint8_t MissedPeriods)
+{
+    if ((MissedPeriods < MIN_FAILSAFE_PERIODS) || (MissedPeriods > MAX_FAILSAFE_PERIODS))
+    {
+        return false;
+    }
+    FailsafePeriods = MissedPeriods;
+    return true;
+}
+
+/****************************************************************************
+ Function
+    TugComm_GetFailsafeStats
+
+ Parameters
+    TugComm_FailsafeStats_t *ThisStats - Filled with the failsafe settings and counts
+
+ Returns
+    None
+
+ Description
+    Reaction times are measured against the control rate at the time
+ Notes
+
+ Author
+ agent
+****************************************************************************/
+void TugComm_GetFailsafeStats(TugComm_FailsafeStats_t *ThisStats)
+{
+    *ThisStats = FailsafeStats;
+    ThisStats->MissedPeriods = FailsafePeriods;
+    ThisStats->ControlPeriod = StatusPeriod;
+}
+
+/****************************************************************************
+ Function
+    TugComm_ClearFailsafeStats
+
+ Parameters
+    None
+
+ Returns
+    None
+
+ Description
+    Zeroes the failsafe counts and reaction times
+ Notes
+
+ Author
+ agent
+****************************************************************************/
+void TugComm_ClearFailsafeStats(void)
+{
+    FailsafeStats.Trips = 0;
+    FailsafeStats.Recoveries = 0;
+    FailsafeStats.LastGap = 0;
+    FailsafeStats.LastReaction = 0;
+    FailsafeStats.MaxReaction = 0;
+}
 
 /***************************************************************************
  private functions
  ***************************************************************************/
+/****************************************************************************
+ Function
+    StartStatusFollowing
+
+ Parameters
+    None
+
+ Returns
+    None
 
+ Description
+    Starts status at the 5 Hz protocol rate when pairing completes
+ Notes
+
+ Author
+ agent
+****************************************************************************/
+static void StartStatusFollowing(void)
+{
+    StatusPeriod = TRANSMIT_TIME;
+    FilteredPeriod = TRANSMIT_TIME << PERIOD_FRACTION_BITS;
+    LastInterval = TRANSMIT_TIME;
+    LastControlTime = ES_Timer_GetTime();
+}
+
+/****************************************************************************
+ Function
+    FollowControlRate
+
+ Parameters
+    None
+
+ Returns
+    None
+
+ Description
+    Moves StatusPeriod toward the time since the last control frame
+ Notes
+    Gaps are clamped to the 5 Hz period, so one lost frame only nudges
+    the rate down. A ConCon fixed at 5 Hz keeps status at 5 Hz
+ Author
+ agent
+****************************************************************************/
+static void FollowControlRate(void)
+{
+    uint16_t Now = ES_Timer_GetTime();
+    uint16_t Interval = Now - LastControlTime;
+    LastControlTime = Now;
+
+    if (Interval < MIN_TRANSMIT_TIME)
+    {
+        Interval = MIN_TRANSMIT_TIME;
+    }
+    else if (Interval > TRANSMIT_TIME)
+    {
+        Interval = TRANSMIT_TIME;
+    }
+    LastInterval = Interval;
+    int16_t Error = (int16_t) (Interval << PERIOD_FRACTION_BITS) - (int16_t) FilteredPeriod;
+    FilteredPeriod += Error >> PERIOD_FILTER_SHIFT;
+    StatusPeriod = (FilteredPeriod + (1 << (PERIOD_FRACTION_BITS - 1))) >> PERIOD_FRACTION_BITS;
+}
+
+/****************************************************************************
+ Function
+    ArmFailsafe
+
+ Parameters
+    None
+
+ Returns
+    None
+
+ Description
+    Restarts FAILSAFE_TIMER for FailsafePeriods and a half of the control
+    period, measured from the frame just received
+ Notes
+    The period is the longer of the filtered one and the last gap, so the
+    deadline widens at once when the ConCon slows down. The ConCon can
+    halve its rate between two frames, making the next gap twice the
+    period with nothing lost. The extra half period keeps that gap inside
+    the deadline at MIN_FAILSAFE_PERIODS.
+    Both are clamped to the 5 Hz period, so a ConCon at 5 Hz gets the
+    longest deadline and a 50 Hz ConCon the shortest
+ Author
+ agent
+****************************************************************************/
+static void ArmFailsafe(void)
+{
+    uint16_t Period = (LastInterval > StatusPeriod) ? LastInterval : StatusPeriod;
+    uint16_t Deadline = (uint16_t) FailsafePeriods * Period + (Period >> 1);
+    if (Deadline < MIN_FAILSAFE_TIME)
+    {
+        Deadline = MIN_FAILSAFE_TIME;
+    }
+    ES_Timer_InitTimer(FAILSAFE_TIMER, Deadline);
+}
+
+/****************************************************************************
+ Function
+    TripFailsafe
+
+ Parameters
+    None
+
+ Returns
+    None
+
+ Description
+    Stops thrust and records how long after the link went quiet it did
+ Notes
+    The link is counted lost when the next frame was due, one control
+    period after the last one arrived
+ Author
+ agent
+****************************************************************************/
+static void TripFailsafe(void)
+{
+    Propulsion_FailsafeStop();
+    
+    uint16_t Gap = ES_Timer_GetTime() - LastControlTime;
+    uint16_t Reaction = (Gap > StatusPeriod) ? (Gap - StatusPeriod) : 0;
+    FailsafeActive = true;
+    FailsafeStats.Trips++;
+    FailsafeStats.LastGap = Gap;
+    FailsafeStats.LastReaction = Reaction;
+    if (Reaction > FailsafeStats.MaxReaction)
+    {
+        FailsafeStats.MaxReaction = Reaction;
+    }
+    printdebug("TugComm: FAILSAFE, no control for %u ms, thrust stopped\r\n", Gap);
+}
+
+/****************************************************************************
+ Function
+    ProbeReplyDelay
+
+ Parameters
+    uint8_t Window - ms the probing ConCon spreads replies over
+
+ Returns
+    uint16_t, ms to wait before replying
+
+ Description
+    Random delay within the window. The core timer's phase when the probe
+    arrived is different on every Tug, which is random enough
+ Notes
+
+ Author
+ agent
+****************************************************************************/
+static uint16_t ProbeReplyDelay(uint8_t Window)
+{
+    if (Window > MAX_PROBE_WINDOW)
+    {
+        Window = MAX_PROBE_WINDOW;
+    }
+    // At least 1 ms, so the timer always runs
+    return 1 + ((Window > 0) ? ((_CP0_GET_COUNT() >> 4) % Window) : 0);
+}
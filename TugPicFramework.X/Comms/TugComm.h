@@ -22,6 +22,17 @@ typedef enum
     WaitingForPairRequestState, WaitingForControlPacketState, PairedState
 }TugCommState_t;
 
+typedef struct
+{
+    uint8_t MissedPeriods;  // Control periods without a frame before thrust stops
+    uint16_t Trips;         // Times thrust was stopped
+    uint16_t Recoveries;    // Times control frames came back before the pairing timeout
+    uint16_t LastGap;       // ms from the last control frame to the stop
+    uint16_t LastReaction;  // ms from the first missed frame to the stop
+    uint16_t MaxReaction;
+    uint16_t ControlPeriod; // ms, control rate the deadline follows
+}TugComm_FailsafeStats_t;
+
 // Public Function Prototypes
 
 bool InitTugComm(uint8_t Priority);
@@ -29,6 +40,9 @@ bool PostTugComm(ES_Event_t ThisEvent);
 ES_Event_t RunTugComm(ES_Event_t ThisEvent);
 TugCommState_t QueryTugComm(void);
 bool CheckPairingButton(void);
+bool TugComm_SetFailsafePeriods(uint8_t MissedPeriods);
+void TugComm_GetFailsafeStats(TugComm_FailsafeStats_t *ThisStats);
+void TugComm_ClearFailsafeStats(void);
 
 
 #endif /* TugComm_H */
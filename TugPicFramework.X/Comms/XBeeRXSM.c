@@ -27,7 +27,13 @@
 #include "XBeeRXSM.h"
 #include "../HALs/PIC32PortHAL.h"
 #include "TugComm.h"
+#include "XBeeBaud.h"
+#include "LinkStats.h"
+#include "TXStatus.h"
+#include "SlotSchedule.h"
+#include "StatusTelemetry.h"
 #include "../Propulsion/Propulsion.h"
+#include "../Propulsion/ThrustLatency.h"
 #include <stdbool.h>
 #include <proc/p32mx170f256b.h>
 
@@ -40,7 +46,7 @@
 #define printdebug(fmt, ...) (0)
 #endif
 
-#define API_ID_RX16 0x81 // API Identifier for RX 16bit packet 
+#define RX_BUFFER_SIZE 64 // Power of 2. Room for 4 frames
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this machine.They should be functions
@@ -61,11 +67,16 @@ static XBeeRXState_t CurrentState;
 // with the introduction of Gen2, we need a module level Priority var as well
 static uint8_t MyPriority;
 
-static uint8_t RXMessageArray[15];
+static uint8_t RXMessageArray[XBEE_FRAME_SIZE + SLOTSCHEDULE_EXTRA_SIZE]; // Slot byte on control
 static uint8_t ByteIndex;
 
 static bool LastRXBufferState;
 
+// Filled by the UART2 ISR, emptied one byte per event by IsRXBufferNonempty
+static volatile uint8_t RXBuffer[RX_BUFFER_SIZE];
+static volatile uint8_t RXHead;
+static volatile uint8_t RXTail;
+
 static uint16_t messageLength;
 static uint16_t PILOTAddress;
 
@@ -73,6 +84,15 @@ static uint16_t Mode3State;
 static bool AutoRefuelInMode3;
 static uint8_t Mode3Index;
 
+// Test hook. Ignores the paired ConCon's control frames, like the link
+// went down, to time the failsafe
+static bool LinkLossTest;
+
+// Last discovery probe heard while free, for the reply
+static uint16_t ProbeSource;
+static uint8_t ProbeRound;
+static uint8_t ProbeRSSI;
+
 static const uint8_t RedLEDStateList[4] = {0,0,1,1}; //None, Red, Blue, Purple
 static const uint8_t BlueLEDStateList[4] = {0,1,0,1}; //None, Red, Blue, Purple
 
@@ -107,8 +127,14 @@ bool InitXBeeRXSM(uint8_t Priority)
   ByteIndex = 0;
   
   //Set up UART for RX
+  RXHead = 0;
+  RXTail = 0;
+  LinkStats_Clear();
   SetupUART();
   
+  //Move the link off 9600 baud. Falls back to 9600 if the XBee won't
+  XBeeBaud_Init();
+  
   //Update last RX Buffer State
   LastRXBufferState = 0;
   
@@ -122,6 +148,11 @@ bool InitXBeeRXSM(uint8_t Priority)
   AutoRefuelInMode3 = false;
   Mode3Index = 0;
   
+  LinkLossTest = false;
+  ProbeSource = XBEE_BROADCAST_ADDRESS;
+  ProbeRound = 0;
+  ProbeRSSI = 0;
+  
   return true;
 }
 
@@ -182,11 +213,13 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
             
             uint8_t tempVal;
             
-            //Get the byte from the UART2 RX Buffer
-            tempVal = U2RXREG;
+            //Get the byte the ISR received
+            tempVal = (uint8_t) ThisEvent.EventParam;
             
             //If the byte is valid as a Start Delimiter (0x7E) then proceed.  Otherwise ignore it.
             if (tempVal == 0x7E) {
+                //Timestamp for control frame latency
+                ThrustLatency_FrameStart();
                 //Save in the array
                 RXMessageArray[ByteIndex]=tempVal;
                 //Increment the index
@@ -210,7 +243,7 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
         case UART_BYTE_RECEIVED: 
         {  
             uint8_t tempVal2;
-            tempVal2 = U2RXREG;
+            tempVal2 = (uint8_t) ThisEvent.EventParam;
             //Save in the array
             RXMessageArray[ByteIndex]=tempVal2;
             //Increment the index
@@ -222,8 +255,15 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
                 //printf("Message Length is %x",messageLength);
                 //We need to start counting through the message length now
                 ByteIndex = 0;
-                //Go to the next state
-                CurrentState = XBeeRXFrameDataState;
+                //Drop frames too long for the array and wait for the next start
+                if (messageLength > (sizeof(RXMessageArray) - 4)) {
+                    LinkStats_LengthError();
+                    CurrentState = XBeeRXIdleState;
+                }
+                else {
+                    //Go to the next state
+                    CurrentState = XBeeRXFrameDataState;
+                }
             }
                 
         }
@@ -243,7 +283,7 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
         case UART_BYTE_RECEIVED: 
         {  
             //Save in the array
-            RXMessageArray[ByteIndex+3]=U2RXREG;
+            RXMessageArray[ByteIndex+3]=(uint8_t) ThisEvent.EventParam;
             //Increment the index
             ByteIndex++;
             
@@ -252,8 +292,14 @@ ES_Event_t RunXBeeRXSM(ES_Event_t ThisEvent)
                 //Go back to being idle
                 CurrentState = XBeeRXIdleState;
                 
-                //Call function to handle new message
-                ParseNewRXMessage();
+                //Call function to handle new message, if it arrived intact
+                if (XBeeProtocol_IsChecksumValid(RXMessageArray)) {
+                    LinkStats_FrameReceived();
+                    ParseNewRXMessage();
+                }
+                else {
+                    LinkStats_ChecksumFailed();
+                }
             }
         }
         break;
@@ -297,22 +343,63 @@ bool IsRXBufferNonempty(void)
 {
     bool returnVal;
     returnVal = false;
-    bool NewRXBufferState;
-    NewRXBufferState = U2STAbits.URXDA;
     //printdebug("Event Checker\r\n");
-    if (NewRXBufferState == 1) {
-        //In this case new data is available; post an event
+    if (RXTail != RXHead) {
+        //In this case new data is available; post it with the event
         ES_Event_t NewEvent;
         NewEvent.EventType = UART_BYTE_RECEIVED;
+        NewEvent.EventParam = RXBuffer[RXTail];
+        RXTail = (RXTail + 1) & (RX_BUFFER_SIZE - 1);
         PostXBeeRXSM(NewEvent);
         returnVal = true;
         //printdebug("New Byte Present\r\n");
     }
-    LastRXBufferState = NewRXBufferState;
+    LastRXBufferState = returnVal;
     
     return returnVal;
 }
 
+/****************************************************************************
+ Function
+     DrainRXFIFO
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Moves received bytes from the UART2 FIFO to the RX buffer. Call from
+     the UART2 ISR. At 115200 the 8 byte FIFO fills in under 1 ms, faster
+     than the framework can be relied on to poll it
+ Notes
+     Bytes are dropped if the buffer is full. The frame they were in fails
+     to parse and the next start delimiter resyncs
+ Author
+     agent
+****************************************************************************/
+void DrainRXFIFO(void)
+{
+    while (U2STAbits.URXDA) {
+        uint8_t NewByte = U2RXREG;
+        uint8_t NextHead = (RXHead + 1) & (RX_BUFFER_SIZE - 1);
+        if (NextHead != RXTail) {
+            RXBuffer[RXHead] = NewByte;
+            RXHead = NextHead;
+        }
+        else {
+            LinkStats_ByteDropped();
+        }
+    }
+    //An overrun stops reception until it is cleared
+    if (U2STAbits.OERR) {
+        U2STACLR = _U2STA_OERR_MASK;
+        LinkStats_UARTOverrun();
+    }
+    IFS1CLR = _IFS1_U2RXIF_MASK;
+}
+
 /***************************************************************************
  private functions
  ***************************************************************************/
@@ -342,10 +429,15 @@ static void SetupUART(void)
     U2STAbits.URXEN = 1;
     
     U2STAbits.UTXISEL = 0b10; //Generate interrupt when transmit buffer is empty
+    U2STAbits.URXISEL = 0b00; //Generate interrupt when a byte is received
     
     //Make interrupt priority high for UART
     IPC9bits.U2IP = 0b111;
     
+    //Receive by interrupt into RXBuffer
+    IFS1CLR = _IFS1_U2RXIF_MASK;
+    IEC1SET = _IEC1_U2RXIE_MASK;
+    
     //Enable interrupts in general
     __builtin_enable_interrupts();
     
@@ -360,6 +452,9 @@ static void SetupUART(void)
 static void ParseNewRXMessage(void)
 {
     ES_Event_t PostEvent;
+    XBeeRX16Header_t Header;
+    uint8_t FrameID;
+    uint8_t Status;
     
     /*
     for (uint8_t i=0; i<15; i++) {
@@ -368,8 +463,15 @@ static void ParseNewRXMessage(void)
     printdebug("Message Complete\r\n");
     */
     
-    // Only Accept RX Packet 16bit API identifier (0x81)
-    if (RXMessageArray[MSGFRAME_APIIDENTIFIER-1] != API_ID_RX16)
+    // Match delivery reports to the frames we sent
+    if (XBeeProtocol_ParseTXStatus(RXMessageArray, &FrameID, &Status))
+    {
+        TXStatus_Received(FrameID, Status);
+        return;
+    }
+    
+    // Otherwise only Accept RX Packet 16bit API identifier (0x81)
+    if (!XBeeProtocol_ParseRX16(RXMessageArray, &Header))
     {
         //printdebug("ParseRX: wrong API ID\r\n");
         return;
@@ -380,16 +482,34 @@ static void ParseNewRXMessage(void)
     // Validate message ID based on TugCommState
     if (TugCommState == WaitingForPairRequestState)
     {
-        // Only accept Request to Pair Messages
-        if (RXMessageArray[MSGFRAME_MESSAGEID-1] != XBee_RequestToPair)
+        // A ConCon looking for free Tugs. TugComm replies after a random delay
+        XBeeProbe_t Probe;
+        if (XBeeProtocol_UnpackProbe(RXMessageArray, &Probe))
+        {
+            ProbeSource = Header.Source;
+            ProbeRound = Probe.Round;
+            ProbeRSSI = Header.RSSI;
+            PostEvent.EventType = XBEE_PROBE_RECEIVED;
+            PostEvent.EventParam = Probe.Window;
+            PostTugComm(PostEvent);
+            return;
+        }
+        
+        // Otherwise only accept Request to Pair Messages
+        XBeeRequestToPair_t Request;
+        if (!XBeeProtocol_UnpackRequestToPair(RXMessageArray, &Request))
         {
-            printdebug("ParseRX: Ignoring. MessageID should be RequesttoPair 0x03, but is: %x \r\n", RXMessageArray[MSGFRAME_MESSAGEID-1]);
+            printdebug("ParseRX: Ignoring. MessageID should be RequesttoPair 0x03, but is: %x \r\n", Header.MessageID);
             return;
         }
         // Set Pilot Address
-        PILOTAddress = (RXMessageArray[MSGFRAME_SOURCEADDRESSMSB-1] << 8) + RXMessageArray[MSGFRAME_SOURCEADDRESSLSB-1];
+        PILOTAddress = Header.Source;
+        // Only our ConCons probe before pairing, and only they can take
+        // telemetry after the status message
+        StatusTelemetry_SetEnabled(PILOTAddress == ProbeSource);
         
         printdebug("ParseRX: Acting on Request to Pair from %x\r\n", PILOTAddress);
+        LinkStats_ValidFrame(Header.RSSI);
         
         // Post message to TUG Comm
         PostEvent.EventType = XBEE_MESSAGE_RECEIVED;
@@ -401,21 +521,32 @@ static void ParseNewRXMessage(void)
     else
     {
         // Only accept Control Messages
-        if (RXMessageArray[MSGFRAME_MESSAGEID-1] != XBee_Control)
+        XBeeControl_t Control;
+        if (!XBeeProtocol_UnpackControl(RXMessageArray, &Control))
         {
-            printdebug("ParseRX: Ignoring. MessageID should be Control 0x01, but is: %x \r\n", RXMessageArray[MSGFRAME_MESSAGEID-1]);
+            printdebug("ParseRX: Ignoring. MessageID should be Control 0x01, but is: %x \r\n", Header.MessageID);
             return;
         }
         
         // Ensure Source is Paired Pilot
-        uint16_t RxPilot = (RXMessageArray[MSGFRAME_SOURCEADDRESSMSB-1] << 8) + RXMessageArray[MSGFRAME_SOURCEADDRESSLSB-1];
+        uint16_t RxPilot = Header.Source;
         if (RxPilot != PILOTAddress)
         {
             printdebug("ParseRX: Ignoring Message from unpaired PILOT: %x\r\n", RxPilot);
+            LinkStats_UnknownSource();
+            return;
+        }
+        
+        if (LinkLossTest)
+        {
             return;
         }
         
         printdebug("ParseRX: Acting on Control Message %x\r\n");
+        LinkStats_ValidFrame(Header.RSSI);
+        
+        // A slotted ConCon wants status back inside its slot
+        SlotSchedule_ControlReceived(&RXMessageArray[XBEE_FRAME_EXTRA], Header.ExtraLength);
         
         // Control Message Validated. Now Act on it.
         // Post message to TUG Comm
@@ -425,7 +556,7 @@ static void ParseNewRXMessage(void)
         
         // Refuel (Important this is before set thrust)
         // Refuel sent
-        if ((RXMessageArray[MSGFRAME_REFUEL-1] != 0) || (AutoRefuelInMode3))
+        if ((Control.Refuel != 0) || (AutoRefuelInMode3))
         {
             PostEvent.EventType = PROPULSION_REFUEL;
             PostEvent.EventParam = 0;
@@ -434,14 +565,19 @@ static void ParseNewRXMessage(void)
         
         // Set Thrust
         ArcadeControl_t controls;
-        controls.X = (int8_t) RXMessageArray[MSGFRAME_X-1];
-        controls.Yaw = (int8_t) RXMessageArray[MSGFRAME_YAW-1];
-        PostEvent.EventType = PROPULSION_SET_THRUST;
-        PostEvent.EventParam = controls.Total;
-        PostPropulsion(PostEvent);
+        controls.X = Control.X;
+        controls.Yaw = Control.Yaw;
+        // Fast path skips the queue when it is on and fuel is available
+        if (!Propulsion_FastSetThrust(controls))
+        {
+            ThrustLatency_FrameAccepted(_Event_Path);
+            PostEvent.EventType = PROPULSION_SET_THRUST;
+            PostEvent.EventParam = controls.Total;
+            PostPropulsion(PostEvent);
+        }
         
         // Mode 3
-        uint8_t Mode3 = RXMessageArray[MSGFRAME_MODE3-1];
+        uint8_t Mode3 = Control.Mode3;
         if (Mode3>0) {
             if (Mode3State == false) {
                 //In this case we have that the button was pressed and is now released
@@ -478,6 +614,55 @@ uint16_t GetPILOTAddress(void)
 {
     return PILOTAddress;
 }
+
+/****************************************************************************
+ * Function
+ *      XBeeRXSM_GetProbe
+ *
+ * Parameters
+ *      uint8_t *Round - Filled with the probe's discovery round
+ *      uint8_t *RSSI - Filled with the -dBm the probe was heard at
+ * Return
+ *      uint16_t, address of the ConCon that sent the last probe
+****************************************************************************/
+uint16_t XBeeRXSM_GetProbe(uint8_t *Round, uint8_t *RSSI)
+{
+    *Round = ProbeRound;
+    *RSSI = ProbeRSSI;
+    return ProbeSource;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeRXSM_SetLinkLossTest
+ *
+ * Parameters
+ *      bool Enable - true to ignore control frames from the paired ConCon
+ * Return
+ *      void
+ * Description
+ *      Fakes a dropped link without touching the radios. Pairing and
+ *      status carry on, so the failsafe and pairing timeout run as they
+ *      would on a real loss
+****************************************************************************/
+void XBeeRXSM_SetLinkLossTest(bool Enable)
+{
+    LinkLossTest = Enable;
+}
+
+/****************************************************************************
+ * Function
+ *      XBeeRXSM_IsLinkLossTest
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if control frames are being ignored
+****************************************************************************/
+bool XBeeRXSM_IsLinkLossTest(void)
+{
+    return LinkLossTest;
+}
     
 static void InitializeMode3LEDPins(void){
     LATBbits.LATB13 = false;
@@ -29,6 +29,11 @@
 #include "../Propulsion/Propulsion.h"
 #include "TugComm.h"
 #include "XBeeRXSM.h"
+#include "ES_DeferRecall.h"
+#include "TXStatus.h"
+#include "StatusTelemetry.h"
+#include "LinkStats.h"
+#include "../Propulsion/MotorControlDriver.h"
 #include <string.h>
 #include <xc.h>
 #include <sys/attribs.h>
@@ -37,11 +42,26 @@
 
 #define THISXBEE 3
 
+#define TX_QUEUE_DEPTH 4 // Power of 2
+#define TX_FRAME_SIZE XBEE_MAX_FRAME_SIZE // Room for status telemetry
+#define FUEL_TREND_MS 5000
+#define WAITED_FLAG 0x8000 // EventParam of a request put in the deferral queue
+#define DEFERRAL_QUEUE_SIZE 2 // One per request type, see WaitingTypes
+
+typedef struct
+{
+    uint8_t Length;
+    uint8_t Bytes[TX_FRAME_SIZE];
+}TXFrame_t;
+
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this machine.They should be functions
    relevant to the behavior of this state machine
 */
-static void ConstructNewTXMessage(uint8_t * TXMessage);
+static void QueueNewTXMessage(ES_Event_t ThisEvent);
+static uint8_t ConstructNewTXMessage(uint8_t * TXMessage, uint8_t FrameID);
+static void GatherTelemetry(StatusTelemetry_t *ThisTelemetry);
+static uint8_t DeferralBit(ES_EventType_t EventType);
 static void ConfigureUART(void);
 static void TurnOnTXInterrupts(void);
 
@@ -55,17 +75,28 @@ static uint8_t MyPriority;
 
 static TugCommState_t TugState;
 static uint8_t FuelLevel;
+static uint16_t TimeToEmpty; // tenths of a second
 
 static const uint16_t TUGAddresses[8] = {0x2115, 0x2017, 0x2184, 0x2188, 0x2119, 0x2185, 0x2115, 0x2017}; // Last two are just repeating the first two
 
 static uint16_t ThisTUGAddress;
 
 
-static uint8_t NewTXMessage[15];
+// Frames waiting to go out. The framework fills slots at TXQueueHead, the
+// ISR sends from TXQueueTail. Both only count up
+static TXFrame_t TXQueue[TX_QUEUE_DEPTH];
+static volatile uint8_t TXQueueHead;
+static volatile uint8_t TXQueueTail;
+
+// Transmit requests made while the queue was full, sent as frames finish
+static ES_Event_t DeferralQueue[DEFERRAL_QUEUE_SIZE + 1];
+static volatile bool TXDeferred;
+static uint8_t WaitingTypes; // DeferralBit of each request in DeferralQueue
+static uint8_t OwedTypes;    // DeferralBit of each type owed a frame
 
 static XBeeTXMessage_t NewMessageID;
 
-static volatile uint8_t ByteCount;
+static volatile uint8_t ByteCount; // Next byte of the frame at TXQueueTail
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -98,6 +129,12 @@ bool InitXBeeTXSM(uint8_t Priority)
   ThisTUGAddress = TUGAddresses[THISXBEE];
   
   ByteCount = 0;
+  TXQueueHead = 0;
+  TXQueueTail = 0;
+  TXDeferred = false;
+  WaitingTypes = 0;
+  OwedTypes = 0;
+  ES_InitDeferralQueueWith(DeferralQueue, DEFERRAL_QUEUE_SIZE + 1);
   
   // Configure UART
   ConfigureUART();
@@ -149,71 +186,24 @@ ES_Event_t RunXBeeTXSM(ES_Event_t ThisEvent)
   ES_Event_t ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
   
-  switch (CurrentState)
+  switch (ThisEvent.EventType)
   {
-    case XBeeTXIdleState:        
+    case XBEE_TRANSMIT_MESSAGE:
+    case XBEE_TX_RETRY:
     {
-      switch (ThisEvent.EventType)
-      {
-        case XBEE_TRANSMIT_MESSAGE:
-        { 
-                //Move into the active state
-            CurrentState = XBeeTXActiveState;
-            
-            //Grab all the relevant parameters for the message
-            //TUG Address = ThisTUGAddress();
-            //Fuel Level Value
-            FuelLevel = Propulsion_GetFuelLevel();
-            
-            //MessageID
-            TugState = QueryTugComm();
-            if (TugState == WaitingForControlPacketState) {
-                NewMessageID = XBee_PairingAcknowledged;
-            }
-            else if (TugState == PairedState) {
-                NewMessageID = XBee_Status;
-            }
-            
-            ConstructNewTXMessage(NewTXMessage);
-            //Now we have a new message to send
-            
-            //for (uint8_t i=0; i<15; i++) {
-            //    printf("Byte = %x\r\n",NewTXMessage[i]);
-            //}
-            
-            ES_Event_t NewEvent;
-            NewEvent.EventType = TRANSMIT_BYTE;
-            PostXBeeTXSM(NewEvent);
-            
-            ByteCount = 0;
-            TurnOnTXInterrupts();
-            //WriteByteToTX(NewTXMessage[ByteCount]);
-            
-        }
-        break;
-
-        default:
-          ;
-      }
+        //Queue a frame whether or not one is going out now
+        QueueNewTXMessage(ThisEvent);
     }
     break;
 
-    case XBeeTXActiveState:     
+    case XBEE_TX_FRAME_SENT:
     {
-      switch (ThisEvent.EventType)
-      {
-        case TRANSMIT_BYTE:
-        { 
-            //puts("A new transmission is in progress\r\n");
-        }
-        break;
-
-        default:
-          ;
-      }
+        //A slot opened up. ES_RecallEvents puts every request that found
+        //the queue full back at the front of ours, newest first
+        ES_RecallEvents(MyPriority, DeferralQueue);
     }
     break;
-    
+
     default:
       ;
   } 
@@ -246,62 +236,227 @@ XBeeTXState_t QueryXBeeTXSM(void)
  private functions
  ***************************************************************************/
 
-static void ConstructNewTXMessage(uint8_t * TXMessage)
+static void QueueNewTXMessage(ES_Event_t ThisEvent)
+{
+    //With the queue full, wait for a frame to finish. Frames are built from
+    //the latest state as they're queued, so one waiting request per type
+    //covers every request of that type made while it waits
+    uint8_t TypeBit = DeferralBit(ThisEvent.EventType);
+    if (ThisEvent.EventParam & WAITED_FLAG) {
+        //Back from the deferral queue
+        ThisEvent.EventParam &= ~WAITED_FLAG;
+        WaitingTypes &= ~TypeBit;
+        if (!(OwedTypes & TypeBit)) {
+            //A newer request of this type was queued while this one waited
+            TXStatus_RequestCoalesced();
+            return;
+        }
+    }
+    else {
+        OwedTypes |= TypeBit;
+    }
+    if ((uint8_t) (TXQueueHead - TXQueueTail) >= TX_QUEUE_DEPTH) {
+        if (WaitingTypes & TypeBit) {
+            TXStatus_RequestCoalesced();
+        }
+        else {
+            ES_Event_t WaitingEvent = ThisEvent;
+            WaitingEvent.EventParam |= WAITED_FLAG;
+            if (ES_DeferEvent(DeferralQueue, WaitingEvent)) {
+                WaitingTypes |= TypeBit;
+            }
+            else {
+                OwedTypes &= ~TypeBit;
+                TXStatus_RequestDropped();
+            }
+        }
+        TXDeferred = true;
+        return;
+    }
+    OwedTypes &= ~TypeBit;
+    
+    //Grab all the relevant parameters for the message
+    //TUG Address = ThisTUGAddress();
+    //Fuel Level Value
+    FuelLevel = Propulsion_GetFuelLevel();
+    TimeToEmpty = Propulsion_GetTimeToEmpty();
+    
+    //MessageID
+    TugState = QueryTugComm();
+    if (TugState == WaitingForPairRequestState) {
+        NewMessageID = XBee_ProbeReply;
+    }
+    else if (TugState == WaitingForControlPacketState) {
+        NewMessageID = XBee_PairingAcknowledged;
+    }
+    else if (TugState == PairedState) {
+        NewMessageID = XBee_Status;
+    }
+    
+    //A retry is only for a probe reply or pairing acknowledgement that
+    //failed. Drop it if pairing has moved on since
+    bool IsPairing = (TugState != PairedState);
+    uint8_t Retries = 0;
+    if (ThisEvent.EventType == XBEE_TX_RETRY) {
+        if (!IsPairing) {
+            return;
+        }
+        Retries = ThisEvent.EventParam;
+    }
+    
+    //Build straight into the free slot, then hand it to the ISR
+    TXFrame_t *ThisFrame = &TXQueue[TXQueueHead & (TX_QUEUE_DEPTH - 1)];
+    ThisFrame->Length = ConstructNewTXMessage(ThisFrame->Bytes,
+            TXStatus_NewFrame(IsPairing, Retries));
+    if (0 == ThisFrame->Length) {
+        return;
+    }
+    
+    //for (uint8_t i=0; i<15; i++) {
+    //    printf("Byte = %x\r\n",ThisFrame->Bytes[i]);
+    //}
+    
+    //Publish the frame before going active, in case the ISR is just
+    //finishing the last one
+    TXQueueHead++;
+    CurrentState = XBeeTXActiveState;
+    TurnOnTXInterrupts();
+    return;
+}
+
+static uint8_t ConstructNewTXMessage(uint8_t * TXMessage, uint8_t FrameID)
 {
     // Get Current PILOTAddress;
     uint16_t PILOTAddress = GetPILOTAddress();
     
-    TXMessage[MSGFRAME_STARTDELIMITER-1]=0x7E;
-    TXMessage[MSGFRAME_LENGTHMSB-1]=0x00;
-    TXMessage[MSGFRAME_LENGTHLSB-1]=0x0B;
-    uint8_t CheckSum = 0;
-    CheckSum += (TXMessage[MSGFRAME_APIIDENTIFIER-1]=0x01);
-    CheckSum += (TXMessage[MSGFRAME_FRAMEID-1]=0x01);
-    CheckSum += (TXMessage[MSGFRAME_DESTINATIONADDRESSMSB-1]=(PILOTAddress & 0xFF00) >> 8);
-    CheckSum += (TXMessage[MSGFRAME_DESTINATIONADDRESSLSB-1]=(PILOTAddress & 0x00FF));
-    CheckSum += (TXMessage[MSGFRAME_OPTIONS-1]=0x00);
-    CheckSum += (TXMessage[MSGFRAME_MESSAGEID-1]=NewMessageID);
-    if (NewMessageID == XBee_PairingAcknowledged) {
-        CheckSum += (TXMessage[MSGFRAME_TUGADDRMSB-1]=(ThisTUGAddress & 0xFF00) >> 8);
-        CheckSum += (TXMessage[MSGFRAME_TUGADDRLSB-1]=(ThisTUGAddress & 0x00FF));
-        CheckSum += (TXMessage[MSGFRAME_PILOTADDRMSB-1]=(PILOTAddress & 0xFF00) >> 8);
-        CheckSum += (TXMessage[MSGFRAME_PILOTADDRLSB-1]=(PILOTAddress & 0x00FF));
-        CheckSum += (TXMessage[MSGFRAME_ACK-1]=0x55);
+    if (NewMessageID == XBee_ProbeReply) {
+        XBeeProbeReply_t Msg;
+        Msg.TugAddress = ThisTUGAddress;
+        uint16_t ProbeSource = XBeeRXSM_GetProbe(&Msg.Round, &Msg.RSSI);
+        return XBeeProtocol_PackProbeReply(TXMessage, FrameID, ProbeSource, &Msg);
+    }
+    else if (NewMessageID == XBee_PairingAcknowledged) {
+        XBeePairingAcknowledged_t Msg;
+        Msg.TugAddress = ThisTUGAddress;
+        Msg.PilotAddress = PILOTAddress;
+        return XBeeProtocol_PackPairingAcknowledged(TXMessage, FrameID, PILOTAddress, &Msg);
     }
     else if (NewMessageID == XBee_Status) {
-        CheckSum += (TXMessage[MSGFRAME_FUELLEVEL-1]=FuelLevel);
-        CheckSum += (TXMessage[MSGFRAME_Y-1]=0);
-        CheckSum += (TXMessage[MSGFRAME_YAW-1]=0);
-        CheckSum += (TXMessage[MSGFRAME_REFUEL-1]=0);
-        CheckSum += (TXMessage[MSGFRAME_MODE3-1]=0);
+        XBeeStatus_t Msg;
+        Msg.FuelLevel = FuelLevel;
+        Msg.TimeToEmpty = TimeToEmpty;
+        uint8_t Length = XBeeProtocol_PackStatus(TXMessage, FrameID, PILOTAddress, &Msg);
+        if (StatusTelemetry_IsEnabled()) {
+            StatusTelemetry_t Telemetry;
+            uint8_t Block[STATUSTELEMETRY_MAX_SIZE];
+            GatherTelemetry(&Telemetry);
+            Length = XBeeProtocol_AppendExtra(TXMessage, Block,
+                    StatusTelemetry_Encode(&Telemetry, Block));
+        }
+        return Length;
     }
-    else {
-        puts("Invalid TX Message is Trying to be Sent\r\n");
+    puts("Invalid TX Message is Trying to be Sent\r\n");
+    return 0;
+}
+
+/*
+ * DeferralBit
+ * Helper for QueueNewTXMessage
+ * One bit per transmit request type, so each type waits at most once
+ */
+static uint8_t DeferralBit(ES_EventType_t EventType)
+{
+    if (EventType == XBEE_TX_RETRY) {
+        return 0x02;
+    }
+    return 0x01; // XBEE_TRANSMIT_MESSAGE
+}
+
+/*
+ * GatherTelemetry
+ * Helper for ConstructNewTXMessage
+ * Reads what goes in the status telemetry block
+ */
+static void GatherTelemetry(StatusTelemetry_t *ThisTelemetry)
+{
+    static bool TrendStarted;
+    static uint16_t TrendStartTime;
+    static uint8_t TrendStartLevel;
+    static int8_t FuelTrend;
+    
+    float LeftRPM = MotorControl_GetRPM(_Left_Motor);
+    float RightRPM = MotorControl_GetRPM(_Right_Motor);
+    if (_Backward_Dir == MotorControl_GetDirection(_Left_Motor)) {
+        LeftRPM = -LeftRPM;
+    }
+    if (_Backward_Dir == MotorControl_GetDirection(_Right_Motor)) {
+        RightRPM = -RightRPM;
     }
-    TXMessage[MSGFRAME_CHECKSUM-1]=0xFF-CheckSum;
+    ThisTelemetry->LeftRPM = (int16_t) LeftRPM;
+    ThisTelemetry->RightRPM = (int16_t) RightRPM;
+    ThisTelemetry->LeftDuty = MotorControl_GetDutyPermille(_Left_Motor);
+    ThisTelemetry->RightDuty = MotorControl_GetDutyPermille(_Right_Motor);
     
-    return;
+    //Fuel change over the last whole window
+    uint16_t Now = ES_Timer_GetTime();
+    if (!TrendStarted) {
+        TrendStarted = true;
+        TrendStartLevel = FuelLevel;
+        TrendStartTime = Now;
+    }
+    else if ((uint16_t) (Now - TrendStartTime) >= FUEL_TREND_MS) {
+        FuelTrend = (int8_t) (FuelLevel - TrendStartLevel);
+        TrendStartLevel = FuelLevel;
+        TrendStartTime = Now;
+    }
+    ThisTelemetry->FuelTrend = FuelTrend;
+    ThisTelemetry->LoadPercent = MotorControl_GetLoadPercent();
+    
+    LinkStats_t Stats;
+    LinkStats_Get(&Stats);
+    ThisTelemetry->ValidFrames = (uint16_t) Stats.ValidFrames;
+    ThisTelemetry->RXErrors = (uint16_t) (Stats.ChecksumFailures + Stats.LengthErrors +
+            Stats.BytesDropped + Stats.UARTOverruns);
+    ThisTelemetry->RSSI = Stats.RSSIAvg;
 }
 
 static void TurnOnTXInterrupts(void)
 {
-    IEC1bits.U2TXIE = 1; //Enable
+    IEC1SET = _IEC1_U2TXIE_MASK; //Enable, atomic against the ISR
     return;
 }
 
-void __ISR(_UART_2_VECTOR, IPL7SOFT) TXBufferEmptyInterruptHandler(void)
+void __ISR(_UART_2_VECTOR, IPL7SOFT) XBeeUARTInterruptHandler(void)
 {
-    //Put something in the buffer
-    U2TXREG = NewTXMessage[ByteCount];
-    ByteCount++;
-    if (ByteCount < 15) {
-        //Do nothing
+    //RX and TX share the UART2 vector
+    if (IFS1bits.U2RXIF) {
+        DrainRXFIFO();
     }
-    else {
+    if (!(IEC1bits.U2TXIE && IFS1bits.U2TXIF)) {
+        return;
+    }
+    
+    //Fill the FIFO. The next queued frame follows on with no gap
+    while (!U2STAbits.UTXBF && (TXQueueTail != TXQueueHead)) {
+        TXFrame_t *ThisFrame = &TXQueue[TXQueueTail & (TX_QUEUE_DEPTH - 1)];
+        U2TXREG = ThisFrame->Bytes[ByteCount];
+        ByteCount++;
+        if (ByteCount >= ThisFrame->Length) {
+            ByteCount = 0;
+            TXQueueTail++;
+            if (TXDeferred) {
+                TXDeferred = false;
+                ES_Event_t NewEvent;
+                NewEvent.EventType = XBEE_TX_FRAME_SENT;
+                PostXBeeTXSM(NewEvent);
+            }
+        }
+    }
+    
+    if (TXQueueTail == TXQueueHead) {
         //Disable interrupt and move back to the inactive state
-        IEC1bits.U2TXIE = 0; //Disable
+        IEC1CLR = _IEC1_U2TXIE_MASK;
         CurrentState = XBeeTXIdleState;
-        ByteCount = 0;
     }
     //Clear interrupt flag
     IFS1CLR = _IFS1_U2TXIF_MASK;
@@ -336,7 +491,7 @@ static void ConfigureUART(void)
     U2STAbits.UTXEN = 1;
     U2STAbits.URXEN = 1;
     
-    U2STAbits.UTXISEL = 0b10; //Generate interrupt when transmit buffer is empty
+    U2STAbits.UTXISEL = 0b10; //Generate interrupt when transmit buffer is empty, so each entry can refill all 8
     
     //Make interrupt priority high for UART
     IPC9bits.U2IP = 0b111;
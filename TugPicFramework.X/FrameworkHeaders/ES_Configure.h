@@ -263,14 +263,19 @@ typedef enum
     /* Propulsion */
     PROPULSION_SET_THRUST,
     PROPULSION_REFUEL,
+    PROPULSION_FUEL_EMPTY,
+    DRIVE_GOAL_REACHED,
     WAIT_TO_PAIR,
     PAIRING_COMPLETE,
     /* TugComm */
     PAIRING_BUTTON_PRESSED,
     XBEE_MESSAGE_RECEIVED,
+    XBEE_PROBE_RECEIVED,
     XBEE_TRANSMIT_MESSAGE,
     /* XBee */
     TRANSMIT_BYTE,
+    XBEE_TX_FRAME_SENT,
+    XBEE_TX_RETRY,
     UART_BYTE_RECEIVED
 
 }ES_EventType_t;
@@ -309,7 +314,8 @@ typedef enum
 
 /****************************************************************************/
 // This is the list of event checking functions
-#define EVENT_CHECK_LIST Check4Keystroke, CheckPairingButton, IsRXBufferNonempty
+#define EVENT_CHECK_LIST Check4Keystroke, CheckPairingButton, IsRXBufferNonempty, \
+        ControlTelemetry_Pump, Propulsion_CheckFuel
 /****************************************************************************/
 // These are the definitions for the post functions to be executed when the
 // corresponding timer expires. All 16 must be defined. If you are not using
@@ -317,11 +323,11 @@ typedef enum
 // Unlike services, any combination of timers may be used and there is no
 // priority in servicing them
 #define TIMER_UNUSED ((pPostFunc)0)
-#define TIMER0_RESP_FUNC PostPropulsion
+#define TIMER0_RESP_FUNC TIMER_UNUSED
 #define TIMER1_RESP_FUNC PostTugComm
 #define TIMER2_RESP_FUNC PostTugComm
-#define TIMER3_RESP_FUNC TIMER_UNUSED
-#define TIMER4_RESP_FUNC TIMER_UNUSED
+#define TIMER3_RESP_FUNC PostTugComm
+#define TIMER4_RESP_FUNC PostTugComm
 #define TIMER5_RESP_FUNC TIMER_UNUSED
 #define TIMER6_RESP_FUNC TIMER_UNUSED
 #define TIMER7_RESP_FUNC TIMER_UNUSED
@@ -341,8 +347,9 @@ typedef enum
 // the timer number matches where the timer event will be routed
 // These symbolic names should be changed to be relevant to your application
 
-#define FUEL_TIMER 0
 #define TRANSMISSION_TIMER 1
 #define COMM_TIMEOUT_TIMER 2
+#define FAILSAFE_TIMER 3
+#define PROBE_REPLY_TIMER 4
 
 #endif /* ES_CONFIGURE_H */
@@ -33,6 +33,7 @@ uint8_t Terminal_ReadByte(void);
 void Terminal_WriteByte(uint8_t txByte);
 bool Terminal_IsRxData(void);
 void Terminal_MoveBuffer2UART( void );
+size_t Terminal_TxSpace(void);
 
 #ifdef __XC16__  // DEPRICATED, USE FOR xc16 of xc32 v1.34 or lower
 int write(int handle, void *buffer, unsigned int len);
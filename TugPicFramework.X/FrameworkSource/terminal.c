@@ -201,6 +201,20 @@ void Terminal_MoveBuffer2UART( void )
   }
 }
 
+/*******************************************************************************
+ * Function: Terminal_TxSpace
+ * Arguments: none
+ * Returns number of bytes that can be queued without overwriting
+ * 
+ * Description: lets binary writers (control telemetry) check that a whole
+ *              frame fits before queueing it, so frames are never cut
+ ******************************************************************************/
+size_t Terminal_TxSpace(void)
+{
+  return circular_buf_capacity(xmitBufferHandle) - 
+          circular_buf_size(xmitBufferHandle);
+}
+
 void __attribute__((noreturn)) _fassert(int nLineNumber,
                                         const char * sFileName,
                                         const char * sFailedExpression,
@@ -0,0 +1,130 @@
+/****************************************************************************
+ Module
+     PIC32_NVM_HAL.c
+ Description
+     Source file for erasing and programming the PIC32MX170F256B's program
+     flash at run time, used to keep settings across power cycles
+ Notes
+     Erase and program stall the CPU until they finish, so callers must
+     keep them away from anything time critical
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+  10/19/26 07:49 agent  started coding
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "PIC32_NVM_HAL.h"
+#include <xc.h>
+#include <sys/kmem.h>
+
+/****************************** Constants *******************************/
+// NVMCON operations (NVMOP with WREN set)
+#define NVMOP_WORD_PGM 0x4001
+#define NVMOP_PAGE_ERASE 0x4004
+#define NVMCON_WR_MASK 0x8000
+#define NVMCON_WREN_MASK 0x4000
+#define NVMCON_ERR_MASK 0x3000 // WRERR | LVDERR
+
+// Unlock sequence
+#define NVM_KEY1 0xAA996655
+#define NVM_KEY2 0x556699AA
+
+/*********************** Static Function Prototypes ************************/
+static bool NVMUnlockAndRun(uint32_t Operation);
+
+/****************************************************************************
+ Function
+    NVM_ErasePage
+
+ Parameters
+   const void *PageAddress: virtual address of a page aligned flash buffer
+
+ Returns
+   bool: true if erase succeeded, false on write or low voltage error
+
+ Description
+   Erases the flash page (all bits set to 1). Blocks for ~20 ms with
+   interrupts disabled, so never call from an ISR or while driving.
+Example
+   NVM_ErasePage(StoragePage);
+****************************************************************************/
+bool NVM_ErasePage(const void *PageAddress)
+{
+    NVMADDR = KVA_TO_PA((uint32_t) PageAddress);
+    return NVMUnlockAndRun(NVMOP_PAGE_ERASE);
+}
+
+/****************************************************************************
+ Function
+    NVM_WriteWords
+
+ Parameters
+   const void *Address: virtual address in flash to write to (word aligned)
+   const uint32_t *Data: words to write
+   uint16_t NumWords: number of words to write
+
+ Returns
+   bool: true if every word programmed, false on first error
+
+ Description
+   Programs words into already erased flash. Blocks with interrupts
+   disabled for each word
+Example
+   NVM_WriteWords(StoragePage, (const uint32_t *) &Record, sizeof(Record)/4);
+****************************************************************************/
+bool NVM_WriteWords(const void *Address, const uint32_t *Data, uint16_t NumWords)
+{
+    uint32_t PhysicalAddress = KVA_TO_PA((uint32_t) Address);
+    
+    for (uint16_t i = 0; i < NumWords; i++)
+    {
+        NVMADDR = PhysicalAddress + (4 * i);
+        NVMDATA = Data[i];
+        if (!NVMUnlockAndRun(NVMOP_WORD_PGM))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/****************************************************************************
+ Function
+    NVMUnlockAndRun
+
+ Parameters
+   uint32_t Operation: NVMCON value (operation and WREN)
+
+ Returns
+   bool: true if no error flags set after operation
+
+ Description
+   Runs the unlock sequence and starts the operation with interrupts
+   disabled, as required by the datasheet, then waits for it to finish
+****************************************************************************/
+static bool NVMUnlockAndRun(uint32_t Operation)
+{
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    
+    NVMCON = Operation;
+    NVMKEY = NVM_KEY1;
+    NVMKEY = NVM_KEY2;
+    NVMCONSET = NVMCON_WR_MASK;
+    
+    // Wait for operation to complete
+    while (NVMCON & NVMCON_WR_MASK)
+    {
+        ;
+    }
+    
+    // Restore interrupts only if they were on before
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
+    }
+    
+    // Disable further writes
+    NVMCONCLR = NVMCON_WREN_MASK;
+    
+    return ((NVMCON & NVMCON_ERR_MASK) == 0);
+}
@@ -0,0 +1,68 @@
+#ifndef PIC32_NVM_HAL
+#define PIC32_NVM_HAL
+#include <stdint.h>
+#include <stdbool.h>
+
+/****************************************************************************
+Flash on the PIC32MX170F256B erases in 1 KB pages and programs 32-bit words.
+NVM_PAGE_SIZE is in bytes, NVM_PAGE_WORDS in 32-bit words.
+****************************************************************************/
+#define NVM_PAGE_SIZE 1024
+#define NVM_PAGE_WORDS (NVM_PAGE_SIZE / 4)
+#define NVM_LAST_PAGE 0x9D03FC00 // Virtual address of the last 256 KB flash page
+
+/****************************************************************************
+NVM_RESERVED_PAGE(Address) places a const array at a page aligned virtual
+address in flash with no initial data. The page is left out of the hex file,
+so reprogramming doesn't overwrite what was saved there, as long as the
+project preserves that range. Host builds get an ordinary page aligned array.
+Example
+   static const volatile uint32_t NVM_RESERVED_PAGE(NVM_LAST_PAGE)
+           StoragePage[NVM_PAGE_WORDS];
+****************************************************************************/
+#ifdef __XC32
+#define NVM_RESERVED_PAGE(Address) \
+        __attribute__((space(prog), address(Address), noload))
+#else
+#define NVM_RESERVED_PAGE(Address) __attribute__((aligned(NVM_PAGE_SIZE)))
+#endif
+
+/****************************************************************************
+ Function
+    NVM_ErasePage
+
+ Parameters
+   const void *PageAddress: virtual address of a page aligned flash buffer
+
+ Returns
+   bool: true if erase succeeded, false on write or low voltage error
+
+ Description
+   Erases the flash page (all bits set to 1). Blocks for ~20 ms with
+   interrupts disabled, so never call from an ISR or while driving.
+Example
+   NVM_ErasePage(StoragePage);
+****************************************************************************/
+bool NVM_ErasePage(const void *PageAddress);
+
+/****************************************************************************
+ Function
+    NVM_WriteWords
+
+ Parameters
+   const void *Address: virtual address in flash to write to (word aligned)
+   const uint32_t *Data: words to write
+   uint16_t NumWords: number of words to write
+
+ Returns
+   bool: true if every word programmed, false on first error
+
+ Description
+   Programs words into already erased flash. Blocks with interrupts
+   disabled for each word
+Example
+   NVM_WriteWords(StoragePage, (const uint32_t *) &Record, sizeof(Record)/4);
+****************************************************************************/
+bool NVM_WriteWords(const void *Address, const uint32_t *Data, uint16_t NumWords);
+
+#endif //PIC32_NVM_HAL
@@ -19,6 +19,8 @@
 #include "EventCheckers.h"
 #include "../Comms/TugComm.h" // for pairing button
 #include "../Comms/XBeeRXSM.h"
+#include "../Propulsion/ControlTelemetry.h" // streams telemetry
+#include "../Propulsion/Propulsion.h" // fuel integration
 // Here you would #include the header files for any other modules that
 // contained event checking functions
 
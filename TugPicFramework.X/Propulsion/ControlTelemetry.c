@@ -0,0 +1,230 @@
+/****************************************************************************
+ * File:   ControlTelemetry.c
+ * Per tick control law telemetry streamed over the terminal UART
+ *
+ * The control law ISR fills one of two fixed size buffers with a frame per
+ * tick. When a buffer is full the ISR flags it and swaps to the other one.
+ * The event checker pushes flagged buffers into the terminal transmit buffer,
+ * so the ISR never waits on the UART. At 25 bytes per 5 ms tick the stream
+ * needs 5 kB/s of the 11.5 kB/s the 115200 baud terminal can carry. At 1 or
+ * 2 ms control periods it needs more than that and frames will be dropped.
+ *
+ * If the task side falls behind, the ISR reuses its buffer and the dropped
+ * frames show up as gaps in the sequence numbers.
+ *
+ * Tools/decode_telemetry.py turns a capture into CSV.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ControlTelemetry.h"
+#include "terminal.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define TELEMETRY_BLOCK_FRAMES 8 // frames per buffer. 40 ms of control ticks
+#define NUM_BLOCKS 2
+
+/*---------------------------- Module Functions ---------------------------*/
+static void FillWheel(TelemetryWheel_t *Sample, const ControlState_t *ThisControl,
+        const Encoder_t *ThisEncoder);
+static int16_t Saturate16(float Value);
+
+/*---------------------------- Module Variables ---------------------------*/
+static TelemetryFrame_t Blocks[NUM_BLOCKS][TELEMETRY_BLOCK_FRAMES];
+static volatile bool BlockReady[NUM_BLOCKS]; // set by ISR, cleared by Pump
+static uint8_t FillBlock;   // ISR only
+static uint8_t FillIndex;   // ISR only
+static uint8_t SendBlock;   // Pump only. Next block to send
+static uint16_t Sequence;
+static volatile uint32_t DroppedFrames;
+static volatile bool Running;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Start
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Clears the buffers and starts capturing one frame per control tick
+****************************************************************************/
+void ControlTelemetry_Start(void)
+{
+    // Stop the ISR from recording while the indices are reset
+    Running = false;
+    BlockReady[0] = false;
+    BlockReady[1] = false;
+    FillBlock = 0;
+    FillIndex = 0;
+    SendBlock = 0;
+    Sequence = 0;
+    DroppedFrames = 0;
+    Running = true;
+}
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Stop
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Stops capturing. Frames already captured are still sent
+****************************************************************************/
+void ControlTelemetry_Stop(void)
+{
+    Running = false;
+}
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_IsRunning
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true while capturing
+****************************************************************************/
+bool ControlTelemetry_IsRunning(void)
+{
+    return Running;
+}
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_GetDropped
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint32_t, frames dropped since Start because the UART fell behind
+****************************************************************************/
+uint32_t ControlTelemetry_GetDropped(void)
+{
+    return DroppedFrames;
+}
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Record
+ *
+ * Parameters
+ *      const ControlState_t *Left, *Right - Control state after the update
+ *      const Encoder_t *LeftEncoder, *RightEncoder - Encoder state
+ * Return
+ *      void
+ * Description
+ *      Called from the control law ISR. Copies one frame into the fill
+ *      buffer. Fixed cost, never blocks and never touches the UART
+****************************************************************************/
+void ControlTelemetry_Record(const ControlState_t *Left, const Encoder_t *LeftEncoder,
+        const ControlState_t *Right, const Encoder_t *RightEncoder)
+{
+    if (!Running)
+    {
+        return;
+    }
+
+    TelemetryFrame_t *Frame = &Blocks[FillBlock][FillIndex];
+    Frame->Sync[0] = TELEMETRY_SYNC0;
+    Frame->Sync[1] = TELEMETRY_SYNC1;
+    Frame->Sequence = Sequence++;
+    FillWheel(&Frame->Left, Left, LeftEncoder);
+    FillWheel(&Frame->Right, Right, RightEncoder);
+
+    // Checksum covers everything between sync and checksum
+    const uint8_t *Bytes = (const uint8_t *) Frame;
+    uint8_t Sum = 0;
+    for (uint8_t i = 2; i < (sizeof(TelemetryFrame_t) - 1); i++)
+    {
+        Sum += Bytes[i];
+    }
+    Frame->Checksum = 0xFF - Sum;
+
+    FillIndex++;
+    if (FillIndex >= TELEMETRY_BLOCK_FRAMES)
+    {
+        FillIndex = 0;
+        uint8_t NextBlock = FillBlock ^ 1;
+        if (BlockReady[NextBlock])
+        {
+            // Other buffer not sent yet. Overwrite this one
+            DroppedFrames += TELEMETRY_BLOCK_FRAMES;
+        }
+        else
+        {
+            BlockReady[FillBlock] = true;
+            FillBlock = NextBlock;
+        }
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Pump
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, always false. No event is posted
+ * Description
+ *      Event checker. Queues any full buffer on the terminal UART once
+ *      there is room for all of it
+****************************************************************************/
+bool ControlTelemetry_Pump(void)
+{
+    // Blocks are filled in order, so send them in order
+    while (BlockReady[SendBlock])
+    {
+        // Wait for room so a frame is never cut or overwritten by printf
+        if (Terminal_TxSpace() < sizeof(Blocks[0]))
+        {
+            break;
+        }
+
+        const uint8_t *Bytes = (const uint8_t *) Blocks[SendBlock];
+        for (uint16_t i = 0; i < sizeof(Blocks[0]); i++)
+        {
+            Terminal_WriteByte(Bytes[i]);
+        }
+        BlockReady[SendBlock] = false;
+        SendBlock ^= 1;
+    }
+    return false;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+/*
+ * FillWheel
+ * Helper for ControlTelemetry_Record
+ * Scales one wheel's control state into the frame
+ */
+static void FillWheel(TelemetryWheel_t *Sample, const ControlState_t *ThisControl,
+        const Encoder_t *ThisEncoder)
+{
+    Sample->TargetRPM = Saturate16(ThisControl->ActualTargetRPM * TELEMETRY_RPM_SCALE);
+    Sample->MeasuredRPM = Saturate16(ThisEncoder->CurrentRPM * TELEMETRY_RPM_SCALE);
+    Sample->Error = Saturate16(ThisControl->RPMError * TELEMETRY_RPM_SCALE);
+    Sample->IntegralTerm = Saturate16(ThisControl->IntegralTerm);
+    Sample->Duty = (uint16_t) ThisControl->RequestedDutyCycle;
+}
+
+/*
+ * Saturate16
+ * Helper for FillWheel
+ * Rounds toward zero and clamps to the int16 range
+ */
+static int16_t Saturate16(float Value)
+{
+    if (Value > INT16_MAX) return INT16_MAX;
+    if (Value < INT16_MIN) return INT16_MIN;
+    return (int16_t) Value;
+}
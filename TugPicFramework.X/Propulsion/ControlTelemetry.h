@@ -0,0 +1,123 @@
+/****************************************************************************
+ * File:   ControlTelemetry.h
+ * Per tick control law telemetry streamed over the terminal UART
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef CONTROLTELEMETRY_H
+#define	CONTROLTELEMETRY_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+#include "MotorControlDriver.h"
+
+// Frame layout (little endian, 25 bytes):
+//  0-1   Sync 0xA5 0x5A
+//  2-3   Sequence number, +1 per control tick (gaps = dropped samples)
+//  4-13  Left wheel sample
+//  14-23 Right wheel sample
+//  24    Checksum, 0xFF - (sum of bytes 2-23)
+// Wheel sample:
+//  int16 Target RPM x10, int16 Measured RPM x10, int16 Error RPM x10,
+//  int16 Integral term (duty), uint16 Commanded duty (0-1000)
+#define TELEMETRY_SYNC0 0xA5
+#define TELEMETRY_SYNC1 0x5A
+#define TELEMETRY_RPM_SCALE 10
+
+typedef struct __attribute__((packed)) {
+    int16_t TargetRPM;
+    int16_t MeasuredRPM;
+    int16_t Error;
+    int16_t IntegralTerm;
+    uint16_t Duty;
+}TelemetryWheel_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t Sync[2];
+    uint16_t Sequence;
+    TelemetryWheel_t Left;
+    TelemetryWheel_t Right;
+    uint8_t Checksum;
+}TelemetryFrame_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Start
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Clears the buffers and starts capturing one frame per control tick
+****************************************************************************/
+void ControlTelemetry_Start(void);
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Stop
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Stops capturing. Frames already captured are still sent
+****************************************************************************/
+void ControlTelemetry_Stop(void);
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_IsRunning
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true while capturing
+****************************************************************************/
+bool ControlTelemetry_IsRunning(void);
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_GetDropped
+ *
+ * Parameters
+ *      void
+ * Return
+ *      uint32_t, frames dropped since Start because the UART fell behind
+****************************************************************************/
+uint32_t ControlTelemetry_GetDropped(void);
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Record
+ *
+ * Parameters
+ *      const ControlState_t *Left, *Right - Control state after the update
+ *      const Encoder_t *LeftEncoder, *RightEncoder - Encoder state
+ * Return
+ *      void
+ * Description
+ *      Called from the control law ISR. Copies one frame into the fill
+ *      buffer. Fixed cost, never blocks and never touches the UART
+****************************************************************************/
+void ControlTelemetry_Record(const ControlState_t *Left, const Encoder_t *LeftEncoder,
+        const ControlState_t *Right, const Encoder_t *RightEncoder);
+
+/****************************************************************************
+ * Function
+ *      ControlTelemetry_Pump
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, always false. No event is posted
+ * Description
+ *      Event checker. Queues any full buffer on the terminal UART once
+ *      there is room for all of it
+****************************************************************************/
+bool ControlTelemetry_Pump(void);
+
+#endif	/* CONTROLTELEMETRY_H */
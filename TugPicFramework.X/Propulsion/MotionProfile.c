@@ -0,0 +1,186 @@
+/****************************************************************************
+ * File:   MotionProfile.c
+ * Jerk limited (S-curve) velocity profile generator for tick goal moves
+ *
+ * Velocities are in RPM, distances in encoder ticks and times in seconds.
+ * The ramp up and ramp down are symmetric. With a jerk limit each ramp is
+ * jerk / constant accel / jerk, without one it is a plain linear ramp.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "MotionProfile.h"
+#include <math.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+
+/*---------------------------- Module Functions ---------------------------*/
+static float RampVelocity(const MotionProfile_t *ThisProfile, float t);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      MotionProfile_Plan
+ *
+ * Parameters
+ *      MotionProfile_t *ThisProfile - Profile to fill in
+ *      uint32_t DistanceTicks - Length of the move in encoder ticks
+ *      float CruiseRPM - Maximum speed of the move in RPM
+ *      float MaxAccel - Acceleration limit in RPM/s. 0 disables the profile
+ *      float MaxJerk - Jerk limit in RPM/s^2. 0 gives a trapezoidal profile
+ * Return
+ *      bool, true if a profile was planned and is now active
+ * Description
+ *      Computes accel/cruise/decel phase times for the move. Short moves
+ *      lower the peak speed (and acceleration) so the move still fits.
+****************************************************************************/
+bool MotionProfile_Plan(MotionProfile_t *ThisProfile, uint32_t DistanceTicks,
+        float CruiseRPM, float MaxAccel, float MaxJerk)
+{
+    // Make sure ISR stops stepping the old profile while this one is built
+    ThisProfile->Active = false;
+
+    if ((DistanceTicks == 0) || (CruiseRPM <= 0) || (MaxAccel <= 0))
+    {
+        return false;
+    }
+
+    float Accel = MaxAccel;
+    float Jerk = (MaxJerk > 0) ? MaxJerk : 0;
+    // Time spent in each jerk segment of a ramp
+    float JerkTime = (Jerk > 0) ? (Accel / Jerk) : 0;
+    // Distance in rpm*sec so velocity math stays in rpm
+    float Distance = (float) DistanceTicks / TICKS_PER_RPM_SECOND;
+
+    // A ramp to V covers V*(V/A + A/J)/2, and there are two of them.
+    // Solve V^2/A + V*A/J = Distance for the fastest peak that still fits
+    float PeakRPM = 0.5f * Accel * (-JerkTime +
+            sqrtf(JerkTime * JerkTime + 4 * Distance / Accel));
+    if (PeakRPM > CruiseRPM) PeakRPM = CruiseRPM;
+
+    // Peak too low to ever reach full accel. Lower accel so the ramp is
+    // pure jerk up then jerk down
+    if ((Jerk > 0) && (PeakRPM < Accel * JerkTime))
+    {
+        Accel = sqrtf(PeakRPM * Jerk);
+        JerkTime = Accel / Jerk;
+    }
+
+    ThisProfile->Distance = (float) DistanceTicks;
+    ThisProfile->PeakRPM = PeakRPM;
+    ThisProfile->Accel = Accel;
+    ThisProfile->Jerk = Jerk;
+    ThisProfile->RampTime = PeakRPM / Accel + JerkTime;
+    // Whatever the two ramps don't cover is done at cruise speed
+    ThisProfile->CruiseTime = (Distance - PeakRPM * ThisProfile->RampTime) / PeakRPM;
+    if (ThisProfile->CruiseTime < 0) ThisProfile->CruiseTime = 0;
+    ThisProfile->TotalTime = 2 * ThisProfile->RampTime + ThisProfile->CruiseTime;
+    ThisProfile->Time = 0;
+    ThisProfile->Velocity = 0;
+    ThisProfile->Position = 0;
+
+    // Set last so ISR never sees a half built profile
+    ThisProfile->Active = true;
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      MotionProfile_Step
+ *
+ * Parameters
+ *      MotionProfile_t *ThisProfile - Profile to advance
+ *      float dt - Time since the last step in seconds
+ * Return
+ *      float, profile velocity in RPM for this step
+ * Description
+ *      Advances the profile by dt and updates Velocity and Position.
+ *      Cheap enough to call from the control law ISR. Clears Active when done
+****************************************************************************/
+float MotionProfile_Step(MotionProfile_t *ThisProfile, float dt)
+{
+    if (!ThisProfile->Active)
+    {
+        return 0;
+    }
+
+    ThisProfile->Time += dt;
+    float t = ThisProfile->Time;
+    float Velocity;
+
+    if (t >= ThisProfile->TotalTime) // done
+    {
+        Velocity = 0;
+        ThisProfile->Active = false;
+    }
+    else if (t < ThisProfile->RampTime) // accelerating
+    {
+        Velocity = RampVelocity(ThisProfile, t);
+    }
+    else if (t < (ThisProfile->RampTime + ThisProfile->CruiseTime)) // cruise
+    {
+        Velocity = ThisProfile->PeakRPM;
+    }
+    else // decelerating. Mirror of the accel ramp
+    {
+        Velocity = RampVelocity(ThisProfile, ThisProfile->TotalTime - t);
+    }
+
+    // Trapezoidal integration of the planned position
+    ThisProfile->Position += 0.5f * (Velocity + ThisProfile->Velocity) * dt
+            * TICKS_PER_RPM_SECOND;
+    if (ThisProfile->Position > ThisProfile->Distance)
+    {
+        ThisProfile->Position = ThisProfile->Distance;
+    }
+    ThisProfile->Velocity = Velocity;
+
+    return Velocity;
+}
+
+/****************************************************************************
+ * Function
+ *      MotionProfile_Cancel
+ *
+ * Parameters
+ *      MotionProfile_t *ThisProfile - Profile to stop
+ * Return
+ *      void
+ * Description
+ *      Stops stepping the profile
+****************************************************************************/
+void MotionProfile_Cancel(MotionProfile_t *ThisProfile)
+{
+    ThisProfile->Active = false;
+    ThisProfile->Velocity = 0;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+/*
+ * RampVelocity
+ * Helper for MotionProfile_Step
+ * Velocity t seconds into the ramp up from 0 to PeakRPM
+ */
+static float RampVelocity(const MotionProfile_t *ThisProfile, float t)
+{
+    float JerkTime = (ThisProfile->Jerk > 0) ?
+        (ThisProfile->Accel / ThisProfile->Jerk) : 0;
+
+    if (t < JerkTime) // accel building up
+    {
+        return 0.5f * ThisProfile->Jerk * t * t;
+    }
+    else if (t < (ThisProfile->RampTime - JerkTime)) // constant accel
+    {
+        return 0.5f * ThisProfile->Accel * JerkTime +
+                ThisProfile->Accel * (t - JerkTime);
+    }
+    else // accel falling off into peak speed
+    {
+        float Remaining = ThisProfile->RampTime - t;
+        return ThisProfile->PeakRPM - 0.5f * ThisProfile->Jerk * Remaining * Remaining;
+    }
+}
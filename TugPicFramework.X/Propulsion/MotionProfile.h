@@ -0,0 +1,79 @@
+/****************************************************************************
+ * File:   MotionProfile.h
+ * Jerk limited (S-curve) velocity profile generator for tick goal moves
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef MOTIONPROFILE_H
+#define	MOTIONPROFILE_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+// 300 encoder ticks per output rev, so 1 rpm held for 1 sec is 5 ticks
+#define TICKS_PER_RPM_SECOND 5.0f
+
+typedef struct {
+    float Distance;         // Total move length in ticks
+    float PeakRPM;          // Cruise speed actually reached (may be < requested)
+    float Accel;            // Acceleration used in RPM/s (may be < limit for short moves)
+    float Jerk;             // Jerk limit in RPM/s^2. 0 for plain trapezoid
+    float RampTime;         // Time spent ramping from 0 to PeakRPM (s)
+    float CruiseTime;       // Time spent at PeakRPM (s)
+    float TotalTime;        // Total profile time (s)
+    float Time;             // Time elapsed since start of profile (s)
+    float Velocity;         // Current profile velocity in RPM
+    float Position;         // Current profile position in ticks
+    bool Active;            // true while the profile is being stepped
+}MotionProfile_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      MotionProfile_Plan
+ *
+ * Parameters
+ *      MotionProfile_t *ThisProfile - Profile to fill in
+ *      uint32_t DistanceTicks - Length of the move in encoder ticks
+ *      float CruiseRPM - Maximum speed of the move in RPM
+ *      float MaxAccel - Acceleration limit in RPM/s. 0 disables the profile
+ *      float MaxJerk - Jerk limit in RPM/s^2. 0 gives a trapezoidal profile
+ * Return
+ *      bool, true if a profile was planned and is now active
+ * Description
+ *      Computes accel/cruise/decel phase times for the move. Short moves
+ *      lower the peak speed (and acceleration) so the move still fits.
+****************************************************************************/
+bool MotionProfile_Plan(MotionProfile_t *ThisProfile, uint32_t DistanceTicks,
+        float CruiseRPM, float MaxAccel, float MaxJerk);
+
+/****************************************************************************
+ * Function
+ *      MotionProfile_Step
+ *
+ * Parameters
+ *      MotionProfile_t *ThisProfile - Profile to advance
+ *      float dt - Time since the last step in seconds
+ * Return
+ *      float, profile velocity in RPM for this step
+ * Description
+ *      Advances the profile by dt and updates Velocity and Position.
+ *      Cheap enough to call from the control law ISR. Clears Active when done
+****************************************************************************/
+float MotionProfile_Step(MotionProfile_t *ThisProfile, float dt);
+
+/****************************************************************************
+ * Function
+ *      MotionProfile_Cancel
+ *
+ * Parameters
+ *      MotionProfile_t *ThisProfile - Profile to stop
+ * Return
+ *      void
+ * Description
+ *      Stops stepping the profile
+****************************************************************************/
+void MotionProfile_Cancel(MotionProfile_t *ThisProfile);
+
+#endif	/* MOTIONPROFILE_H */
@@ -9,6 +9,11 @@
 /*----------------------------- Include Files -----------------------------*/
 #include "terminal.h"
 #include "MotorControlDriver.h"
+#include "MotorLinearization.h"
+#include "ControlTelemetry.h"
+#include "Propulsion.h"
+#include "ThrustLatency.h"
+#include "../HALs/PIC32_NVM_HAL.h"
 #include "../HALs/PIC32PortHAL.h"
 #include "ES_Configure.h"
 #include "ES_Events.h"
@@ -17,28 +22,77 @@
 #include <string.h>
 
 /*----------------------------- Module Defines ----------------------------*/
-// #define USE_CLOSED_LOOP // uncomment to enable closed loop code 
-
-// PID constants
-#define pGain 1
-#define iGain 2
-#define dGain 0.5
-#define PositionGain 0.5
+// Default PID constants. Used until gains are tuned and saved to flash
+#define DEFAULT_P_GAIN 1
+#define DEFAULT_I_GAIN 2
+#define DEFAULT_D_GAIN 0.5
+#define DEFAULT_POSITION_GAIN 0.5
+// Cross coupling gain. RPM of correction per tick of left/right mismatch.
+// Peak heading error on a 2 m drive in the drive simulator, right motor
+// 10% weak, at 2 ticks of mismatch per degree:
+//   profile:  1.19 ticks (0.32 deg), 0.90 (0.24 deg) with SyncGain=0
+//   creep:    3.95 ticks (1.07 deg), 4.30 (1.16 deg) with SyncGain=0
+// The profile's position term already keeps the wheels in step, so cross
+// coupling only helps the creep. The simulator can override it
+#ifndef SyncGain
+#define SyncGain 0.5
+#endif
 // Target RPM at the Goal Position. This is to prevent the robot from coming to a stop early
 #define PositionGainOffset 2 //(Try 2 rpm)
 
+// Motion profile defaults for DriveStraight/DriveTurn. In the drive
+// simulator a 2 m drive with the right motor 10% weak reaches its goal in
+// 3755 ms with the profile, overrunning by -0.04/0.07 ticks (L/R). The old
+// PositionGain creep (accel 0) takes 4710 ms and overruns by 0.32/-0.13
+#define DEFAULT_PROFILE_ACCEL 200 // RPM/s. 0 to fall back to PositionGain only
+#define DEFAULT_PROFILE_JERK 2000 // RPM/s^2. 0 for trapezoidal profile
+
 #define MAX_RPM 250 // RPM measurements above this value will be ignored to reduce noise
 
 #define TICK_DISTANCE_ERROR 0 // Number of ticks error considered at target 
+#define SETTLED_RPM 1 // Both wheels below this speed at goal counts as converged
+
+// Characterization sweep timing
+#define CHAR_SETTLE_MS 1000 // 1 s for speed to settle after a duty change
+#define CHAR_SAMPLE_MS 500 // then average speed over 0.5 s
+
+// Relay feedback auto tune
+#define TUNE_TARGET_RPM 60 // Speed the relay oscillates around
+#define TUNE_RELAY_DUTY 150 // Relay swing above and below the feedforward duty
+#define TUNE_SKIP_HALF_CYCLES 4 // Let the oscillation settle first
+#define TUNE_MEASURE_CYCLES 4 // Full cycles averaged for amplitude and period
+#define TUNE_TIMEOUT_MS 10000 // Give up after 10 s without a result
+#define TUNE_STEP_MS 1500 // Step test to TUNE_TARGET_RPM, before and after tuning
+#define TUNE_REST_TIMEOUT_MS 2000 // Step anyway if a wheel won't come to rest
+#define TUNE_SETTLE_RPM 3 // Settled within 5% of TUNE_TARGET_RPM
+#define PI 3.14159265f
+
+// Saved gain record
+#define GAINS_MAGIC 0x47414E31 // "GAN1". Change if the record layout changes
 
 // PWM configuration
 #define PWM_TIMER 3
-#define PWM_PERIOD 1999 // Base frequency of 10kHz with prescale of 4
-#define DUTY_CYCLE_TO_OCRS  2 // multiplier
+#define PWM_CLOCK 20000000 // PBCLK with prescale of 1
+#define DEFAULT_PWM_FREQ 20000 // Hz. Above hearing
+#define MIN_PWM_FREQ 1000 // 20000 counts
+#define MAX_PWM_FREQ 40000 // 500 counts
+#define PWM_UPDATE_GUARD 40 // Timer3 counts (2 us). Wait out the period match if closer than this
 #define MAX_DUTY_CYCLE 1000
-#define CONTROL_LAW_PERIOD 24999 // Set period to be 5 ms
-#define PERIOD_2_RPM 1000000 // conversion factor ((10^9*60)/(200*6*50))
-#define ZERO_SPEED_PERIOD 1000000 // Amount of ticks considered not moving (1rpm)
+#define DUTY_CYCLE_TO_Q15 32.768f // 0-1000 duty cycle to Q15
+#define CONTROL_LAW_COUNTS_PER_MS 2500 // Timer4 counts per ms. 20MHz PBCLK with prescale of 8
+#define LOAD_FILTER_SHIFT 4 // Running load average over ~16 ticks
+#define DEFAULT_CONTROL_PERIOD_MS 5
+#define MIN_CONTROL_PERIOD_MS 1
+#define MAX_CONTROL_PERIOD_MS 20 // 50000 counts. Largest that fits 16 bit PR4
+#define NOMINAL_CONTROL_DT 0.005f // Saved gains are stored as if running at 5 ms
+#define CORE_COUNTS_PER_T2 4 // Core timer (20 MHz) counts per Timer2 (5 MHz) count
+#define PERIOD_2_RPM 4000000 // conversion factor ((10^9*60)/(50*6*50)), 50 ns counts
+#define ZERO_SPEED_PERIOD 4000000 // Core timer counts considered not moving (1rpm)
+#define CORE_COUNTS_PER_S 20000000.0f
+
+// Keeps the compiler from moving memory accesses across a sequence count
+// update. The M4K is single core and in order, so nothing else is needed
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
 
 // Left motor ports and pins
 #define L_DIRB_PORT _Port_A
@@ -60,11 +114,48 @@
 #define L_ENCODER_CHA PORTAbits.RA4 // Pin 12
 #define L_ENCODER_CHB PORTBbits.RB12 // Pin 23
 
-// RIght encoder ports and pins
-#define R_ENCODER_CHA PORTBbits.RB10 // Pin 21
-#define R_ENCODER_CHB PORTBbits.RB13 // Pin 24
+// RIght encoder ports and pins. RB10 is the XBee's U2TX and RB13 the red
+// Mode 3 LED, so the encoder is on IC3's free pins
+#define R_ENCODER_CHA PORTBbits.RB5 // Pin 14
+#define R_ENCODER_CHB PORTBbits.RB11 // Pin 22
 
 /*----------------------------- Module Types ------------------------------*/
+// State of the relay test on one motor
+typedef struct {
+    float BiasDuty;         // Feedforward duty at the test speed
+    bool RelayHigh;         // true if relay is on the high duty
+    uint8_t HalfCycles;     // Relay switches so far
+    uint16_t MeasureTicks;  // Ticks spent in the measured cycles
+    float MaxRPM;           // Peak speed in measured cycles
+    float MinRPM;           // Lowest speed in measured cycles
+    bool Done;
+}RelayTune_t;
+
+// Auto tune runs a step test with the old gains, the relay test, then a
+// step test with the new gains
+typedef enum {
+    _Tune_Before_Step, _Tune_Relay, _Tune_After_Step
+}TunePhase_t;
+
+// Step test on one motor. Ticks count from the step
+typedef struct {
+    uint16_t RiseStartTick; // First tick at 10% of the test speed, 0 until then
+    uint16_t RiseEndTick;   // First tick at 90%, 0 until then
+    uint16_t LastOutsideTick; // Last tick outside TUNE_SETTLE_RPM
+    float PeakRPM;
+}StepTest_t;
+
+// Gains as stored in flash
+typedef union {
+    struct {
+        uint32_t Magic;
+        MotorControl_Gains_t LeftGains;
+        MotorControl_Gains_t RightGains;
+        float PositionGain;
+        uint32_t Checksum;  // ~(sum of all words before it)
+    };
+    uint32_t Words[9];
+}StoredGains_t;
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this machine.They should be functions
@@ -77,27 +168,108 @@ static void InitInputCapture(void);
 static void InitLeftEncoder(void);
 static void InitRightEncoder(void);
 static void InitControlLaw(void);
+static uint16_t DutyQ15ToOCRS(MotorControl_Direction_t WhichDirection, uint16_t DutyQ15);
+static uint16_t DutyCycleToQ15(float DutyCycle);
+static void WaitForPWMUpdateWindow(void);
 
-#ifdef USE_CLOSED_LOOP
-void __ISR(_TIMER_2_VECTOR, IPL6SOFT) Timer2Handler(void);
 void __ISR(_TIMER_4_VECTOR, IPL4SOFT) ControlLawHandler(void);
+static void RunControlLaw(void);
+static uint32_t CaptureToCoreTime(uint16_t CapturedTime);
+static void CheckZeroSpeed(Encoder_t *ThisEncoder, volatile uint32_t *Seq, 
+        uint32_t Now);
+static void RunObserver(ControlState_t *ThisControl, Encoder_t *ThisEncoder,
+        MotorControl_Direction_t PWMDirection, uint16_t PWMDutyQ15, uint32_t Now);
 void __ISR(_INPUT_CAPTURE_1_VECTOR, IPL7SOFT) LeftEncoderHandler(void);
-void __ISR(_INPUT_CAPTURE_2_VECTOR, IPL7SOFT) RightEncoderHandler(void);
+void __ISR(_INPUT_CAPTURE_3_VECTOR, IPL7SOFT) RightEncoderHandler(void);
 void UpdateControlLaw(ControlState_t *ThisControl, Encoder_t *ThisEncoder);
-#endif
+static void CharacterizationStep(void);
+static void AutoTuneStep(void);
+static void StartStepTest(void);
+static bool StepTestStep(MotorControl_StepResult_t *Results);
+static void RecordStep(StepTest_t *ThisStep, float RPM);
+static MotorControl_StepResult_t StepResult(const StepTest_t *ThisStep);
+static void ResetSpeedLoop(ControlState_t *ThisControl);
+static bool RelayTuneStep(RelayTune_t *ThisTune, ControlState_t *ThisControl, 
+        Encoder_t *ThisEncoder);
+static void LoadGains(void);
+static MotorControl_Gains_t RescaleGains(MotorControl_Gains_t Gains, float OldDt, float NewDt);
+static uint32_t GainsChecksum(const StoredGains_t *Record);
+static void SeqWriteBegin(volatile uint32_t *Seq);
+static void SeqWriteEnd(volatile uint32_t *Seq);
+static void SeqReadCopy(const volatile uint32_t *Seq, void *Dest, 
+        const void *Source, size_t Size);
 /*---------------------------- Module Variables ---------------------------*/
 // everybody needs a state variable, you may need others as well.
 static bool MotorsActive; // true if motors are moving in any way. False if stopped
-static RolloverTimer_t ICTimerRollover;
+static uint16_t PWMCounts;  // Timer3 counts per PWM cycle (PR3 + 1)
+static uint16_t LeftPWMDutyQ15;    // Last duty cycle set, kept for frequency changes
+static uint16_t RightPWMDutyQ15;
+static MotorControl_Direction_t LeftPWMDirection;
+static MotorControl_Direction_t RightPWMDirection;
 static Encoder_t LeftEncoder;
 static Encoder_t RightEncoder;
 static ControlState_t LeftControl;
 static ControlState_t RightControl;
 
+// Sequence counts for snapshot reads. Odd while an ISR is writing the struct
+static volatile uint32_t LeftEncoderSeq;
+static volatile uint32_t RightEncoderSeq;
+static volatile uint32_t LeftControlSeq;
+static volatile uint32_t RightControlSeq;
+
 static bool LeftDriveGoalActive;
 static bool RightDriveGoalActive;
 static bool LeftDriveGoalReached;
 static bool RightDriveGoalReached;
+static bool DriveSyncActive; // true while both wheels are cross coupled
+static volatile bool UseObserver; // Speed loops run on the observer estimate
+static volatile bool ClosedLoopActive; // Speed loops set the duty cycles
+
+static float ProfileMaxAccel;
+static float ProfileMaxJerk;
+
+static volatile bool CharacterizationActive;
+static MotorControl_Direction_t CharDirection; // Direction being swept
+static uint8_t CharIndex;       // Table point being measured
+static uint16_t CharTickCount;  // Ticks spent at current point
+static uint16_t CharSettleTicks; // CHAR_SETTLE_MS in ticks at current rate
+static uint16_t CharSampleTicks; // CHAR_SAMPLE_MS in ticks at current rate
+static float CharLeftSum;       // Sum of speed samples at current point
+static float CharRightSum;
+
+static float PositionGain;
+static volatile bool AutoTuneActive;
+static uint16_t AutoTuneTicks;  // Ticks since tuning started
+static uint16_t AutoTuneTimeoutTicks; // TUNE_TIMEOUT_MS in ticks at current rate
+static RelayTune_t LeftTune;
+static RelayTune_t RightTune;
+static TunePhase_t TunePhase;
+static uint16_t StepTestTicks;  // Ticks since the step, 0 while coming to rest
+static uint16_t RestTicks;      // Ticks spent waiting for rest
+static StepTest_t LeftStep;
+static StepTest_t RightStep;
+// Step results of the last auto tune, indexed by MotorControl_Motor_t
+static MotorControl_StepResult_t TuneBefore[2];
+static MotorControl_StepResult_t TuneAfter[2];
+static bool TuneComparisonValid; // Both step tests of the last tune ran
+
+// Control law rate
+static uint8_t ControlPeriodMs;
+static float ControlLawDt;      // seconds per control law tick
+
+// Control law ISR cost, in Timer4 counts. Reset each time they are read
+static volatile uint32_t LoadCountSum;
+static volatile uint32_t LoadSamples;
+static volatile uint16_t LoadCountPeak;
+static volatile uint32_t LoadOverruns; // ISR still running at the next period
+// Running average of the same, x16. Never reset, for telemetry
+static volatile uint32_t LoadFilteredX16;
+
+// Last flash page, reserved for saved gains. No initial data, so reflashing
+// the firmware leaves saved gains in place. A whole page so erasing it can't
+// touch anything else. Volatile so reads always go to flash
+static const volatile uint32_t NVM_RESERVED_PAGE(NVM_LAST_PAGE) 
+        GainStoragePage[NVM_PAGE_WORDS];
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -128,12 +300,10 @@ bool InitMotorControlDriver(void)
     InitPWMTimer();
     InitLeftMotor();
     InitRightMotor(); 
-#ifdef USE_CLOSED_LOOP
     InitInputCapture();
     InitLeftEncoder();
     InitRightEncoder();
     InitControlLaw();
-#endif
     
     //enable global interrupts (built in)
     __builtin_enable_interrupts();
@@ -142,26 +312,43 @@ bool InitMotorControlDriver(void)
     OC1CONbits.ON = 1;
     OC2CONbits.ON = 1;
     T3CONbits.ON = 1;
-#ifdef USE_CLOSED_LOOP
     IC1CONbits.ON = 1;
-    IC2CONbits.ON = 1;
+    IC3CONbits.ON = 1;
     T2CONbits.ON = 1;
-    T4CONbits.ON = 0; // Control law timer. Not turning on for now
-#endif   
     
     
     // Init Variables to 0
     MotorsActive = 0;
-    memset(&ICTimerRollover, 0, sizeof(ICTimerRollover));
     memset(&LeftEncoder, 0, sizeof(LeftEncoder));
     memset(&RightEncoder, 0, sizeof(RightEncoder));
     memset(&LeftControl, 0, sizeof(LeftControl));
     memset(&RightControl, 0, sizeof(RightControl));
+    LeftControl.WhichMotor = _Left_Motor;
+    RightControl.WhichMotor = _Right_Motor;
+    ControlPeriodMs = DEFAULT_CONTROL_PERIOD_MS;
+    ControlLawDt = DEFAULT_CONTROL_PERIOD_MS * 0.001f;
+    // Saved gains if there are any, otherwise defaults
+    LoadGains();
     
     LeftDriveGoalActive = 0;
     RightDriveGoalActive = 0;
     LeftDriveGoalReached = 0;
     RightDriveGoalReached = 0;
+    DriveSyncActive = false;
+    UseObserver = false;
+    
+    ProfileMaxAccel = DEFAULT_PROFILE_ACCEL;
+    ProfileMaxJerk = DEFAULT_PROFILE_JERK;
+    
+    // Default tables until the motors are characterized
+    MotorLinearization_Init();
+    CharacterizationActive = false;
+    AutoTuneActive = false;
+    ClosedLoopActive = false;
+    
+    // Drive tick. Always runs so zero speed detection works in open loop.
+    // The speed loops only drive the motors once closed loop is enabled
+    T4CONbits.ON = 1;
     
     puts("...Done Initializing MotorControl\r\n");
  
@@ -183,35 +370,141 @@ bool InitMotorControlDriver(void)
  *      Set specified motor to move at set PWM duty cycle in specified direction
 ****************************************************************************/
 void MotorControl_SetMotorDutyCycle(MotorControl_Motor_t WhichMotor, MotorControl_Direction_t WhichDirection, uint16_t DutyCycle)
+{
+    MotorControl_SetMotorDutyQ15(WhichMotor, WhichDirection, DutyCycleToQ15(DutyCycle));
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetMotorDutyQ15     
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Direction to move motor in
+ *      uint16_t DutyQ15 - Duty cycle as a Q15 fraction (0-MOTOR_DUTY_Q15_FULL)
+ * Return
+ *      void
+ * Description
+ *      Same as SetMotorDutyCycle but uses the full PWM timer resolution
+****************************************************************************/
+void MotorControl_SetMotorDutyQ15(MotorControl_Motor_t WhichMotor, 
+        MotorControl_Direction_t WhichDirection, uint16_t DutyQ15)
 {
     if (_Left_Motor == WhichMotor)
     {  
         //Set WhichMotor's DIRB LAT to WhichDirection to set direction correctly
         L_DIRB_LAT = WhichDirection;
-        // invert duty cycle for backwards
-        if (_Backward_Dir == WhichDirection)
-        {
-            DutyCycle = MAX_DUTY_CYCLE - DutyCycle;
-        }
-        //Set OCRS register for WhichMotor to DUTY_CYCLE_TO_OCRS * Duty Cycle
-        L_OCRS = DUTY_CYCLE_TO_OCRS * DutyCycle;
-
+        // OCRS is double buffered, new value starts at next period
+        L_OCRS = DutyQ15ToOCRS(WhichDirection, DutyQ15);
+        LeftPWMDirection = WhichDirection;
+        LeftPWMDutyQ15 = DutyQ15;
     }
     else if (_Right_Motor == WhichMotor)
     {
         //Set WhichMotor's DIRB LAT to WhichDirection to set direction correctly
         R_DIRB_LAT = WhichDirection;
-        // invert duty cycle for backwards
-        if (_Backward_Dir == WhichDirection)
-        {
-            DutyCycle = MAX_DUTY_CYCLE - DutyCycle;
-        }
-        //Set OCRS register for WhichMotor to DUTY_CYCLE_TO_OCRS * Duty Cycle
-        R_OCRS = DUTY_CYCLE_TO_OCRS * DutyCycle;
+        // OCRS is double buffered, new value starts at next period
+        R_OCRS = DutyQ15ToOCRS(WhichDirection, DutyQ15);
+        RightPWMDirection = WhichDirection;
+        RightPWMDutyQ15 = DutyQ15;
+    }
+    ThrustLatency_PWMWritten();
+	//Motors are moving while either duty cycle is on
+    MotorsActive = (0 != LeftPWMDutyQ15) || (0 != RightPWMDutyQ15);
+}
 
+/****************************************************************************
+ * Function
+ *      MotorControl_SetMotorDutiesQ15     
+ *      
+ * Parameters
+ *      MotorControl_Direction_t LeftDirection, RightDirection - Directions
+ *      uint16_t LeftDutyQ15, RightDutyQ15 - Q15 duty cycles
+ * Return
+ *      void
+ * Description
+ *      Sets both motors so the new duty cycles start in the same PWM cycle
+****************************************************************************/
+void MotorControl_SetMotorDutiesQ15(MotorControl_Direction_t LeftDirection, 
+        uint16_t LeftDutyQ15, MotorControl_Direction_t RightDirection, 
+        uint16_t RightDutyQ15)
+{
+    // Work out register values first so the critical section is just writes
+    uint16_t LeftOCRS = DutyQ15ToOCRS(LeftDirection, LeftDutyQ15);
+    uint16_t RightOCRS = DutyQ15ToOCRS(RightDirection, RightDutyQ15);
+    
+    // Both OCRS writes must land on the same side of a period match
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    WaitForPWMUpdateWindow();
+    L_DIRB_LAT = LeftDirection;
+    R_DIRB_LAT = RightDirection;
+    L_OCRS = LeftOCRS;
+    R_OCRS = RightOCRS;
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
     }
-	//Motors are now moving
-    MotorsActive = true;
+    ThrustLatency_PWMWritten();
+    
+    LeftPWMDirection = LeftDirection;
+    LeftPWMDutyQ15 = LeftDutyQ15;
+    RightPWMDirection = RightDirection;
+    RightPWMDutyQ15 = RightDutyQ15;
+	//Motors are moving while either duty cycle is on
+    MotorsActive = (0 != LeftPWMDutyQ15) || (0 != RightPWMDutyQ15);
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetPWMFrequency     
+ *      
+ * Parameters
+ *      uint32_t FrequencyHz - PWM frequency (1 kHz to 40 kHz)
+ * Return
+ *      bool, false if out of range
+ * Description
+ *      Changes the drive PWM frequency. Current duty cycles are kept.
+ *      Resolution is PBCLK/FrequencyHz steps, 1000 at the 20 kHz default
+****************************************************************************/
+bool MotorControl_SetPWMFrequency(uint32_t FrequencyHz)
+{
+    if ((FrequencyHz < MIN_PWM_FREQ) || (FrequencyHz > MAX_PWM_FREQ))
+    {
+        return false;
+    }
+    
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    // Stop the timer so it can't run past a shorter period
+    T3CONbits.ON = 0;
+    PWMCounts = PWM_CLOCK / FrequencyHz;
+    PR3 = PWMCounts - 1;
+    TMR3 = 0;
+    // Rescale duty cycles to the new period. With the timer stopped OCR
+    // won't reload from OCRS, so write both
+    L_OCRS = DutyQ15ToOCRS(LeftPWMDirection, LeftPWMDutyQ15);
+    OC1R = L_OCRS;
+    R_OCRS = DutyQ15ToOCRS(RightPWMDirection, RightPWMDutyQ15);
+    OC2R = R_OCRS;
+    T3CONbits.ON = 1;
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
+    }
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetPWMFrequency     
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint32_t, PWM frequency in Hz
+****************************************************************************/
+uint32_t MotorControl_GetPWMFrequency(void)
+{
+    return PWM_CLOCK / PWMCounts;
 }
 	
 /****************************************************************************
@@ -223,10 +516,16 @@ void MotorControl_SetMotorDutyCycle(MotorControl_Motor_t WhichMotor, MotorContro
  * Return
  *      void
  * Description
- *      Stop both motors
+ *      Stop both motors. Clears every target and both speed loops, so the
+ *      duty cycles stay at 0 in velocity mode too
 ****************************************************************************/
 void MotorControl_StopMotors(void)
 {
+    // Hold off the control tick until every target and loop is cleared,
+    // so it can't drive the motors from half cleared state
+    uint32_t WasEnabled = IEC0 & _IEC0_T4IE_MASK;
+    IEC0CLR = _IEC0_T4IE_MASK;
+    
     //Call SetMotorDutyCycle with duty cycle of 0
     MotorControl_SetMotorDutyCycle(_Left_Motor, _Forward_Dir, 0);
 	MotorControl_SetMotorDutyCycle(_Right_Motor, _Forward_Dir, 0);	
@@ -240,13 +539,26 @@ void MotorControl_StopMotors(void)
     // Cancel any tick goal
     LeftControl.TargetTickCount = 0;
     RightControl.TargetTickCount = 0;
+    MotionProfile_Cancel(&LeftControl.Profile);
+    MotionProfile_Cancel(&RightControl.Profile);
     
     // Reset Drive Goals
     LeftDriveGoalActive = 0;
     LeftDriveGoalReached = 0;
     RightDriveGoalActive = 0;
     RightDriveGoalReached = 0;
-
+    DriveSyncActive = false;
+    
+    // Abort any characterization sweep or auto tune
+    CharacterizationActive = false;
+    AutoTuneActive = false;
+    
+    // Clear the speed loops. In velocity mode a wound up integral would
+    // otherwise keep driving the motors against the zero target
+    ResetSpeedLoop(&LeftControl);
+    ResetSpeedLoop(&RightControl);
+    
+    IEC0SET = WasEnabled;
 }
 
 /****************************************************************************
@@ -258,13 +570,13 @@ void MotorControl_StopMotors(void)
  * Return
  *      void
  * Description
- *      Enables Control Law timer interrupt, causing motors to follow CL control
+ *      Lets the speed loops set the duty cycles from the next control tick
  *      SetMotorDutyCycle will not work properly when enabled
 ****************************************************************************/
 void MotorControl_EnableClosedLoop(void)
 {
-    // Turn on timer to start control law running
-    T4CONbits.ON = 1;
+    // Control tick is always running. Just hand it the motors
+    ClosedLoopActive = true;
 }
 
 /****************************************************************************
@@ -276,13 +588,14 @@ void MotorControl_EnableClosedLoop(void)
  * Return
  *      void
  * Description
- *      Disables Control Law timer interrupt. Motors use direct Duty Cycle
+ *      Stops the speed loops setting the duty cycles. Motors use direct 
+ *      Duty Cycle. The control tick keeps running for zero speed detection
  *      SetMotorDutyCycle will not work properly when enabled
 ****************************************************************************/
 void MotorControl_DisableClosedLoop(void)
 {
-    // Turn off timer to stop control law running
-    T4CONbits.ON = 0;
+    // Speed loops stop at the next tick
+    ClosedLoopActive = false;
     
     // Reset all error terms
     LeftControl.IntegralTerm = 0;
@@ -317,6 +630,8 @@ void MotorControl_SetMotorSpeed(MotorControl_Motor_t WhichMotor, MotorControl_Di
     MotorsActive = true;
     // Turn on closed loop control whenever a speed command is sent
     MotorControl_EnableClosedLoop();
+    // Independent wheel command. Drive functions re-enable sync after
+    DriveSyncActive = false;
     
     if (_Left_Motor == WhichMotor)
     {
@@ -332,6 +647,32 @@ void MotorControl_SetMotorSpeed(MotorControl_Motor_t WhichMotor, MotorControl_Di
         RightControl.TargetRPM = (float) Speed / 10;        
     }   
 }
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetSpeedTargets
+ *      
+ * Parameters
+ *      MotorControl_Direction_t LeftDirection, RightDirection - Directions
+ *      uint16_t LeftSpeed, RightSpeed - target speeds in 0.1 RPM
+ * Return
+ *      void
+ * Description
+ *      Sets both speed targets for the control tick's own use. Only stores
+ *      the targets and the closed loop flag, so it is safe from the tick.
+ *      Leaves drive sync and drive goals to the task level drive functions
+****************************************************************************/
+void MotorControl_SetSpeedTargets(MotorControl_Direction_t LeftDirection, 
+        uint16_t LeftSpeed, MotorControl_Direction_t RightDirection, 
+        uint16_t RightSpeed)
+{
+    LeftControl.TargetDirection = LeftDirection;
+    LeftControl.TargetRPM = (float) LeftSpeed / 10;
+    RightControl.TargetDirection = RightDirection;
+    RightControl.TargetRPM = (float) RightSpeed / 10;
+    // Speed loops take over from this tick
+    ClosedLoopActive = true;
+}
 /****************************************************************************
  * Function
  *      MotorControl_ResetTickCount
@@ -418,9 +759,18 @@ void MotorControl_DriveStraight(MotorControl_Direction_t WhichDirection, uint16_
     MotorControl_SetTickGoal(_Left_Motor, NumTicks);
     MotorControl_SetTickGoal(_Right_Motor, NumTicks);
     
+    // Plan velocity profiles for the move
+    MotionProfile_Plan(&LeftControl.Profile, NumTicks, (float) Speed / 10, 
+            ProfileMaxAccel, ProfileMaxJerk);
+    MotionProfile_Plan(&RightControl.Profile, NumTicks, (float) Speed / 10, 
+            ProfileMaxAccel, ProfileMaxJerk);
+    
     // Set Speed
     MotorControl_SetMotorSpeed(_Left_Motor, WhichDirection, Speed);
     MotorControl_SetMotorSpeed(_Right_Motor, WhichDirection, Speed);
+    
+    // Both wheels travel the same number of ticks, so keep them in step
+    DriveSyncActive = true;
 }
 
 /****************************************************************************
@@ -450,6 +800,12 @@ void MotorControl_DriveTurn(MotorControl_Turn_t WhichTurn, uint16_t Speed, uint1
     MotorControl_SetTickGoal(_Left_Motor, NumTicks);
     MotorControl_SetTickGoal(_Right_Motor, NumTicks);
     
+    // Plan velocity profiles for the move
+    MotionProfile_Plan(&LeftControl.Profile, NumTicks, (float) Speed / 10, 
+            ProfileMaxAccel, ProfileMaxJerk);
+    MotionProfile_Plan(&RightControl.Profile, NumTicks, (float) Speed / 10, 
+            ProfileMaxAccel, ProfileMaxJerk);
+    
     // Set Speed and direction
     if (WhichTurn == _Clockwise_Turn)
     {
@@ -462,158 +818,653 @@ void MotorControl_DriveTurn(MotorControl_Turn_t WhichTurn, uint16_t Speed, uint1
         MotorControl_SetMotorSpeed(_Right_Motor, _Forward_Dir, Speed);
     }
     
+    // Both wheels travel the same number of ticks, so keep them in step
+    DriveSyncActive = true;
 }
 
 /****************************************************************************
  * Function
- *      MotorControl_GetEncoder
+ *      MotorControl_SetProfileLimits
+ *      
+ * Parameters
+ *      uint16_t MaxAccel - Acceleration limit in RPM/s. 0 disables profiling
+ *                          and DriveStraight/DriveTurn use the position gain
+ *      uint16_t MaxJerk - Jerk limit in RPM/s^2. 0 gives a trapezoidal profile
+ * Return
+ *      void
+ * Description
+ *      Sets limits used to plan motion profiles for DriveStraight/DriveTurn
+ *      Takes effect on the next move
+****************************************************************************/
+void MotorControl_SetProfileLimits(uint16_t MaxAccel, uint16_t MaxJerk)
+{
+    ProfileMaxAccel = MaxAccel;
+    ProfileMaxJerk = MaxJerk;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_StartCharacterization
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Sweeps both motors through every linearization duty cycle in each 
+ *      direction and records steady state speed into the MotorLinearization
+ *      tables. Runs from the control law ISR and takes about 35 s.
+ *      Any call to StopMotors aborts it
+****************************************************************************/
+void MotorControl_StartCharacterization(void)
+{
+    MotorControl_StopMotors();
+    
+    CharDirection = _Forward_Dir;
+    CharIndex = 0;
+    CharTickCount = 0;
+    CharSettleTicks = CHAR_SETTLE_MS / ControlPeriodMs;
+    CharSampleTicks = CHAR_SAMPLE_MS / ControlPeriodMs;
+    // Tables are part old, part new until the sweep finishes
+    MotorLinearization_SetCharacterized(false);
+    CharacterizationActive = true;
+    
+    // Control law timer steps the sweep
+    MotorControl_EnableClosedLoop();
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_IsCharacterizing
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true while a characterization sweep is running
+****************************************************************************/
+bool MotorControl_IsCharacterizing(void)
+{
+    return CharacterizationActive;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetGains
  *      
  * Parameters
  *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Gains_t NewGains - PID gains to use
  * Return
- *      Encoder_t struct for specified motor
+ *      void
  * Description
- *      Get function to return Encoder Struct for specified Motor
+ *      Replaces the PID gains for one motor. Does not save them to flash
 ****************************************************************************/
-Encoder_t MotorControl_GetEncoder(MotorControl_Motor_t WhichMotor)
+void MotorControl_SetGains(MotorControl_Motor_t WhichMotor, MotorControl_Gains_t NewGains)
 {
     if (_Left_Motor == WhichMotor)
     {
-        return LeftEncoder;
+        LeftControl.Gains = NewGains;
     }
-    else
+    else if (_Right_Motor == WhichMotor)
     {
-        return RightEncoder;      
+        RightControl.Gains = NewGains;
     }
 }
 
 /****************************************************************************
  * Function
- *      MotorControl_GetControlState
+ *      MotorControl_GetGains
  *      
  * Parameters
  *      MotorControl_Motor_t WhichMotor - Left or Right Motor
  * Return
- *      ControlState_t struct for specified motor
- * Description
- *      Get function to return ControlState Struct for specified Motor
+ *      MotorControl_Gains_t, PID gains in use for that motor
 ****************************************************************************/
-ControlState_t MotorControl_GetControlState(MotorControl_Motor_t WhichMotor)
+MotorControl_Gains_t MotorControl_GetGains(MotorControl_Motor_t WhichMotor)
 {
     if (_Left_Motor == WhichMotor)
     {
-        return LeftControl;
+        return LeftControl.Gains;
     }
     else
     {
-        return RightControl;      
+        return RightControl.Gains;
     }
 }
 
-/***************************************************************************
- private functions
- ***************************************************************************/
-
-/*
- * InitPWMTimer
- * Helper Function for InitMotorControl
- * Handles configuration of Timer for PWM
- */
-static void InitPWMTimer(void)
-{
-    ////Timer 3 configuration (PWM OC)
-    //turn timer off 
-    T3CONbits.ON = 0;
-    //disable stop in idle 
-    T3CONbits.SIDL = 0;
-    //Set prescaler to 4
-    T3CONbits.TCKPS = 0b010;
-    //Set to 16-bit mode (Using T3 does this inherently)
-    //Use synchronous internal clock 
-    T3CONbits.TCS = 0; 
-    T3CONbits.TGATE = 0;
-    //Set period to required PWM period 
-    PR3 = PWM_PERIOD;
-    //Clear timer 
-    TMR3 = 0;
-}
-
-/*
- * InitLeftMotor
- * Helper Function for InitMotorControl
- * Handles configuration of ports and OC for Left Motor
- */
-static void InitLeftMotor(void)
+/****************************************************************************
+ * Function
+ *      MotorControl_SaveGains
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if gains were written to flash
+ * Description
+ *      Saves both motors' gains and the position gain to flash so they are 
+ *      loaded at next boot. Blocks ~20 ms with interrupts off, so only call
+ *      while the motors are stopped
+****************************************************************************/
+bool MotorControl_SaveGains(void)
 {
-    PortSetup_ConfigureDigitalOutputs(L_DIRB_PORT, L_DIRB_PIN);
-
-    // Set DIRB Lo for forward to ensure motor isn't running
-    L_DIRB_LAT = 0;
-    
-    //Turn OC1 off 
-    OC1CONbits.ON = 0;
-    //Disable SIDLE 
-    OC1CONbits.SIDL = 0;
-    //Use 16 bit mode 
-    OC1CONbits.OC32 = 0;
-    //Use timer 3 
-    OC1CONbits.OCTSEL = 1;
-    //Set to PWM mode, fault disabled 
-    OC1CONbits.OCM = 0b110;
+    // Don't stall the CPU while anything is moving
+    if (MotorsActive)
+    {
+        return false;
+    }
     
-    //Write initial duty cycle of 0
-    OC1R = 0;
-    OC1RS = 0;
+    StoredGains_t Record;
+    Record.Magic = GAINS_MAGIC;
+    // Stored at the nominal rate so they load correctly at any rate
+    Record.LeftGains = RescaleGains(LeftControl.Gains, ControlLawDt, NOMINAL_CONTROL_DT);
+    Record.RightGains = RescaleGains(RightControl.Gains, ControlLawDt, NOMINAL_CONTROL_DT);
+    Record.PositionGain = PositionGain;
+    Record.Checksum = GainsChecksum(&Record);
     
-    // Configure Pins
-    L_DIRA_REG = OC1_PERIPHERAL_CODE;
+    if (!NVM_ErasePage((const void *) GainStoragePage))
+    {
+        return false;
+    }
+    return NVM_WriteWords((const void *) GainStoragePage, Record.Words, 
+            sizeof(Record.Words) / sizeof(Record.Words[0]));
 }
 
-/*
- * InitRightMotor
- * Helper Function for InitMotorControl
- * Handles configuration of ports and OC for Right Motor
- */
-static void InitRightMotor(void)
+/****************************************************************************
+ * Function
+ *      MotorControl_StartAutoTune
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Relay feedback auto tune of both speed loops. Each motor is switched
+ *      between two duty cycles around a test speed until it oscillates, and
+ *      PID gains are computed from the oscillation amplitude and period.
+ *      A step to the test speed runs before and after, so the old and new
+ *      gains can be compared. Takes up to about 17 s.
+ *      New gains are used right away but only saved by MotorControl_SaveGains.
+ *      Any call to StopMotors aborts it
+****************************************************************************/
+void MotorControl_StartAutoTune(void)
 {
-    PortSetup_ConfigureDigitalOutputs(R_DIRB_PORT, R_DIRB_PIN);
-    
-    // Set DIRB Lo for forward to ensure motor isn't running
-    R_DIRB_LAT = 0;
-    
-    //Turn OC2 off 
-    OC2CONbits.ON = 0;
-    //Disable SIDLE 
-    OC2CONbits.SIDL = 0;
-    //Use 16 bit mode 
-    OC2CONbits.OC32 = 0;
-    //Use timer 3 
-    OC2CONbits.OCTSEL = 1;
-    //Set to PWM mode, fault disabled 
-    OC2CONbits.OCM = 0b110;
-    
-    //Write initial duty cycle of 0
-    OC2R = 0;
-    OC2RS = 0;
+    MotorControl_StopMotors();
     
-    // Configure Pins
-    R_DIRA_REG = OC2_PERIPHERAL_CODE;
+    memset(&LeftTune, 0, sizeof(LeftTune));
+    memset(&RightTune, 0, sizeof(RightTune));
+    // Relay swings around the duty the table says gives the test speed
+    LeftTune.BiasDuty = MotorLinearization_RPMToDuty(_Left_Motor, _Forward_Dir, TUNE_TARGET_RPM);
+    RightTune.BiasDuty = MotorLinearization_RPMToDuty(_Right_Motor, _Forward_Dir, TUNE_TARGET_RPM);
+    // Start high to get moving
+    LeftTune.RelayHigh = true;
+    RightTune.RelayHigh = true;
+    AutoTuneTicks = 0;
+    AutoTuneTimeoutTicks = TUNE_TIMEOUT_MS / ControlPeriodMs;
+    // Step response with the old gains first, for comparison
+    TuneComparisonValid = false;
+    TunePhase = _Tune_Before_Step;
+    StartStepTest();
+    AutoTuneActive = true;
     
+    // Control law timer steps the tuning
+    MotorControl_EnableClosedLoop();
 }
 
-/*
- * InitInputCapture
- * Helper Function for InitMotorControl
- * Handles configuration interrupts, and timers for input capture
+/****************************************************************************
+ * Function
+ *      MotorControl_IsAutoTuning
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true while auto tune is running
+****************************************************************************/
+bool MotorControl_IsAutoTuning(void)
+{
+    return AutoTuneActive;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetTuneComparison
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_StepResult_t *Before - Filled with the step response
+ *                                          with the gains before tuning
+ *      MotorControl_StepResult_t *After - Filled with it on the new gains
+ * Return
+ *      bool, false if no auto tune has finished since boot
+ * Description
+ *      Times are MOTORCONTROL_STEP_NOT_REACHED if the wheel never got there
+****************************************************************************/
+bool MotorControl_GetTuneComparison(MotorControl_Motor_t WhichMotor, 
+        MotorControl_StepResult_t *Before, MotorControl_StepResult_t *After)
+{
+    if (AutoTuneActive || !TuneComparisonValid)
+    {
+        return false;
+    }
+    *Before = TuneBefore[WhichMotor];
+    *After = TuneAfter[WhichMotor];
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetControlPeriod
+ *      
+ * Parameters
+ *      uint8_t PeriodMs - Control law period in ms (1-20)
+ * Return
+ *      bool, false if out of range or a sweep/auto tune is running
+ * Description
+ *      Changes the control law rate. I and D gains and the error sum are
+ *      rescaled so the controller behaves the same in continuous time
+****************************************************************************/
+bool MotorControl_SetControlPeriod(uint8_t PeriodMs)
+{
+    if ((PeriodMs < MIN_CONTROL_PERIOD_MS) || (PeriodMs > MAX_CONTROL_PERIOD_MS) ||
+            CharacterizationActive || AutoTuneActive)
+    {
+        return false;
+    }
+    
+    float NewDt = PeriodMs * 0.001f;
+    
+    // Hold off the control law while its state is changed
+    uint32_t WasEnabled = IEC0 & _IEC0_T4IE_MASK;
+    IEC0CLR = _IEC0_T4IE_MASK;
+    
+    LeftControl.Gains = RescaleGains(LeftControl.Gains, ControlLawDt, NewDt);
+    RightControl.Gains = RescaleGains(RightControl.Gains, ControlLawDt, NewDt);
+    // I gain scales with dt, so scale the sum the other way to keep the
+    // integral term continuous
+    LeftControl.SumError *= ControlLawDt / NewDt;
+    RightControl.SumError *= ControlLawDt / NewDt;
+    
+    ControlLawDt = NewDt;
+    ControlPeriodMs = PeriodMs;
+    PR4 = ((uint32_t) PeriodMs * CONTROL_LAW_COUNTS_PER_MS) - 1;
+    TMR4 = 0;
+    
+    // Old load numbers are for the old rate
+    LoadCountSum = 0;
+    LoadSamples = 0;
+    LoadCountPeak = 0;
+    LoadOverruns = 0;
+    LoadFilteredX16 = 0;
+    
+    IEC0SET = WasEnabled;
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetControlPeriod
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, control law period in ms
+****************************************************************************/
+uint8_t MotorControl_GetControlPeriod(void)
+{
+    return ControlPeriodMs;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetControlLawLoad
+ *      
+ * Parameters
+ *      float *AvgPercent - Filled with average CPU share of the control law ISR
+ *      float *PeakPercent - Filled with the worst single tick
+ *      uint32_t *Overruns - Filled with ticks that ran into the next period
+ * Return
+ *      void
+ * Description
+ *      Reports control law ISR cost since the last call, then resets it.
+ *      Cost is measured from the timer period match, so it includes
+ *      interrupt latency and time spent in higher priority ISRs
+****************************************************************************/
+void MotorControl_GetControlLawLoad(float *AvgPercent, float *PeakPercent, 
+        uint32_t *Overruns)
+{
+    // Snapshot with the control law held off so the numbers agree
+    uint32_t WasEnabled = IEC0 & _IEC0_T4IE_MASK;
+    IEC0CLR = _IEC0_T4IE_MASK;
+    uint32_t Sum = LoadCountSum;
+    uint32_t Samples = LoadSamples;
+    uint16_t Peak = LoadCountPeak;
+    *Overruns = LoadOverruns;
+    LoadCountSum = 0;
+    LoadSamples = 0;
+    LoadCountPeak = 0;
+    LoadOverruns = 0;
+    IEC0SET = WasEnabled;
+    
+    float PeriodCounts = (float) ControlPeriodMs * CONTROL_LAW_COUNTS_PER_MS;
+    *AvgPercent = (Samples > 0) ? (100.0f * Sum / Samples / PeriodCounts) : 0;
+    *PeakPercent = 100.0f * Peak / PeriodCounts;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetVelocityObserver
+ *      
+ * Parameters
+ *      bool Enable - true to run the speed loops on the observer estimate,
+ *                    false to use the raw speed of the last encoder edge
+ * Return
+ *      void
+ * Description
+ *      The observer runs either way so switching is bumpless. Off by default
+****************************************************************************/
+void MotorControl_SetVelocityObserver(bool Enable)
+{
+    UseObserver = Enable;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_IsVelocityObserver
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the speed loops use the observer estimate
+****************************************************************************/
+bool MotorControl_IsVelocityObserver(void)
+{
+    return UseObserver;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetEncoder
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      Encoder_t struct for specified motor
+ * Description
+ *      Consistent copy of the Encoder struct for specified Motor. Retries 
+ *      if an encoder ISR or the control law wrote it during the copy, so
+ *      call from the framework only, never from an ISR
+****************************************************************************/
+Encoder_t MotorControl_GetEncoder(MotorControl_Motor_t WhichMotor)
+{
+    Encoder_t Snapshot;
+    if (_Left_Motor == WhichMotor)
+    {
+        SeqReadCopy(&LeftEncoderSeq, &Snapshot, &LeftEncoder, sizeof(Snapshot));
+    }
+    else
+    {
+        SeqReadCopy(&RightEncoderSeq, &Snapshot, &RightEncoder, sizeof(Snapshot));
+    }
+    return Snapshot;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetControlState
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      ControlState_t struct for specified motor
+ * Description
+ *      Consistent copy of the ControlState struct for specified Motor. 
+ *      Same rules as MotorControl_GetEncoder
+****************************************************************************/
+ControlState_t MotorControl_GetControlState(MotorControl_Motor_t WhichMotor)
+{
+    ControlState_t Snapshot;
+    if (_Left_Motor == WhichMotor)
+    {
+        SeqReadCopy(&LeftControlSeq, &Snapshot, &LeftControl, sizeof(Snapshot));
+    }
+    else
+    {
+        SeqReadCopy(&RightControlSeq, &Snapshot, &RightControl, sizeof(Snapshot));
+    }
+    return Snapshot;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetRPM
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      float, latest measured speed of specified motor in RPM
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+float MotorControl_GetRPM(MotorControl_Motor_t WhichMotor)
+{
+    return (_Left_Motor == WhichMotor) ? LeftEncoder.CurrentRPM : 
+        RightEncoder.CurrentRPM;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetTickCount
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      uint32_t, encoder ticks of specified motor since the last reset
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+uint32_t MotorControl_GetTickCount(MotorControl_Motor_t WhichMotor)
+{
+    return (_Left_Motor == WhichMotor) ? LeftEncoder.TickCount : 
+        RightEncoder.TickCount;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetDirection
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      MotorControl_Direction_t, direction of the last encoder tick
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+MotorControl_Direction_t MotorControl_GetDirection(MotorControl_Motor_t WhichMotor)
+{
+    return (_Left_Motor == WhichMotor) ? LeftEncoder.Direction : 
+        RightEncoder.Direction;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetEstimatedRPM
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      float, observer speed estimate of specified motor in RPM
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+float MotorControl_GetEstimatedRPM(MotorControl_Motor_t WhichMotor)
+{
+    return (_Left_Motor == WhichMotor) ? LeftControl.Observer.RPM : 
+        RightControl.Observer.RPM;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetTargetRPM
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      float, speed the control law is aiming for this tick in RPM
+ * Description
+ *      Includes profile, position and sync adjustments to the user target.
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+float MotorControl_GetTargetRPM(MotorControl_Motor_t WhichMotor)
+{
+    return (_Left_Motor == WhichMotor) ? LeftControl.ActualTargetRPM : 
+        RightControl.ActualTargetRPM;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetDutyPermille
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      int16_t, last duty cycle written in tenths of a percent, negative
+ *      when driving backward
+ * Description
+ *      Direction and duty are read separately, so from the framework they
+ *      can be one update apart. Good enough for telemetry
+****************************************************************************/
+int16_t MotorControl_GetDutyPermille(MotorControl_Motor_t WhichMotor)
+{
+    uint16_t DutyQ15 = (_Left_Motor == WhichMotor) ? LeftPWMDutyQ15 : RightPWMDutyQ15;
+    MotorControl_Direction_t Direction = (_Left_Motor == WhichMotor) ? 
+        LeftPWMDirection : RightPWMDirection;
+    int16_t Permille = ((uint32_t) DutyQ15 * 1000 + (MOTOR_DUTY_Q15_FULL / 2)) / 
+            MOTOR_DUTY_Q15_FULL;
+    return (_Backward_Dir == Direction) ? -Permille : Permille;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetLoadPercent
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, running average CPU share of the control law ISR
+ * Description
+ *      Averages over about the last 16 ticks and, unlike
+ *      MotorControl_GetControlLawLoad, doesn't reset anything
+****************************************************************************/
+uint8_t MotorControl_GetLoadPercent(void)
+{
+    uint32_t PeriodCounts = (uint32_t) ControlPeriodMs * CONTROL_LAW_COUNTS_PER_MS;
+    uint32_t Percent = (100 * (LoadFilteredX16 >> LOAD_FILTER_SHIFT) + 
+            (PeriodCounts / 2)) / PeriodCounts;
+    return (Percent > 100) ? 100 : (uint8_t) Percent;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+/*
+ * InitPWMTimer
+ * Helper Function for InitMotorControl
+ * Handles configuration of Timer for PWM
+ */
+static void InitPWMTimer(void)
+{
+    ////Timer 3 configuration (PWM OC)
+    //turn timer off 
+    T3CONbits.ON = 0;
+    //disable stop in idle 
+    T3CONbits.SIDL = 0;
+    //Set prescaler to 1 for full resolution
+    T3CONbits.TCKPS = 0b000;
+    //Set to 16-bit mode (Using T3 does this inherently)
+    //Use synchronous internal clock 
+    T3CONbits.TCS = 0; 
+    T3CONbits.TGATE = 0;
+    //Set period to required PWM period 
+    PWMCounts = PWM_CLOCK / DEFAULT_PWM_FREQ;
+    PR3 = PWMCounts - 1;
+    //Clear timer 
+    TMR3 = 0;
+}
+
+/*
+ * InitLeftMotor
+ * Helper Function for InitMotorControl
+ * Handles configuration of ports and OC for Left Motor
+ */
+static void InitLeftMotor(void)
+{
+    PortSetup_ConfigureDigitalOutputs(L_DIRB_PORT, L_DIRB_PIN);
+
+    // Set DIRB Lo for forward to ensure motor isn't running
+    L_DIRB_LAT = 0;
+    
+    //Turn OC1 off 
+    OC1CONbits.ON = 0;
+    //Disable SIDLE 
+    OC1CONbits.SIDL = 0;
+    //Use 16 bit mode 
+    OC1CONbits.OC32 = 0;
+    //Use timer 3 
+    OC1CONbits.OCTSEL = 1;
+    //Set to PWM mode, fault disabled 
+    OC1CONbits.OCM = 0b110;
+    
+    //Write initial duty cycle of 0
+    OC1R = 0;
+    OC1RS = 0;
+    
+    // Configure Pins
+    L_DIRA_REG = OC1_PERIPHERAL_CODE;
+}
+
+/*
+ * InitRightMotor
+ * Helper Function for InitMotorControl
+ * Handles configuration of ports and OC for Right Motor
+ */
+static void InitRightMotor(void)
+{
+    PortSetup_ConfigureDigitalOutputs(R_DIRB_PORT, R_DIRB_PIN);
+    
+    // Set DIRB Lo for forward to ensure motor isn't running
+    R_DIRB_LAT = 0;
+    
+    //Turn OC2 off 
+    OC2CONbits.ON = 0;
+    //Disable SIDLE 
+    OC2CONbits.SIDL = 0;
+    //Use 16 bit mode 
+    OC2CONbits.OC32 = 0;
+    //Use timer 3 
+    OC2CONbits.OCTSEL = 1;
+    //Set to PWM mode, fault disabled 
+    OC2CONbits.OCM = 0b110;
+    
+    //Write initial duty cycle of 0
+    OC2R = 0;
+    OC2RS = 0;
+    
+    // Configure Pins
+    R_DIRA_REG = OC2_PERIPHERAL_CODE;
+    
+}
+
+/*
+ * InitInputCapture
+ * Helper Function for InitMotorControl
+ * Handles configuration interrupts, and timers for input capture
  */
 static void InitInputCapture(void)
 {
-    // Clear Interrupt flags
+    // Timer2 only latches the capture. Timestamps are extended to the 32 bit
+    // core timer in the IC ISRs, so its rollover needs no interrupt
+    IEC0CLR = _IEC0_T2IE_MASK;
     IFS0CLR = _IFS0_T2IF_MASK;
-    // Set priority
-    IPC2bits.T2IP = 6;
-    // Enable Interrupt
-    IEC0SET = _IEC0_T2IE_MASK;
     
     // Timer 2 (Encoder input capture)
     //turn timer off 
@@ -680,34 +1531,34 @@ static void InitLeftEncoder(void)
 static void InitRightEncoder(void)
 {
     // Clear Interrupt flags
-    IFS0CLR = _IFS0_IC2IF_MASK;
-    IFS0CLR = _IFS0_IC2EIF_MASK;
+    IFS0CLR = _IFS0_IC3IF_MASK;
+    IFS0CLR = _IFS0_IC3EIF_MASK;
     //Set interrupt priority
-    IPC2bits.IC2IP = 7;
+    IPC3bits.IC3IP = 7;
     //enable interrupt
-    IEC0SET = _IEC0_IC2IE_MASK;
+    IEC0SET = _IEC0_IC3IE_MASK;
     
-    ////Input Capture 2 configuration (Encoder)
-    //Turn IC2 Off 
-    IC2CONbits.ON = 0;
+    ////Input Capture 3 configuration (Encoder)
+    //Turn IC3 Off 
+    IC3CONbits.ON = 0;
     //disable SIDL 
-    IC2CONbits.SIDL = 0;
+    IC3CONbits.SIDL = 0;
     //Configure Mode Edge Detect mode ? every edge (rising and falling)
-    IC2CONbits.ICM = 0b001;
+    IC3CONbits.ICM = 0b001;
     //Use 16 bit timer 
-    IC2CONbits.C32 = 0;
+    IC3CONbits.C32 = 0;
     //Use timer 2
-    IC2CONbits.ICTMR = 1;
+    IC3CONbits.ICTMR = 1;
     //Interrupt every event 
-    IC2CONbits.ICI = 0b00;
-    //Clear IC2 buffer by reading IC1BUF 
-    IC2BUF;
+    IC3CONbits.ICI = 0b00;
+    //Clear IC3 buffer by reading IC3BUF 
+    IC3BUF;
     
     //Encoder Port Setup
-    PortSetup_ConfigureDigitalInputs(_Port_B, _Pin_10); // CH A
-    PortSetup_ConfigureDigitalInputs(_Port_B, _Pin_13); // CH B
-    // Map IC2 to RPB10 
-    IC2R = 0b0011;
+    PortSetup_ConfigureDigitalInputs(_Port_B, _Pin_5); // CH A
+    PortSetup_ConfigureDigitalInputs(_Port_B, _Pin_11); // CH B
+    // Map IC3 to RPB5 
+    IC3R = 0b0001;
 }
 
 /*
@@ -729,61 +1580,18 @@ static void InitControlLaw(void)
     T4CONbits.ON = 0;
     //disable stop in idle 
     T4CONbits.SIDL = 0;
-    //Set prescaler to 4 
-    T4CONbits.TCKPS = 0b010;
+    //Set prescaler to 8 so the slowest rate still fits in 16 bits
+    T4CONbits.TCKPS = 0b011;
     //Set to 16-bit mode 
     T4CONbits.T32 = 0;
     //Use syncronous internal clock 
     T4CONbits.TCS = 0; 
     T4CONbits.TGATE = 0;
-    //Set period to 24999 for time of 5 ms
-    PR4 = CONTROL_LAW_PERIOD;
+    //Set period to 12499 for time of 5 ms
+    PR4 = (DEFAULT_CONTROL_PERIOD_MS * CONTROL_LAW_COUNTS_PER_MS) - 1;
     //Clear timer to 0 
     TMR4 = 0;
-}
-#ifdef USE_CLOSED_LOOP
-/****************************************************************************
- Function
- Timer2Handler
-
- Parameters
-     None
-
- Returns
- void
- Description
- Interrupt Handler for Encoder timer rollover
- Notes
-
- Author
- * Andrew Sack 
-****************************************************************************/
-void __ISR(_TIMER_2_VECTOR, IPL6SOFT) Timer2Handler(void)
-{
-    //Disable interrupts globally (creates protected region in case IC happens)
-    __builtin_disable_interrupts();
-    //If T2IF is pending (there is a small chance that the IC has fired and handled it already)
-    if (1 == IFS0bits.T2IF)
-    {
-        //	Increment the rollover counter
-        ICTimerRollover.Rollover++;
-        //	Clear the roll?over interrupt (timer interrupt flag)
-        IFS0CLR = _IFS0_T2IF_MASK;  
-    }
-    
-    // Check for long time since last tick and set speed to 0 if so
-    if ((ICTimerRollover.TotalTime - LeftEncoder.LastTime.TotalTime) > ZERO_SPEED_PERIOD)
-    {
-        LeftEncoder.CurrentRPM = 0;
-    }
-        if ((ICTimerRollover.TotalTime - RightEncoder.LastTime.TotalTime) > ZERO_SPEED_PERIOD)
-    {
-        RightEncoder.CurrentRPM = 0;
-    }
-    
-    
-    //Enable interrupts (OK, since we know interrupts were enabled to get here)
-    __builtin_enable_interrupts();
+    // Turned on at the end of InitMotorControlDriver, once state is set up
 }
 
 /****************************************************************************
@@ -806,26 +1614,19 @@ void __ISR(_INPUT_CAPTURE_1_VECTOR, IPL7SOFT) LeftEncoderHandler(void)
 {
     __builtin_disable_interrupts();
     
-    //Read ICxBUFinto a static variable
-    ICTimerRollover.CapturedTime = IC1BUF;
+    //Read ICxBUF and convert it to a 32 bit core timer timestamp
+    uint32_t CaptureTime = CaptureToCoreTime(IC1BUF);
     //Clear the capture interrupt flag
     IFS0CLR = _IFS0_IC1IF_MASK;
-    //If T2IF is pending and CapturedTime is after rollover (<0x8000)
-    if (1 == IFS0bits.T2IF && ICTimerRollover.CapturedTime < 0x8000)
-    {
-        //	Increment the rollover counter
-        ICTimerRollover.Rollover++;
-        //	Clear the rollover interrupt (timer interrupt flag)
-        IFS0CLR = _IFS0_T2IF_MASK;
-    }   
     
+    SeqWriteBegin(&LeftEncoderSeq);
     //Copy timer value to Encoder struct and calculate speed
-    LeftEncoder.CurrentPeriod.TotalTime = ICTimerRollover.TotalTime - LeftEncoder.LastTime.TotalTime;
-    LeftEncoder.LastTime.TotalTime = ICTimerRollover.TotalTime;
+    LeftEncoder.CurrentPeriod = CaptureTime - LeftEncoder.LastTime;
+    LeftEncoder.LastTime = CaptureTime;
     LeftEncoder.TickCount++;
     
     // Calculate RPM. Only keep if below max
-    float TempRPM = (float) PERIOD_2_RPM / LeftEncoder.CurrentPeriod.TotalTime;
+    float TempRPM = (float) PERIOD_2_RPM / LeftEncoder.CurrentPeriod;
     if (TempRPM < MAX_RPM) LeftEncoder.CurrentRPM = TempRPM;
     
     // Trigger was a rising edge
@@ -846,15 +1647,19 @@ void __ISR(_INPUT_CAPTURE_1_VECTOR, IPL7SOFT) LeftEncoderHandler(void)
         // target reached within margin of error
         if (LeftEncoder.TickCount >= (LeftControl.TargetTickCount - TICK_DISTANCE_ERROR))
         {
-            printf("Left Drive Goal Reached \r\n");
+            SeqWriteBegin(&LeftControlSeq);
             // stop motor
             LeftControl.TargetRPM = 0;
             //Set DriveGoalReached to true
             LeftDriveGoalReached = true;
             // Reset TargetTickCount
             LeftControl.TargetTickCount = 0;
+            // Done with the motion profile
+            MotionProfile_Cancel(&LeftControl.Profile);
+            SeqWriteEnd(&LeftControlSeq);
         }
     }    
+    SeqWriteEnd(&LeftEncoderSeq);
     __builtin_enable_interrupts();
 }
 
@@ -874,30 +1679,23 @@ void __ISR(_INPUT_CAPTURE_1_VECTOR, IPL7SOFT) LeftEncoderHandler(void)
  Author
  * Andrew Sack 
 ****************************************************************************/
-void __ISR(_INPUT_CAPTURE_2_VECTOR, IPL7SOFT) RightEncoderHandler(void)
+void __ISR(_INPUT_CAPTURE_3_VECTOR, IPL7SOFT) RightEncoderHandler(void)
 {
      __builtin_disable_interrupts();
     
-    //Read ICxBUFinto a static variable
-    ICTimerRollover.CapturedTime = IC2BUF;
+    //Read ICxBUF and convert it to a 32 bit core timer timestamp
+    uint32_t CaptureTime = CaptureToCoreTime(IC3BUF);
     //Clear the capture interrupt flag
-    IFS0CLR = _IFS0_IC2IF_MASK;
-    //If T2IF is pending and CapturedTime is after rollover (<0x8000)
-    if (1 == IFS0bits.T2IF && ICTimerRollover.CapturedTime < 0x8000)
-    {
-        //	Increment the rollover counter
-        ICTimerRollover.Rollover++;
-        //	Clear the rollover interrupt (timer interrupt flag)
-        IFS0CLR = _IFS0_T2IF_MASK;
-    }   
+    IFS0CLR = _IFS0_IC3IF_MASK;
     
+    SeqWriteBegin(&RightEncoderSeq);
     //Copy timer value to Encoder struct and calculate speed
-    RightEncoder.CurrentPeriod.TotalTime = ICTimerRollover.TotalTime - RightEncoder.LastTime.TotalTime;
-    RightEncoder.LastTime.TotalTime = ICTimerRollover.TotalTime;
+    RightEncoder.CurrentPeriod = CaptureTime - RightEncoder.LastTime;
+    RightEncoder.LastTime = CaptureTime;
     RightEncoder.TickCount++;
     
     // Calculate RPM. Only keep if below max
-    float TempRPM = (float) PERIOD_2_RPM / RightEncoder.CurrentPeriod.TotalTime;
+    float TempRPM = (float) PERIOD_2_RPM / RightEncoder.CurrentPeriod;
     if (TempRPM < MAX_RPM) RightEncoder.CurrentRPM = TempRPM;
     
     // Trigger was a rising edge
@@ -917,15 +1715,19 @@ void __ISR(_INPUT_CAPTURE_2_VECTOR, IPL7SOFT) RightEncoderHandler(void)
         // target reached
         if (RightEncoder.TickCount >= (RightControl.TargetTickCount - TICK_DISTANCE_ERROR))
         {
-            printf("Right Drive Goal Reached \r\n");
+            SeqWriteBegin(&RightControlSeq);
             // stop motor
             RightControl.TargetRPM = 0;
             //Set DriveGoalReached to true
             RightDriveGoalReached = true;
             // Reset TargetTickCount
             RightControl.TargetTickCount = 0;
+            // Done with the motion profile
+            MotionProfile_Cancel(&RightControl.Profile);
+            SeqWriteEnd(&RightControlSeq);
         }
     } 
+    SeqWriteEnd(&RightEncoderSeq);
     
     // reenable interrupts
     __builtin_enable_interrupts();
@@ -941,24 +1743,118 @@ void __ISR(_INPUT_CAPTURE_2_VECTOR, IPL7SOFT) RightEncoderHandler(void)
  Returns
  void
  Description
- Interrupt Handler for Control Law Timer
+ Interrupt Handler for Control Law Timer
+ Notes
+
+ Author
+ * Andrew Sack 
+****************************************************************************/
+void __ISR(_TIMER_4_VECTOR, IPL4SOFT) ControlLawHandler(void)
+{
+    //	Clear the timer interrupt flag
+    IFS0CLR = _IFS0_T4IF_MASK;  
+    
+    // Control states are rewritten all through the tick
+    SeqWriteBegin(&LeftControlSeq);
+    SeqWriteBegin(&RightControlSeq);
+    RunControlLaw();
+    SeqWriteEnd(&RightControlSeq);
+    SeqWriteEnd(&LeftControlSeq);
+    
+    // Timer4 restarted from 0 at the period match that fired this interrupt,
+    // so it now holds latency + run time of the control law
+    uint16_t Elapsed = TMR4;
+    if (IFS0bits.T4IF)
+    {
+        // Already past the next period. TMR4 wrapped so count a full period
+        LoadOverruns++;
+        Elapsed = PR4 + 1;
+    }
+    LoadCountSum += Elapsed;
+    LoadSamples++;
+    LoadFilteredX16 += Elapsed - (LoadFilteredX16 >> LOAD_FILTER_SHIFT);
+    if (Elapsed > LoadCountPeak)
+    {
+        LoadCountPeak = Elapsed;
+    }
+}
+
+/****************************************************************************
+ Function
+ RunControlLaw
+
+ Parameters
+     None
+
+ Returns
+ void
+ Description
+ One control tick. Zero speed detection and the observers run in every
+ mode. Then runs the characterization sweep or auto tune if active,
+ otherwise updates both speed loops and checks drive goals in closed loop
  Notes
 
  Author
  * Andrew Sack 
 ****************************************************************************/
-void __ISR(_TIMER_4_VECTOR, IPL4SOFT) ControlLawHandler(void)
+static void RunControlLaw(void)
 {
-    //	Clear the timer interrupt flag
-    IFS0CLR = _IFS0_T4IF_MASK;  
+    // Zero speed detection. No edges means no speed update from the ISRs.
+    // Runs in open loop too, so speed decays and LastTime keeps up
+    uint32_t Now = _CP0_GET_COUNT();
+    CheckZeroSpeed(&LeftEncoder, &LeftEncoderSeq, Now);
+    CheckZeroSpeed(&RightEncoder, &RightEncoderSeq, Now);
+    // Speed estimates track the wheels in every mode so switching is smooth
+    RunObserver(&LeftControl, &LeftEncoder, LeftPWMDirection, LeftPWMDutyQ15, Now);
+    RunObserver(&RightControl, &RightEncoder, RightPWMDirection, RightPWMDutyQ15, Now);
+    // Fuel burns at the commanded thrust whatever the drive mode
+    Propulsion_BurnFuel(ControlPeriodMs);
     
-    // Left Motor Control Law
-    UpdateControlLaw(&LeftControl, &LeftEncoder);
-    MotorControl_SetMotorDutyCycle(_Left_Motor, LeftControl.TargetDirection, (uint16_t) LeftControl.RequestedDutyCycle);
+    // Characterization sweep replaces the control law while running
+    if (CharacterizationActive)
+    {
+        CharacterizationStep();
+        return;
+    }
+    // So does auto tune
+    if (AutoTuneActive)
+    {
+        AutoTuneStep();
+        return;
+    }
+    // Newest teleop thrust from the fast path, if any. Open loop sets the
+    // duty cycles here, velocity mode sets the speed targets
+    Propulsion_ReadThrustMailbox();
+    
+    // Open loop. Duty cycles are set directly
+    if (!ClosedLoopActive)
+    {
+        return;
+    }
+    
+    // Cross coupling. Slow the wheel that is ahead and speed up the one behind
+    if (DriveSyncActive)
+    {
+        float SyncError = (float) LeftEncoder.TickCount - (float) RightEncoder.TickCount;
+        LeftControl.SyncCorrection = -SyncGain * SyncError;
+        RightControl.SyncCorrection = SyncGain * SyncError;
+    }
+    else
+    {
+        LeftControl.SyncCorrection = 0;
+        RightControl.SyncCorrection = 0;
+    }
     
-    // Right Motor Control Law.
+    // Left and Right Motor Control Law
+    UpdateControlLaw(&LeftControl, &LeftEncoder);
     UpdateControlLaw(&RightControl, &RightEncoder);
-    MotorControl_SetMotorDutyCycle(_Right_Motor, RightControl.TargetDirection, (uint16_t)RightControl.RequestedDutyCycle);
+    // Apply both in the same PWM cycle. Q15 keeps the fractional duty cycle
+    MotorControl_SetMotorDutiesQ15(
+            LeftControl.TargetDirection, DutyCycleToQ15(LeftControl.RequestedDutyCycle),
+            RightControl.TargetDirection, DutyCycleToQ15(RightControl.RequestedDutyCycle));
+    
+    // Log this tick if a capture is running
+    ControlTelemetry_Record(&LeftControl, &LeftEncoder, &RightControl, &RightEncoder);
     
     // Check Drive Goal status for event posting
     bool DriveGoalReached = false;
@@ -968,22 +1864,95 @@ void __ISR(_TIMER_4_VECTOR, IPL4SOFT) ControlLawHandler(void)
         // If either are active and not reached, its false. Else, true
         DriveGoalReached = !((LeftDriveGoalActive && !LeftDriveGoalReached) || 
                 (RightDriveGoalActive && !RightDriveGoalReached));
+        
+        // Synced drive is only done once both wheels have come to rest
+        if (DriveGoalReached && DriveSyncActive)
+        {
+            DriveGoalReached = (LeftEncoder.CurrentRPM < SETTLED_RPM) && 
+                    (RightEncoder.CurrentRPM < SETTLED_RPM);
+        }
     }
     // Post event if reached
     if (DriveGoalReached)
     {
-#ifdef USE_CLOSED_LOOP
-        printf("MotorControl: Posting DRIVE_GOAL_REACHED\n\r");
         ES_Event_t PostEvent;
         PostEvent.EventType = DRIVE_GOAL_REACHED;
-        PostDriveTrain(PostEvent);
-#endif        
+        PostPropulsion(PostEvent);
         // Clear all flags
         LeftDriveGoalActive = false;
         LeftDriveGoalReached = false;
         RightDriveGoalActive = false;
         RightDriveGoalReached = false;
+        DriveSyncActive = false;
+    }
+}
+
+/*
+ * CaptureToCoreTime
+ * Helper for the encoder ISRs
+ * Timer2 has counted on since the capture. Reading it with the core timer
+ * gives how long ago the capture was, so the capture keeps its Timer2
+ * precision on a 32 bit timebase. Good for captures up to 13 ms old
+ */
+static uint32_t CaptureToCoreTime(uint16_t CapturedTime)
+{
+    uint32_t Now = _CP0_GET_COUNT();
+    uint16_t SinceCapture = (uint16_t) TMR2 - CapturedTime;
+    return Now - ((uint32_t) SinceCapture * CORE_COUNTS_PER_T2);
+}
+
+/*
+ * CheckZeroSpeed
+ * Helper for RunControlLaw, every tick in every drive mode
+ * Zeroes the speed of a wheel with no edge for ZERO_SPEED_PERIOD. While
+ * stopped, LastTime is dragged along so the core timer wrapping (every
+ * 214 s) can't make the first edge after a long stop look fast
+ */
+static void CheckZeroSpeed(Encoder_t *ThisEncoder, volatile uint32_t *Seq, 
+        uint32_t Now)
+{
+    // Encoder ISR could update LastTime part way through
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    if ((Now - ThisEncoder->LastTime) > ZERO_SPEED_PERIOD)
+    {
+        SeqWriteBegin(Seq);
+        ThisEncoder->CurrentRPM = 0;
+        ThisEncoder->LastTime = Now - ZERO_SPEED_PERIOD;
+        SeqWriteEnd(Seq);
+    }
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
+    }
+}
+
+/*
+ * RunObserver
+ * Helper for RunControlLaw
+ * Steps one wheel's speed observer with the duty cycle applied since the
+ * last tick. A drive against the wheel's motion counts as braking
+ */
+static void RunObserver(ControlState_t *ThisControl, Encoder_t *ThisEncoder,
+        MotorControl_Direction_t PWMDirection, uint16_t PWMDutyQ15, uint32_t Now)
+{
+    // Tick count and edge time must come from the same edge
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    uint32_t TickCount = ThisEncoder->TickCount;
+    uint32_t LastTime = ThisEncoder->LastTime;
+    MotorControl_Direction_t WheelDirection = ThisEncoder->Direction;
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
     }
+    
+    float ModelRPM = MotorLinearization_DutyToRPM(ThisControl->WhichMotor, 
+            PWMDirection, PWMDutyQ15 / DUTY_CYCLE_TO_Q15);
+    if ((PWMDirection != WheelDirection) && (ThisControl->Observer.RPM > 0))
+    {
+        ModelRPM = -ModelRPM;
+    }
+    VelocityObserver_Update(&ThisControl->Observer, TickCount, 
+            (Now - LastTime) / CORE_COUNTS_PER_S, ModelRPM, ControlLawDt);
 }
 
 /****************************************************************************
@@ -1005,9 +1974,40 @@ void __ISR(_TIMER_4_VECTOR, IPL4SOFT) ControlLawHandler(void)
 ****************************************************************************/
 void UpdateControlLaw(ControlState_t *ThisControl, Encoder_t *ThisEncoder)
 {
+    // Stopped, with no speed or goal to hold. Keep the motor off and the
+    // loop clear, or the D term kicks it as the speed reading drops to 0
+    if ((0 == ThisControl->TargetRPM) && (0 == ThisControl->TargetTickCount))
+    {
+        ThisControl->ActualTargetRPM = 0;
+        ThisControl->RequestedDutyCycle = 0;
+        ThisControl->IntegralTerm = 0;
+        ThisControl->RPMError = 0;
+        ThisControl->LastError = 0;
+        ThisControl->SumError = 0;
+        return;
+    }
     
-    // Position goal set
-    if (ThisControl->TargetTickCount != 0)
+    // Position goal set and following a motion profile
+    if ((ThisControl->TargetTickCount != 0) && ThisControl->Profile.Active)
+    {
+        // Profile velocity is the feedforward. Position gain pulls the wheel 
+        // back onto the planned position if it falls behind or runs ahead
+        float ProfileRPM = MotionProfile_Step(&ThisControl->Profile, ControlLawDt);
+        ThisControl->ActualTargetRPM = ProfileRPM + (PositionGain *
+                (ThisControl->Profile.Position - (float) ThisEncoder->TickCount));
+        
+        // Bound by 0 and TargetRPM
+        if (ThisControl->ActualTargetRPM > ThisControl->TargetRPM)
+        {
+            ThisControl->ActualTargetRPM = ThisControl->TargetRPM;
+        }
+        if (ThisControl->ActualTargetRPM < 0)
+        {
+            ThisControl->ActualTargetRPM = 0;
+        }
+    }
+    // Position goal set. No profile or profile finished short of goal
+    else if (ThisControl->TargetTickCount != 0)
     {
         // Scale target velocity based on distance to goal
         ThisControl->ActualTargetRPM = (PositionGain * 
@@ -1031,11 +2031,34 @@ void UpdateControlLaw(ControlState_t *ThisControl, Encoder_t *ThisEncoder)
         ThisControl->ActualTargetRPM = ThisControl->TargetRPM;
     }
     
-    ThisControl->RPMError = ThisControl->ActualTargetRPM - ThisEncoder->CurrentRPM;
+    // Apply left/right sync correction. Never ask for reverse
+    ThisControl->ActualTargetRPM += ThisControl->SyncCorrection;
+    if (ThisControl->ActualTargetRPM < 0)
+    {
+        ThisControl->ActualTargetRPM = 0;
+    }
+    
+    // Observer estimate is smooth between edges. Raw speed steps at each one
+    float MeasuredRPM = UseObserver ? ThisControl->Observer.RPM : 
+        ThisEncoder->CurrentRPM;
+    ThisControl->RPMError = ThisControl->ActualTargetRPM - MeasuredRPM;
     ThisControl->SumError += ThisControl->RPMError;
-    ThisControl->RequestedDutyCycle =
-    (pGain * ((ThisControl->RPMError)+(iGain * ThisControl->SumError)+
-            (dGain* (ThisControl->RPMError-ThisControl->LastError))));
+    // Integral contribution to duty. Kept for telemetry
+    ThisControl->IntegralTerm = ThisControl->Gains.P * ThisControl->Gains.I * 
+            ThisControl->SumError;
+    // Feedforward from the characterization table. PID only corrects the rest.
+    // Default tables are a guess the gains weren't tuned with, so no
+    // feedforward until the motors have been swept
+    float Feedforward = 0;
+    if (MotorLinearization_IsCharacterized())
+    {
+        Feedforward = MotorLinearization_RPMToDuty(ThisControl->WhichMotor, 
+                ThisControl->TargetDirection, ThisControl->ActualTargetRPM);
+    }
+    ThisControl->RequestedDutyCycle = Feedforward +
+    (ThisControl->Gains.P * ((ThisControl->RPMError)+
+            (ThisControl->Gains.I * ThisControl->SumError)+
+            (ThisControl->Gains.D * (ThisControl->RPMError-ThisControl->LastError))));
     if (ThisControl->RequestedDutyCycle > MAX_DUTY_CYCLE) {
         ThisControl->RequestedDutyCycle = MAX_DUTY_CYCLE;
         ThisControl->SumError -= ThisControl->RPMError;   /* anti-windup */
@@ -1045,4 +2068,491 @@ void UpdateControlLaw(ControlState_t *ThisControl, Encoder_t *ThisEncoder)
     } 
     ThisControl->LastError = ThisControl->RPMError; // update
 }
-#endif
\ No newline at end of file
+
+/****************************************************************************
+ Function
+ CharacterizationStep
+
+ Parameters
+ None
+
+ Returns
+ void
+ Description
+ Helper for control law ISR. Steps the characterization sweep by one tick.
+ Holds each duty cycle for CHAR_SETTLE_MS, then averages the speed of
+ both motors over CHAR_SAMPLE_MS and stores it in the tables.
+ Sweeps forward then backward, then stops the motors.
+ Notes
+
+ Author
+ * agent 
+****************************************************************************/
+static void CharacterizationStep(void)
+{
+    uint16_t DutyCycle = CharIndex * LINEARIZATION_DUTY_STEP;
+    
+    // New point. Set duty cycle and clear sums
+    if (CharTickCount == 0)
+    {
+        MotorControl_SetMotorDutiesQ15(CharDirection, DutyCycleToQ15(DutyCycle),
+                CharDirection, DutyCycleToQ15(DutyCycle));
+        CharLeftSum = 0;
+        CharRightSum = 0;
+    }
+    CharTickCount++;
+    
+    // Settled. Accumulate speed
+    if (CharTickCount > CharSettleTicks)
+    {
+        CharLeftSum += LeftEncoder.CurrentRPM;
+        CharRightSum += RightEncoder.CurrentRPM;
+    }
+    
+    // Done sampling this point
+    if (CharTickCount >= (CharSettleTicks + CharSampleTicks))
+    {
+        MotorLinearization_SetPoint(_Left_Motor, CharDirection, CharIndex, 
+                CharLeftSum / CharSampleTicks);
+        MotorLinearization_SetPoint(_Right_Motor, CharDirection, CharIndex, 
+                CharRightSum / CharSampleTicks);
+        
+        CharTickCount = 0;
+        CharIndex++;
+        if (CharIndex >= LINEARIZATION_POINTS)
+        {
+            CharIndex = 0;
+            if (CharDirection == _Forward_Dir)
+            {
+                // Sweep backward next
+                CharDirection = _Backward_Dir;
+            }
+            else
+            {
+                // Both directions done
+                MotorLinearization_SetCharacterized(true);
+                MotorControl_StopMotors();
+                MotorControl_DisableClosedLoop();
+                CharacterizationActive = false;
+            }
+        }
+    }
+}
+
+/****************************************************************************
+ Function
+ AutoTuneStep
+
+ Parameters
+ None
+
+ Returns
+ void
+ Description
+ Helper for control law ISR. Steps the auto tune by one tick: a step test
+ on the old gains, the relay test on both motors until both have a result
+ or it times out, then a step test on the new gains. Motors that timed out
+ keep their gains
+ Notes
+
+ Author
+ * agent
+****************************************************************************/
+static void AutoTuneStep(void)
+{
+    switch (TunePhase)
+    {
+        case _Tune_Before_Step:
+        {
+            if (StepTestStep(TuneBefore))
+            {
+                TunePhase = _Tune_Relay;
+            }
+        } break;
+        case _Tune_Relay:
+        {
+            AutoTuneTicks++;
+            if (!LeftTune.Done)
+            {
+                LeftTune.Done = RelayTuneStep(&LeftTune, &LeftControl, &LeftEncoder);
+            }
+            if (!RightTune.Done)
+            {
+                RightTune.Done = RelayTuneStep(&RightTune, &RightControl, &RightEncoder);
+            }
+            if ((LeftTune.Done && RightTune.Done) || (AutoTuneTicks >= AutoTuneTimeoutTicks))
+            {
+                TunePhase = _Tune_After_Step;
+                StartStepTest();
+            }
+        } break;
+        case _Tune_After_Step:
+        {
+            if (StepTestStep(TuneAfter))
+            {
+                TuneComparisonValid = true;
+                MotorControl_StopMotors();
+                MotorControl_DisableClosedLoop();
+                AutoTuneActive = false;
+            }
+        } break;
+    }
+}
+
+/*
+ * StartStepTest
+ * Helper for the auto tune
+ * Stops both wheels so the step starts from rest
+ */
+static void StartStepTest(void)
+{
+    StepTestTicks = 0;
+    RestTicks = 0;
+    memset(&LeftStep, 0, sizeof(LeftStep));
+    memset(&RightStep, 0, sizeof(RightStep));
+    LeftControl.TargetRPM = 0;
+    RightControl.TargetRPM = 0;
+    MotorControl_SetMotorDutiesQ15(_Forward_Dir, 0, _Forward_Dir, 0);
+}
+
+/*
+ * StepTestStep
+ * Helper for AutoTuneStep
+ * One tick of a step test. Waits for both wheels to stop, then runs the
+ * speed loops on a step to TUNE_TARGET_RPM for TUNE_STEP_MS. Fills
+ * Results for both motors and returns true once done, wheels stopped
+ */
+static bool StepTestStep(MotorControl_StepResult_t *Results)
+{
+    if (0 == StepTestTicks)
+    {
+        bool AtRest = (0 == LeftEncoder.CurrentRPM) && (0 == RightEncoder.CurrentRPM);
+        RestTicks++;
+        if (!AtRest && (RestTicks < (TUNE_REST_TIMEOUT_MS / ControlPeriodMs)))
+        {
+            return false;
+        }
+        // Step. Both loops start clean
+        ResetSpeedLoop(&LeftControl);
+        ResetSpeedLoop(&RightControl);
+        LeftControl.TargetDirection = _Forward_Dir;
+        RightControl.TargetDirection = _Forward_Dir;
+        LeftControl.TargetRPM = TUNE_TARGET_RPM;
+        RightControl.TargetRPM = TUNE_TARGET_RPM;
+    }
+    StepTestTicks++;
+    
+    UpdateControlLaw(&LeftControl, &LeftEncoder);
+    UpdateControlLaw(&RightControl, &RightEncoder);
+    MotorControl_SetMotorDutiesQ15(
+            _Forward_Dir, DutyCycleToQ15(LeftControl.RequestedDutyCycle),
+            _Forward_Dir, DutyCycleToQ15(RightControl.RequestedDutyCycle));
+    RecordStep(&LeftStep, LeftEncoder.CurrentRPM);
+    RecordStep(&RightStep, RightEncoder.CurrentRPM);
+    
+    if (StepTestTicks < (TUNE_STEP_MS / ControlPeriodMs))
+    {
+        return false;
+    }
+    Results[_Left_Motor] = StepResult(&LeftStep);
+    Results[_Right_Motor] = StepResult(&RightStep);
+    LeftControl.TargetRPM = 0;
+    RightControl.TargetRPM = 0;
+    MotorControl_SetMotorDutiesQ15(_Forward_Dir, 0, _Forward_Dir, 0);
+    return true;
+}
+
+/*
+ * RecordStep
+ * Helper for StepTestStep
+ * Tracks rise, peak and settling of one wheel for this tick
+ */
+static void RecordStep(StepTest_t *ThisStep, float RPM)
+{
+    if (RPM > ThisStep->PeakRPM)
+    {
+        ThisStep->PeakRPM = RPM;
+    }
+    if ((0 == ThisStep->RiseStartTick) && (RPM >= (0.1f * TUNE_TARGET_RPM)))
+    {
+        ThisStep->RiseStartTick = StepTestTicks;
+    }
+    if ((0 == ThisStep->RiseEndTick) && (RPM >= (0.9f * TUNE_TARGET_RPM)))
+    {
+        ThisStep->RiseEndTick = StepTestTicks;
+    }
+    if ((RPM > (TUNE_TARGET_RPM + TUNE_SETTLE_RPM)) || 
+            (RPM < (TUNE_TARGET_RPM - TUNE_SETTLE_RPM)))
+    {
+        ThisStep->LastOutsideTick = StepTestTicks;
+    }
+}
+
+/*
+ * StepResult
+ * Helper for StepTestStep
+ * Converts one wheel's step test to ms and percent
+ */
+static MotorControl_StepResult_t StepResult(const StepTest_t *ThisStep)
+{
+    MotorControl_StepResult_t Result;
+    Result.RiseMs = (0 == ThisStep->RiseEndTick) ? MOTORCONTROL_STEP_NOT_REACHED :
+        (ThisStep->RiseEndTick - ThisStep->RiseStartTick) * ControlPeriodMs;
+    // Still outside the band on the last tick means it never settled
+    Result.SettleMs = (ThisStep->LastOutsideTick >= StepTestTicks) ? 
+        MOTORCONTROL_STEP_NOT_REACHED : ThisStep->LastOutsideTick * ControlPeriodMs;
+    Result.OvershootPct = (ThisStep->PeakRPM > TUNE_TARGET_RPM) ? 
+        (100.0f * (ThisStep->PeakRPM - TUNE_TARGET_RPM) / TUNE_TARGET_RPM) : 0;
+    return Result;
+}
+
+/*
+ * ResetSpeedLoop
+ * Helper for StepTestStep and MotorControl_StopMotors
+ * Clears the PID state and any position, profile or sync target
+ */
+static void ResetSpeedLoop(ControlState_t *ThisControl)
+{
+    ThisControl->IntegralTerm = 0;
+    ThisControl->RPMError = 0;
+    ThisControl->LastError = 0;
+    ThisControl->SumError = 0;
+    ThisControl->SyncCorrection = 0;
+    ThisControl->TargetTickCount = 0;
+    MotionProfile_Cancel(&ThisControl->Profile);
+}
+
+/****************************************************************************
+ Function
+ RelayTuneStep
+
+ Parameters
+ RelayTune_t *ThisTune - Relay test state for the motor
+ ControlState_t *ThisControl - Control struct for the motor. Gains set here
+ Encoder_t *ThisEncoder - Encoder struct for the motor
+
+ Returns
+ bool, true once gains have been computed
+ Description
+ One tick of the relay test. Switches duty cycle each time the speed crosses
+ TUNE_TARGET_RPM, and after the oscillation settles measures its amplitude
+ and period. Ultimate gain Ku = 4h/(pi*a), ultimate period Tu, then
+ Ziegler-Nichols PID: Kp = 0.6Ku, Ti = Tu/2, Td = Tu/8, converted to the
+ per tick sum/difference form used by UpdateControlLaw
+ Notes
+
+ Author
+ * agent 
+****************************************************************************/
+static bool RelayTuneStep(RelayTune_t *ThisTune, ControlState_t *ThisControl, 
+        Encoder_t *ThisEncoder)
+{
+    float Speed = ThisEncoder->CurrentRPM;
+    
+    // Switch relay when speed crosses the test speed
+    if ((ThisTune->RelayHigh && (Speed > TUNE_TARGET_RPM)) ||
+            (!ThisTune->RelayHigh && (Speed < TUNE_TARGET_RPM)))
+    {
+        ThisTune->RelayHigh = !ThisTune->RelayHigh;
+        ThisTune->HalfCycles++;
+        
+        // Start of measurement. Seed peaks
+        if (ThisTune->HalfCycles == TUNE_SKIP_HALF_CYCLES)
+        {
+            ThisTune->MaxRPM = Speed;
+            ThisTune->MinRPM = Speed;
+            ThisTune->MeasureTicks = 0;
+        }
+    }
+    
+    // Measuring
+    if (ThisTune->HalfCycles >= TUNE_SKIP_HALF_CYCLES)
+    {
+        ThisTune->MeasureTicks++;
+        if (Speed > ThisTune->MaxRPM) ThisTune->MaxRPM = Speed;
+        if (Speed < ThisTune->MinRPM) ThisTune->MinRPM = Speed;
+    }
+    
+    // Enough cycles. Compute gains
+    if (ThisTune->HalfCycles >= (TUNE_SKIP_HALF_CYCLES + 2 * TUNE_MEASURE_CYCLES))
+    {
+        float Amplitude = 0.5f * (ThisTune->MaxRPM - ThisTune->MinRPM);
+        float Period = (float) ThisTune->MeasureTicks * ControlLawDt / TUNE_MEASURE_CYCLES;
+        if ((Amplitude > 0) && (Period > 0))
+        {
+            float Ku = 4 * TUNE_RELAY_DUTY / (PI * Amplitude);
+            ThisControl->Gains.P = 0.6f * Ku;
+            ThisControl->Gains.I = ControlLawDt / (0.5f * Period);
+            ThisControl->Gains.D = (0.125f * Period) / ControlLawDt;
+        }
+        // Park this wheel while the other one finishes
+        MotorControl_SetMotorDutyQ15(ThisControl->WhichMotor, _Forward_Dir, 0);
+        return true;
+    }
+    
+    // Apply relay output
+    float Duty = ThisTune->BiasDuty + 
+            (ThisTune->RelayHigh ? TUNE_RELAY_DUTY : -TUNE_RELAY_DUTY);
+    if (Duty < 0) Duty = 0;
+    if (Duty > MAX_DUTY_CYCLE) Duty = MAX_DUTY_CYCLE;
+    MotorControl_SetMotorDutyQ15(ThisControl->WhichMotor, _Forward_Dir, DutyCycleToQ15(Duty));
+    
+    return false;
+}
+
+/*
+ * LoadGains
+ * Helper Function for InitMotorControl
+ * Loads gains saved in flash if the record is valid, otherwise defaults
+ */
+static void LoadGains(void)
+{
+    StoredGains_t Record;
+    for (uint8_t i = 0; i < (sizeof(Record.Words) / sizeof(Record.Words[0])); i++)
+    {
+        Record.Words[i] = GainStoragePage[i];
+    }
+    
+    if ((Record.Magic == GAINS_MAGIC) && (Record.Checksum == GainsChecksum(&Record)))
+    {
+        puts("MotorControl: Loaded saved gains\r");
+        LeftControl.Gains = RescaleGains(Record.LeftGains, NOMINAL_CONTROL_DT, ControlLawDt);
+        RightControl.Gains = RescaleGains(Record.RightGains, NOMINAL_CONTROL_DT, ControlLawDt);
+        PositionGain = Record.PositionGain;
+    }
+    else
+    {
+        LeftControl.Gains.P = DEFAULT_P_GAIN;
+        LeftControl.Gains.I = DEFAULT_I_GAIN;
+        LeftControl.Gains.D = DEFAULT_D_GAIN;
+        RightControl.Gains = LeftControl.Gains;
+        PositionGain = DEFAULT_POSITION_GAIN;
+    }
+}
+
+/*
+ * GainsChecksum
+ * Helper for LoadGains and SaveGains
+ * Ones complement of the sum of every word before the checksum
+ */
+static uint32_t GainsChecksum(const StoredGains_t *Record)
+{
+    uint32_t Sum = 0;
+    for (uint8_t i = 0; i < ((sizeof(Record->Words) / sizeof(Record->Words[0])) - 1); i++)
+    {
+        Sum += Record->Words[i];
+    }
+    return ~Sum;
+}
+
+/*
+ * RescaleGains
+ * Helper for SetControlPeriod, SaveGains and LoadGains
+ * Converts per tick gains from one control period to another. I is
+ * dt/Ti so it scales with dt, D is Td/dt so it scales inversely
+ */
+static MotorControl_Gains_t RescaleGains(MotorControl_Gains_t Gains, float OldDt, float NewDt)
+{
+    Gains.I *= NewDt / OldDt;
+    Gains.D *= OldDt / NewDt;
+    return Gains;
+}
+
+/*
+ * DutyQ15ToOCRS
+ * Helper for the duty cycle setters
+ * Scales a Q15 duty cycle to the PWM period. Backward runs the H-bridge
+ * with DIRB high, so the low time of the PWM is the drive time
+ */
+static uint16_t DutyQ15ToOCRS(MotorControl_Direction_t WhichDirection, uint16_t DutyQ15)
+{
+    uint16_t OnCounts;
+    if (DutyQ15 >= MOTOR_DUTY_Q15_FULL)
+    {
+        // OCRS past PR3 keeps the output on for the whole period
+        OnCounts = PWMCounts;
+    }
+    else
+    {
+        OnCounts = (uint16_t) ((((uint32_t) DutyQ15 * PWMCounts) + 0x4000) >> 15);
+    }
+    if (_Backward_Dir == WhichDirection)
+    {
+        OnCounts = PWMCounts - OnCounts;
+    }
+    return OnCounts;
+}
+
+/*
+ * DutyCycleToQ15
+ * Helper for the duty cycle setters
+ * Converts a 0-1000 duty cycle, fractions kept, to Q15
+ */
+static uint16_t DutyCycleToQ15(float DutyCycle)
+{
+    if (DutyCycle <= 0) return 0;
+    if (DutyCycle >= MAX_DUTY_CYCLE) return MOTOR_DUTY_Q15_FULL;
+    return (uint16_t) (DutyCycle * DUTY_CYCLE_TO_Q15);
+}
+
+/*
+ * WaitForPWMUpdateWindow
+ * Helper for MotorControl_SetMotorDutiesQ15
+ * If Timer3 is about to hit the period match, waits for it to pass so two
+ * OCRS writes can't be split across it. Waits at most PWM_UPDATE_GUARD counts
+ */
+static void WaitForPWMUpdateWindow(void)
+{
+    // Timer off (init) means no period match to race
+    if (!T3CONbits.ON)
+    {
+        return;
+    }
+    while (TMR3 >= (PR3 - PWM_UPDATE_GUARD))
+    {
+    }
+}
+
+/*
+ * SeqWriteBegin
+ * Helper for the ISRs that write snapshot protected structs
+ * Makes the count odd before any field changes
+ */
+static void SeqWriteBegin(volatile uint32_t *Seq)
+{
+    (*Seq)++;
+    COMPILER_BARRIER();
+}
+
+/*
+ * SeqWriteEnd
+ * Helper for the ISRs that write snapshot protected structs
+ * Makes the count even again once every field is written
+ */
+static void SeqWriteEnd(volatile uint32_t *Seq)
+{
+    COMPILER_BARRIER();
+    (*Seq)++;
+}
+
+/*
+ * SeqReadCopy
+ * Helper for the snapshot getters
+ * Copies Source and retries if the count was odd or moved meanwhile, so a
+ * write that interrupted the copy is never returned half done. Framework
+ * writes can't overlap a framework read, so only ISR writes count, and
+ * each retry means an ISR ran. From an ISR that pre-empted a writer it
+ * would spin
+ */
+static void SeqReadCopy(const volatile uint32_t *Seq, void *Dest, 
+        const void *Source, size_t Size)
+{
+    uint32_t Start;
+    do
+    {
+        Start = *Seq;
+        COMPILER_BARRIER();
+        memcpy(Dest, Source, Size);
+        COMPILER_BARRIER();
+    } while ((Start & 1) || (Start != *Seq));
+}
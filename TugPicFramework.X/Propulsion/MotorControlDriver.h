@@ -11,11 +11,16 @@
 #define	MOTORCONTROLDRIVER_H
 
 #include "ES_Types.h"     /* gets bool type for returns */
+#include "MotionProfile.h"
+#include "VelocityObserver.h"
 
 // Drive Train (In header to allow use in other modules)
 #define TICKS_PER_CM 7.639 // Encoder ticks per cm of drive train distance
 #define TICKS_PER_DEGREE 1.85 // ticks per degree of drive train rotation (was 1.8)(was 1.763)
 
+// Q15 duty cycle. 0 is off, MOTOR_DUTY_Q15_FULL is always on
+#define MOTOR_DUTY_Q15_FULL 0x7FFF
+
 typedef enum
 {
   _Left_Motor = 0,
@@ -34,25 +39,33 @@ typedef enum
   _CounterClockwise_Turn = 1,
 }MotorControl_Turn_t;
 
-// encoder tick count type
-typedef union {
-    struct {
-        uint16_t CapturedTime;
-        uint16_t Rollover;   
-    };
-    uint32_t TotalTime;
-} RolloverTimer_t;
-
-
 typedef struct {
-    RolloverTimer_t LastTime;   // time of last encoder tick
-    RolloverTimer_t CurrentPeriod; // Period of most recent tick
+    uint32_t LastTime;          // core timer count at last encoder tick
+    uint32_t CurrentPeriod;     // Period of most recent tick in core timer counts
     float CurrentRPM;           // Speed of most recent tick in RPM
     uint32_t TickCount;         // Number of ticks since last reset
     MotorControl_Direction_t Direction; // Direction of last tick
 }Encoder_t ;
 
+// PID gains in the form used by the control law
+// Duty = P * (Error + I * SumError + D * (Error - LastError)), once per tick
+typedef struct {
+    float P;
+    float I;
+    float D;
+}MotorControl_Gains_t;
+
+// Step response of one speed loop, from the auto tune's step tests
+#define MOTORCONTROL_STEP_NOT_REACHED 0xFFFF
 typedef struct {
+    uint16_t RiseMs;            // 10% to 90% of the step
+    uint16_t SettleMs;          // Until it stays within 5% of the step
+    float OvershootPct;         // Peak past the step, percent of it
+}MotorControl_StepResult_t;
+
+typedef struct {
+    MotorControl_Motor_t WhichMotor; // Motor this state controls
+    MotorControl_Gains_t Gains;      // Gains for this motor
     uint32_t TargetTickCount;
     float TargetRPM;            // Set by user
     float ActualTargetRPM;      // Actual target used by control law. Changed based on distance when TickGoalSet
@@ -62,6 +75,9 @@ typedef struct {
     float LastError;
     float SumError;
     MotorControl_Direction_t TargetDirection;
+    float SyncCorrection;       // RPM added to target to keep both wheels in step
+    MotionProfile_t Profile;    // Velocity profile for current tick goal move
+    VelocityObserver_t Observer; // Speed estimate between encoder edges
 }ControlState_t;
 
 // Public Function Prototypes
@@ -86,6 +102,63 @@ bool InitMotorControlDriver(void);
 ****************************************************************************/
 void MotorControl_SetMotorDutyCycle(MotorControl_Motor_t WhichMotor, MotorControl_Direction_t WhichDirection, uint16_t DutyCycle);
 
+/****************************************************************************
+ * Function
+ *      MotorControl_SetMotorDutyQ15     
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Direction to move motor in
+ *      uint16_t DutyQ15 - Duty cycle as a Q15 fraction (0-MOTOR_DUTY_Q15_FULL)
+ * Return
+ *      void
+ * Description
+ *      Same as SetMotorDutyCycle but uses the full PWM timer resolution
+****************************************************************************/
+void MotorControl_SetMotorDutyQ15(MotorControl_Motor_t WhichMotor, 
+        MotorControl_Direction_t WhichDirection, uint16_t DutyQ15);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetMotorDutiesQ15     
+ *      
+ * Parameters
+ *      MotorControl_Direction_t LeftDirection, RightDirection - Directions
+ *      uint16_t LeftDutyQ15, RightDutyQ15 - Q15 duty cycles
+ * Return
+ *      void
+ * Description
+ *      Sets both motors so the new duty cycles start in the same PWM cycle
+****************************************************************************/
+void MotorControl_SetMotorDutiesQ15(MotorControl_Direction_t LeftDirection, 
+        uint16_t LeftDutyQ15, MotorControl_Direction_t RightDirection, 
+        uint16_t RightDutyQ15);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetPWMFrequency     
+ *      
+ * Parameters
+ *      uint32_t FrequencyHz - PWM frequency (1 kHz to 40 kHz)
+ * Return
+ *      bool, false if out of range
+ * Description
+ *      Changes the drive PWM frequency. Current duty cycles are kept.
+ *      Resolution is PBCLK/FrequencyHz steps, 1000 at the 20 kHz default
+****************************************************************************/
+bool MotorControl_SetPWMFrequency(uint32_t FrequencyHz);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetPWMFrequency     
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint32_t, PWM frequency in Hz
+****************************************************************************/
+uint32_t MotorControl_GetPWMFrequency(void);
+
 /****************************************************************************
  * Function
  *      MotorControl_StopMotors
@@ -108,7 +181,7 @@ void MotorControl_StopMotors(void);
  * Return
  *      void
  * Description
- *      Enables Control Law timer interrupt, causing motors to follow CL control
+ *      Lets the speed loops set the duty cycles from the next control tick
  *      SetMotorDutyCycle will not work properly when enabled
 ****************************************************************************/
 void MotorControl_EnableClosedLoop(void);
@@ -122,7 +195,8 @@ void MotorControl_EnableClosedLoop(void);
  * Return
  *      void
  * Description
- *      Disables Control Law timer interrupt. Motors use direct Duty Cycle
+ *      Stops the speed loops setting the duty cycles. Motors use direct 
+ *      Duty Cycle. The control tick keeps running for zero speed detection
  *      SetMotorDutyCycle will not work properly when enabled
 ****************************************************************************/
 void MotorControl_DisableClosedLoop(void);
@@ -145,6 +219,23 @@ void MotorControl_DisableClosedLoop(void);
 ****************************************************************************/
 void MotorControl_SetMotorSpeed(MotorControl_Motor_t WhichMotor, MotorControl_Direction_t WhichDirection, uint16_t Speed);
 
+/****************************************************************************
+ * Function
+ *      MotorControl_SetSpeedTargets
+ *      
+ * Parameters
+ *      MotorControl_Direction_t LeftDirection, RightDirection - Directions
+ *      uint16_t LeftSpeed, RightSpeed - target speeds in 0.1 RPM
+ * Return
+ *      void
+ * Description
+ *      Sets both speed targets from inside the control tick. Safe from the
+ *      tick, unlike SetMotorSpeed. Doesn't change drive sync or drive goals
+****************************************************************************/
+void MotorControl_SetSpeedTargets(MotorControl_Direction_t LeftDirection, 
+        uint16_t LeftSpeed, MotorControl_Direction_t RightDirection, 
+        uint16_t RightSpeed);
+
 /****************************************************************************
  * Function
  *      MotorControl_ResetTickCount
@@ -172,6 +263,241 @@ void MotorControl_ResetTickCount(MotorControl_Motor_t WhichMotor);
 ****************************************************************************/
 void MotorControl_SetTickGoal(MotorControl_Motor_t WhichMotor, uint32_t NumTicks);
 
+/****************************************************************************
+ * Function
+ *      MotorControl_DriveStraight
+ *      
+ * Parameters
+ *      MotorControl_Direction_t WhichDirection - Direction to drive in 
+ *                                      (forward or backward)       
+ *      uint16_t Speed - target speed to move at in units of 0.1 RPM (5 RPM = 50)
+ *                       Max speed is approx 170 RPM
+ *      uint16_t DistanceCM - Ground distance to travel in centimeters
+ *                  if set to 0, will drive indefinitely
+ * Return
+ *      void
+ * Description
+ *      Drive whole drive train straight forward or backward at set speed for 
+ *      specified distance. Follows a motion profile when one is enabled
+****************************************************************************/
+void MotorControl_DriveStraight(MotorControl_Direction_t WhichDirection, uint16_t Speed, uint16_t DistanceCM);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_DriveTurn
+ *      
+ * Parameters
+ *      MotorControl_Turn_t WhichTurn - Direction to turn (clock or counterclock)      
+ *      uint16_t Speed - target speed to move at in units of 0.1 RPM (5 RPM = 50)
+ *                       Max speed is approx 170 RPM
+ *      uint16_t AngleDeg - Angle in degrees to rotate base by
+ *                  if set to 0, will drive indefinitely
+ * Return
+ *      void
+ * Description
+ *      Turn whole drive train on the spot by Angle in specified direction and 
+ *      speed. Follows a motion profile when one is enabled
+****************************************************************************/
+void MotorControl_DriveTurn(MotorControl_Turn_t WhichTurn, uint16_t Speed, uint16_t AngleDeg);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetProfileLimits
+ *      
+ * Parameters
+ *      uint16_t MaxAccel - Acceleration limit in RPM/s. 0 disables profiling
+ *                          and DriveStraight/DriveTurn use the position gain
+ *      uint16_t MaxJerk - Jerk limit in RPM/s^2. 0 gives a trapezoidal profile
+ * Return
+ *      void
+ * Description
+ *      Sets limits used to plan motion profiles for DriveStraight/DriveTurn
+ *      Takes effect on the next move
+****************************************************************************/
+void MotorControl_SetProfileLimits(uint16_t MaxAccel, uint16_t MaxJerk);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_StartCharacterization
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Sweeps both motors through every linearization duty cycle in each 
+ *      direction and records steady state speed into the MotorLinearization
+ *      tables. Runs from the control law ISR and takes about 35 s.
+ *      Any call to StopMotors aborts it
+****************************************************************************/
+void MotorControl_StartCharacterization(void);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_IsCharacterizing
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true while a characterization sweep is running
+****************************************************************************/
+bool MotorControl_IsCharacterizing(void);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetGains
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Gains_t NewGains - PID gains to use
+ * Return
+ *      void
+ * Description
+ *      Replaces the PID gains for one motor. Does not save them to flash
+****************************************************************************/
+void MotorControl_SetGains(MotorControl_Motor_t WhichMotor, MotorControl_Gains_t NewGains);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetGains
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      MotorControl_Gains_t, PID gains in use for that motor
+****************************************************************************/
+MotorControl_Gains_t MotorControl_GetGains(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SaveGains
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if gains were written to flash
+ * Description
+ *      Saves both motors' gains and the position gain to flash so they are 
+ *      loaded at next boot. Blocks ~20 ms with interrupts off, so only call
+ *      while the motors are stopped
+****************************************************************************/
+bool MotorControl_SaveGains(void);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_StartAutoTune
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Relay feedback auto tune of both speed loops. Each motor is switched
+ *      between two duty cycles around a test speed until it oscillates, and
+ *      PID gains are computed from the oscillation amplitude and period.
+ *      A step to the test speed runs before and after, so the old and new
+ *      gains can be compared. Takes up to about 17 s.
+ *      New gains are used right away but only saved by MotorControl_SaveGains.
+ *      Any call to StopMotors aborts it
+****************************************************************************/
+void MotorControl_StartAutoTune(void);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_IsAutoTuning
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true while auto tune is running
+****************************************************************************/
+bool MotorControl_IsAutoTuning(void);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetTuneComparison
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_StepResult_t *Before - Filled with the step response
+ *                                          with the gains before tuning
+ *      MotorControl_StepResult_t *After - Filled with it on the new gains
+ * Return
+ *      bool, false if no auto tune has finished since boot
+ * Description
+ *      Times are MOTORCONTROL_STEP_NOT_REACHED if the wheel never got there
+****************************************************************************/
+bool MotorControl_GetTuneComparison(MotorControl_Motor_t WhichMotor, 
+        MotorControl_StepResult_t *Before, MotorControl_StepResult_t *After);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetControlPeriod
+ *      
+ * Parameters
+ *      uint8_t PeriodMs - Control law period in ms (1-20)
+ * Return
+ *      bool, false if out of range or a sweep/auto tune is running
+ * Description
+ *      Changes the control law rate. I and D gains and the error sum are
+ *      rescaled so the controller behaves the same in continuous time
+****************************************************************************/
+bool MotorControl_SetControlPeriod(uint8_t PeriodMs);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetControlPeriod
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, control law period in ms
+****************************************************************************/
+uint8_t MotorControl_GetControlPeriod(void);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetControlLawLoad
+ *      
+ * Parameters
+ *      float *AvgPercent - Filled with average CPU share of the control law ISR
+ *      float *PeakPercent - Filled with the worst single tick
+ *      uint32_t *Overruns - Filled with ticks that ran into the next period
+ * Return
+ *      void
+ * Description
+ *      Reports control law ISR cost since the last call, then resets it.
+ *      Cost is measured from the timer period match, so it includes
+ *      interrupt latency and time spent in higher priority ISRs
+****************************************************************************/
+void MotorControl_GetControlLawLoad(float *AvgPercent, float *PeakPercent, 
+        uint32_t *Overruns);
+
+
+/****************************************************************************
+ * Function
+ *      MotorControl_SetVelocityObserver
+ *      
+ * Parameters
+ *      bool Enable - true to run the speed loops on the observer estimate,
+ *                    false to use the raw speed of the last encoder edge
+ * Return
+ *      void
+ * Description
+ *      The observer runs either way so switching is bumpless. Off by default
+****************************************************************************/
+void MotorControl_SetVelocityObserver(bool Enable);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_IsVelocityObserver
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the speed loops use the observer estimate
+****************************************************************************/
+bool MotorControl_IsVelocityObserver(void);
 
 /****************************************************************************
  * Function
@@ -182,7 +508,9 @@ void MotorControl_SetTickGoal(MotorControl_Motor_t WhichMotor, uint32_t NumTicks
  * Return
  *      Encoder_t struct for specified motor
  * Description
- *      Get function to return Encoder Struct for specified Motor
+ *      Consistent copy of the Encoder struct for specified Motor. Retries 
+ *      if an encoder ISR or the control law wrote it during the copy, so
+ *      call from the framework only, never from an ISR
 ****************************************************************************/
 Encoder_t MotorControl_GetEncoder(MotorControl_Motor_t WhichMotor);
 
@@ -195,10 +523,106 @@ Encoder_t MotorControl_GetEncoder(MotorControl_Motor_t WhichMotor);
  * Return
  *      ControlState_t struct for specified motor
  * Description
- *      Get function to return ControlState Struct for specified Motor
+ *      Consistent copy of the ControlState struct for specified Motor. 
+ *      Same rules as MotorControl_GetEncoder
 ****************************************************************************/
 ControlState_t MotorControl_GetControlState(MotorControl_Motor_t WhichMotor);
 
+/****************************************************************************
+ * Function
+ *      MotorControl_GetRPM
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      float, latest measured speed of specified motor in RPM
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+float MotorControl_GetRPM(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetTickCount
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      uint32_t, encoder ticks of specified motor since the last reset
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+uint32_t MotorControl_GetTickCount(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetDirection
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      MotorControl_Direction_t, direction of the last encoder tick
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+MotorControl_Direction_t MotorControl_GetDirection(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetEstimatedRPM
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      float, observer speed estimate of specified motor in RPM
+ * Description
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+float MotorControl_GetEstimatedRPM(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetTargetRPM
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      float, speed the control law is aiming for this tick in RPM
+ * Description
+ *      Includes profile, position and sync adjustments to the user target.
+ *      Single word read, so never torn. Safe from ISRs
+****************************************************************************/
+float MotorControl_GetTargetRPM(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetDutyPermille
+ *      
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ * Return
+ *      int16_t, last duty cycle written in tenths of a percent, negative
+ *      when driving backward
+ * Description
+ *      Direction and duty are read separately, so from the framework they
+ *      can be one update apart. Good enough for telemetry
+****************************************************************************/
+int16_t MotorControl_GetDutyPermille(MotorControl_Motor_t WhichMotor);
+
+/****************************************************************************
+ * Function
+ *      MotorControl_GetLoadPercent
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint8_t, running average CPU share of the control law ISR
+ * Description
+ *      Averages over about the last 16 ticks and, unlike
+ *      MotorControl_GetControlLawLoad, doesn't reset anything
+****************************************************************************/
+uint8_t MotorControl_GetLoadPercent(void);
+
 /****************************************************************************
  * Function
  *      MotorControl_DriveStraight
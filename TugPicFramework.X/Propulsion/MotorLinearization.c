@@ -0,0 +1,309 @@
+/****************************************************************************
+ * File:   MotorLinearization.c
+ * Per motor duty cycle vs speed tables used to linearize the drive train
+ *
+ * Each table holds the steady state speed of one motor in one direction at
+ * duty cycles 0, 100, ... 1000. The tables are filled by the
+ * characterization sweep in MotorControlDriver and inverted here to get the
+ * duty cycle for a wanted speed.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "MotorLinearization.h"
+#include <stdio.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+// Defaults used until the motors are characterized
+#define LEFT_MIN_DUTY_CYCLE 300 // Duty cycle at which the left motor starts moving
+#define RIGHT_MIN_DUTY_CYCLE 300 // Duty cycle at which the right motor starts moving
+#define DEFAULT_MAX_RPM 170 // Approx top speed at full duty cycle
+#define MAX_DUTY_CYCLE 1000
+
+#define NUM_MOTORS 2
+#define NUM_DIRECTIONS 2
+
+/*---------------------------- Module Functions ---------------------------*/
+static void LoadDefaultCurve(float *Curve, uint16_t MinDutyCycle);
+
+/*---------------------------- Module Variables ---------------------------*/
+// Indexed [Motor][Direction][Point]
+static float SpeedTable[NUM_MOTORS][NUM_DIRECTIONS][LINEARIZATION_POINTS];
+// True once a full sweep has filled the tables
+static bool Characterized;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      MotorLinearization_Init
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Loads the default tables. Defaults reproduce the old linear mapping
+ *      above a fixed minimum duty cycle
+****************************************************************************/
+void MotorLinearization_Init(void)
+{
+    LoadDefaultCurve(SpeedTable[_Left_Motor][_Forward_Dir], LEFT_MIN_DUTY_CYCLE);
+    LoadDefaultCurve(SpeedTable[_Left_Motor][_Backward_Dir], LEFT_MIN_DUTY_CYCLE);
+    LoadDefaultCurve(SpeedTable[_Right_Motor][_Forward_Dir], RIGHT_MIN_DUTY_CYCLE);
+    LoadDefaultCurve(SpeedTable[_Right_Motor][_Backward_Dir], RIGHT_MIN_DUTY_CYCLE);
+    Characterized = false;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_SetPoint
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      uint8_t Index - Table point. Duty cycle is Index*LINEARIZATION_DUTY_STEP
+ *      float RPM - Measured steady state speed at that duty cycle
+ * Return
+ *      void
+ * Description
+ *      Stores one measured point. Called by the characterization sweep
+****************************************************************************/
+void MotorLinearization_SetPoint(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, uint8_t Index, float RPM)
+{
+    if (Index >= LINEARIZATION_POINTS) return;
+
+    float *Curve = SpeedTable[WhichMotor][WhichDirection];
+    // Keep table monotonic so the inverse lookup is well defined.
+    // Measurement noise can make a point read slightly below the last one
+    if ((Index > 0) && (RPM < Curve[Index - 1]))
+    {
+        RPM = Curve[Index - 1];
+    }
+    Curve[Index] = RPM;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_SetCharacterized
+ *
+ * Parameters
+ *      bool IsValid - true once every point of all 4 tables is measured
+ * Return
+ *      void
+ * Description
+ *      Called by the characterization sweep. Cleared when a sweep starts,
+ *      so an aborted sweep leaves the tables marked unmeasured
+****************************************************************************/
+void MotorLinearization_SetCharacterized(bool IsValid)
+{
+    Characterized = IsValid;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_IsCharacterized
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the tables were measured rather than defaults
+****************************************************************************/
+bool MotorLinearization_IsCharacterized(void)
+{
+    return Characterized;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_GetPoint
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      uint8_t Index - Table point
+ * Return
+ *      float, steady state speed in RPM at Index*LINEARIZATION_DUTY_STEP
+****************************************************************************/
+float MotorLinearization_GetPoint(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, uint8_t Index)
+{
+    if (Index >= LINEARIZATION_POINTS) return 0;
+    return SpeedTable[WhichMotor][WhichDirection][Index];
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_RPMToDuty
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      float RPM - Desired steady state speed
+ * Return
+ *      uint16_t, duty cycle (0-1000) expected to give that speed
+ * Description
+ *      Inverse lookup with linear interpolation between table points
+****************************************************************************/
+uint16_t MotorLinearization_RPMToDuty(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, float RPM)
+{
+    // turn motor all the way off to get rid of noise
+    if (RPM <= 0) return 0;
+
+    const float *Curve = SpeedTable[WhichMotor][WhichDirection];
+
+    // Find first point at or above the wanted speed. A measured table can
+    // start flat, or at or above the wanted speed, so the segment may have
+    // no slope. The point before it already gives the speed then
+    for (uint8_t i = 1; i < LINEARIZATION_POINTS; i++)
+    {
+        if (Curve[i] >= RPM)
+        {
+            float Rise = Curve[i] - Curve[i - 1];
+            float Fraction = (Rise > 0) ? ((RPM - Curve[i - 1]) / Rise) : 0;
+            if (Fraction < 0)
+            {
+                Fraction = 0;
+            }
+            return (uint16_t) (LINEARIZATION_DUTY_STEP * ((i - 1) + Fraction));
+        }
+    }
+
+    // Faster than the motor can go
+    return MAX_DUTY_CYCLE;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_DutyToRPM
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      float DutyCycle - Applied duty cycle (0-1000)
+ * Return
+ *      float, steady state speed expected at that duty cycle in RPM
+ * Description
+ *      Forward lookup with linear interpolation between table points
+****************************************************************************/
+float MotorLinearization_DutyToRPM(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, float DutyCycle)
+{
+    if (DutyCycle <= 0) return 0;
+    if (DutyCycle >= MAX_DUTY_CYCLE)
+    {
+        return SpeedTable[WhichMotor][WhichDirection][LINEARIZATION_POINTS - 1];
+    }
+
+    const float *Curve = SpeedTable[WhichMotor][WhichDirection];
+    float Point = DutyCycle / LINEARIZATION_DUTY_STEP;
+    uint8_t i = (uint8_t) Point;
+    return Curve[i] + ((Point - i) * (Curve[i + 1] - Curve[i]));
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_ThrustToDuty
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      float Thrust - Thrust magnitude from 0 to 1
+ * Return
+ *      uint16_t, duty cycle (0-1000)
+ * Description
+ *      Maps thrust onto a fraction of the top speed every motor can reach
+ *      in both directions so both motors respond the same to the same input.
+ *      Thrust past 1 is held at 1, so a faster motor tops out where its
+ *      table reaches the common top speed rather than jumping to full duty
+****************************************************************************/
+uint16_t MotorLinearization_ThrustToDuty(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, float Thrust)
+{
+    if (Thrust <= 0) return 0;
+    if (Thrust > 1) Thrust = 1;
+
+    return MotorLinearization_RPMToDuty(WhichMotor, WhichDirection,
+            Thrust * MotorLinearization_GetCommonMaxRPM());
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_GetCommonMaxRPM
+ *
+ * Parameters
+ *      void
+ * Return
+ *      float, top speed of the slowest motor/direction in RPM
+ * Description
+ *      Fastest speed both motors can hold in both directions. Full thrust
+ *      maps to this speed
+****************************************************************************/
+float MotorLinearization_GetCommonMaxRPM(void)
+{
+    float CommonMaxRPM = SpeedTable[0][0][LINEARIZATION_POINTS - 1];
+    for (uint8_t m = 0; m < NUM_MOTORS; m++)
+    {
+        for (uint8_t d = 0; d < NUM_DIRECTIONS; d++)
+        {
+            if (SpeedTable[m][d][LINEARIZATION_POINTS - 1] < CommonMaxRPM)
+            {
+                CommonMaxRPM = SpeedTable[m][d][LINEARIZATION_POINTS - 1];
+            }
+        }
+    }
+    return CommonMaxRPM;
+}
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_PrintTables
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Prints all 4 tables to the terminal
+****************************************************************************/
+void MotorLinearization_PrintTables(void)
+{
+    printf("%s\r\n", Characterized ? "Measured" : "Defaults, not characterized");
+    printf("Duty \tL Fwd \tL Bwd \tR Fwd \tR Bwd\r\n");
+    for (uint8_t i = 0; i < LINEARIZATION_POINTS; i++)
+    {
+        printf("%u \t%0.1f \t%0.1f \t%0.1f \t%0.1f\r\n",
+                i * LINEARIZATION_DUTY_STEP,
+                SpeedTable[_Left_Motor][_Forward_Dir][i],
+                SpeedTable[_Left_Motor][_Backward_Dir][i],
+                SpeedTable[_Right_Motor][_Forward_Dir][i],
+                SpeedTable[_Right_Motor][_Backward_Dir][i]);
+    }
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+/*
+ * LoadDefaultCurve
+ * Helper for MotorLinearization_Init
+ * Stopped below MinDutyCycle then linear up to DEFAULT_MAX_RPM at full duty
+ */
+static void LoadDefaultCurve(float *Curve, uint16_t MinDutyCycle)
+{
+    for (uint8_t i = 0; i < LINEARIZATION_POINTS; i++)
+    {
+        uint16_t DutyCycle = i * LINEARIZATION_DUTY_STEP;
+        if (DutyCycle <= MinDutyCycle)
+        {
+            Curve[i] = 0;
+        }
+        else
+        {
+            Curve[i] = (float) DEFAULT_MAX_RPM * (DutyCycle - MinDutyCycle)
+                    / (MAX_DUTY_CYCLE - MinDutyCycle);
+        }
+    }
+}
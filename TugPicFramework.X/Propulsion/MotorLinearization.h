@@ -0,0 +1,168 @@
+/****************************************************************************
+ * File:   MotorLinearization.h
+ * Per motor duty cycle vs speed tables used to linearize the drive train
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef MOTORLINEARIZATION_H
+#define	MOTORLINEARIZATION_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+#include "MotorControlDriver.h"
+
+// Table has one steady state speed per duty cycle step from 0 to 1000
+#define LINEARIZATION_POINTS 11
+#define LINEARIZATION_DUTY_STEP 100
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_Init
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Loads the default tables. Defaults reproduce the old linear mapping
+ *      above a fixed minimum duty cycle
+****************************************************************************/
+void MotorLinearization_Init(void);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_SetPoint
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      uint8_t Index - Table point. Duty cycle is Index*LINEARIZATION_DUTY_STEP
+ *      float RPM - Measured steady state speed at that duty cycle
+ * Return
+ *      void
+ * Description
+ *      Stores one measured point. Called by the characterization sweep
+****************************************************************************/
+void MotorLinearization_SetPoint(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, uint8_t Index, float RPM);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_SetCharacterized
+ *
+ * Parameters
+ *      bool IsValid - true once every point of all 4 tables is measured
+ * Return
+ *      void
+ * Description
+ *      Called by the characterization sweep. Cleared when a sweep starts,
+ *      so an aborted sweep leaves the tables marked unmeasured
+****************************************************************************/
+void MotorLinearization_SetCharacterized(bool IsValid);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_IsCharacterized
+ *
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if the tables were measured rather than defaults
+****************************************************************************/
+bool MotorLinearization_IsCharacterized(void);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_GetPoint
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      uint8_t Index - Table point
+ * Return
+ *      float, steady state speed in RPM at Index*LINEARIZATION_DUTY_STEP
+****************************************************************************/
+float MotorLinearization_GetPoint(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, uint8_t Index);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_RPMToDuty
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      float RPM - Desired steady state speed
+ * Return
+ *      uint16_t, duty cycle (0-1000) expected to give that speed
+ * Description
+ *      Inverse lookup with linear interpolation between table points
+****************************************************************************/
+uint16_t MotorLinearization_RPMToDuty(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, float RPM);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_DutyToRPM
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      float DutyCycle - Applied duty cycle (0-1000)
+ * Return
+ *      float, steady state speed expected at that duty cycle in RPM
+ * Description
+ *      Forward lookup with linear interpolation between table points
+****************************************************************************/
+float MotorLinearization_DutyToRPM(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, float DutyCycle);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_ThrustToDuty
+ *
+ * Parameters
+ *      MotorControl_Motor_t WhichMotor - Left or Right Motor
+ *      MotorControl_Direction_t WhichDirection - Forward or Backward
+ *      float Thrust - Thrust magnitude from 0 to 1
+ * Return
+ *      uint16_t, duty cycle (0-1000)
+ * Description
+ *      Maps thrust onto a fraction of the top speed every motor can reach
+ *      in both directions so both motors respond the same to the same input.
+ *      Thrust past 1 is held at 1, so a faster motor tops out where its
+ *      table reaches the common top speed rather than jumping to full duty
+****************************************************************************/
+uint16_t MotorLinearization_ThrustToDuty(MotorControl_Motor_t WhichMotor,
+        MotorControl_Direction_t WhichDirection, float Thrust);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_GetCommonMaxRPM
+ *
+ * Parameters
+ *      void
+ * Return
+ *      float, top speed of the slowest motor/direction in RPM
+ * Description
+ *      Fastest speed both motors can hold in both directions. Full thrust
+ *      maps to this speed
+****************************************************************************/
+float MotorLinearization_GetCommonMaxRPM(void);
+
+/****************************************************************************
+ * Function
+ *      MotorLinearization_PrintTables
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Prints all 4 tables to the terminal
+****************************************************************************/
+void MotorLinearization_PrintTables(void);
+
+#endif	/* MOTORLINEARIZATION_H */
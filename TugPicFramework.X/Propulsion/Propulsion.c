@@ -27,6 +27,9 @@
 #include "terminal.h"
 #include "Propulsion.h"
 #include "MotorControlDriver.h"
+#include "MotorLinearization.h"
+#include "ThrustMix.h"
+#include "ThrustLatency.h"
 #include "../HALs/PIC32PortHAL.h"
 #include <xc.h>
 #include <sys/attribs.h>
@@ -41,15 +44,13 @@
 #endif
 
 
-#define LEFT_MIN_DUTY_CYCLE 300 // Duty cycle at which the left motor starts moving
-#define RIGHT_MIN_DUTY_CYCLE 300 // Duty cycle at which the right motor starts moving
-#define MAX_DUTY_CYCLE 1000 // Max duty cycle input
-#define MAX_INPUT 127 // max val of x and yaw
-
 #define FULL_FUEL 255 
-#define FUEL_BURN_TIME 200 // msec = 5 Hz
-#define ONE_SEC 1000
-#define FUEL_BURN_PER_SEC 25.5 // Fuel burn at 100% thrust per second
+// Fuel is integrated in millionths of a level count so slow burns still count
+#define FUEL_UNITS_PER_LEVEL 1000000
+#define FULL_FUEL_UNITS ((uint32_t) FULL_FUEL * FUEL_UNITS_PER_LEVEL)
+#define FUEL_BURN_PER_MS 25500 // Fuel units burned per ms at 100% thrust (25.5 levels/s)
+#define MS_PER_TENTH_SEC 100
+#define TIME_TO_EMPTY_MAX 0xFFFE // Tenths of a second. Longer times saturate here
 
 #define abs(a) ((a) >= 0 ?  (a) : -1*(a))
 
@@ -60,6 +61,11 @@
 */
 void SetThrust(ArcadeControl_t input);
 uint16_t Propulsion_SetMotorDutyCycle(MotorControl_Motor_t WhichMotor, float Thrust);
+static uint16_t SetMotorSpeed(MotorControl_Motor_t WhichMotor, int16_t ThrustQ15);
+static uint16_t ThrustToSpeed(int16_t ThrustQ15);
+static void PostThrustMailbox(ArcadeControl_t input);
+static void StopDrive(void);
+static void SetBurnRate(int16_t LeftThrustQ15, int16_t RightThrustQ15);
 
 /*---------------------------- Module Variables ---------------------------*/
 // everybody needs a state variable, you may need others as well.
@@ -69,8 +75,18 @@ static PropulsionState_t CurrentState;
 // with the introduction of Gen2, we need a module level Priority var as well
 static uint8_t MyPriority;
 
-static float FuelLevel;
-static float FuelBurnRate;
+// Burned down by the control tick, so volatile
+static volatile uint32_t FuelLevel;     // Fuel units remaining
+static volatile uint32_t FuelBurnPerMs; // Fuel units per ms at the commanded thrust
+
+static volatile Propulsion_DriveMode_t DriveMode; // read by control law ISR
+
+// Fast path thrust mailbox. One word so a single store publishes it:
+// bits 0-15 ArcadeControl_t, bits 16-31 sequence number
+static volatile uint32_t ThrustMailbox;
+static uint16_t MailboxSequence; // Writer side only
+static uint16_t MailboxLastRead; // Control law ISR only
+static volatile bool FastPathEnabled;
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -104,8 +120,16 @@ bool InitPropulsion(uint8_t Priority)
     MotorControl_StopMotors();
     
     // Start Fuel as full and burn rate as 0
-    FuelLevel = FULL_FUEL;
-    FuelBurnRate = 0;
+    FuelLevel = FULL_FUEL_UNITS;
+    FuelBurnPerMs = 0;
+    
+    // Open loop until switched. Needs no encoders
+    DriveMode = _OpenLoop_Drive;
+    // Control frames go through the event queue until enabled
+    FastPathEnabled = false;
+    ThrustMailbox = 0;
+    MailboxSequence = 0;
+    MailboxLastRead = 0;
     
     puts("...Done Initializing Propulsion\r\n");
  
@@ -167,6 +191,12 @@ ES_Event_t RunPropulsion(ES_Event_t ThisEvent)
     
     ES_Event_t PostEvent;
     
+    // Printed here rather than in the encoder ISRs, which can't use the UART
+    if (DRIVE_GOAL_REACHED == ThisEvent.EventType)
+    {
+        printf("Propulsion: Drive Goal Reached\r\n");
+    }
+    
     switch (CurrentState)
     {
         case (FuelEmptyState):
@@ -176,25 +206,20 @@ ES_Event_t RunPropulsion(ES_Event_t ThisEvent)
                 case (PROPULSION_REFUEL):
                 {
                     printdebug("Propulsion: Fuel Empty PROPULSION_REFUEL\r\n");
-                    FuelLevel = FULL_FUEL;
+                    FuelLevel = FULL_FUEL_UNITS;
                     CurrentState = FuelFullState;
-                    // Start fuel burning timer
-                    ES_Timer_InitTimer(FUEL_TIMER, FUEL_BURN_TIME);
                 } break;
                 case (PAIRING_COMPLETE):
                 {
                     printdebug("Propulsion: Fuel Empty PAIRING_COMPLETE\r\n");
-                    FuelLevel = FULL_FUEL;
+                    FuelLevel = FULL_FUEL_UNITS;
                     CurrentState = FuelFullState;
-                    // Start fuel burning timer
-                    ES_Timer_InitTimer(FUEL_TIMER, FUEL_BURN_TIME);
                 } break;
                 case (WAIT_TO_PAIR):
                 {
                     printdebug("Propulsion: Fuel Empty WAIT_TO_PAIR\r\n");
                     // Disable Motors when pairing
-                    MotorControl_StopMotors();
-                    FuelBurnRate = 0;
+                    StopDrive();
                 } break;
                 default:
                     ;
@@ -208,40 +233,22 @@ ES_Event_t RunPropulsion(ES_Event_t ThisEvent)
                 case (PROPULSION_SET_THRUST):
                 {
                     printdebug("Propulsion: FuelFull PROPULSION_SET_THRUST\r\n");
+                    ThrustLatency_SetpointApplied(_Event_Path);
                     SetThrust((ArcadeControl_t) ThisEvent.EventParam);
                 } break;
-                case (ES_TIMEOUT):
+                case (PROPULSION_FUEL_EMPTY):
                 {
-                    //printdebug("Propulsion: FuelFull ES_TIMEOUT\r\n");
-                    // Make sure it is correct timer
-                    if (ThisEvent.EventParam == FUEL_TIMER)
-                    {
-                        FuelLevel -= FuelBurnRate; // Decrement Fuel
-                        //printdebug("Burned Fuel. Level: %0.3f \t Rate: %0.5f \r\n", FuelLevel, FuelBurnRate );
-                        
-                        if (FuelLevel > 0)
-                        {
-                            // Restart fuel burning timer
-                            ES_Timer_InitTimer(FUEL_TIMER, FUEL_BURN_TIME);
-                        }
-                        else
-                        {
-                            // Stop motors and go to FuelEmpty State
-                            MotorControl_StopMotors();
-                            FuelBurnRate = 0;
-                            CurrentState = FuelEmptyState;
-                        }
-                    }
+                    printdebug("Propulsion: FuelFull PROPULSION_FUEL_EMPTY\r\n");
+                    // Stop motors and go to FuelEmpty State
+                    StopDrive();
+                    CurrentState = FuelEmptyState;
                 } break;
                 case (WAIT_TO_PAIR):
                 {
                     printdebug("Propulsion: FuelFull WAIT_TO_PAIR\r\n");
                     // Disable Motors when pairing
-                    MotorControl_StopMotors();
-                    FuelBurnRate = 0;
+                    StopDrive();
                     CurrentState = FuelEmptyState;
-                    // Stop fuel burning timer
-                    ES_Timer_StopTimer(FUEL_TIMER);
                 } break;
                 default:
                     ;
@@ -290,10 +297,237 @@ PropulsionState_t QueryPropulsion(void)
 ****************************************************************************/
 uint8_t Propulsion_GetFuelLevel(void)
 {
-    if (FuelLevel <= 0) return 0;
-    if (FuelLevel >= 255) return 255;
-    return (uint8_t) FuelLevel;
+    // Round up so the level only reads 0 once the tank is really empty
+    return (uint8_t) ((FuelLevel + FUEL_UNITS_PER_LEVEL - 1) / FUEL_UNITS_PER_LEVEL);
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_GetTimeToEmpty
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      uint16_t, time until the tank is empty at the current thrust in
+ *      tenths of a second. PROPULSION_NOT_BURNING if thrust is 0
+****************************************************************************/
+uint16_t Propulsion_GetTimeToEmpty(void)
+{
+    // Control tick can burn fuel between the reads. Use one of each
+    uint32_t Level = FuelLevel;
+    uint32_t BurnPerMs = FuelBurnPerMs;
+    if (BurnPerMs == 0)
+    {
+        return PROPULSION_NOT_BURNING;
+    }
+    uint32_t TimeToEmpty = Level / BurnPerMs / MS_PER_TENTH_SEC;
+    return (TimeToEmpty > TIME_TO_EMPTY_MAX) ? TIME_TO_EMPTY_MAX : (uint16_t) TimeToEmpty;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_CheckFuel
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if PROPULSION_FUEL_EMPTY was posted
+ * Description
+ *      Event checker. Posts PROPULSION_FUEL_EMPTY once the control tick
+ *      has burned the tank dry
+****************************************************************************/
+bool Propulsion_CheckFuel(void)
+{
+    if ((FuelFullState == CurrentState) && (0 == FuelLevel))
+    {
+        ES_Event_t PostEvent;
+        PostEvent.EventType = PROPULSION_FUEL_EMPTY;
+        PostPropulsion(PostEvent);
+        return true;
+    }
+    return false;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_SetDriveMode
+ *      
+ * Parameters
+ *      Propulsion_DriveMode_t NewMode - Open loop duty or closed loop speed
+ * Return
+ *      void
+ * Description
+ *      Switches how thrust commands drive the motors. Stops the motors and
+ *      empties the thrust mailbox, so the next thrust command starts cleanly
+ *      in the new mode
+****************************************************************************/
+void Propulsion_SetDriveMode(Propulsion_DriveMode_t NewMode)
+{
+    StopDrive();
+    // Control law would overwrite open loop duty cycles
+    MotorControl_DisableClosedLoop();
+    DriveMode = NewMode;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_GetDriveMode
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      Propulsion_DriveMode_t, current drive mode
+****************************************************************************/
+Propulsion_DriveMode_t Propulsion_GetDriveMode(void)
+{
+    return DriveMode;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_SetFastPath
+ *      
+ * Parameters
+ *      bool Enable - true to send control frames through the mailbox
+ * Return
+ *      void
+ * Description
+ *      Turns the low latency control frame path on or off
+****************************************************************************/
+void Propulsion_SetFastPath(bool Enable)
+{
+    FastPathEnabled = Enable;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_IsFastPath
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      bool, true if control frames use the fast path
+****************************************************************************/
+bool Propulsion_IsFastPath(void)
+{
+    return FastPathEnabled;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_FastSetThrust
+ *      
+ * Parameters
+ *      ArcadeControl_t input - Thrust from a validated control frame
+ * Return
+ *      bool, false if the caller should post PROPULSION_SET_THRUST instead
+ * Description
+ *      Sets thrust without waiting in the framework queue. The thrust goes
+ *      in the mailbox and the next control tick applies it in either drive
+ *      mode, so only the tick writes the motors on this path.
+ *      Refused while the fast path is off or the tank is empty, so a refuel
+ *      posted just before is handled first
+****************************************************************************/
+bool Propulsion_FastSetThrust(ArcadeControl_t input)
+{
+    if (!FastPathEnabled || (FuelFullState != CurrentState))
+    {
+        return false;
+    }
+    
+    ThrustLatency_FrameAccepted(_Fast_Path);
+    // Burn rate is set here. The tick only writes the motors
+    int16_t LeftThrustQ15;
+    int16_t RightThrustQ15;
+    ThrustMix_Mix(input.X, input.Yaw, &LeftThrustQ15, &RightThrustQ15);
+    SetBurnRate(LeftThrustQ15, RightThrustQ15);
+    PostThrustMailbox(input);
+    return true;
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_FailsafeStop
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Link failsafe. Zeroes both duty cycles now and the speed targets the
+ *      control law holds, without waiting in the framework queue. Stays in
+ *      the fuel state it was in, so the next control frame drives again
+****************************************************************************/
+void Propulsion_FailsafeStop(void)
+{
+    if (FuelFullState == CurrentState)
+    {
+        StopDrive();
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_BurnFuel
+ *      
+ * Parameters
+ *      uint8_t ElapsedMs - Time since the last call, the control period
+ * Return
+ *      void
+ * Description
+ *      Called from the control tick in every drive mode. Burns fuel at the
+ *      commanded rate, so a thrust change counts from the tick it takes
+ *      effect on
+****************************************************************************/
+void Propulsion_BurnFuel(uint8_t ElapsedMs)
+{
+    uint32_t Burned = (uint32_t) ElapsedMs * FuelBurnPerMs;
+    FuelLevel = (Burned >= FuelLevel) ? 0 : (FuelLevel - Burned);
+}
+
+/****************************************************************************
+ * Function
+ *      Propulsion_ReadThrustMailbox
+ *      
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Called from the control law ISR in every drive mode, before the
+ *      speed loops run. Applies the newest mailbox thrust, if there is one.
+ *      Open loop sets the duty cycles, velocity mode the wheel speed targets
+****************************************************************************/
+void Propulsion_ReadThrustMailbox(void)
+{
+    uint32_t Mail = ThrustMailbox;
+    uint16_t Sequence = Mail >> 16;
+    // Sequence 0 is an emptied mailbox
+    if ((0 == Sequence) || (Sequence == MailboxLastRead))
+    {
+        return;
+    }
+    MailboxLastRead = Sequence;
     
+    ArcadeControl_t input;
+    input.Total = Mail & 0xFFFF;
+    int16_t LeftThrustQ15;
+    int16_t RightThrustQ15;
+    ThrustMix_Mix(input.X, input.Yaw, &LeftThrustQ15, &RightThrustQ15);
+    ThrustLatency_SetpointApplied(_Fast_Path);
+    if (_Velocity_Drive == DriveMode)
+    {
+        MotorControl_SetSpeedTargets(
+                (LeftThrustQ15 >= 0) ? _Forward_Dir : _Backward_Dir, 
+                ThrustToSpeed(LeftThrustQ15),
+                (RightThrustQ15 >= 0) ? _Forward_Dir : _Backward_Dir, 
+                ThrustToSpeed(RightThrustQ15));
+    }
+    else
+    {
+        Propulsion_SetMotorDutyCycle(_Left_Motor, (float) LeftThrustQ15 / THRUST_Q15_FULL);
+        Propulsion_SetMotorDutyCycle(_Right_Motor, (float) RightThrustQ15 / THRUST_Q15_FULL);
+    }
 }
 
 /***************************************************************************
@@ -311,8 +545,8 @@ uint8_t Propulsion_GetFuelLevel(void)
  void
 
  Description
- Converts control input to L&R thrust and sets motor duty cycles
- Calculates thrust percentage and sets FuelBurnRate
+ Converts control input to L&R thrust with ThrustMix and sets motor duty cycles
+ Sets the fuel burn rate for the new thrust
  
  Notes
 
@@ -323,59 +557,47 @@ void SetThrust(ArcadeControl_t input)
 {
     printdebug("Propulsion: Setting thrust %x\r\n", input.Total);
     
-    // Set -128 to -127 to make pos and neg symmetric
-    if (input.X == -128) input.X = -127;
-    if (input.Yaw == -128) input.Yaw = -127;
+    // Fixed point table mix. Same result as the old float quadrant mix
+    int16_t LeftThrustQ15;
+    int16_t RightThrustQ15;
+    ThrustMix_Mix(input.X, input.Yaw, &LeftThrustQ15, &RightThrustQ15);
     
-    // Convert To floats betwen -1 and 1 for math
-    float X_ratio = (float) input.X / MAX_INPUT;
-    float Yaw_ratio = (float) input.Yaw / MAX_INPUT;
+    float LeftThrust = (float) LeftThrustQ15 / THRUST_Q15_FULL;
+    float RightThrust = (float) RightThrustQ15 / THRUST_Q15_FULL;
     
-    //variables to determine the quadrants 
-    float maximum = max(abs(X_ratio), abs(Yaw_ratio));
-    float total = X_ratio + Yaw_ratio;
-    float difference = X_ratio - Yaw_ratio;
-    
-    float LeftThrust;
-    float RightThrust;
-
-    // set thrust according to the quadrant that the values are in
-    if (X_ratio >= 0)
+    // Duty cycle in open loop, speed in 0.1 RPM in velocity mode
+    uint16_t LeftDC;
+    uint16_t RightDC;
+    if (_Velocity_Drive == DriveMode)
     {
-        if (Yaw_ratio >= 0) // 1st quadrant
-        {
-            LeftThrust = maximum;
-            RightThrust = difference;
-        }
-        else // 2nd quadrant
-        {
-            LeftThrust = total;
-            RightThrust = maximum;
-        }
+        LeftDC = SetMotorSpeed(_Left_Motor, LeftThrustQ15);
+        RightDC = SetMotorSpeed(_Right_Motor, RightThrustQ15);
     }
     else
     {
-        if (Yaw_ratio >= 0) // 4th quadrant
-        {
-            LeftThrust = total;
-            RightThrust = -1 * maximum;
-        }
-        else // 3rd quadrant
-        {
-            LeftThrust = -1 * maximum;
-            RightThrust = difference;
-        }
-    }  
-    
-    // Set motor duty cycles according to thrust
-    uint16_t LeftDC = Propulsion_SetMotorDutyCycle(_Left_Motor, LeftThrust);
-    uint16_t RightDC = Propulsion_SetMotorDutyCycle(_Right_Motor, RightThrust);
+        // Set motor duty cycles according to thrust
+        LeftDC = Propulsion_SetMotorDutyCycle(_Left_Motor, LeftThrust);
+        RightDC = Propulsion_SetMotorDutyCycle(_Right_Motor, RightThrust);
+    }
     
-    // Calculate FuelBurnRate per timer cycle based on average of 2 thrusts
-    FuelBurnRate = (abs(LeftThrust) + abs(RightThrust)) * FUEL_BURN_PER_SEC * FUEL_BURN_TIME / (2*ONE_SEC);
+    // New thrust burns from the next control tick
+    SetBurnRate(LeftThrustQ15, RightThrustQ15);
 
-    printdebug("X: %d \t Yaw: %d \t Fuel: %0.3f \t Burn: %0.5f \r\nLeft Thrust: %0.3f \t Right Thrust %0.3f Left DC: %u \t Right DC: %u \r\n\r\n", 
-            input.X, input.Yaw, FuelLevel, FuelBurnRate, LeftThrust, RightThrust, LeftDC, RightDC );
+    printdebug("X: %d \t Yaw: %d \t Fuel: %u \t Burn: %u \r\nLeft Thrust: %0.3f \t Right Thrust %0.3f Left DC: %u \t Right DC: %u \r\n\r\n", 
+            input.X, input.Yaw, FuelLevel, FuelBurnPerMs, LeftThrust, RightThrust, LeftDC, RightDC );
+}
+
+/*
+ * SetBurnRate
+ * Sets the rate from the average magnitude of the two Q15 thrusts. The
+ * control tick burns at the new rate from its next run. One word store,
+ * so the tick sees the old rate or the new one
+ */
+static void SetBurnRate(int16_t LeftThrustQ15, int16_t RightThrustQ15)
+{
+    uint32_t ThrustSum = abs(LeftThrustQ15) + abs(RightThrustQ15);
+    // Average of the two is ThrustSum / (2 * THRUST_Q15_FULL)
+    FuelBurnPerMs = (ThrustSum * FUEL_BURN_PER_MS) / (2 * THRUST_Q15_FULL);
 }
 
 /* Propulsion_SetMotorDutyCycle
@@ -397,26 +619,69 @@ uint16_t Propulsion_SetMotorDutyCycle(MotorControl_Motor_t WhichMotor, float Thr
     }
     Thrust = abs(Thrust);
     
-    uint16_t DutyCycle;
-
-    // Convert to Duty Cycle with Minimum DC offset
-    if (Thrust == 0) // turn motor all the way off to get rid of noise
-    {
-        DutyCycle = 0;
-    }
-    else if (WhichMotor == _Left_Motor)
-    {
-        DutyCycle = Thrust * (MAX_DUTY_CYCLE - LEFT_MIN_DUTY_CYCLE) 
-                + LEFT_MIN_DUTY_CYCLE;
-    }
-    else // Right motor
-    {
-        DutyCycle = Thrust * (MAX_DUTY_CYCLE - RIGHT_MIN_DUTY_CYCLE) 
-                + RIGHT_MIN_DUTY_CYCLE;
-    }
+    // Convert to Duty Cycle through the motor's linearization table
+    // so both motors give the same speed for the same thrust
+    uint16_t DutyCycle = MotorLinearization_ThrustToDuty(WhichMotor, WhichDir, Thrust);
     
     // Set motor 
     MotorControl_SetMotorDutyCycle(WhichMotor, WhichDir, DutyCycle);
     
     return DutyCycle;
-}
\ No newline at end of file
+}
+
+/*
+ * SetMotorSpeed
+ * Helper for SetThrust in velocity mode
+ * Full thrust maps to the top speed both motors can hold, the same scale
+ * open loop uses, so switching modes doesn't change the stick feel.
+ * Returns the speed that was set in 0.1 RPM
+ */
+static uint16_t SetMotorSpeed(MotorControl_Motor_t WhichMotor, int16_t ThrustQ15)
+{
+    MotorControl_Direction_t WhichDir = (ThrustQ15 >= 0) ? _Forward_Dir : _Backward_Dir;
+    uint16_t Speed = ThrustToSpeed(ThrustQ15);
+    
+    MotorControl_SetMotorSpeed(WhichMotor, WhichDir, Speed);
+    return Speed;
+}
+
+/*
+ * ThrustToSpeed
+ * Helper for SetMotorSpeed and the mailbox
+ * Returns the speed magnitude for a Q15 thrust in 0.1 RPM
+ */
+static uint16_t ThrustToSpeed(int16_t ThrustQ15)
+{
+    float MaxSpeed = MotorLinearization_GetCommonMaxRPM() * 10; // 0.1 RPM
+    return (uint16_t) (abs(ThrustQ15) * MaxSpeed / THRUST_Q15_FULL);
+}
+
+/*
+ * PostThrustMailbox
+ * Helper for Propulsion_FastSetThrust
+ * Publishes thrust with a new sequence number in one 32 bit store. The ISR
+ * only ever sees a whole old or whole new command. Sequence 0 is skipped,
+ * it marks an emptied mailbox
+ */
+static void PostThrustMailbox(ArcadeControl_t input)
+{
+    MailboxSequence++;
+    if (0 == MailboxSequence)
+    {
+        MailboxSequence++;
+    }
+    ThrustMailbox = ((uint32_t) MailboxSequence << 16) | input.Total;
+}
+
+/*
+ * StopDrive
+ * Stops the motors and the fuel burn. Empties the mailbox first, so a
+ * command the control tick hasn't read yet can't restart the motors and
+ * nothing stale is left for the tick after a mode change
+ */
+static void StopDrive(void)
+{
+    ThrustMailbox = 0;
+    MotorControl_StopMotors();
+    SetBurnRate(0, 0);
+}
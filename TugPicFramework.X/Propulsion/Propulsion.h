@@ -33,6 +33,16 @@ typedef union {
     uint16_t Total;
 } TankControl_t;
 
+// How pilot thrust commands drive the motors
+typedef enum
+{
+    _OpenLoop_Drive,    // Thrust sets linearized duty cycle directly
+    _Velocity_Drive     // Thrust sets wheel speed targets held by the PID
+}Propulsion_DriveMode_t;
+
+// Time to empty when no thrust is commanded
+#define PROPULSION_NOT_BURNING 0xFFFF
+
 // typedefs for the states
 // State definitions for use with the query function
 typedef enum
@@ -47,6 +57,16 @@ bool PostPropulsion(ES_Event_t ThisEvent);
 ES_Event_t RunPropulsion(ES_Event_t ThisEvent);
 PropulsionState_t QueryPropulsion(void);
 uint8_t Propulsion_GetFuelLevel(void);
+uint16_t Propulsion_GetTimeToEmpty(void);
+bool Propulsion_CheckFuel(void);
+void Propulsion_SetDriveMode(Propulsion_DriveMode_t NewMode);
+Propulsion_DriveMode_t Propulsion_GetDriveMode(void);
+void Propulsion_SetFastPath(bool Enable);
+bool Propulsion_IsFastPath(void);
+bool Propulsion_FastSetThrust(ArcadeControl_t input);
+void Propulsion_FailsafeStop(void);
+void Propulsion_BurnFuel(uint8_t ElapsedMs);
+void Propulsion_ReadThrustMailbox(void);
 
 #endif /* Propulsion_H */
 
@@ -0,0 +1,162 @@
+/****************************************************************************
+ * File:   ThrustLatency.c
+ * Measures time from a control frame's start byte to the PWM register write
+ *
+ * Each path holds at most one frame in flight. A frame goes Queued when it
+ * is validated, Applied when its thrust becomes the setpoint, and is
+ * measured at the next OCxRS write. In velocity mode that write comes from
+ * the control law tick, so the time waiting for the tick is included.
+ * A newer frame replaces one still in flight, so only frames that reach the
+ * motors are counted.
+ *
+ * Times come from the core timer, which runs at half the 40 MHz SYSCLK.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ThrustLatency.h"
+#include <xc.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define CORE_TICKS_PER_US 20
+
+typedef enum
+{
+    _Idle_Frame, _Queued_Frame, _Applied_Frame
+}FrameState_t;
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint32_t FrameStartCount; // Core timer at the last start delimiter
+
+// Indexed by ThrustLatency_Path_t
+static volatile uint8_t State[NUM_THRUST_PATHS];
+static volatile uint32_t StartCount[NUM_THRUST_PATHS];
+static volatile uint32_t LatencySum[NUM_THRUST_PATHS];
+static volatile uint32_t LatencyPeak[NUM_THRUST_PATHS];
+static volatile uint32_t LatencySamples[NUM_THRUST_PATHS];
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      ThrustLatency_FrameStart
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when a frame start delimiter is read. Timestamps the frame
+****************************************************************************/
+void ThrustLatency_FrameStart(void)
+{
+    FrameStartCount = _CP0_GET_COUNT();
+}
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_FrameAccepted
+ *
+ * Parameters
+ *      ThrustLatency_Path_t WhichPath - Path the frame's thrust is sent on
+ * Return
+ *      void
+ * Description
+ *      Call once a control frame is validated. Starts timing it on WhichPath
+****************************************************************************/
+void ThrustLatency_FrameAccepted(ThrustLatency_Path_t WhichPath)
+{
+    // Idle first so an ISR can't finish this frame with a stale start time
+    State[WhichPath] = _Idle_Frame;
+    StartCount[WhichPath] = FrameStartCount;
+    State[WhichPath] = _Queued_Frame;
+}
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_SetpointApplied
+ *
+ * Parameters
+ *      ThrustLatency_Path_t WhichPath - Path that just applied a setpoint
+ * Return
+ *      void
+ * Description
+ *      Call when the frame's thrust becomes the motor setpoint. The next
+ *      PWM write finishes the measurement
+****************************************************************************/
+void ThrustLatency_SetpointApplied(ThrustLatency_Path_t WhichPath)
+{
+    if (_Queued_Frame == State[WhichPath])
+    {
+        State[WhichPath] = _Applied_Frame;
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_PWMWritten
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call right after the OCxRS registers are written. Safe from ISRs
+****************************************************************************/
+void ThrustLatency_PWMWritten(void)
+{
+    uint32_t Now = _CP0_GET_COUNT();
+
+    // Called from both the control law ISR and the framework
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    for (uint8_t i = 0; i < NUM_THRUST_PATHS; i++)
+    {
+        if (_Applied_Frame == State[i])
+        {
+            uint32_t Latency = Now - StartCount[i];
+            LatencySum[i] += Latency;
+            LatencySamples[i]++;
+            if (Latency > LatencyPeak[i])
+            {
+                LatencyPeak[i] = Latency;
+            }
+            State[i] = _Idle_Frame;
+        }
+    }
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
+    }
+}
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_GetStats
+ *
+ * Parameters
+ *      ThrustLatency_Path_t WhichPath - Path to report
+ *      uint32_t *Count - Frames measured since the last call
+ *      float *AvgUs, *MaxUs - Average and worst latency in microseconds
+ * Return
+ *      void
+ * Description
+ *      Reads and resets the stats for one path
+****************************************************************************/
+void ThrustLatency_GetStats(ThrustLatency_Path_t WhichPath, uint32_t *Count,
+        float *AvgUs, float *MaxUs)
+{
+    uint32_t InterruptStatus = __builtin_disable_interrupts();
+    uint32_t Sum = LatencySum[WhichPath];
+    uint32_t Samples = LatencySamples[WhichPath];
+    uint32_t Peak = LatencyPeak[WhichPath];
+    LatencySum[WhichPath] = 0;
+    LatencySamples[WhichPath] = 0;
+    LatencyPeak[WhichPath] = 0;
+    if (InterruptStatus & 0x00000001)
+    {
+        __builtin_enable_interrupts();
+    }
+
+    *Count = Samples;
+    *AvgUs = (Samples > 0) ? ((float) Sum / Samples / CORE_TICKS_PER_US) : 0;
+    *MaxUs = (float) Peak / CORE_TICKS_PER_US;
+}
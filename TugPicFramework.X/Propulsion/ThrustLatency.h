@@ -0,0 +1,92 @@
+/****************************************************************************
+ * File:   ThrustLatency.h
+ * Measures time from a control frame's start byte to the PWM register write
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef THRUSTLATENCY_H
+#define	THRUSTLATENCY_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+// Route a control frame took to the motors
+typedef enum
+{
+    _Event_Path,    // PROPULSION_SET_THRUST through the framework queue
+    _Fast_Path,     // Thrust mailbox
+    NUM_THRUST_PATHS
+}ThrustLatency_Path_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_FrameStart
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call when a frame start delimiter is read. Timestamps the frame
+****************************************************************************/
+void ThrustLatency_FrameStart(void);
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_FrameAccepted
+ *
+ * Parameters
+ *      ThrustLatency_Path_t WhichPath - Path the frame's thrust is sent on
+ * Return
+ *      void
+ * Description
+ *      Call once a control frame is validated. Starts timing it on WhichPath
+****************************************************************************/
+void ThrustLatency_FrameAccepted(ThrustLatency_Path_t WhichPath);
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_SetpointApplied
+ *
+ * Parameters
+ *      ThrustLatency_Path_t WhichPath - Path that just applied a setpoint
+ * Return
+ *      void
+ * Description
+ *      Call when the frame's thrust becomes the motor setpoint. The next
+ *      PWM write finishes the measurement
+****************************************************************************/
+void ThrustLatency_SetpointApplied(ThrustLatency_Path_t WhichPath);
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_PWMWritten
+ *
+ * Parameters
+ *      void
+ * Return
+ *      void
+ * Description
+ *      Call right after the OCxRS registers are written. Safe from ISRs
+****************************************************************************/
+void ThrustLatency_PWMWritten(void);
+
+/****************************************************************************
+ * Function
+ *      ThrustLatency_GetStats
+ *
+ * Parameters
+ *      ThrustLatency_Path_t WhichPath - Path to report
+ *      uint32_t *Count - Frames measured since the last call
+ *      float *AvgUs, *MaxUs - Average and worst latency in microseconds
+ * Return
+ *      void
+ * Description
+ *      Reads and resets the stats for one path
+****************************************************************************/
+void ThrustLatency_GetStats(ThrustLatency_Path_t WhichPath, uint32_t *Count,
+        float *AvgUs, float *MaxUs);
+
+#endif	/* THRUSTLATENCY_H */
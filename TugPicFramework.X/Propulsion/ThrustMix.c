@@ -0,0 +1,125 @@
+/****************************************************************************
+ * File:   ThrustMix.c
+ * Fixed point (X, Yaw) to (Left, Right) thrust mixing
+ *
+ * The mix is piecewise linear with kinks only on the axes and the
+ * |X| = |Yaw| diagonals. ThrustMixTable.h samples it every 16 counts so
+ * every kink is a grid line or a cell diagonal. Each cell is split into two
+ * triangles along the diagonal a kink could run through, so interpolating
+ * over the triangle gives the exact mix, not an approximation.
+ *
+ * No hardware access, so Tools/check_thrust_mix.py builds this file on the
+ * host and checks it against the reference model for every input.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ThrustMix.h"
+#include "ThrustMixTable.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define MAX_INPUT 127 // max val of x and yaw
+#define CELL_SIZE (1 << THRUST_MIX_STEP_SHIFT)
+#define CELL_MASK (CELL_SIZE - 1)
+#define LAST_CELL (THRUST_MIX_NUM_NODES - 2)
+// Interpolated values are in input counts * CELL_SIZE
+#define Q15_DIVISOR (MAX_INPUT * CELL_SIZE)
+
+/*---------------------------- Module Functions ---------------------------*/
+static int32_t InterpolateCell(uint8_t CellX, uint8_t CellY, uint8_t FracX, 
+        uint8_t FracY, uint8_t Side);
+static int16_t ScaleToQ15(int32_t Value);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      ThrustMix_Mix
+ *
+ * Parameters
+ *      int8_t X - Forward command (-128 is treated as -127)
+ *      int8_t Yaw - Yaw command (-128 is treated as -127)
+ *      int16_t *LeftThrust - Filled with left thrust in Q15
+ *      int16_t *RightThrust - Filled with right thrust in Q15
+ * Return
+ *      void
+ * Description
+ *      Four quadrant max/sum/difference mix from XYYawConversionMapping.m.
+ *      Interpolates the generated ThrustMixTable.h, all integer math
+****************************************************************************/
+void ThrustMix_Mix(int8_t X, int8_t Yaw, int16_t *LeftThrust, int16_t *RightThrust)
+{
+    // Set -128 to -127 to make pos and neg symmetric
+    if (X == -128) X = -127;
+    if (Yaw == -128) Yaw = -127;
+    
+    // Offset so the first node is 0, then split into cell and position in cell
+    uint8_t OffsetX = (uint8_t) (X - THRUST_MIX_MIN_NODE);
+    uint8_t OffsetY = (uint8_t) (Yaw - THRUST_MIX_MIN_NODE);
+    uint8_t CellX = OffsetX >> THRUST_MIX_STEP_SHIFT;
+    uint8_t CellY = OffsetY >> THRUST_MIX_STEP_SHIFT;
+    uint8_t FracX = OffsetX & CELL_MASK;
+    uint8_t FracY = OffsetY & CELL_MASK;
+    
+    *LeftThrust = ScaleToQ15(InterpolateCell(CellX, CellY, FracX, FracY, 0));
+    *RightThrust = ScaleToQ15(InterpolateCell(CellX, CellY, FracX, FracY, 1));
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+/*
+ * InterpolateCell
+ * Helper for ThrustMix_Mix
+ * Linear interpolation over the triangle of the cell the point is in.
+ * Cells on the X = -Yaw diagonal are split along that diagonal, all others
+ * along X = Yaw. Returns the mix in input counts * CELL_SIZE
+ */
+static int32_t InterpolateCell(uint8_t CellX, uint8_t CellY, uint8_t FracX, 
+        uint8_t FracY, uint8_t Side)
+{
+    int32_t N00 = ThrustMixNodes[CellY][CellX][Side];
+    int32_t N10 = ThrustMixNodes[CellY][CellX + 1][Side];
+    int32_t N01 = ThrustMixNodes[CellY + 1][CellX][Side];
+    int32_t N11 = ThrustMixNodes[CellY + 1][CellX + 1][Side];
+    
+    if ((CellX + CellY) == LAST_CELL) // on the X = -Yaw diagonal
+    {
+        if ((FracX + FracY) <= CELL_SIZE) // lower left triangle
+        {
+            return (N00 * CELL_SIZE) + ((N10 - N00) * FracX) + ((N01 - N00) * FracY);
+        }
+        else // upper right triangle
+        {
+            return (N11 * CELL_SIZE) + ((N11 - N01) * (FracX - CELL_SIZE)) + 
+                    ((N11 - N10) * (FracY - CELL_SIZE));
+        }
+    }
+    else
+    {
+        if (FracX >= FracY) // lower right triangle
+        {
+            return (N00 * CELL_SIZE) + ((N10 - N00) * FracX) + ((N11 - N10) * FracY);
+        }
+        else // upper left triangle
+        {
+            return (N00 * CELL_SIZE) + ((N11 - N01) * FracX) + ((N01 - N00) * FracY);
+        }
+    }
+}
+
+/*
+ * ScaleToQ15
+ * Helper for ThrustMix_Mix
+ * Converts input counts * CELL_SIZE to Q15 thrust, rounded and clamped
+ */
+static int16_t ScaleToQ15(int32_t Value)
+{
+    int32_t Scaled = Value * THRUST_Q15_FULL;
+    // Round half away from zero
+    Scaled += (Scaled >= 0) ? (Q15_DIVISOR / 2) : -(Q15_DIVISOR / 2);
+    Scaled /= Q15_DIVISOR;
+    if (Scaled > THRUST_Q15_FULL) return THRUST_Q15_FULL;
+    if (Scaled < -THRUST_Q15_FULL) return -THRUST_Q15_FULL;
+    return (int16_t) Scaled;
+}
@@ -0,0 +1,35 @@
+/****************************************************************************
+ * File:   ThrustMix.h
+ * Fixed point (X, Yaw) to (Left, Right) thrust mixing
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef THRUSTMIX_H
+#define	THRUSTMIX_H
+
+#include "ES_Types.h"     /* gets int types */
+
+// Q15 thrust. Full forward is THRUST_Q15_FULL, full reverse its negative
+#define THRUST_Q15_FULL 32767
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      ThrustMix_Mix
+ *
+ * Parameters
+ *      int8_t X - Forward command (-128 is treated as -127)
+ *      int8_t Yaw - Yaw command (-128 is treated as -127)
+ *      int16_t *LeftThrust - Filled with left thrust in Q15
+ *      int16_t *RightThrust - Filled with right thrust in Q15
+ * Return
+ *      void
+ * Description
+ *      Four quadrant max/sum/difference mix from XYYawConversionMapping.m.
+ *      Interpolates the generated ThrustMixTable.h, all integer math
+****************************************************************************/
+void ThrustMix_Mix(int8_t X, int8_t Yaw, int16_t *LeftThrust, int16_t *RightThrust);
+
+#endif	/* THRUSTMIX_H */
@@ -0,0 +1,37 @@
+/****************************************************************************
+ * File:   ThrustMixTable.h
+ * Thrust mixing nodes for ThrustMix.c
+ *
+ * GENERATED by Tools/gen_thrust_mix_table.py. Do not edit by hand.
+ * Indexed [Yaw node][X node][Left/Right]. Nodes every 16 counts from -128,
+ * values in input counts.
+ ***************************************************************************/
+
+#ifndef THRUSTMIXTABLE_H
+#define	THRUSTMIXTABLE_H
+
+#define THRUST_MIX_STEP_SHIFT 4 // 16 counts per cell
+#define THRUST_MIX_MIN_NODE (-128)
+#define THRUST_MIX_NUM_NODES 17
+
+static const int16_t ThrustMixNodes[THRUST_MIX_NUM_NODES][THRUST_MIX_NUM_NODES][2] = {
+    {{-128, 0}, {-128, 16}, {-128, 32}, {-128, 48}, {-128, 64}, {-128, 80}, {-128, 96}, {-128, 112}, {-128, 128}, {-112, 128}, {-96, 128}, {-80, 128}, {-64, 128}, {-48, 128}, {-32, 128}, {-16, 128}, {0, 128}},
+    {{-128, -16}, {-112, 0}, {-112, 16}, {-112, 32}, {-112, 48}, {-112, 64}, {-112, 80}, {-112, 96}, {-112, 112}, {-96, 112}, {-80, 112}, {-64, 112}, {-48, 112}, {-32, 112}, {-16, 112}, {0, 112}, {16, 128}},
+    {{-128, -32}, {-112, -16}, {-96, 0}, {-96, 16}, {-96, 32}, {-96, 48}, {-96, 64}, {-96, 80}, {-96, 96}, {-80, 96}, {-64, 96}, {-48, 96}, {-32, 96}, {-16, 96}, {0, 96}, {16, 112}, {32, 128}},
+    {{-128, -48}, {-112, -32}, {-96, -16}, {-80, 0}, {-80, 16}, {-80, 32}, {-80, 48}, {-80, 64}, {-80, 80}, {-64, 80}, {-48, 80}, {-32, 80}, {-16, 80}, {0, 80}, {16, 96}, {32, 112}, {48, 128}},
+    {{-128, -64}, {-112, -48}, {-96, -32}, {-80, -16}, {-64, 0}, {-64, 16}, {-64, 32}, {-64, 48}, {-64, 64}, {-48, 64}, {-32, 64}, {-16, 64}, {0, 64}, {16, 80}, {32, 96}, {48, 112}, {64, 128}},
+    {{-128, -80}, {-112, -64}, {-96, -48}, {-80, -32}, {-64, -16}, {-48, 0}, {-48, 16}, {-48, 32}, {-48, 48}, {-32, 48}, {-16, 48}, {0, 48}, {16, 64}, {32, 80}, {48, 96}, {64, 112}, {80, 128}},
+    {{-128, -96}, {-112, -80}, {-96, -64}, {-80, -48}, {-64, -32}, {-48, -16}, {-32, 0}, {-32, 16}, {-32, 32}, {-16, 32}, {0, 32}, {16, 48}, {32, 64}, {48, 80}, {64, 96}, {80, 112}, {96, 128}},
+    {{-128, -112}, {-112, -96}, {-96, -80}, {-80, -64}, {-64, -48}, {-48, -32}, {-32, -16}, {-16, 0}, {-16, 16}, {0, 16}, {16, 32}, {32, 48}, {48, 64}, {64, 80}, {80, 96}, {96, 112}, {112, 128}},
+    {{-128, -128}, {-112, -112}, {-96, -96}, {-80, -80}, {-64, -64}, {-48, -48}, {-32, -32}, {-16, -16}, {0, 0}, {16, 16}, {32, 32}, {48, 48}, {64, 64}, {80, 80}, {96, 96}, {112, 112}, {128, 128}},
+    {{-112, -128}, {-96, -112}, {-80, -96}, {-64, -80}, {-48, -64}, {-32, -48}, {-16, -32}, {0, -16}, {16, -16}, {16, 0}, {32, 16}, {48, 32}, {64, 48}, {80, 64}, {96, 80}, {112, 96}, {128, 112}},
+    {{-96, -128}, {-80, -112}, {-64, -96}, {-48, -80}, {-32, -64}, {-16, -48}, {0, -32}, {16, -32}, {32, -32}, {32, -16}, {32, 0}, {48, 16}, {64, 32}, {80, 48}, {96, 64}, {112, 80}, {128, 96}},
+    {{-80, -128}, {-64, -112}, {-48, -96}, {-32, -80}, {-16, -64}, {0, -48}, {16, -48}, {32, -48}, {48, -48}, {48, -32}, {48, -16}, {48, 0}, {64, 16}, {80, 32}, {96, 48}, {112, 64}, {128, 80}},
+    {{-64, -128}, {-48, -112}, {-32, -96}, {-16, -80}, {0, -64}, {16, -64}, {32, -64}, {48, -64}, {64, -64}, {64, -48}, {64, -32}, {64, -16}, {64, 0}, {80, 16}, {96, 32}, {112, 48}, {128, 64}},
+    {{-48, -128}, {-32, -112}, {-16, -96}, {0, -80}, {16, -80}, {32, -80}, {48, -80}, {64, -80}, {80, -80}, {80, -64}, {80, -48}, {80, -32}, {80, -16}, {80, 0}, {96, 16}, {112, 32}, {128, 48}},
+    {{-32, -128}, {-16, -112}, {0, -96}, {16, -96}, {32, -96}, {48, -96}, {64, -96}, {80, -96}, {96, -96}, {96, -80}, {96, -64}, {96, -48}, {96, -32}, {96, -16}, {96, 0}, {112, 16}, {128, 32}},
+    {{-16, -128}, {0, -112}, {16, -112}, {32, -112}, {48, -112}, {64, -112}, {80, -112}, {96, -112}, {112, -112}, {112, -96}, {112, -80}, {112, -64}, {112, -48}, {112, -32}, {112, -16}, {112, 0}, {128, 16}},
+    {{0, -128}, {16, -128}, {32, -128}, {48, -128}, {64, -128}, {80, -128}, {96, -128}, {112, -128}, {128, -128}, {128, -112}, {128, -96}, {128, -80}, {128, -64}, {128, -48}, {128, -32}, {128, -16}, {128, 0}},
+};
+
+#endif	/* THRUSTMIXTABLE_H */
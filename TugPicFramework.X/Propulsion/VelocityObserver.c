@@ -0,0 +1,127 @@
+/****************************************************************************
+ * File:   VelocityObserver.c
+ * Alpha-beta-gamma wheel speed observer run at the control law rate
+ *
+ * The raw encoder speed only changes on an edge, so at low speed the
+ * control law sees a staircase. Between edges this predicts speed from the
+ * applied duty cycle with a first order motor model, and moves position
+ * with it. Each update compares the predicted position at the time of the
+ * last edge against the tick count, which is exact at that instant, and
+ * corrects both by the alpha and beta gains. A slower gamma share learns
+ * a bias on the model, so a low battery or extra drag doesn't leave the
+ * estimate lagging at steady state.
+ *
+ * Position is kept relative to a recent tick count so float precision
+ * doesn't run out as the count grows.
+ *
+ * Author: agent
+ ***************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "VelocityObserver.h"
+#include "MotionProfile.h" // TICKS_PER_RPM_SECOND
+
+/*----------------------------- Module Defines ----------------------------*/
+#define OBSERVER_ALPHA 0.3f     // Share of position error corrected per update
+#define OBSERVER_BETA 0.1f      // Share of position error taken as speed error
+#define OBSERVER_GAMMA 0.05f    // Share of position error taken as model error
+#define MODEL_TAU 0.08f         // Approx mechanical time constant (s)
+#define STOPPED_RPM 1.0f        // Slower than the encoder can tell from 0
+#define MAX_TICKS_PER_UPDATE 100 // More means the tick count was reset
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ * Function
+ *      VelocityObserver_Reset
+ *
+ * Parameters
+ *      VelocityObserver_t *ThisObserver - Observer to reset
+ *      uint32_t TickCount - Current encoder tick count
+ *      float RPM - Starting speed estimate
+ * Return
+ *      void
+ * Description
+ *      Starts the estimate over, with the wheel at its last edge
+****************************************************************************/
+void VelocityObserver_Reset(VelocityObserver_t *ThisObserver, uint32_t TickCount,
+        float RPM)
+{
+    ThisObserver->BaseCount = TickCount;
+    ThisObserver->Position = 0;
+    ThisObserver->RPM = (RPM > 0) ? RPM : 0;
+    ThisObserver->ModelBias = 0;
+    ThisObserver->SinceCorrection = 0;
+}
+
+/****************************************************************************
+ * Function
+ *      VelocityObserver_Update
+ *
+ * Parameters
+ *      VelocityObserver_t *ThisObserver - Observer to advance
+ *      uint32_t TickCount - Encoder tick count now
+ *      float SinceEdge - Seconds since the last encoder edge
+ *      float ModelRPM - Steady state speed for the applied duty cycle.
+ *                       Negative if the drive opposes the wheel's motion
+ *      float dt - Time since the last update in seconds
+ * Return
+ *      float, new speed estimate in RPM
+ * Description
+ *      Predicts with a first order motor model, then corrects with where
+ *      the wheel was at its last edge. Cheap enough for the control law ISR
+****************************************************************************/
+float VelocityObserver_Update(VelocityObserver_t *ThisObserver, uint32_t TickCount,
+        float SinceEdge, float ModelRPM, float dt)
+{
+    // Measure position from the newest tick count
+    uint32_t NewTicks = TickCount - ThisObserver->BaseCount;
+    if (NewTicks > MAX_TICKS_PER_UPDATE)
+    {
+        VelocityObserver_Reset(ThisObserver, TickCount, ThisObserver->RPM);
+    }
+    else
+    {
+        ThisObserver->Position -= (float) NewTicks;
+        ThisObserver->BaseCount = TickCount;
+    }
+
+    // Predict. Speed relaxes toward the model, position follows the mean
+    float OldRPM = ThisObserver->RPM;
+    float NewRPM = OldRPM + 
+            ((ModelRPM + ThisObserver->ModelBias - OldRPM) * dt / MODEL_TAU);
+    if (NewRPM < 0) NewRPM = 0;
+    ThisObserver->Position += 0.5f * (OldRPM + NewRPM) * TICKS_PER_RPM_SECOND * dt;
+    ThisObserver->SinceCorrection += dt;
+
+    // Correct. At an edge the wheel was exactly at TickCount. Without one
+    // it can't have passed the next edge yet
+    float Error = 0;
+    bool Measured = false;
+    if (NewTicks > 0)
+    {
+        Error = (NewRPM * TICKS_PER_RPM_SECOND * SinceEdge) - ThisObserver->Position;
+        Measured = true;
+    }
+    else if (ThisObserver->Position > 1)
+    {
+        Error = 1 - ThisObserver->Position;
+        Measured = true;
+    }
+    if (Measured)
+    {
+        float ErrorRPM = Error / (TICKS_PER_RPM_SECOND * ThisObserver->SinceCorrection);
+        ThisObserver->Position += OBSERVER_ALPHA * Error;
+        NewRPM += OBSERVER_BETA * ErrorRPM;
+        ThisObserver->ModelBias += OBSERVER_GAMMA * ErrorRPM;
+        ThisObserver->SinceCorrection = 0;
+    }
+
+    // Can't be faster than one tick in SinceEdge, and below STOPPED_RPM
+    // the encoder can't tell it from stopped
+    float MaxRPM = (SinceEdge > 0) ?
+        (1.0f / (TICKS_PER_RPM_SECOND * SinceEdge)) : NewRPM;
+    if (NewRPM > MaxRPM) NewRPM = MaxRPM;
+    if ((MaxRPM <= STOPPED_RPM) || (NewRPM < 0)) NewRPM = 0;
+
+    ThisObserver->RPM = NewRPM;
+    return NewRPM;
+}
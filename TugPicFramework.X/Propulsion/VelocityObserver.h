@@ -0,0 +1,59 @@
+/****************************************************************************
+ * File:   VelocityObserver.h
+ * Alpha-beta-gamma wheel speed observer run at the control law rate
+ *
+ * Author: agent
+ ***************************************************************************/
+
+#ifndef VELOCITYOBSERVER_H
+#define	VELOCITYOBSERVER_H
+
+#include "ES_Types.h"     /* gets bool type for returns */
+
+typedef struct {
+    uint32_t BaseCount;     // Encoder tick count Position is measured from
+    float Position;         // Estimated ticks past BaseCount
+    float RPM;              // Estimated speed, never negative
+    float ModelBias;        // Learned error of the motor model in RPM
+    float SinceCorrection;  // Seconds since the last edge or limit correction
+}VelocityObserver_t;
+
+// Public Function Prototypes
+
+/****************************************************************************
+ * Function
+ *      VelocityObserver_Reset
+ *
+ * Parameters
+ *      VelocityObserver_t *ThisObserver - Observer to reset
+ *      uint32_t TickCount - Current encoder tick count
+ *      float RPM - Starting speed estimate
+ * Return
+ *      void
+ * Description
+ *      Starts the estimate over, with the wheel at its last edge
+****************************************************************************/
+void VelocityObserver_Reset(VelocityObserver_t *ThisObserver, uint32_t TickCount,
+        float RPM);
+
+/****************************************************************************
+ * Function
+ *      VelocityObserver_Update
+ *
+ * Parameters
+ *      VelocityObserver_t *ThisObserver - Observer to advance
+ *      uint32_t TickCount - Encoder tick count now
+ *      float SinceEdge - Seconds since the last encoder edge
+ *      float ModelRPM - Steady state speed for the applied duty cycle.
+ *                       Negative if the drive opposes the wheel's motion
+ *      float dt - Time since the last update in seconds
+ * Return
+ *      float, new speed estimate in RPM
+ * Description
+ *      Predicts with a first order motor model, then corrects with where
+ *      the wheel was at its last edge. Cheap enough for the control law ISR
+****************************************************************************/
+float VelocityObserver_Update(VelocityObserver_t *ThisObserver, uint32_t TickCount,
+        float SinceEdge, float ModelRPM, float dt);
+
+#endif	/* VELOCITYOBSERVER_H */
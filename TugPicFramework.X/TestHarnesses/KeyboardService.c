@@ -21,7 +21,16 @@
 #include "KeyboardService.h"
 #include "../Propulsion/Propulsion.h"
 #include "../Propulsion/MotorControlDriver.h"
+#include "../Propulsion/MotorLinearization.h"
+#include "../Propulsion/ControlTelemetry.h"
+#include "../Propulsion/ThrustLatency.h"
 #include "../Comms/TugComm.h"
+#include "../Comms/XBeeTXSM.h"
+#include "../Comms/XBeeRXSM.h"
+#include "XBeeBaud.h"
+#include "LinkStats.h"
+#include "TXStatus.h"
+#include "StatusTelemetry.h"
 #include "../FrameworkHeaders/ES_Timers.h"
 
 
@@ -29,6 +38,7 @@
 #define PROPULSION_INCREMENT 1 // was 5
 #define FULL_THRUST 127
 #define HALF_THRUST 64
+#define NUM_CONTROL_PERIODS 5
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this service.They should be functions
@@ -36,6 +46,8 @@
 */
 void PrintInstructions(void);
 /*---------------------------- Module Variables ---------------------------*/
+// Control law periods stepped through by 'r', in ms
+static const uint8_t ControlPeriods[NUM_CONTROL_PERIODS] = {1, 2, 5, 10, 20};
 // with the introduction of Gen2, we need a module level Priority variable
 static uint8_t MyPriority;
 
@@ -274,6 +286,272 @@ ES_Event_t RunKeyboardService(ES_Event_t ThisEvent)
                     PostEvent.EventType = XBEE_MESSAGE_RECEIVED;
                     PostTugComm(PostEvent);
                 } break;
+                
+                case 'c':
+                {
+                    MotorControl_StartCharacterization();
+                    printf("KeyboardService: Starting motor characterization sweep (~35 s)\n\r");
+                } break;
+                case 'v':
+                {
+                    if (MotorControl_IsCharacterizing())
+                    {
+                        printf("KeyboardService: Characterization still running\n\r");
+                    }
+                    MotorLinearization_PrintTables();
+                } break;
+                case 't':
+                {
+                    MotorControl_StartAutoTune();
+                    printf("KeyboardService: Starting PID auto tune\n\r");
+                } break;
+                case 'g':
+                {
+                    MotorControl_Gains_t Left = MotorControl_GetGains(_Left_Motor);
+                    MotorControl_Gains_t Right = MotorControl_GetGains(_Right_Motor);
+                    if (MotorControl_IsAutoTuning())
+                    {
+                        printf("KeyboardService: Auto tune still running\n\r");
+                    }
+                    printf("Left  P=%0.3f I=%0.4f D=%0.3f\r\n", Left.P, Left.I, Left.D);
+                    printf("Right P=%0.3f I=%0.4f D=%0.3f\r\n", Right.P, Right.I, Right.D);
+                    // Step to the tune speed on the old and new gains
+                    for (uint8_t i = 0; i < 2; i++)
+                    {
+                        MotorControl_StepResult_t Before;
+                        MotorControl_StepResult_t After;
+                        if (MotorControl_GetTuneComparison((MotorControl_Motor_t) i, 
+                                &Before, &After))
+                        {
+                            printf("%s step old/new: rise %u/%u ms, settle %u/%u ms, "
+                                    "overshoot %0.1f/%0.1f %%\r\n", 
+                                    (_Left_Motor == i) ? "Left " : "Right", 
+                                    Before.RiseMs, After.RiseMs, Before.SettleMs, 
+                                    After.SettleMs, Before.OvershootPct, After.OvershootPct);
+                        }
+                    }
+                } break;
+                case 'k':
+                {
+                    if (MotorControl_IsAutoTuning())
+                    {
+                        printf("KeyboardService: Wait for auto tune to finish\n\r");
+                    }
+                    else if (MotorControl_SaveGains())
+                    {
+                        printf("KeyboardService: Gains saved to flash\n\r");
+                    }
+                    else
+                    {
+                        printf("KeyboardService: Gain save failed (motors must be stopped)\n\r");
+                    }
+                } break;
+                case 'r':
+                {
+                    // Step to the next period in the list, wrapping around
+                    uint8_t Current = MotorControl_GetControlPeriod();
+                    uint8_t Next = ControlPeriods[0];
+                    for (uint8_t i = 0; i < NUM_CONTROL_PERIODS; i++)
+                    {
+                        if (ControlPeriods[i] > Current)
+                        {
+                            Next = ControlPeriods[i];
+                            break;
+                        }
+                    }
+                    if (MotorControl_SetControlPeriod(Next))
+                    {
+                        printf("KeyboardService: Control law period %u ms\n\r", Next);
+                    }
+                    else
+                    {
+                        printf("KeyboardService: Can't change rate during sweep/auto tune\n\r");
+                    }
+                } break;
+                case 'u':
+                {
+                    float AvgPercent;
+                    float PeakPercent;
+                    uint32_t Overruns;
+                    MotorControl_GetControlLawLoad(&AvgPercent, &PeakPercent, &Overruns);
+                    printf("Control law %u ms: avg %0.2f%% peak %0.2f%% CPU, %u overruns\r\n",
+                            MotorControl_GetControlPeriod(), AvgPercent, PeakPercent, 
+                            (unsigned) Overruns);
+                } break;
+                case 'f':
+                {
+                    // Switch between the old audible rate and the new default
+                    uint32_t NewFrequency = (MotorControl_GetPWMFrequency() == 20000) ? 10000 : 20000;
+                    MotorControl_SetPWMFrequency(NewFrequency);
+                    printf("KeyboardService: PWM frequency %u Hz\n\r", (unsigned) NewFrequency);
+                } break;
+                case 'l':
+                {
+                    if (ControlTelemetry_IsRunning())
+                    {
+                        ControlTelemetry_Stop();
+                        printf("KeyboardService: Telemetry stopped, %u frames dropped\n\r", 
+                                (unsigned) ControlTelemetry_GetDropped());
+                    }
+                    else
+                    {
+                        printf("KeyboardService: Telemetry started\n\r");
+                        ControlTelemetry_Start();
+                    }
+                } break;
+                case 'm':
+                {
+                    if (_Velocity_Drive == Propulsion_GetDriveMode())
+                    {
+                        Propulsion_SetDriveMode(_OpenLoop_Drive);
+                        printf("KeyboardService: Open loop drive (motors stopped)\n\r");
+                    }
+                    else
+                    {
+                        Propulsion_SetDriveMode(_Velocity_Drive);
+                        printf("KeyboardService: Velocity drive (motors stopped)\n\r");
+                    }
+                } break;
+                case 'e':
+                {
+                    // Compare wheel speed at a fixed thrust across battery/load
+                    // in each mode. Velocity mode should hold the target
+                    printf("%s: L %0.1f RPM (target %0.1f) \t R %0.1f RPM (target %0.1f)\r\n",
+                            (_Velocity_Drive == Propulsion_GetDriveMode()) ? "Velocity" : "Open loop",
+                            MotorControl_GetRPM(_Left_Motor), MotorControl_GetTargetRPM(_Left_Motor),
+                            MotorControl_GetRPM(_Right_Motor), MotorControl_GetTargetRPM(_Right_Motor));
+                } break;
+                case 'o':
+                {
+                    MotorControl_SetVelocityObserver(!MotorControl_IsVelocityObserver());
+                    printf("KeyboardService: Speed loops on %s speed\n\r",
+                            MotorControl_IsVelocityObserver() ? "observer" : "raw encoder");
+                } break;
+                case 'b':
+                {
+                    // Step the XBee link through its rates. Each change
+                    // measures the UART round trip to the radio
+                    if (XBeeTXIdleState != QueryXBeeTXSM())
+                    {
+                        puts("KeyboardService: XBee busy, try again\r");
+                        break;
+                    }
+                    XBeeBaud_SetRate((XBeeBaud_GetRate() + 1) % NUM_XBEE_BAUDS);
+                    for (uint8_t i = 0; i < NUM_XBEE_BAUDS; i++)
+                    {
+                        printf("%6u baud: AT round trip %u us%s\r\n",
+                                XBeeBaud_GetBitsPerSecond(i), XBeeBaud_GetRoundTripUs(i),
+                                (i == XBeeBaud_GetRate()) ? " (in use)" : "");
+                    }
+                } break;
+                case 'h':
+                {
+                    Propulsion_SetFastPath(!Propulsion_IsFastPath());
+                    printf("KeyboardService: Control frame fast path %s\n\r",
+                            Propulsion_IsFastPath() ? "on" : "off");
+                } break;
+                case 'y':
+                {
+                    static const char *PathNames[NUM_THRUST_PATHS] = {"Event", "Fast"};
+                    for (uint8_t i = 0; i < NUM_THRUST_PATHS; i++)
+                    {
+                        uint32_t Count;
+                        float AvgUs;
+                        float MaxUs;
+                        ThrustLatency_GetStats(i, &Count, &AvgUs, &MaxUs);
+                        printf("%s path: %u frames, avg %0.1f us, max %0.1f us start byte to PWM\r\n",
+                                PathNames[i], (unsigned) Count, AvgUs, MaxUs);
+                    }
+                } break;
+                case 'n':
+                {
+                    LinkStats_t Stats;
+                    LinkStats_Get(&Stats);
+                    printf("XBee RX: %u frames, %u bad checksum, %u too long, %u bytes dropped, %u overruns\r\n",
+                            (unsigned) Stats.FramesReceived, (unsigned) Stats.ChecksumFailures,
+                            (unsigned) Stats.LengthErrors, (unsigned) Stats.BytesDropped,
+                            (unsigned) Stats.UARTOverruns);
+                    printf("From Pilot: %u valid, %u unknown source, %u pairing timeouts\r\n",
+                            (unsigned) Stats.ValidFrames, (unsigned) Stats.UnknownSource,
+                            (unsigned) Stats.PairingTimeouts);
+                    printf("RSSI -%u/-%u/-%u dBm min/avg/max, longest gap %u ms\r\n",
+                            Stats.RSSIMin, Stats.RSSIAvg, Stats.RSSIMax, Stats.MaxGapMs);
+                    for (uint8_t i = 0; i < LINKSTATS_GAP_BINS; i++)
+                    {
+                        if (0 != LinkStats_GetGapBinLimit(i))
+                        {
+                            printf("  gap < %4u ms: %u\r\n", LinkStats_GetGapBinLimit(i),
+                                    (unsigned) Stats.GapCounts[i]);
+                        }
+                        else
+                        {
+                            printf("  gap >= %3u ms: %u\r\n", LinkStats_GetGapBinLimit(i - 1),
+                                    (unsigned) Stats.GapCounts[i]);
+                        }
+                    }
+                } break;
+                case 'j':
+                {
+                    LinkStats_Clear();
+                    printf("KeyboardService: XBee link stats cleared\n\r");
+                } break;
+                case 'd':
+                {
+                    TXStatus_Stats_t Stats;
+                    TXStatus_GetStats(&Stats);
+                    printf("XBee TX: %u sent, %u delivered, %u no ACK, %u CCA fail, %u purged, %u no status\r\n",
+                            (unsigned) Stats.Sent, (unsigned) Stats.Delivered,
+                            (unsigned) Stats.NoAck, (unsigned) Stats.CCAFailures,
+                            (unsigned) Stats.Purged, (unsigned) Stats.NoResponse);
+                    printf("Delivery avg %u us, max %u us queued to TX Status, %u pairing retries\r\n",
+                            (unsigned) Stats.AvgLatencyUs, (unsigned) Stats.MaxLatencyUs,
+                            (unsigned) Stats.PairingRetries);
+                    printf("Queue full: %u requests coalesced, %u dropped\r\n",
+                            (unsigned) Stats.Coalesced, (unsigned) Stats.Dropped);
+                } break;
+                case 'p':
+                {
+                    TXStatus_SetPairingRetry(!TXStatus_IsPairingRetry());
+                    printf("KeyboardService: Early resend of failed pairing frames %s\n\r",
+                            TXStatus_IsPairingRetry() ? "on" : "off");
+                } break;
+                case 'i':
+                {
+                    StatusTelemetry_SetEnabled(!StatusTelemetry_IsEnabled());
+                    printf("KeyboardService: Telemetry after each status frame %s\n\r",
+                            StatusTelemetry_IsEnabled() ? "on" : "off");
+                } break;
+                case 'L':
+                {
+                    XBeeRXSM_SetLinkLossTest(!XBeeRXSM_IsLinkLossTest());
+                    printf("KeyboardService: Simulated link loss %s\n\r",
+                            XBeeRXSM_IsLinkLossTest() ? "on, ignoring control frames" : "off");
+                } break;
+                case 'F':
+                {
+                    TugComm_FailsafeStats_t Failsafe;
+                    TugComm_GetFailsafeStats(&Failsafe);
+                    printf("Failsafe: stop after %u missed periods of %u ms, %u trips, %u recovered\r\n",
+                            Failsafe.MissedPeriods, Failsafe.ControlPeriod,
+                            Failsafe.Trips, Failsafe.Recoveries);
+                    printf("Last stop %u ms after the last frame, reaction %u ms (max %u ms) plus %u ms control tick\r\n",
+                            Failsafe.LastGap, Failsafe.LastReaction, Failsafe.MaxReaction,
+                            MotorControl_GetControlPeriod());
+                    TugComm_ClearFailsafeStats();
+                } break;
+                case 'N':
+                {
+                    TugComm_FailsafeStats_t Failsafe;
+                    TugComm_GetFailsafeStats(&Failsafe);
+                    uint8_t MissedPeriods = Failsafe.MissedPeriods + 1;
+                    if (!TugComm_SetFailsafePeriods(MissedPeriods))
+                    {
+                        MissedPeriods = 2;
+                        TugComm_SetFailsafePeriods(MissedPeriods);
+                    }
+                    printf("KeyboardService: Failsafe stops thrust after %u missed control periods\n\r",
+                            MissedPeriods);
+                } break;
 
                 default:
                 {
@@ -331,6 +609,33 @@ void PrintInstructions(void)
     printf( "\n\n------------ TugComm --------------\r\n");
     printf( "Press 'z' to post PAIRING_BUTTON_PRESSED to TugComm\n\r");
     printf( "Press 'x' to post XBEE_MESSAGE_RECEIVED to TugComm\n\r");
+    
+    printf( "\n\n------------ Motor Characterization --------------\r\n");
+    printf( "Press 'c' to run the duty cycle vs speed sweep\n\r");
+    printf( "Press 'v' to print the linearization tables\n\r");
+    printf( "Press 't' to auto tune the PID gains\n\r");
+    printf( "Press 'g' to print the PID gains and the last tune's step tests\n\r");
+    printf( "Press 'k' to save the PID gains to flash\n\r");
+    printf( "Press 'r' to step the control law period (1/2/5/10/20 ms)\n\r");
+    printf( "Press 'u' to print control law CPU use since last press\n\r");
+    printf( "Press 'f' to switch PWM between 10 kHz and 20 kHz\n\r");
+    printf( "Press 'l' to start/stop control law telemetry (Tools/decode_telemetry.py)\n\r");
+    
+    printf( "\n\n------------ Drive Mode --------------\r\n");
+    printf( "Press 'm' to switch teleop between open loop and velocity drive\n\r");
+    printf( "Press 'e' to print wheel speeds and targets\n\r");
+    printf( "Press 'o' to switch the speed loops between observer and raw encoder speed\n\r");
+    printf( "Press 'b' to step the XBee link baud rate and print UART round trips\n\r");
+    printf( "Press 'h' to switch the control frame fast path on/off\n\r");
+    printf( "Press 'y' to print control frame latency since last press\n\r");
+    printf( "Press 'n' to print XBee link stats\n\r");
+    printf( "Press 'j' to clear XBee link stats\n\r");
+    printf( "Press 'd' to print XBee delivery stats since last press\n\r");
+    printf( "Press 'p' to switch early resend of failed pairing frames on/off\n\r");
+    printf( "Press 'i' to switch telemetry after each status frame on/off until the next pairing\n\r");
+    printf( "Press 'L' to start/stop ignoring control frames, a simulated link loss\n\r");
+    printf( "Press 'F' to print failsafe trips and reaction time since last press\n\r");
+    printf( "Press 'N' to step the failsafe's missed control periods (2-8)\n\r");
 }
 
 